@@ -0,0 +1,715 @@
+#include "chatbench.h"
+#include <time.h>
+#include <signal.h>
+
+/*
+ * Function to get the auth string from the auth file.
+ *
+ * @param authFile: the name of the file to open.
+ *
+ * return's the auth string or NULL if the file can't be read.
+*/
+char *get_bench_auth_string(char *authFile) {
+    FILE *file = fopen(authFile, "r");
+    if (!file) {
+        return NULL;
+    }
+    char *line = read_line(file);
+    fclose(file);
+    if (line == NULL) {
+        line = calloc(1, sizeof(char));
+    }
+    return line;
+}
+
+/*
+ * Function to parse the operation mix given on the command line. The mix is
+ * four comma separated weights for SAY, LIST, KICK and LEAVE.
+ *
+ * @param bench: The Bench struct to store the mix in.
+ *
+ * @param mix: The mix string.
+ *
+ * return's a bool indicating if the mix was valid or not.
+*/
+bool parse_bench_mix(Bench *bench, char *mix) {
+    char *copy = strdup(mix);
+    char *save = NULL;
+    char *token = strtok_r(copy, ",", &save);
+    bench->mixTotal = 0;
+    for (int i = 0; i < B_OPS; ++i) {
+        char *end;
+        if (token == NULL) {
+            free(copy);
+            return false;
+        }
+        long weight = strtol(token, &end, 10);
+        if (*end != '\0' || weight < 0) {
+            free(copy);
+            return false;
+        }
+        bench->mix[i] = (int) weight;
+        bench->mixTotal += weight;
+        token = strtok_r(NULL, ",", &save);
+    }
+    free(copy);
+    return token == NULL && bench->mixTotal > 0;
+}
+
+/*
+ * Function to parse the command line of the benchmark.
+ *
+ * @param bench: The Bench struct to fill in.
+ *
+ * @param argc: The argument count.
+ *
+ * @param argv: The arguments.
+ *
+ * return's a bool indicating if the arguments were valid or not.
+*/
+bool parse_bench_args(Bench *bench, int argc, char **argv) {
+    int opt;
+    bench->connCount = DEFAULT_CONNECTIONS;
+    bench->rate = DEFAULT_RATE;
+    bench->duration = DEFAULT_DURATION;
+    bench->csvFile = NULL;
+    parse_bench_mix(bench, DEFAULT_MIX);
+    while ((opt = getopt(argc, argv, "c:r:d:m:o:")) != -1) {
+        switch (opt) {
+            case 'c':
+                bench->connCount = atoi(optarg);
+                break;
+            case 'r':
+                bench->rate = atof(optarg);
+                break;
+            case 'd':
+                bench->duration = atoi(optarg);
+                break;
+            case 'm':
+                if (!parse_bench_mix(bench, optarg)) {
+                    return false;
+                }
+                break;
+            case 'o':
+                bench->csvFile = optarg;
+                break;
+            default:
+                return false;
+        }
+    }
+    if (argc - optind != 2 || bench->connCount <= 0 || bench->rate <= 0 ||
+            bench->duration <= 0) {
+        return false;
+    }
+    bench->authString = get_bench_auth_string(argv[optind]);
+    bench->port = argv[optind + 1];
+    return bench->authString != NULL;
+}
+
+/*
+ * Function to open a TCP connection to the server.
+ *
+ * @param port: The port the server is listening on.
+ *
+ * return's the connected socket or -1 on failure.
+*/
+int connect_bench_socket(char *port) {
+    struct addrinfo hints, *result;
+    int sock = -1;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = DEFAULT_PROTOCOL;
+    if (getaddrinfo(LOCALHOST, port, &hints, &result) != 0) {
+        return -1;
+    }
+    for (struct addrinfo *attempt = result; attempt != NULL;
+            attempt = attempt->ai_next) {
+        sock = socket(attempt->ai_family, attempt->ai_socktype,
+                attempt->ai_protocol);
+        if (sock == -1) {
+            continue;
+        }
+        if (connect(sock, attempt->ai_addr, attempt->ai_addrlen) == -1) {
+            close(sock);
+            sock = -1;
+            continue;
+        }
+        break;
+    }
+    freeaddrinfo(result);
+    return sock;
+}
+
+/*
+ * Function to parse a message from the server on a first character basis.
+ *
+ * @param fromServer: The FILE * that reads from the server socket.
+ *
+ * @param closed: Set to true if the server closed the connection.
+ *
+ * return's a ServerMessage struct with the information of the message.
+*/
+ServerMessage parse_bench_message(FILE *fromServer, bool *closed) {
+    ServerMessage msg;
+    msg.message = NULL;
+    msg.messID = S_INVALID;
+    int first = fgetc(fromServer);
+    if (first == EOF) {
+        *closed = true;
+        return msg;
+    }
+    switch (first) {
+        case 'A':
+            msg = parse_auth_message_from_server(fromServer);
+            break;
+        case 'M':
+            msg = parse_msg_message_from_server(fromServer);
+            break;
+        case 'N':
+            msg = parse_name_taken_message_from_server(fromServer);
+            break;
+        case 'W':
+            msg = parse_who_message_from_server(fromServer);
+            break;
+        case 'E':
+            msg = parse_enter_message_from_server(fromServer);
+            break;
+        case 'L':
+            first = fgetc(fromServer);
+            if (first == 'E') {
+                msg = parse_leave_message_from_server(fromServer);
+            }
+            if (first == 'I') {
+                msg = parse_list_message_from_server(fromServer);
+            }
+            break;
+        case 'K':
+            msg = parse_kick_message_from_server(fromServer);
+            break;
+        case 'O':
+            msg = parse_ok_message_from_server(fromServer);
+            break;
+        default:
+            free(read_line(fromServer));
+            break;
+    }
+    return msg;
+}
+
+/*
+ * Function to free the message of a ServerMessage if it was allocated by
+ * the parser.
+ *
+ * @param msg: The message to free.
+ *
+ * return's nothing.
+*/
+void free_bench_message(ServerMessage msg) {
+    switch (msg.messID) {
+        case S_MSG:
+        case S_ENTER:
+        case S_LEAVE:
+        case S_LIST:
+            free(msg.message);
+            break;
+        default:
+            break;
+    }
+}
+
+/*
+ * Function to read the next handshake message from the server. The server
+ * broadcasts chat traffic to connections that are still negotiating, so
+ * MSG:, ENTER:, LEAVE: and LIST: messages are skipped here.
+ *
+ * @param fromServer: The FILE * that reads from the server socket.
+ *
+ * @param closed: Set to true if the server closed the connection.
+ *
+ * return's the next handshake message.
+*/
+ServerMessage next_handshake_message(FILE *fromServer, bool *closed) {
+    ServerMessage msg = parse_bench_message(fromServer, closed);
+    while (!*closed && (msg.messID == S_MSG || msg.messID == S_ENTER ||
+            msg.messID == S_LEAVE || msg.messID == S_LIST)) {
+        free_bench_message(msg);
+        msg = parse_bench_message(fromServer, closed);
+    }
+    return msg;
+}
+
+/*
+ * Function to perform the AUTH:, WHO: and NAME: negotiation for a benchmark
+ * connection. A NAME_TAKEN: reply is answered with a new numbered name.
+ *
+ * @param conn: The connection to negotiate for.
+ *
+ * return's a bool indicating if the connection got into the chat.
+*/
+bool bench_handshake(BenchConn *conn) {
+    bool closed = false;
+    int attempt = 0;
+    ServerMessage msg = next_handshake_message(conn->fromServer, &closed);
+    if (msg.messID != S_AUTH) {
+        return false;
+    }
+    send_auth_string(conn->toServer, conn->bench->authString);
+    msg = next_handshake_message(conn->fromServer, &closed);
+    if (msg.messID != S_OK) {
+        return false;
+    }
+    while (!closed) {
+        msg = next_handshake_message(conn->fromServer, &closed);
+        if (msg.messID != S_WHO) {
+            return false;
+        }
+        send_client_name(conn->toServer, "NAME", conn->name);
+        msg = next_handshake_message(conn->fromServer, &closed);
+        if (msg.messID == S_OK) {
+            return true;
+        }
+        if (msg.messID != S_NAME_TAKEN) {
+            return false;
+        }
+        pthread_mutex_lock(&conn->lock);
+        free(conn->name);
+        conn->name = malloc(sizeof(char) * BUFFSIZE);
+        snprintf(conn->name, BUFFSIZE, "%s%d_%d", BENCH_NAME, conn->index,
+                ++attempt);
+        pthread_mutex_unlock(&conn->lock);
+    }
+    return false;
+}
+
+/*
+ * Function to connect a benchmark connection to the server and get it into
+ * the chat.
+ *
+ * @param conn: The connection to connect.
+ *
+ * return's a bool indicating success.
+*/
+bool bench_connect(BenchConn *conn) {
+    Bench *bench = conn->bench;
+    uint64_t start = get_time_ns();
+    int sock = connect_bench_socket(bench->port);
+    if (sock == -1) {
+        __atomic_fetch_add(&bench->connectFailures, 1, __ATOMIC_RELAXED);
+        return false;
+    }
+    pthread_mutex_lock(&conn->lock);
+    conn->socket = sock;
+    conn->toServer = fdopen(sock, "w");
+    conn->fromServer = fdopen(dup(sock), "r");
+    pthread_mutex_unlock(&conn->lock);
+    if (!bench_handshake(conn)) {
+        __atomic_fetch_add(&bench->connectFailures, 1, __ATOMIC_RELAXED);
+        pthread_mutex_lock(&conn->lock);
+        fclose(conn->toServer);
+        fclose(conn->fromServer);
+        conn->toServer = NULL;
+        conn->fromServer = NULL;
+        pthread_mutex_unlock(&conn->lock);
+        return false;
+    }
+    histogram_record(&bench->connectTime, get_time_ns() - start);
+    __atomic_fetch_add(&bench->connects, 1, __ATOMIC_RELAXED);
+    pthread_mutex_lock(&conn->lock);
+    conn->live = true;
+    pthread_mutex_unlock(&conn->lock);
+    return true;
+}
+
+/*
+ * Function to close a benchmark connection after the server kicked it or
+ * closed the socket.
+ *
+ * @param conn: The connection to close.
+ *
+ * return's nothing.
+*/
+void bench_disconnect(BenchConn *conn) {
+    pthread_mutex_lock(&conn->lock);
+    conn->live = false;
+    fclose(conn->toServer);
+    fclose(conn->fromServer);
+    conn->toServer = NULL;
+    conn->fromServer = NULL;
+    pthread_mutex_unlock(&conn->lock);
+}
+
+/*
+ * Function to record the delivery latency of a chat message. Messages sent
+ * by the benchmark carry their send time as "t=<nanoseconds>".
+ *
+ * @param bench: The Bench struct.
+ *
+ * @param message: The message as returned by the MSG: parser.
+ *
+ * return's nothing.
+*/
+void record_bench_delivery(Bench *bench, char *message) {
+    char *stamp = strstr(message, ": t=");
+    if (stamp == NULL) {
+        return;
+    }
+    uint64_t sent = strtoull(stamp + strlen(": t="), NULL, 10);
+    uint64_t now = get_time_ns();
+    if (sent == 0 || sent > now) {
+        return;
+    }
+    histogram_record(&bench->latency, now - sent);
+    __atomic_fetch_add(&bench->delivered, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * Function run by the reader thread of each connection. Connects, reads
+ * everything the server sends and reconnects after a KICK: or LEAVE:.
+ *
+ * @param connInfo: The BenchConn the thread reads for.
+ *
+ * return's NULL.
+*/
+void *bench_reader(void *connInfo) {
+    BenchConn *conn = (BenchConn *) connInfo;
+    Bench *bench = conn->bench;
+    while (bench->running) {
+        if (!bench_connect(conn)) {
+            usleep(RECONNECT_DELAY_US);
+            continue;
+        }
+        bool closed = false;
+        while (!closed) {
+            ServerMessage msg = parse_bench_message(conn->fromServer,
+                    &closed);
+            if (msg.messID == S_MSG) {
+                record_bench_delivery(bench, msg.message);
+            }
+            if (msg.messID == S_KICK) {
+                closed = true;
+            }
+            free_bench_message(msg);
+        }
+        bench_disconnect(conn);
+    }
+    return NULL;
+}
+
+/*
+ * Function to choose the next operation according to the configured mix.
+ *
+ * @param bench: The Bench struct.
+ *
+ * @param seed: The random seed of the caller.
+ *
+ * return's the operation to perform.
+*/
+BenchOp choose_bench_op(Bench *bench, unsigned int *seed) {
+    int pick = rand_r(seed) % bench->mixTotal;
+    for (int i = 0; i < B_OPS; ++i) {
+        if (pick < bench->mix[i]) {
+            return (BenchOp) i;
+        }
+        pick -= bench->mix[i];
+    }
+    return B_SAY;
+}
+
+/*
+ * Function to get a copy of the name of a live connection other than the
+ * sender, used as the target of a KICK:.
+ *
+ * @param bench: The Bench struct.
+ *
+ * @param sender: The index of the sending connection.
+ *
+ * @param seed: The random seed of the caller.
+ *
+ * return's a copy of the name or NULL if no other connection is live.
+*/
+char *choose_kick_target(Bench *bench, int sender, unsigned int *seed) {
+    int start = rand_r(seed) % bench->connCount;
+    for (int i = 0; i < bench->connCount; ++i) {
+        BenchConn *conn = &bench->conns[(start + i) % bench->connCount];
+        if (conn->index == sender) {
+            continue;
+        }
+        char *name = NULL;
+        pthread_mutex_lock(&conn->lock);
+        if (conn->live) {
+            name = strdup(conn->name);
+        }
+        pthread_mutex_unlock(&conn->lock);
+        if (name != NULL) {
+            return name;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Function to perform one operation on a connection.
+ *
+ * @param conn: The connection which sends.
+ *
+ * @param op: The operation to perform.
+ *
+ * @param target: The name to kick for a B_KICK operation.
+ *
+ * return's a bool indicating if anything was sent.
+*/
+bool send_bench_op(BenchConn *conn, BenchOp op, char *target) {
+    char buffer[BUFFSIZE];
+    bool sent = false;
+    pthread_mutex_lock(&conn->lock);
+    if (conn->live) {
+        sent = true;
+        switch (op) {
+            case B_SAY:
+                snprintf(buffer, BUFFSIZE, "t=%llu",
+                        (unsigned long long) get_time_ns());
+                send_input_as_client_message(buffer, conn->toServer);
+                break;
+            case B_LIST:
+                send_client_command_to_server("LIST:", conn->toServer);
+                break;
+            case B_KICK:
+                fprintf(conn->toServer, "KICK:%s\n", target);
+                fflush(conn->toServer);
+                break;
+            case B_LEAVE:
+                send_client_command_to_server("LEAVE:", conn->toServer);
+                conn->live = false;
+                break;
+            default:
+                sent = false;
+        }
+    }
+    pthread_mutex_unlock(&conn->lock);
+    return sent;
+}
+
+/*
+ * Function which drives the configured traffic from the calling thread until
+ * the duration is over. Operations are spread round robin over the
+ * connections at a fixed interval.
+ *
+ * @param bench: The Bench struct.
+ *
+ * return's nothing.
+*/
+void run_bench_load(Bench *bench) {
+    unsigned int seed = (unsigned int) get_time_ns();
+    uint64_t interval = (uint64_t) (1000000000.0 / bench->rate);
+    uint64_t end = bench->startNs + (uint64_t) bench->duration * 1000000000ULL;
+    uint64_t next = get_time_ns();
+    for (uint64_t i = 0; next < end; ++i, next += interval) {
+        uint64_t now = get_time_ns();
+        if (next > now) {
+            struct timespec wait;
+            wait.tv_sec = (next - now) / 1000000000ULL;
+            wait.tv_nsec = (next - now) % 1000000000ULL;
+            nanosleep(&wait, NULL);
+        }
+        BenchConn *conn = &bench->conns[i % bench->connCount];
+        BenchOp op = choose_bench_op(bench, &seed);
+        char *target = NULL;
+        if (op == B_KICK) {
+            target = choose_kick_target(bench, conn->index, &seed);
+            if (target == NULL) {
+                op = B_SAY;
+            }
+        }
+        if (send_bench_op(conn, op, target)) {
+            __atomic_fetch_add(&bench->sent[op], 1, __ATOMIC_RELAXED);
+        }
+        free(target);
+    }
+}
+
+/*
+ * Function to start the reader thread of every connection and wait until
+ * they are all in the chat or a second has passed per 100 connections.
+ *
+ * @param bench: The Bench struct.
+ *
+ * return's nothing.
+*/
+void start_bench_connections(Bench *bench) {
+    bench->conns = calloc(bench->connCount, sizeof(BenchConn));
+    for (int i = 0; i < bench->connCount; ++i) {
+        BenchConn *conn = &bench->conns[i];
+        conn->index = i;
+        conn->bench = bench;
+        conn->name = malloc(sizeof(char) * BUFFSIZE);
+        snprintf(conn->name, BUFFSIZE, "%s%d", BENCH_NAME, i);
+        pthread_mutex_init(&conn->lock, NULL);
+        pthread_create(&conn->reader, NULL, bench_reader, (void *) conn);
+    }
+    uint64_t deadline = get_time_ns() +
+            (uint64_t) (1 + bench->connCount / 100) * 1000000000ULL;
+    while (get_time_ns() < deadline &&
+            __atomic_load_n(&bench->connects, __ATOMIC_RELAXED) <
+            (uint64_t) bench->connCount) {
+        usleep(1000);
+    }
+}
+
+/*
+ * Function to stop every reader thread by shutting its socket down.
+ *
+ * @param bench: The Bench struct.
+ *
+ * return's nothing.
+*/
+void stop_bench_connections(Bench *bench) {
+    bench->running = false;
+    for (int i = 0; i < bench->connCount; ++i) {
+        BenchConn *conn = &bench->conns[i];
+        pthread_mutex_lock(&conn->lock);
+        if (conn->fromServer != NULL) {
+            shutdown(conn->socket, SHUT_RDWR);
+        }
+        pthread_mutex_unlock(&conn->lock);
+    }
+    for (int i = 0; i < bench->connCount; ++i) {
+        pthread_join(bench->conns[i].reader, NULL);
+    }
+}
+
+/*
+ * Function to convert nanoseconds to microseconds for the report.
+ *
+ * @param ns: The time in nanoseconds.
+ *
+ * return's the time in microseconds.
+*/
+double ns_to_us(uint64_t ns) {
+    return ns / 1000.0;
+}
+
+/*
+ * Function to print the human readable report.
+ *
+ * @param bench: The Bench struct.
+ *
+ * @param output: Where to print the report.
+ *
+ * return's nothing.
+*/
+void print_bench_report(Bench *bench, FILE *output) {
+    double elapsed = (bench->endNs - bench->startNs) / 1e9;
+    uint64_t sent = 0;
+    for (int i = 0; i < B_OPS; ++i) {
+        sent += bench->sent[i];
+    }
+    fprintf(output, "connections: %d over %.2fs (target %.1f ops/s)\n",
+            bench->connCount, elapsed, bench->rate);
+    fprintf(output, "connects: %llu (%.1f/s), failures: %llu, "
+            "handshake p50 %.1fus p99 %.1fus\n",
+            (unsigned long long) bench->connects, bench->connects / elapsed,
+            (unsigned long long) bench->connectFailures,
+            ns_to_us(histogram_percentile(&bench->connectTime, 50)),
+            ns_to_us(histogram_percentile(&bench->connectTime, 99)));
+    fprintf(output, "sent: SAY %llu LIST %llu KICK %llu LEAVE %llu "
+            "(%.1f msgs/s)\n", (unsigned long long) bench->sent[B_SAY],
+            (unsigned long long) bench->sent[B_LIST],
+            (unsigned long long) bench->sent[B_KICK],
+            (unsigned long long) bench->sent[B_LEAVE], sent / elapsed);
+    fprintf(output, "delivered: %llu (%.1f msgs/s)\n",
+            (unsigned long long) bench->delivered,
+            bench->delivered / elapsed);
+    fprintf(output, "latency: p50 %.1fus p99 %.1fus p999 %.1fus "
+            "max %.1fus mean %.1fus\n",
+            ns_to_us(histogram_percentile(&bench->latency, 50)),
+            ns_to_us(histogram_percentile(&bench->latency, 99)),
+            ns_to_us(histogram_percentile(&bench->latency, 99.9)),
+            ns_to_us(histogram_max(&bench->latency)),
+            ns_to_us(histogram_mean(&bench->latency)));
+    fflush(output);
+}
+
+/*
+ * Function to print the report as one CSV row, with a header if asked for.
+ *
+ * @param bench: The Bench struct.
+ *
+ * @param output: Where to print the row.
+ *
+ * @param header: Whether to print the header line first.
+ *
+ * return's nothing.
+*/
+void print_bench_csv(Bench *bench, FILE *output, bool header) {
+    double elapsed = (bench->endNs - bench->startNs) / 1e9;
+    uint64_t sent = 0;
+    for (int i = 0; i < B_OPS; ++i) {
+        sent += bench->sent[i];
+    }
+    if (header) {
+        fprintf(output, "connections,seconds,rate,connects,connects_per_s,"
+                "connect_failures,say,list,kick,leave,msgs_per_s,delivered,"
+                "delivered_per_s,p50_us,p99_us,p999_us,max_us\n");
+    }
+    fprintf(output, "%d,%.3f,%.1f,%llu,%.1f,%llu,%llu,%llu,%llu,%llu,%.1f,"
+            "%llu,%.1f,%.1f,%.1f,%.1f,%.1f\n", bench->connCount, elapsed,
+            bench->rate, (unsigned long long) bench->connects,
+            bench->connects / elapsed,
+            (unsigned long long) bench->connectFailures,
+            (unsigned long long) bench->sent[B_SAY],
+            (unsigned long long) bench->sent[B_LIST],
+            (unsigned long long) bench->sent[B_KICK],
+            (unsigned long long) bench->sent[B_LEAVE], sent / elapsed,
+            (unsigned long long) bench->delivered, bench->delivered / elapsed,
+            ns_to_us(histogram_percentile(&bench->latency, 50)),
+            ns_to_us(histogram_percentile(&bench->latency, 99)),
+            ns_to_us(histogram_percentile(&bench->latency, 99.9)),
+            ns_to_us(histogram_max(&bench->latency)));
+    fflush(output);
+}
+
+/*
+ * Function to append the CSV row to the file given with -o. The header is
+ * only written when the file is empty.
+ *
+ * @param bench: The Bench struct.
+ *
+ * return's nothing.
+*/
+void write_bench_csv_file(Bench *bench) {
+    FILE *file = fopen(bench->csvFile, "a");
+    if (!file) {
+        fprintf(stderr, "chatbench: can't open %s\n", bench->csvFile);
+        return;
+    }
+    print_bench_csv(bench, file, ftell(file) == 0);
+    fclose(file);
+}
+
+int main(int argc, char **argv) {
+    Bench *bench = calloc(1, sizeof(Bench));
+    if (!parse_bench_args(bench, argc, argv)) {
+        fprintf(stderr, "%s\n", BENCH_USAGE);
+        exit(BENCH_BAD_ARGS);
+    }
+    signal(SIGPIPE, SIG_IGN);
+    bench->running = true;
+    start_bench_connections(bench);
+    if (bench->connects == 0) {
+        fprintf(stderr, "Communications error\n");
+        exit(BENCH_COMMS_ERR);
+    }
+    bench->startNs = get_time_ns();
+    run_bench_load(bench);
+    // Give the last messages a moment to be delivered before stopping.
+    usleep(200000);
+    bench->endNs = get_time_ns();
+    stop_bench_connections(bench);
+    print_bench_report(bench, stdout);
+    print_bench_csv(bench, stdout, true);
+    if (bench->csvFile != NULL) {
+        write_bench_csv_file(bench);
+    }
+    return BENCH_OK;
+}
@@ -0,0 +1,89 @@
+#ifndef CHATBENCH_H
+#define CHATBENCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include "comms.h"
+#include "shared.h"
+#include "histogram.h"
+
+#define BENCH_USAGE "Usage: chatbench authfile port [-c connections] " \
+        "[-r rate] [-d seconds] [-m say,list,kick,leave] [-o csvfile]"
+#define BENCH_NAME "bench"
+#define DEFAULT_CONNECTIONS 10
+#define DEFAULT_RATE 50.0
+#define DEFAULT_DURATION 10
+#define DEFAULT_MIX "95,5,0,0"
+// How long a reader waits before trying to connect again after a failure.
+#define RECONNECT_DELAY_US 100000
+
+// Enum of the operations a benchmark connection can perform.
+typedef enum {
+    B_SAY,
+    B_LIST,
+    B_KICK,
+    B_LEAVE,
+    B_OPS
+} BenchOp;
+
+typedef struct Bench Bench;
+
+// struct to store the state of one benchmark connection.
+typedef struct {
+    int index;
+    char *name;
+    int socket;
+
+    bool live;
+
+    FILE *toServer;
+    FILE *fromServer;
+
+    pthread_t reader;
+    pthread_mutex_t lock; // guards toServer, name and live.
+
+    Bench *bench;
+} BenchConn;
+
+// struct to store the benchmark configuration and results.
+struct Bench {
+    char *authString;
+    char *port;
+    char *csvFile;
+
+    int connCount;
+    int duration;
+    double rate;
+    int mix[B_OPS];
+    int mixTotal;
+
+    volatile bool running;
+
+    BenchConn *conns;
+
+    uint64_t connects;
+    uint64_t connectFailures;
+    uint64_t sent[B_OPS];
+    uint64_t delivered;
+    uint64_t startNs;
+    uint64_t endNs;
+
+    Histogram latency;
+    Histogram connectTime;
+};
+
+// Enum to store the exit codes of the benchmark.
+typedef enum {
+    BENCH_OK = 0,
+    BENCH_BAD_ARGS = 1,
+    BENCH_COMMS_ERR = 2
+} BenchExitCodes;
+
+#endif //ass4_chatbench_h
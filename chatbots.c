@@ -0,0 +1,449 @@
+#include "chatbots.h"
+#include <signal.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+/*
+ * Function to note that a bot has joined or given up on joining. Once
+ * every bot has, the number that joined is printed to stderr.
+ *
+ * @param bot: The bot.
+ *
+ * @param joined: If the bot joined, false if it closed before it could.
+ *
+ * return's nothing.
+*/
+void bot_settled(Bot *bot, bool joined) {
+    BotHost *host = bot->host;
+    if (bot->settled) {
+        return;
+    }
+    bot->settled = true;
+    if (joined) {
+        host->joined++;
+    }
+    if (++host->settled == host->count) {
+        fprintf(stderr, "chatbots: %d of %d bots joined\n", host->joined,
+                host->count);
+        fflush(stderr);
+    }
+}
+
+/*
+ * Function used as onJoined by the handlers.
+ *
+ * @param session: The bot's session.
+ *
+ * @param context: The bot.
+ *
+ * return's nothing.
+*/
+void bot_joined(ChatSession *session, void *context) {
+    bot_settled((Bot *) context, true);
+}
+
+/*
+ * Function used as onClosed by the handlers. A bot that didn't leave or
+ * get kicked says why on stderr.
+ *
+ * @param session: The bot's session.
+ *
+ * @param reason: Why the session was closed.
+ *
+ * @param context: The bot.
+ *
+ * return's nothing.
+*/
+void bot_closed(ChatSession *session, ChatCloseReason reason,
+        void *context) {
+    Bot *bot = (Bot *) context;
+    if (reason == CHAT_AUTH_FAILED) {
+        fprintf(stderr, "%s: Authentication error\n", bot->name);
+    } else if (reason == CHAT_COMMS_FAILED) {
+        fprintf(stderr, "%s: Communications error\n", bot->name);
+    }
+    bot_settled(bot, false);
+}
+
+/*
+ * Function of the "log" handler, which prints what its bot sees to stdout
+ * the way the client shows it, after the bot's name in the chat.
+ *
+ * @param session: The bot's session.
+ *
+ * @param name: Who sent the message.
+ *
+ * @param text: The message.
+ *
+ * @param context: The bot.
+ *
+ * return's nothing.
+*/
+void log_msg(ChatSession *session, char *name, char *text, void *context) {
+    printf("%s: %s: %s\n", session->name, name, text);
+}
+
+/*
+ * Function of the "log" handler called when a chatter enters.
+ *
+ * @param session: The bot's session.
+ *
+ * @param name: The chatter.
+ *
+ * @param context: The bot.
+ *
+ * return's nothing.
+*/
+void log_enter(ChatSession *session, char *name, void *context) {
+    printf("%s: (%s has entered the chat)\n", session->name, name);
+}
+
+/*
+ * Function of the "log" handler called when a chatter leaves.
+ *
+ * @param session: The bot's session.
+ *
+ * @param name: The chatter.
+ *
+ * @param context: The bot.
+ *
+ * return's nothing.
+*/
+void log_leave(ChatSession *session, char *name, void *context) {
+    printf("%s: (%s has left the chat)\n", session->name, name);
+}
+
+/*
+ * Function of the "log" handler called with the reply to a LIST:.
+ *
+ * @param session: The bot's session.
+ *
+ * @param names: The chatters, comma separated.
+ *
+ * @param context: The bot.
+ *
+ * return's nothing.
+*/
+void log_list(ChatSession *session, char *names, void *context) {
+    printf("%s: (current chatters: %s)\n", session->name, names);
+}
+
+/*
+ * Function of the "log" handler called when the bot is kicked.
+ *
+ * @param session: The bot's session.
+ *
+ * @param context: The bot.
+ *
+ * return's nothing.
+*/
+void log_kick(ChatSession *session, void *context) {
+    printf("%s: Kicked\n", session->name);
+}
+
+/*
+ * Function of the "echo" handler. A message "@name text" where name is
+ * the bot's name in the chat is answered with text.
+ *
+ * @param session: The bot's session.
+ *
+ * @param name: Who sent the message.
+ *
+ * @param text: The message.
+ *
+ * @param context: The bot.
+ *
+ * return's nothing.
+*/
+void echo_msg(ChatSession *session, char *name, char *text, void *context) {
+    size_t length = strlen(session->name);
+    if (text[0] == '@' && strncmp(text + 1, session->name, length) == 0 &&
+            text[length + 1] == ' ') {
+        chat_session_say(session, text + length + 2);
+    }
+}
+
+// Every handler a manifest line can name. A new behaviour is added here.
+static BotHandler botHandlers[] = {
+    {"quiet", {bot_joined, NULL, NULL, NULL, NULL, NULL, bot_closed}},
+    {"log", {bot_joined, log_msg, log_enter, log_leave, log_list, log_kick,
+            bot_closed}},
+    {"echo", {bot_joined, echo_msg, NULL, NULL, NULL, NULL, bot_closed}},
+};
+
+/*
+ * Function to find a handler by name.
+ *
+ * @param name: The name of the handler.
+ *
+ * return's the handler, NULL if there is none by that name.
+*/
+BotHandler *find_bot_handler(char *name) {
+    int count = sizeof(botHandlers) / sizeof(BotHandler);
+    for (int i = 0; i < count; ++i) {
+        if (strcmp(botHandlers[i].name, name) == 0) {
+            return &botHandlers[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Function to get the auth string in an auth file. Bots usually share a
+ * few auth files, so the string of the file read last is reused.
+ *
+ * @param authFile: The name of the auth file.
+ *
+ * return's the auth string, shared between bots, or NULL if the file
+ * can't be read.
+*/
+char *get_bot_auth_string(char *authFile) {
+    static char *lastFile = NULL;
+    static char *lastString = NULL;
+    if (lastFile != NULL && strcmp(lastFile, authFile) == 0) {
+        return lastString;
+    }
+    FILE *file = fopen(authFile, "r");
+    if (!file) {
+        return NULL;
+    }
+    char *line = read_line(file);
+    fclose(file);
+    if (line == NULL) {
+        line = calloc(1, sizeof(char));
+    }
+    free(lastFile);
+    lastFile = strdup(authFile);
+    lastString = line;
+    return line;
+}
+
+/*
+ * Function to add a bot from one line of the manifest. A line is a name,
+ * an auth file and optionally a handler, separated by spaces.
+ *
+ * @param host: The BotHost.
+ *
+ * @param line: The line. Blank lines and lines starting with '#' are
+ *              skipped.
+ *
+ * return's a bool indicating if the line was valid.
+*/
+bool add_bot(BotHost *host, char *line) {
+    char *save = NULL;
+    char *name = strtok_r(line, " \t", &save);
+    if (name == NULL || name[0] == '#') {
+        return true;
+    }
+    char *authFile = strtok_r(NULL, " \t", &save);
+    char *handlerName = strtok_r(NULL, " \t", &save);
+    if (authFile == NULL || strtok_r(NULL, " \t", &save) != NULL) {
+        return false;
+    }
+    BotHandler *handler = find_bot_handler(handlerName != NULL ?
+            handlerName : DEFAULT_BOT_HANDLER);
+    char *authString = get_bot_auth_string(authFile);
+    if (handler == NULL || authString == NULL) {
+        return false;
+    }
+    if (host->count == host->capacity) {
+        host->capacity = host->capacity ? host->capacity * 2 : 64;
+        host->bots = (Bot *) realloc(host->bots,
+                sizeof(Bot) * host->capacity);
+    }
+    Bot *bot = &host->bots[host->count++];
+    bot->name = strdup(name);
+    bot->authString = authString;
+    bot->handler = handler;
+    bot->session = NULL;
+    bot->events = 0;
+    bot->settled = false;
+    bot->host = host;
+    return true;
+}
+
+/*
+ * Function to read the manifest.
+ *
+ * @param host: The BotHost to add the bots to.
+ *
+ * @param manifest: The name of the manifest file.
+ *
+ * return's a bool indicating if the manifest was read and every line of
+ * it was valid.
+*/
+bool read_bot_manifest(BotHost *host, char *manifest) {
+    FILE *file = fopen(manifest, "r");
+    if (!file) {
+        fprintf(stderr, "chatbots: can't open %s\n", manifest);
+        return false;
+    }
+    char *line;
+    for (int number = 1; (line = read_line(file)) != NULL; ++number) {
+        bool valid = add_bot(host, line);
+        free(line);
+        if (!valid) {
+            fprintf(stderr, "chatbots: %s:%d: bad line\n", manifest,
+                    number);
+            fclose(file);
+            return false;
+        }
+    }
+    fclose(file);
+    return host->count > 0;
+}
+
+/*
+ * Function to raise the open file limit as far as it goes, since every
+ * bot holds a socket.
+ *
+ * return's nothing.
+*/
+void raise_file_limit(void) {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 &&
+            limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+
+/*
+ * Function to bring what the epoll watches for a bot in line with what its
+ * session waits for. poll() and epoll share the values of the events used.
+ *
+ * @param host: The BotHost.
+ *
+ * @param bot: The bot.
+ *
+ * return's nothing.
+*/
+void watch_bot(BotHost *host, Bot *bot) {
+    short events = chat_session_events(bot->session);
+    if (events == bot->events) {
+        return;
+    }
+    struct epoll_event event;
+    memset(&event, 0, sizeof(struct epoll_event));
+    event.events = events;
+    event.data.ptr = bot;
+    epoll_ctl(host->epoll, bot->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD,
+            chat_session_fd(bot->session), &event);
+    bot->events = events;
+}
+
+/*
+ * Function to start the sessions of every bot.
+ *
+ * @param host: The BotHost.
+ *
+ * return's nothing.
+*/
+void start_bots(BotHost *host) {
+    for (int i = 0; i < host->count; ++i) {
+        Bot *bot = &host->bots[i];
+        bot->session = chat_session_new(bot->name, bot->authString,
+                &bot->handler->callbacks, bot);
+        if (!chat_session_connect(bot->session, host->port)) {
+            fprintf(stderr, "%s: Communications error\n", bot->name);
+            chat_session_free(bot->session);
+            bot->session = NULL;
+            bot_settled(bot, false);
+            continue;
+        }
+        host->open++;
+        watch_bot(host, bot);
+    }
+}
+
+/*
+ * Function to let a bot's session act on what the epoll reported. The
+ * session is freed once it closes; closing its socket already took it off
+ * the epoll.
+ *
+ * @param host: The BotHost.
+ *
+ * @param bot: The bot.
+ *
+ * @param events: The events reported.
+ *
+ * return's nothing.
+*/
+void handle_bot(BotHost *host, Bot *bot, uint32_t events) {
+    if (bot->session == NULL) {
+        return;
+    }
+    if (!chat_session_handle(bot->session, (short) events)) {
+        chat_session_free(bot->session);
+        bot->session = NULL;
+        host->open--;
+        return;
+    }
+    watch_bot(host, bot);
+}
+
+/*
+ * Function which runs every bot on one epoll loop until all of their
+ * sessions have closed.
+ *
+ * @param host: The BotHost.
+ *
+ * return's nothing.
+*/
+void run_bots(BotHost *host) {
+    struct epoll_event events[BOT_EVENTS];
+    while (host->open > 0) {
+        int ready = epoll_wait(host->epoll, events, BOT_EVENTS, -1);
+        if (ready < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "Communications error\n");
+            exit(BOTS_COMMS_ERR);
+        }
+        for (int i = 0; i < ready; ++i) {
+            handle_bot(host, (Bot *) events[i].data.ptr, events[i].events);
+        }
+        fflush(stdout);
+    }
+}
+
+/*
+ * Function to free the bots once every session has closed.
+ *
+ * @param host: The BotHost.
+ *
+ * return's nothing.
+*/
+void free_bots(BotHost *host) {
+    for (int i = 0; i < host->count; ++i) {
+        free(host->bots[i].name);
+    }
+    free(host->bots);
+    close(host->epoll);
+    free(host);
+}
+
+int main(int argc, char **argv) {
+    if (argc != 3 || strlen(argv[2]) == 0) {
+        fprintf(stderr, "%s\n", BOTS_USAGE);
+        exit(BOTS_BAD_ARGS);
+    }
+    BotHost *host = calloc(1, sizeof(BotHost));
+    host->port = argv[2];
+    if (!read_bot_manifest(host, argv[1])) {
+        fprintf(stderr, "%s\n", BOTS_USAGE);
+        exit(BOTS_BAD_ARGS);
+    }
+    signal(SIGPIPE, SIG_IGN);
+    raise_file_limit();
+    host->epoll = epoll_create1(0);
+    start_bots(host);
+    if (host->open == 0) {
+        fprintf(stderr, "Communications error\n");
+        exit(BOTS_COMMS_ERR);
+    }
+    run_bots(host);
+    free_bots(host);
+    return BOTS_OK;
+}
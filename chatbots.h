@@ -0,0 +1,57 @@
+#ifndef CHATBOTS_H
+#define CHATBOTS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include "chatclient.h"
+
+#define BOTS_USAGE "Usage: chatbots manifest port"
+// Handler of a manifest line that doesn't name one.
+#define DEFAULT_BOT_HANDLER "quiet"
+// Most epoll events taken per epoll_wait().
+#define BOT_EVENTS 256
+
+// A behaviour a bot can be given in the manifest. Every handler gets its
+// bot as the callbacks' context.
+typedef struct {
+    char *name;
+    ChatCallbacks callbacks;
+} BotHandler;
+
+typedef struct BotHost BotHost;
+
+// One chat identity from the manifest.
+typedef struct {
+    char *name; // as given in the manifest.
+    char *authString;
+    BotHandler *handler;
+    ChatSession *session; // NULL once the session has closed.
+    short events; // what the epoll is watching the session for.
+    bool settled; // joined, or closed without joining.
+    BotHost *host;
+} Bot;
+
+// Every bot of the process, run on one epoll loop.
+struct BotHost {
+    char *port;
+    int epoll;
+    Bot *bots;
+    int count;
+    int capacity;
+    int open; // bots whose session hasn't closed.
+    int settled; // bots that have joined or given up.
+    int joined;
+};
+
+// Enum to store the exit codes of chatbots.
+typedef enum {
+    BOTS_OK = 0,
+    BOTS_BAD_ARGS = 1,
+    BOTS_COMMS_ERR = 2
+} BotsExitCodes;
+
+#endif //ass4_chatbots_h
@@ -0,0 +1,587 @@
+#include "chatclient.h"
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/*
+ * Function to open a socket to the server on a local TCP port.
+ *
+ * @param port: The port.
+ *
+ * @param nonblocking: If set the socket is non-blocking and the connect()
+ *                     may still be in progress when it is returned.
+ *
+ * return's the socket or -1 if the connection failed.
+*/
+static int connect_tcp_socket(char *port, bool nonblocking) {
+    struct addrinfo *result;
+    struct addrinfo hints;
+    int serverSocket = -1;
+    memset(&hints, 0, sizeof(struct addrinfo));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = DEFAULT_PROTOCOL;
+    if (getaddrinfo(LOCALHOST, port, &hints, &result) != 0) {
+        return -1;
+    }
+    for (struct addrinfo *attempts = result; attempts != NULL;
+            attempts = attempts->ai_next) {
+        serverSocket = socket(attempts->ai_family, attempts->ai_socktype |
+                (nonblocking ? SOCK_NONBLOCK : 0), attempts->ai_protocol);
+        if (serverSocket == -1) {
+            continue;
+        }
+        int v = 1;
+        setsockopt(serverSocket, SOL_SOCKET, SO_KEEPALIVE, &v, sizeof(v));
+        if (connect(serverSocket, attempts->ai_addr,
+                attempts->ai_addrlen) == -1 &&
+                !(nonblocking && errno == EINPROGRESS)) {
+            close(serverSocket);
+            serverSocket = -1;
+            continue;
+        }
+        break;
+    }
+    freeaddrinfo(result);
+    return serverSocket;
+}
+
+/*
+ * Function to open a socket to the server on a Unix domain socket.
+ *
+ * @param path: The path of the socket.
+ *
+ * @param nonblocking: If set the socket is non-blocking.
+ *
+ * return's the socket or -1 if the connection failed.
+*/
+static int connect_unix_socket(char *path, bool nonblocking) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(struct sockaddr_un));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        return -1;
+    }
+    strcpy(address.sun_path, path);
+    int serverSocket = socket(AF_UNIX, SOCK_STREAM |
+            (nonblocking ? SOCK_NONBLOCK : 0), DEFAULT_PROTOCOL);
+    if (serverSocket == -1) {
+        return -1;
+    }
+    if (connect(serverSocket, (struct sockaddr *) &address,
+            sizeof(struct sockaddr_un)) == -1 &&
+            !(nonblocking && errno == EINPROGRESS)) {
+        close(serverSocket);
+        return -1;
+    }
+    return serverSocket;
+}
+
+/*
+ * Function to open a socket to the server. A port with a '/' in it is
+ * taken as the path of the server's Unix socket.
+ *
+ * @param port: The port or path.
+ *
+ * @param nonblocking: If set the socket is non-blocking and the connect()
+ *                     may still be in progress when it is returned.
+ *
+ * return's the socket or -1 if the connection failed.
+*/
+int chat_connect_socket(char *port, bool nonblocking) {
+    if (strchr(port, '/') != NULL) {
+        return connect_unix_socket(port, nonblocking);
+    }
+    return connect_tcp_socket(port, nonblocking);
+}
+
+/*
+ * Function to make the name to try after a name was taken. A name with a
+ * digit in it has its last character replaced by the attempt number,
+ * otherwise the number is appended.
+ *
+ * @param name: The name that was taken.
+ *
+ * @param attempt: How many names were tried before this one, from 0.
+ *
+ * return's the new name, to be freed by the caller.
+*/
+char *chat_next_name(char *name, int attempt) {
+    bool digitPresent = false;
+    int len = strlen(name);
+    for (int i = 0; i < len; ++i) {
+        if (isdigit(name[i])) {
+            digitPresent = true;
+            break;
+        }
+    }
+    char *suffix = int_to_string(attempt);
+    char *next = (char *) malloc(sizeof(char) * (len + strlen(suffix) + 1));
+    strcpy(next, name);
+    sprintf(next + (digitPresent ? len - 1 : len), "%s", suffix);
+    free(suffix);
+    return next;
+}
+
+/*
+ * Function to create a chat session. Nothing is sent until it is
+ * connected with chat_session_connect().
+ *
+ * @param name: The name to join the chat under.
+ *
+ * @param authString: The string to answer AUTH: with.
+ *
+ * @param callbacks: The callbacks, copied into the session.
+ *
+ * @param context: Handed to every callback.
+ *
+ * return's the session.
+*/
+ChatSession *chat_session_new(char *name, char *authString,
+        ChatCallbacks *callbacks, void *context) {
+    ChatSession *session = (ChatSession *) calloc(1, sizeof(ChatSession));
+    session->state = CHAT_CONNECTING;
+    session->name = strdup(name);
+    session->authString = strdup(authString);
+    session->socket = -1;
+    session->callbacks = *callbacks;
+    session->context = context;
+    return session;
+}
+
+/*
+ * Function to start connecting a session to the server. The connection
+ * finishes, and the handshake runs, as chat_session_handle() is called.
+ *
+ * @param session: The session.
+ *
+ * @param port: The server's port, or the path of its Unix socket.
+ *
+ * return's a bool indicating if the connection was started.
+*/
+bool chat_session_connect(ChatSession *session, char *port) {
+    session->socket = chat_connect_socket(port, true);
+    if (session->socket == -1) {
+        session->state = CHAT_CLOSED;
+        return false;
+    }
+    session->serverLines = new_line_reader_sized(session->socket,
+            CHAT_READ_BUFFSIZE);
+    return true;
+}
+
+/*
+ * Function to get the descriptor a session's caller should watch.
+ *
+ * @param session: The session.
+ *
+ * return's the socket, -1 if the session isn't connected.
+*/
+int chat_session_fd(ChatSession *session) {
+    return session->socket;
+}
+
+/*
+ * Function to get what a session is waiting for on its socket.
+ *
+ * @param session: The session.
+ *
+ * return's the poll() events to watch for, 0 once it is closed.
+*/
+short chat_session_events(ChatSession *session) {
+    if (session->state == CHAT_CLOSED) {
+        return 0;
+    }
+    if (session->state == CHAT_CONNECTING) {
+        return POLLOUT;
+    }
+    return POLLIN | (byte_buffer_pending(&session->outbound) ? POLLOUT : 0);
+}
+
+/*
+ * Function to close a session's socket and tell the caller why.
+ *
+ * @param session: The session.
+ *
+ * @param reason: Why it was closed.
+ *
+ * return's nothing.
+*/
+static void close_session(ChatSession *session, ChatCloseReason reason) {
+    if (session->state == CHAT_CLOSED) {
+        return;
+    }
+    session->state = CHAT_CLOSED;
+    close(session->socket);
+    if (session->callbacks.onClosed != NULL) {
+        session->callbacks.onClosed(session, reason, session->context);
+    }
+}
+
+/*
+ * Function to write a session's queued output to its socket. The buffer is
+ * given back once it has all been written, since most sessions only send
+ * now and then.
+ *
+ * @param session: The session.
+ *
+ * return's the result of byte_buffer_write().
+*/
+static ssize_t write_session_output(ChatSession *session) {
+    ssize_t written = byte_buffer_write(&session->outbound, session->socket);
+    if (byte_buffer_pending(&session->outbound) == 0) {
+        free(session->outbound.data);
+        memset(&session->outbound, 0, sizeof(ByteBuffer));
+    }
+    return written;
+}
+
+/*
+ * Function to write as much of a session's queued output as its socket
+ * takes.
+ *
+ * @param session: The session.
+ *
+ * return's nothing, the session is closed if the connection is broken.
+*/
+static void flush_session(ChatSession *session) {
+    if (session->state == CHAT_CLOSED || session->state == CHAT_CONNECTING) {
+        return;
+    }
+    if (write_session_output(session) < 0) {
+        close_session(session, CHAT_COMMS_FAILED);
+    }
+}
+
+/*
+ * Function to write a session's queued output straight away after the
+ * caller sent on it. A broken connection is left to be found, and the
+ * session closed, by the next chat_session_handle().
+ *
+ * @param session: The session.
+ *
+ * return's nothing.
+*/
+static void try_flush_session(ChatSession *session) {
+    write_session_output(session);
+}
+
+/*
+ * Function to queue a line for the server.
+ *
+ * @param session: The session.
+ *
+ * @param prefix: The start of the line, such as "SAY:".
+ *
+ * @param text: The rest of the line.
+ *
+ * return's nothing.
+*/
+static void queue_line(ChatSession *session, char *prefix, char *text) {
+    byte_buffer_append(&session->outbound, prefix, strlen(prefix));
+    byte_buffer_append(&session->outbound, text, strlen(text));
+    byte_buffer_append(&session->outbound, "\n", 1);
+}
+
+/*
+ * Function to handle a message from the server before the session has
+ * joined. Chat traffic sent to the connection while it is negotiating is
+ * skipped.
+ *
+ * @param session: The session.
+ *
+ * @param msg: The message.
+ *
+ * return's nothing.
+*/
+static void handle_handshake_message(ChatSession *session,
+        ServerMessage msg) {
+    if (msg.messID == S_MSG || msg.messID == S_ENTER ||
+            msg.messID == S_LEAVE || msg.messID == S_LIST ||
+            msg.messID == S_TOKEN || msg.messID == S_PING) {
+        return;
+    }
+    if (session->state == CHAT_AUTHENTICATING) {
+        if (msg.messID == S_AUTH && !session->authSent) {
+            queue_line(session, "AUTH:", session->authString);
+            session->authSent = true;
+        } else if (msg.messID == S_OK && session->authSent) {
+            session->state = CHAT_NAMING;
+        } else if (msg.messID == S_WHO && !session->authSent) {
+            // A server without an auth string goes straight to WHO:.
+            session->state = CHAT_NAMING;
+            queue_line(session, "NAME:", session->name);
+        } else {
+            close_session(session, session->authSent ? CHAT_AUTH_FAILED :
+                    CHAT_COMMS_FAILED);
+        }
+        return;
+    }
+    if (msg.messID == S_WHO) {
+        queue_line(session, "NAME:", session->name);
+    } else if (msg.messID == S_NAME_TAKEN) {
+        char *name = chat_next_name(session->name, session->renames++);
+        free(session->name);
+        session->name = name;
+    } else if (msg.messID == S_OK) {
+        session->state = CHAT_JOINED;
+        if (session->callbacks.onJoined != NULL) {
+            session->callbacks.onJoined(session, session->context);
+        }
+    } else {
+        close_session(session, CHAT_COMMS_FAILED);
+    }
+}
+
+/*
+ * Function to hand a chat message to the caller. The parser gives it as
+ * "name: text" and names can't hold a ':', so it is split at the first.
+ *
+ * @param session: The session.
+ *
+ * @param message: The message as parsed.
+ *
+ * return's nothing.
+*/
+static void deliver_chat_message(ChatSession *session, char *message) {
+    if (session->callbacks.onMsg == NULL) {
+        return;
+    }
+    char *text = strchr(message, ':');
+    *text = '\0';
+    session->callbacks.onMsg(session, message, text + 2, session->context);
+}
+
+/*
+ * Function to handle a message from the server once the session has
+ * joined.
+ *
+ * @param session: The session.
+ *
+ * @param msg: The message.
+ *
+ * return's nothing.
+*/
+static void handle_chat_message(ChatSession *session, ServerMessage msg) {
+    ChatCallbacks *callbacks = &session->callbacks;
+    switch (msg.messID) {
+        case S_MSG:
+            deliver_chat_message(session, msg.message);
+            break;
+        case S_ENTER:
+            if (callbacks->onEnter != NULL) {
+                callbacks->onEnter(session, msg.message, session->context);
+            }
+            break;
+        case S_LEAVE:
+            if (callbacks->onLeave != NULL) {
+                callbacks->onLeave(session, msg.message, session->context);
+            }
+            break;
+        case S_LIST:
+            if (callbacks->onList != NULL) {
+                callbacks->onList(session, msg.message, session->context);
+            }
+            break;
+        case S_KICK:
+            if (callbacks->onKick != NULL) {
+                callbacks->onKick(session, session->context);
+            }
+            close_session(session, CHAT_KICKED);
+            break;
+        case S_PING:
+            byte_buffer_append(&session->outbound, "PONG:\n",
+                    strlen("PONG:\n"));
+            break;
+        case S_TOKEN: // sessions aren't resumed, so the token isn't kept.
+        case S_INVALID:
+        default:
+            break;
+    }
+}
+
+/*
+ * Function to handle one line from the server.
+ *
+ * @param session: The session.
+ *
+ * @param line: The line, without its newline.
+ *
+ * return's nothing.
+*/
+static void handle_session_line(ChatSession *session, char *line) {
+    ServerMessage msg = parse_server_message_line(line);
+    if (session->state == CHAT_JOINED) {
+        handle_chat_message(session, msg);
+    } else {
+        handle_handshake_message(session, msg);
+    }
+    switch (msg.messID) {
+        case S_MSG:
+        case S_ENTER:
+        case S_LEAVE:
+        case S_LIST:
+        case S_TOKEN:
+        case S_FOUND:
+        case S_SEARCHED:
+            free(msg.message);
+            break;
+        default:
+            break;
+    }
+}
+
+/*
+ * Function to read everything the server has sent a session and handle
+ * every complete line. Reading goes on until the socket is empty, so the
+ * session also works with an edge-triggered epoll.
+ *
+ * @param session: The session.
+ *
+ * return's nothing, the session is closed if the server went away.
+*/
+static void read_session_lines(ChatSession *session) {
+    LineReader *reader = session->serverLines;
+    while (session->state != CHAT_CLOSED) {
+        ssize_t count = fill_line_reader(reader);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        char *line;
+        while (session->state != CHAT_CLOSED &&
+                (line = next_line(reader)) != NULL) {
+            handle_session_line(session, line);
+        }
+        if (count == 0 || (count < 0 && errno != EAGAIN)) {
+            // The server hangs up on a wrong auth string.
+            close_session(session, session->state == CHAT_AUTHENTICATING &&
+                    session->authSent ? CHAT_AUTH_FAILED :
+                    CHAT_COMMS_FAILED);
+        }
+        if (count < 0) {
+            return;
+        }
+    }
+}
+
+/*
+ * Function to finish a non-blocking connect() once the socket is
+ * writable.
+ *
+ * @param session: The session.
+ *
+ * return's a bool indicating if the connection was made.
+*/
+static bool finish_connect(ChatSession *session) {
+    int error = 0;
+    socklen_t length = sizeof(error);
+    if (getsockopt(session->socket, SOL_SOCKET, SO_ERROR, &error,
+            &length) == -1 || error != 0) {
+        return false;
+    }
+    session->state = CHAT_AUTHENTICATING;
+    return true;
+}
+
+/*
+ * Function to let a session act on what poll() or epoll reported for its
+ * socket. Callbacks are made from here.
+ *
+ * @param session: The session.
+ *
+ * @param revents: The events reported, in poll() terms.
+ *
+ * return's a bool indicating if the session is still open. Once it is
+ * false the session should be freed.
+*/
+bool chat_session_handle(ChatSession *session, short revents) {
+    if (session->state == CHAT_CONNECTING) {
+        if (!(revents & (POLLOUT | POLLERR | POLLHUP))) {
+            return true;
+        }
+        if (!finish_connect(session)) {
+            close_session(session, CHAT_COMMS_FAILED);
+            return false;
+        }
+        revents |= POLLIN;
+    }
+    if (revents & (POLLIN | POLLERR | POLLHUP)) {
+        read_session_lines(session);
+    }
+    flush_session(session);
+    return session->state != CHAT_CLOSED;
+}
+
+/*
+ * Function to send a chat message on a session.
+ *
+ * @param session: The session, which must have joined.
+ *
+ * @param text: The message.
+ *
+ * return's nothing, the message is dropped if the session hasn't joined.
+*/
+void chat_session_say(ChatSession *session, char *text) {
+    if (session->state != CHAT_JOINED) {
+        return;
+    }
+    queue_line(session, "SAY:", text);
+    try_flush_session(session);
+}
+
+/*
+ * Function to send a command, such as "KICK:bob" or "LIST:", on a session.
+ *
+ * @param session: The session, which must have joined.
+ *
+ * @param command: The command without its newline.
+ *
+ * return's nothing, the command is dropped if the session hasn't joined.
+*/
+void chat_session_send(ChatSession *session, char *command) {
+    if (session->state != CHAT_JOINED) {
+        return;
+    }
+    queue_line(session, "", command);
+    try_flush_session(session);
+}
+
+/*
+ * Function to leave the chat and close the session. A LEAVE: is sent if
+ * the session had joined, without waiting for the socket to take it.
+ *
+ * @param session: The session.
+ *
+ * return's nothing.
+*/
+void chat_session_leave(ChatSession *session) {
+    if (session->state == CHAT_JOINED) {
+        queue_line(session, "", "LEAVE:");
+        try_flush_session(session);
+    }
+    close_session(session, CHAT_LEFT);
+}
+
+/*
+ * Function to free a session, closing it first if it is still open. No
+ * callbacks are made.
+ *
+ * @param session: The session.
+ *
+ * return's nothing.
+*/
+void chat_session_free(ChatSession *session) {
+    if (session->state != CHAT_CLOSED && session->socket != -1) {
+        close(session->socket);
+    }
+    if (session->serverLines != NULL) {
+        free_line_reader(session->serverLines);
+    }
+    free(session->outbound.data);
+    free(session->name);
+    free(session->authString);
+    free(session);
+}
@@ -0,0 +1,89 @@
+#ifndef CHATCLIENT_H
+#define CHATCLIENT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <poll.h>
+#include "comms.h"
+#include "shared.h"
+
+// libchatclient: chat sessions driven by the caller's own event loop. A
+// session never blocks. The caller watches chat_session_fd() for
+// chat_session_events() and hands what poll() (or epoll) reported to
+// chat_session_handle(), which calls back as messages arrive. Nothing in a
+// session is locked, so one session is only ever used by one thread at a
+// time; any number of sessions can share a thread. Like the client, the
+// caller should ignore SIGPIPE.
+
+// Initial size of a session's read buffer. It grows for longer lines, such
+// as a big LIST:, and is kept small so many sessions fit in little memory.
+#define CHAT_READ_BUFFSIZE 512
+
+// Where a session is in its life.
+typedef enum {
+    CHAT_CONNECTING, // the connect() hasn't finished.
+    CHAT_AUTHENTICATING, // waiting for AUTH: and then OK:.
+    CHAT_NAMING, // waiting for WHO: and then OK: or NAME_TAKEN:.
+    CHAT_JOINED,
+    CHAT_CLOSED
+} ChatState;
+
+// Why a session was closed.
+typedef enum {
+    CHAT_LEFT, // chat_session_leave() was called.
+    CHAT_KICKED,
+    CHAT_AUTH_FAILED,
+    CHAT_COMMS_FAILED // the connection failed or the server broke protocol.
+} ChatCloseReason;
+
+typedef struct ChatSession ChatSession;
+
+// Called by a session as it goes. Any of them may be NULL. The strings are
+// only valid during the call. A callback may send on its session but must
+// not free it; that is done once chat_session_handle() returns false.
+typedef struct {
+    void (*onJoined)(ChatSession *session, void *context);
+    void (*onMsg)(ChatSession *session, char *name, char *text,
+            void *context);
+    void (*onEnter)(ChatSession *session, char *name, void *context);
+    void (*onLeave)(ChatSession *session, char *name, void *context);
+    void (*onList)(ChatSession *session, char *names, void *context);
+    void (*onKick)(ChatSession *session, void *context);
+    void (*onClosed)(ChatSession *session, ChatCloseReason reason,
+            void *context);
+} ChatCallbacks;
+
+// One connection to the server.
+struct ChatSession {
+    ChatState state;
+    char *name; // the name asked for, changed if it was taken.
+    int renames; // names tried after the first.
+    char *authString;
+    bool authSent;
+
+    int socket;
+    LineReader *serverLines;
+    ByteBuffer outbound; // bytes the socket hasn't taken yet, freed once
+                         // it has taken them all.
+
+    ChatCallbacks callbacks;
+    void *context; // handed to every callback.
+};
+
+ChatSession *chat_session_new(char *name, char *authString,
+        ChatCallbacks *callbacks, void *context);
+bool chat_session_connect(ChatSession *session, char *port);
+int chat_session_fd(ChatSession *session);
+short chat_session_events(ChatSession *session);
+bool chat_session_handle(ChatSession *session, short revents);
+void chat_session_say(ChatSession *session, char *text);
+void chat_session_send(ChatSession *session, char *command);
+void chat_session_leave(ChatSession *session);
+void chat_session_free(ChatSession *session);
+
+int chat_connect_socket(char *port, bool nonblocking);
+char *chat_next_name(char *name, int attempt);
+
+#endif //ass4_chatclient_h
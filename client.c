@@ -48,12 +48,30 @@ char *get_auth_string(char *authFile) {
 */
 Client *new_client(char *name, char *authFile, char *port) {
     Client *client = (Client *) malloc(sizeof(Client));
-    client->name = malloc(sizeof(char) * strlen(name));
+    client->name = malloc(sizeof(char) * (strlen(name) + 1));
     strcpy(client->name, name);
     client->authString = get_auth_string(authFile);
     client->port = port;
-    client->nameSuffix = "0";
+    client->renames = 0;
     client->fromUser = stdin;
+    setvbuf(stdout, NULL, _IOFBF, DISPLAY_BUFFSIZE);
+    client->pollMode = false;
+    client->bulkMode = false;
+    client->inputPaused = false;
+    client->outputOnly = false;
+    client->maxDisplayLatency = 0;
+    client->displayPending = 0;
+    client->userLines = NULL;
+    memset(&client->outbound, 0, sizeof(ByteBuffer));
+    client->outboundMidFrame = false;
+    client->token = NULL;
+    client->framesReceived = 0;
+    client->shmMode = false;
+    client->channel = NULL;
+    memset(&client->roster, 0, sizeof(Roster));
+    client->resyncInterval = 0;
+    client->nextResync = 0;
+    client->leaving = false;
     pthread_mutex_init(&client->clientLock, NULL);
     pthread_mutex_init(&client->serverLock, NULL);
     return client;
@@ -63,17 +81,17 @@ Client *new_client(char *name, char *authFile, char *port) {
  * Function to get an OK message from server when client send's an AUTH:
  * message.
  *
- * @param fromServer: a FILE * that read's from the server socket
+ * @param client: The Client struct whose server connection is read.
  *
  * return's nothing.
 */
-void get_auth_ok_message_from_server(FILE *fromServer) {
-    char first = fgetc(fromServer);
+void get_auth_ok_message_from_server(Client *client) {
+    char *line = read_line_blocking(client->serverLines);
     ServerMessage msg;
     msg.message = NULL;
     msg.messID = S_INVALID;
-    if (first == 'O') {
-        msg = parse_ok_message_from_server(fromServer);
+    if (line != NULL && line[0] == 'O') {
+        msg = parse_server_message_line(line);
     } else {
         fprintf(stderr, "Authentication error\n");
         fflush(stderr);
@@ -86,61 +104,42 @@ void get_auth_ok_message_from_server(FILE *fromServer) {
     }
 }
 
+/*
+ * Function for a reader which found the server's connection closed. Once
+ * the client is leaving the server closing on it is expected, so the
+ * reading thread stops and leave_chat() exit's with OK.
+ *
+ * @param client: The Client struct.
+ *
+ * return's nothing if the client isn't leaving.
+*/
+void stop_if_leaving(Client *client) {
+    if (__atomic_load_n(&client->leaving, __ATOMIC_ACQUIRE)) {
+        pthread_exit(NULL);
+    }
+}
+
 /*
  * Function to parse a server message. 
- * The first character is used to identify the message sent by the server.
- * Further checks in comms.c
+ * Blocks until a whole line has been read from the server, the first
+ * character then identifies the message. Further checks in comms.c
  *
- * @param fromServer: The FILE * that reads from the server socket.
+ * @param client: The Client struct whose server connection is read.
  *
  * return's a ServerMessage struct with the information of the message 
  * sent by the server.
 */
-ServerMessage parse_server_messages(FILE *fromServer) {
-    ServerMessage msg;
-    msg.message = NULL;
-    msg.messID = S_INVALID;
-    char first = fgetc(fromServer);
-    if (first <= 0) {
-        fprintf(stderr, "Communications error\n");
-        fflush(stderr);
-        exit(COMMS_ERR);
-    }
-    switch (first) {
-        case 'A':
-            msg = parse_auth_message_from_server(fromServer);
-            break;
-        case 'M':
-            msg = parse_msg_message_from_server(fromServer);
-            break;
-        case 'N':
-            msg = parse_name_taken_message_from_server(fromServer);
-            break;
-        case 'W':
-            msg = parse_who_message_from_server(fromServer);
-            break;
-        case 'E':
-            msg = parse_enter_message_from_server(fromServer);
-            break;
-        case 'L':
-            first = fgetc(fromServer);
-            if (first == 'E') {
-                msg = parse_leave_message_from_server(fromServer);
-            }
-            if (first == 'I') {
-                msg = parse_list_message_from_server(fromServer);
-            }
-            break;
-        case 'K':
-            msg = parse_kick_message_from_server(fromServer);
-            break;
-        case 'O':
-            msg = parse_ok_message_from_server(fromServer);
-            break;
-        default:
-            break;
+ServerMessage parse_server_messages(Client *client) {
+    char *line;
+    while ((line = read_line_blocking(client->serverLines)) == NULL) {
+        stop_if_leaving(client);
+        if (!resume_connection(client)) {
+            fprintf(stderr, "Communications error\n");
+            fflush(stderr);
+            exit(COMMS_ERR);
+        }
     }
-    return msg;
+    return parse_server_message_line(line);
 }
 
 /*
@@ -151,24 +150,9 @@ ServerMessage parse_server_messages(FILE *fromServer) {
  * return's nothing.
 */
 void generate_new_name(Client *client) {
-    bool digitPresent = false;
-    int len = strlen(client->name);
-    client->name = realloc(client->name, sizeof(char) * 
-            strlen(client->name + 2));
-    for (int i = 0; i < len; ++i) {
-        if (isdigit(client->name[i])) {
-            digitPresent = true;
-            break;
-        }
-    }
-    if (digitPresent) {
-        sprintf(client->name + (len - 1), "%s", client->nameSuffix);
-    } else {
-        sprintf(client->name + len, "%s", client->nameSuffix);
-    }
-    int number = atoi(client->nameSuffix);
-    number++;
-    client->nameSuffix = int_to_string(number);
+    char *name = chat_next_name(client->name, client->renames++);
+    free(client->name);
+    client->name = name;
 }
 
 /*
@@ -181,7 +165,6 @@ void generate_new_name(Client *client) {
 */
 void print_enter_message(FILE *output, char *name) {
     fprintf(output, "(%s has entered the chat)\n", name);
-    fflush(output);
 }
 
 /*
@@ -195,7 +178,6 @@ void print_enter_message(FILE *output, char *name) {
 */
 void print_incoming_message(FILE *output, char *message) {
     fprintf(output, "%s\n", message);
-    fflush(output);
 }
 
 /*
@@ -209,7 +191,6 @@ void print_incoming_message(FILE *output, char *message) {
 */
 void print_client_list(FILE *output, char *message) {
     fprintf(output, "(current chatters: %s)\n", message);
-    fflush(output);
 }
 
 /*
@@ -223,7 +204,32 @@ void print_client_list(FILE *output, char *message) {
 */
 void print_client_left(FILE *output, char *name) {
     fprintf(output, "(%s has left the chat)\n", name);
-    fflush(output);
+}
+
+/*
+ * Function which print's a message found by a search.
+ *
+ * @param output: The standard output of the client.
+ *
+ * @param message: The message found, with who said it.
+ *
+ * return's nothing.
+*/
+void print_search_hit(FILE *output, char *message) {
+    fprintf(output, "(found) %s\n", message);
+}
+
+/*
+ * Function which print's how many messages a search found.
+ *
+ * @param output: The standard output of the client.
+ *
+ * @param count: The number found.
+ *
+ * return's nothing.
+*/
+void print_search_end(FILE *output, char *count) {
+    fprintf(output, "(search found %s)\n", count);
 }
 
 /*
@@ -237,7 +243,7 @@ void print_client_left(FILE *output, char *name) {
 void shutdown_client(Client *client) {
     free(client->authString);
     free(client->name);
-    fclose(client->fromServer);
+    free_line_reader(client->serverLines);
     fclose(client->toServer);
     pthread_mutex_destroy(&client->clientLock);
     pthread_mutex_destroy(&client->serverLock);
@@ -247,8 +253,347 @@ void shutdown_client(Client *client) {
 }
 
 /*
- * Function which is used to perform necessary actions once proper
- * classification of server messages is performed. 
+ * Function to get how long the rendered messages may stay in the stdout
+ * buffer before they have to be flushed.
+ *
+ * @param client: The Client struct.
+ *
+ * return's the time left in ms, 0 if a flush is due now or -1 if nothing
+ * is waiting to be flushed.
+*/
+int display_timeout(Client *client) {
+    if (client->displayPending == 0) {
+        return -1;
+    }
+    uint64_t elapsed = get_time_ns() - client->displayPending;
+    uint64_t limit = (uint64_t) client->maxDisplayLatency * 1000000;
+    if (elapsed >= limit) {
+        return 0;
+    }
+    return (limit - elapsed + 999999) / 1000000;
+}
+
+/*
+ * Function which writes the rendered messages out to stdout.
+ *
+ * @param client: The Client struct.
+ *
+ * return's nothing.
+*/
+void flush_display(Client *client) {
+    fflush(stdout);
+    client->displayPending = 0;
+}
+
+/*
+ * Function called once every message that had arrived has been handled.
+ * The rendered batch is flushed if it has waited as long as the maximum
+ * display latency allows.
+ *
+ * @param client: The Client struct.
+ *
+ * return's nothing.
+*/
+void end_display_batch(Client *client) {
+    if (display_timeout(client) == 0) {
+        flush_display(client);
+    }
+}
+
+/*
+ * Function to find a name in the local roster.
+ *
+ * @param roster: The roster.
+ *
+ * @param name: The name looked for.
+ *
+ * @param index: Set to where the name is, or where it would be inserted.
+ *
+ * return's a bool indicating if the name is in the roster.
+*/
+bool find_roster_name(Roster *roster, char *name, int *index) {
+    int low = 0, high = roster->count;
+    while (low < high) {
+        int middle = low + (high - low) / 2;
+        int order = strcmp(roster->names[middle], name);
+        if (order == 0) {
+            *index = middle;
+            return true;
+        }
+        if (order < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    *index = low;
+    return false;
+}
+
+/*
+ * Function to add a name to the local roster, keeping it sorted. A name
+ * already in the roster isn't added again.
+ *
+ * @param roster: The roster.
+ *
+ * @param name: The name of the chatter.
+ *
+ * return's nothing.
+*/
+void add_roster_name(Roster *roster, char *name) {
+    int index;
+    if (find_roster_name(roster, name, &index)) {
+        return;
+    }
+    if (roster->count == roster->capacity) {
+        roster->capacity = roster->capacity ? roster->capacity * 2 : 16;
+        roster->names = (char **) realloc(roster->names,
+                sizeof(char *) * roster->capacity);
+    }
+    memmove(&roster->names[index + 1], &roster->names[index],
+            sizeof(char *) * (roster->count - index));
+    roster->names[index] = strdup(name);
+    roster->count++;
+}
+
+/*
+ * Function to remove a name from the local roster.
+ *
+ * @param roster: The roster.
+ *
+ * @param name: The name of the chatter.
+ *
+ * return's nothing.
+*/
+void remove_roster_name(Roster *roster, char *name) {
+    int index;
+    if (!find_roster_name(roster, name, &index)) {
+        return;
+    }
+    free(roster->names[index]);
+    roster->count--;
+    memmove(&roster->names[index], &roster->names[index + 1],
+            sizeof(char *) * (roster->count - index));
+}
+
+/*
+ * Function to apply an ENTER: or LEAVE: to the local roster. While a LIST:
+ * is unanswered the change is also kept, since the reply may have been
+ * built before it happened.
+ *
+ * @param roster: The roster.
+ *
+ * @param entered: true for ENTER:, false for LEAVE:.
+ *
+ * @param name: The name of the chatter.
+ *
+ * return's nothing.
+*/
+void note_roster_change(Roster *roster, bool entered, char *name) {
+    if (entered) {
+        add_roster_name(roster, name);
+    } else {
+        remove_roster_name(roster, name);
+    }
+    if (!roster->listPending) {
+        return;
+    }
+    if (roster->changeCount == roster->changeCapacity) {
+        roster->changeCapacity = roster->changeCapacity ?
+                roster->changeCapacity * 2 : 16;
+        roster->changes = (RosterChange *) realloc(roster->changes,
+                sizeof(RosterChange) * roster->changeCapacity);
+    }
+    roster->changes[roster->changeCount].entered = entered;
+    roster->changes[roster->changeCount].name = strdup(name);
+    roster->changeCount++;
+}
+
+/*
+ * Function to replace the local roster with the reply to a LIST:. The
+ * changes seen since the LIST: was sent are applied again on top, so the
+ * roster ends up as current as the last ENTER: or LEAVE: for each name.
+ *
+ * @param roster: The roster.
+ *
+ * @param list: The names from the LIST: reply, comma separated.
+ *
+ * return's nothing.
+*/
+void replace_roster(Roster *roster, char *list) {
+    for (int i = 0; i < roster->count; ++i) {
+        free(roster->names[i]);
+    }
+    roster->count = 0;
+    char *savePtr;
+    for (char *name = strtok_r(list, ",", &savePtr); name != NULL;
+            name = strtok_r(NULL, ",", &savePtr)) {
+        add_roster_name(roster, name);
+    }
+    roster->listPending = false;
+    for (int i = 0; i < roster->changeCount; ++i) {
+        note_roster_change(roster, roster->changes[i].entered,
+                roster->changes[i].name);
+        free(roster->changes[i].name);
+    }
+    roster->changeCount = 0;
+}
+
+/*
+ * Function to note that a LIST: is about to be sent to the server. The
+ * next resync is timed from now.
+ *
+ * @param client: The Client struct.
+ *
+ * return's nothing.
+*/
+void expect_roster(Client *client) {
+    client->roster.listPending = true;
+    client->nextResync = get_time_ns() +
+            (uint64_t) client->resyncInterval * 1000000000;
+}
+
+/*
+ * Function to answer the user's LIST from the local roster, in the same
+ * form as the reply from the server, without asking the server.
+ *
+ * @param client: The Client struct.
+ *
+ * return's nothing.
+*/
+void print_local_roster(Client *client) {
+    Roster *roster = &client->roster;
+    ByteBuffer list;
+    memset(&list, 0, sizeof(ByteBuffer));
+    for (int i = 0; i < roster->count; ++i) {
+        if (i) {
+            byte_buffer_append(&list, ",", 1);
+        }
+        byte_buffer_append(&list, roster->names[i],
+                strlen(roster->names[i]));
+    }
+    byte_buffer_append(&list, "", 1);
+    print_client_list(stdout, list.data);
+    flush_display(client);
+    free(list.data);
+}
+
+/*
+ * Function to answer the user's line locally if it is a LIST command.
+ *
+ * @param client: The Client struct.
+ *
+ * @param line: The line entered by the user.
+ *
+ * return's a bool indicating if the line was answered, in which case it
+ * mustn't be sent.
+*/
+bool answer_list_locally(Client *client, char *line) {
+    if (strncmp(line, LIST_COMMAND, strlen(LIST_COMMAND)) != 0) {
+        return false;
+    }
+    MUTEX_LOCK(&client->clientLock);
+    print_local_roster(client);
+    MUTEX_UNLOCK(&client->clientLock);
+    return true;
+}
+
+/*
+ * Function used in the threaded mode before blocking on the server. Waits
+ * for more messages while rendered ones are still buffered, and flushes
+ * them when the maximum display latency is reached first.
+ *
+ * @param client: The Client struct.
+ *
+ * return's nothing.
+*/
+void wait_for_server_messages(Client *client) {
+    struct pollfd fd = {client->serverSocket, POLLIN, 0};
+    int timeout;
+    if (client->channel != NULL) {
+        // Nothing to poll on a channel, so it is not waited on.
+        flush_display(client);
+        return;
+    }
+    while ((timeout = display_timeout(client)) >= 0) {
+        if (timeout == 0) {
+            flush_display(client);
+            return;
+        }
+        if (poll(&fd, 1, timeout) != 0) {
+            return;
+        }
+    }
+}
+
+/*
+ * Function which performs the necessary action for a message once proper
+ * classification of the server message is performed.
+ *
+ * @param client: The client struct containing the client information.
+ *
+ * @param msg: The message sent by the server.
+ *
+ * return's nothing.
+*/
+void handle_server_message(Client *client, ServerMessage msg) {
+    if (msg.messID == S_TOKEN) {
+        free(client->token);
+        client->token = msg.message;
+        client->framesReceived = 0;
+        return;
+    }
+    if (client->token != NULL) {
+        client->framesReceived++;
+    }
+    if (msg.messID == S_PING) {
+        MUTEX_LOCK(&client->serverLock);
+        send_client_command_to_server("PONG:", client->toServer);
+        MUTEX_UNLOCK(&client->serverLock);
+        return;
+    }
+    switch (msg.messID) {
+        case S_MSG:
+            print_incoming_message(stdout, msg.message);
+            break;
+        case S_ENTER:
+            note_roster_change(&client->roster, true, msg.message);
+            print_enter_message(stdout, msg.message);
+            break;
+        case S_LIST:
+            // Only ever sent for the local roster, so it isn't shown.
+            replace_roster(&client->roster, msg.message);
+            free(msg.message);
+            return;
+        case S_LEAVE:
+            note_roster_change(&client->roster, false, msg.message);
+            print_client_left(stdout, msg.message);
+            break;
+        case S_KICK:
+            shutdown_client(client);
+            break;
+        case S_FOUND:
+            print_search_hit(stdout, msg.message);
+            break;
+        case S_SEARCHED:
+            print_search_end(stdout, msg.message);
+            break;
+        case S_INVALID:
+        default:
+            return;
+    }
+    if (client->displayPending == 0) {
+        client->displayPending = get_time_ns();
+    }
+    if (msg.messID != S_KICK) {
+        free(msg.message);
+    }
+}
+
+/*
+ * Function which reads the server messages and handles them in the
+ * threaded mode. Messages are rendered into the stdout buffer, which is
+ * flushed once no more are waiting or the maximum display latency is up.
  *
  * @param clientInfo: The client struct containing the client
  *                    information.
@@ -258,34 +603,18 @@ void shutdown_client(Client *client) {
 void handle_connection(Client *clientInfo) {
     Client *client = (Client *) clientInfo;
     ServerMessage msg;
-    memset(&msg, 0, sizeof(ServerMessage));
     while (1) {
-        while (msg.messID != S_KICK) {
-            msg = parse_server_messages(client->fromServer);
-            pthread_mutex_lock(&client->clientLock);
-            switch (msg.messID) {
-                case S_MSG:
-                    print_incoming_message(stdout, msg.message);
-                    break;
-                case S_ENTER:
-                    print_enter_message(stdout, msg.message);
-                    break;
-                case S_LIST:
-                    print_client_list(stdout, msg.message);
-                    break;
-                case S_LEAVE:
-                    print_client_left(stdout, msg.message);
-                    break;
-                case S_KICK:
-                    shutdown_client(client);
-                    break;
-                case S_INVALID:
-                default:;
-            }
-            pthread_mutex_unlock(&client->clientLock);
+        if (!line_reader_has_line(client->serverLines)) {
+            MUTEX_LOCK(&client->clientLock);
+            end_display_batch(client);
+            MUTEX_UNLOCK(&client->clientLock);
+            wait_for_server_messages(client);
         }
+        msg = parse_server_messages(client);
+        MUTEX_LOCK(&client->clientLock);
+        handle_server_message(client, msg);
+        MUTEX_UNLOCK(&client->clientLock);
     }
-    return;
 }
 
 /*
@@ -307,6 +636,96 @@ void process_input_from_user(char *line, FILE *toServer) {
     }
 }
 
+/*
+ * Function which frames a line of user input the same way
+ * process_input_from_user() does, but straight into a buffer so many lines
+ * can be sent with one write.
+ *
+ * @param frames: The buffer the framed message is appended to.
+ *
+ * @param line: The line entered by the user.
+ *
+ * return's nothing.
+*/
+void frame_user_line(ByteBuffer *frames, char *line) {
+    if (line[0] == '*') {
+        byte_buffer_append(frames, line + 1, strlen(line + 1));
+    } else {
+        byte_buffer_append(frames, "SAY:", strlen("SAY:"));
+        byte_buffer_append(frames, line, strlen(line));
+    }
+    byte_buffer_append(frames, "\n", 1);
+}
+
+/*
+ * Function which leaves the chat once the user's input has ended. The
+ * LEAVE: message is written out before the client exit's normally.
+ *
+ * @param client: The Client struct which contains the information of the
+ *                client.
+ *
+ * return's nothing.
+*/
+void leave_chat(Client *client) {
+    __atomic_store_n(&client->leaving, true, __ATOMIC_RELEASE);
+    send_client_command_to_server("LEAVE:", client->toServer);
+    if (client->pollMode) {
+        int flags = fcntl(client->serverSocket, F_GETFL);
+        fcntl(client->serverSocket, F_SETFL, flags & ~O_NONBLOCK);
+        byte_buffer_write(&client->outbound, client->serverSocket);
+    }
+    exit(OK);
+}
+
+/*
+ * Function which sends piped user input in bulk in the threaded mode.
+ * stdin is read BULK_CHUNK bytes at a time, every complete line in the
+ * chunk is framed into one buffer and the buffer is sent with a blocking
+ * write. The write only returns once the server has taken the data, so a
+ * server that is slow to read holds the client back.
+ *
+ * @param client: The Client struct which contains the information of the
+ *                client.
+ *
+ * return's nothing, leaves the chat at the end of the input.
+*/
+void send_bulk_input(Client *client) {
+    LineReader *reader = new_line_reader_sized(fileno(client->fromUser),
+            BULK_CHUNK);
+    ByteBuffer frames;
+    memset(&frames, 0, sizeof(ByteBuffer));
+    char *line;
+    while (1) {
+        if (fill_line_reader(reader) < 0 && errno != EINTR) {
+            reader->eof = true;
+        }
+        while ((line = next_line(reader)) != NULL) {
+            if (!answer_list_locally(client, line)) {
+                frame_user_line(&frames, line);
+            }
+        }
+        MUTEX_LOCK(&client->serverLock);
+        fflush(client->toServer);
+        ssize_t written;
+        if (client->channel != NULL) {
+            written = shm_endpoint_write(client->channel,
+                    frames.data + frames.start, byte_buffer_pending(&frames));
+            frames.start += written < 0 ? 0 : written;
+        } else {
+            written = byte_buffer_write(&frames, client->serverSocket);
+        }
+        if (written < 0) {
+            fprintf(stderr, "Communications error\n");
+            fflush(stderr);
+            exit(COMMS_ERR);
+        }
+        if (reader->eof) {
+            leave_chat(client);
+        }
+        MUTEX_UNLOCK(&client->serverLock);
+    }
+}
+
 /*
  * Function which handles user input.
  *
@@ -317,55 +736,406 @@ void process_input_from_user(char *line, FILE *toServer) {
 void *handle_user_input(void *clientInfo) {
     Client *client = (Client *) clientInfo;
     char *line;
+    if (client->bulkMode) {
+        send_bulk_input(client);
+    }
     while (1) {
         line = read_line(client->fromUser);
-        pthread_mutex_lock(&client->serverLock);
+        if (line != NULL && answer_list_locally(client, line)) {
+            free(line);
+            continue;
+        }
+        MUTEX_LOCK(&client->serverLock);
+        if (line == NULL) {
+            leave_chat(client);
+        }
         process_input_from_user(line, client->toServer);
-        pthread_mutex_unlock(&client->serverLock);
+        MUTEX_UNLOCK(&client->serverLock);
     }
     return NULL;
 }
 
 /*
- * Function used to connect to the server.
+ * Function used to connect to the server. A port with a '/' in it is taken
+ * as the path of the server's Unix socket.
  *
  * @param client: The client struct which contains the client info.
  *
  * return's a bool indicating successfull connection or not.
 */
 bool connect_to_server(Client *client) {
-    struct addrinfo *result;
-    struct addrinfo hints;
-    hints.ai_family = AF_INET;
-    hints.ai_socktype = SOCK_STREAM;
-    hints.ai_protocol = DEFAULT_PROTOCOL;
-    if (getaddrinfo(LOCALHOST, client->port, &hints, &result) != 0) {
+    client->serverSocket = chat_connect_socket(client->port, false);
+    if (client->serverSocket == -1) {
+        return false;
+    }
+    client->serverLines = new_line_reader(client->serverSocket);
+    client->toServer = fdopen(dup(client->serverSocket), "w");
+    return true;
+}
+
+/*
+ * Function to offer the server a shared-memory channel after its first
+ * AUTH: on a Unix socket. If the server takes it up, it answers OK: and
+ * both directions move to the channel, where AUTH: is sent again;
+ * otherwise it answers AUTH: and the socket is used as usual.
+ *
+ * @param client: The Client struct connected over a Unix socket.
+ *
+ * return's a bool indicating if the client is now on the channel.
+*/
+bool offer_channel(Client *client) {
+    int fd;
+    ShmEndpoint *channel = shm_endpoint_create(client->serverSocket, &fd);
+    if (channel == NULL) {
+        return false;
+    }
+    bool sent = shm_send_offer(client->serverSocket, fd);
+    char *reply = sent ? read_line_blocking(client->serverLines) : NULL;
+    if (reply == NULL) {
+        fprintf(stderr, "Communications error\n");
+        exit(COMMS_ERR);
+    }
+    if (strcmp(reply, "OK:") != 0) {
+        shm_endpoint_free(channel);
         return false;
     }
-    for (struct addrinfo *attempts = result; attempts != NULL; 
-            attempts = attempts->ai_next) {
-        client->serverSocket = socket(attempts->ai_family,
-                attempts->ai_socktype, attempts->ai_protocol);
-        if (client->serverSocket == -1) {
+    client->channel = channel;
+    free_line_reader(client->serverLines);
+    client->serverLines = new_line_reader_from(shm_endpoint_read, channel);
+    fclose(client->toServer);
+    client->toServer = shm_endpoint_stream(channel, "w");
+    return true;
+}
+
+/*
+ * Function to drop the rest of a message the server only got part of
+ * before the connection dropped, so the new connection starts on a whole
+ * message.
+ *
+ * @param client: The Client struct in poll mode.
+ *
+ * return's nothing.
+*/
+void drop_partial_frame(Client *client) {
+    ByteBuffer *outbound = &client->outbound;
+    if (!client->outboundMidFrame) {
+        return;
+    }
+    char *newline = memchr(outbound->data + outbound->start, '\n',
+            byte_buffer_pending(outbound));
+    outbound->start = newline == NULL ? outbound->length :
+            (size_t) (newline - outbound->data) + 1;
+    client->outboundMidFrame = false;
+}
+
+/*
+ * Function to open a new connection and present the resumption token in
+ * place of the auth string. The server then replays the messages missed.
+ *
+ * @param client: The Client struct with a token.
+ *
+ * return's a bool indicating if the server resumed the session.
+*/
+bool reconnect_to_server(Client *client) {
+    FILE *toServer = client->toServer;
+    close(client->serverSocket);
+    free_line_reader(client->serverLines);
+    client->serverLines = NULL;
+    if (!connect_to_server(client)) {
+        return false;
+    }
+    ServerMessage msg = parse_server_message_line(
+            read_line_blocking(client->serverLines));
+    bool resumed = msg.messID == S_AUTH;
+    if (resumed) {
+        send_resume_message(client->toServer, client->token,
+                (unsigned long long) client->framesReceived);
+        msg = parse_server_message_line(
+                read_line_blocking(client->serverLines));
+        resumed = msg.messID == S_OK;
+    }
+    if (client->pollMode) {
+        // The poll loop keeps writing through its outbound buffer.
+        fclose(client->toServer);
+        client->toServer = toServer;
+        drop_partial_frame(client);
+        resumed = resumed && set_nonblocking(client->serverSocket);
+    } else {
+        fclose(toServer);
+    }
+    return resumed;
+}
+
+/*
+ * Function called when the connection to the server drops. If the server
+ * gave a resumption token the session is resumed on a new connection,
+ * without a new handshake and without missing any messages.
+ *
+ * @param client: The Client struct.
+ *
+ * return's a bool indicating if the session was resumed.
+*/
+bool resume_connection(Client *client) {
+    if (client->token == NULL) {
+        return false;
+    }
+    bool resumed = false;
+    MUTEX_LOCK(&client->serverLock);
+    for (int i = 0; i < RESUME_ATTEMPTS && !resumed; ++i) {
+        if (i) {
+            usleep(RESUME_RETRY_DELAY);
+        }
+        resumed = reconnect_to_server(client);
+    }
+    MUTEX_UNLOCK(&client->serverLock);
+    return resumed;
+}
+
+/*
+ * Function used as the write function of the toServer stream in poll mode.
+ * The bytes are queued in the outbound buffer and written by the event loop
+ * when the socket can take them.
+ *
+ * @param clientInfo: The Client struct.
+ *
+ * @param data: The bytes written to the stream.
+ *
+ * @param size: The number of bytes.
+ *
+ * return's the number of bytes taken, which is always all of them.
+*/
+ssize_t queue_output_for_server(void *clientInfo, const char *data,
+        size_t size) {
+    Client *client = (Client *) clientInfo;
+    byte_buffer_append(&client->outbound, data, size);
+    return size;
+}
+
+/*
+ * Function to write as much queued output to the server as the socket
+ * takes without blocking.
+ *
+ * @param client: The Client struct.
+ *
+ * return's nothing and exit's if the connection is broken.
+*/
+void flush_output_to_server(Client *client) {
+    if (byte_buffer_write(&client->outbound, client->serverSocket) < 0) {
+        if (resume_connection(client)) {
+            return;
+        }
+        fprintf(stderr, "Communications error\n");
+        fflush(stderr);
+        exit(COMMS_ERR);
+    }
+    ByteBuffer *outbound = &client->outbound;
+    client->outboundMidFrame = outbound->start > 0 &&
+            outbound->data[outbound->start - 1] != '\n';
+}
+
+/*
+ * Function which reads everything available from the server in poll mode
+ * and handles every complete message.
+ *
+ * @param client: The Client struct.
+ *
+ * return's nothing and exit's if the server closed the connection.
+*/
+void read_server_lines(Client *client) {
+    ssize_t count = fill_line_reader(client->serverLines);
+    if (count < 0 && errno != EAGAIN && errno != EINTR) {
+        client->serverLines->eof = true;
+    }
+    char *line;
+    while ((line = next_line(client->serverLines)) != NULL) {
+        handle_server_message(client, parse_server_message_line(line));
+    }
+    end_display_batch(client);
+    if (client->serverLines->eof && !resume_connection(client)) {
+        fprintf(stderr, "Communications error\n");
+        fflush(stderr);
+        exit(COMMS_ERR);
+    }
+}
+
+/*
+ * Function which reads what the user has typed in poll mode and sends
+ * every complete line.
+ *
+ * @param client: The Client struct.
+ *
+ * return's nothing and leaves the chat at the end of the user's input.
+*/
+void read_user_lines(Client *client) {
+    if (fill_line_reader(client->userLines) < 0 && errno != EAGAIN &&
+            errno != EINTR) {
+        client->userLines->eof = true;
+    }
+    char *line;
+    while ((line = next_line(client->userLines)) != NULL) {
+        if (answer_list_locally(client, line)) {
             continue;
         }
-        int v = 1;
-        setsockopt(client->serverSocket, SOL_SOCKET, SO_KEEPALIVE, &v, 
-                sizeof(v));
-        if (connect(client->serverSocket, attempts->ai_addr,
-                attempts->ai_addrlen) == -1) {
-            close(client->serverSocket);
-            client->serverSocket = -1;
+        if (client->bulkMode) {
+            frame_user_line(&client->outbound, line);
+        } else {
+            process_input_from_user(line, client->toServer);
+        }
+    }
+    if (client->userLines->eof) {
+        leave_chat(client);
+    }
+}
+
+/*
+ * Function which decides whether stdin should be watched. Reading stops
+ * while more than BULK_HIGH_WATER bytes wait for the server and starts
+ * again once they drain below BULK_LOW_WATER, so a fast input can't grow
+ * the outbound buffer faster than the server reads it.
+ *
+ * @param client: The Client struct.
+ *
+ * return's a bool indicating if stdin should be read.
+*/
+bool want_user_input(Client *client) {
+    size_t pending = byte_buffer_pending(&client->outbound);
+    if (pending > BULK_HIGH_WATER) {
+        client->inputPaused = true;
+    } else if (pending < BULK_LOW_WATER) {
+        client->inputPaused = false;
+    }
+    return !client->inputPaused;
+}
+
+/*
+ * Function to get how long until the local roster is next resynced in
+ * poll mode.
+ *
+ * @param client: The Client struct.
+ *
+ * return's the time left in ms, 0 if a resync is due now or -1 if none is
+ * to be sent.
+*/
+int resync_timeout(Client *client) {
+    if (client->resyncInterval == 0 || client->roster.listPending) {
+        return -1;
+    }
+    uint64_t now = get_time_ns();
+    if (now >= client->nextResync) {
+        return 0;
+    }
+    return (client->nextResync - now + 999999) / 1000000;
+}
+
+/*
+ * Function which runs the client on a single thread. The server socket is
+ * non-blocking and both it and stdin are watched with poll(), so no second
+ * thread or locks are needed.
+ *
+ * @param client: The Client struct which has finished the handshake.
+ *
+ * return's nothing.
+*/
+void run_poll_loop(Client *client) {
+    cookie_io_functions_t functions = {NULL, queue_output_for_server, NULL,
+            NULL};
+    fclose(client->toServer);
+    client->toServer = fopencookie(client, "w", functions);
+    client->userLines = new_line_reader_sized(fileno(client->fromUser),
+            client->bulkMode ? BULK_CHUNK : IO_BUFFSIZE);
+    if (!set_nonblocking(client->serverSocket)) {
+        fprintf(stderr, "Communications error\n");
+        exit(COMMS_ERR);
+    }
+    if (line_reader_has_line(client->serverLines)) {
+        // Read along with the reply that seeded the roster.
+        read_server_lines(client);
+    }
+    struct pollfd fds[2];
+    while (1) {
+        if (resync_timeout(client) == 0) {
+            expect_roster(client);
+            send_client_command_to_server("LIST:", client->toServer);
+        }
+        fds[0].fd = client->serverSocket;
+        fds[0].events = POLLIN;
+        if (byte_buffer_pending(&client->outbound)) {
+            fds[0].events |= POLLOUT;
+        }
+        fds[1].fd = !client->outputOnly && want_user_input(client) ?
+                fileno(client->fromUser) : -1;
+        fds[1].events = POLLIN;
+        int timeout = display_timeout(client);
+        int resync = resync_timeout(client);
+        if (resync >= 0 && (timeout < 0 || resync < timeout)) {
+            timeout = resync;
+        }
+        int ready = poll(fds, 2, timeout);
+        if (ready == 0) {
+            if (display_timeout(client) == 0) {
+                flush_display(client);
+            }
             continue;
         }
-        break;
+        if (ready < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "Communications error\n");
+            exit(COMMS_ERR);
+        }
+        if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+            read_server_lines(client);
+        }
+        if (fds[1].revents & (POLLIN | POLLHUP | POLLERR)) {
+            read_user_lines(client);
+        }
+        flush_output_to_server(client);
     }
-    if (client->serverSocket == -1) {
-        return false;
+}
+
+/*
+ * Function to seed the local roster from one LIST: once the client has
+ * joined. Anything else that arrives before the reply is handled as usual.
+ *
+ * @param client: The Client struct which has finished the handshake.
+ *
+ * return's nothing.
+*/
+void seed_roster(Client *client) {
+    expect_roster(client);
+    send_client_command_to_server("LIST:", client->toServer);
+    while (client->roster.listPending) {
+        handle_server_message(client, parse_server_messages(client));
     }
-    client->fromServer = fdopen(client->serverSocket, "r");
-    client->toServer = fdopen(client->serverSocket, "w");
-    return true;
+}
+
+/*
+ * Function run on its own thread in the threaded mode to resync the local
+ * roster every resyncInterval seconds. No LIST: is sent while the last one
+ * is still unanswered.
+ *
+ * @param clientInfo: The Client struct.
+ *
+ * return's NULL.
+*/
+void *resync_roster(void *clientInfo) {
+    Client *client = (Client *) clientInfo;
+    while (1) {
+        sleep(client->resyncInterval);
+        MUTEX_LOCK(&client->clientLock);
+        bool due = !client->roster.listPending;
+        if (due) {
+            expect_roster(client);
+        }
+        MUTEX_UNLOCK(&client->clientLock);
+        if (due) {
+            MUTEX_LOCK(&client->serverLock);
+            send_client_command_to_server("LIST:", client->toServer);
+            MUTEX_UNLOCK(&client->serverLock);
+        }
+    }
+    return NULL;
 }
 
 /*
@@ -383,18 +1153,22 @@ void start_client(Client *client) {
         exit(COMMS_ERR);
     }
     
-    ServerMessage msg = parse_server_messages(client->fromServer);
+    ServerMessage msg = parse_server_messages(client);
+    if (msg.messID == S_AUTH && client->shmMode && !client->pollMode &&
+            strchr(client->port, '/') != NULL && offer_channel(client)) {
+        msg = parse_server_messages(client);
+    }
     if (msg.messID == S_AUTH) {
         send_auth_string(client->toServer, client->authString);
-        get_auth_ok_message_from_server(client->fromServer);
+        get_auth_ok_message_from_server(client);
     }
-    msg = parse_server_messages(client->fromServer);
+    msg = parse_server_messages(client);
     if (msg.messID == S_WHO) {
         send_client_name(client->toServer, "NAME", client->name);   
     }
     
     while (1) {
-        msg = parse_server_messages(client->fromServer);
+        msg = parse_server_messages(client);
         if (msg.messID == S_OK) {
             break;
         }
@@ -406,7 +1180,7 @@ void start_client(Client *client) {
                 exit(COMMS_ERR);
             }
         }
-        msg = parse_server_messages(client->fromServer);
+        msg = parse_server_messages(client);
         if (msg.messID == S_WHO) {
             send_client_name(client->toServer, "NAME", client->name);
         } else {
@@ -414,27 +1188,101 @@ void start_client(Client *client) {
             exit(COMMS_ERR);
         }
     }
-    pthread_t inputThread;
-    pthread_create(&inputThread, NULL, handle_user_input,
-            (void *) client);
+    seed_roster(client);
+    if (client->pollMode) {
+        run_poll_loop(client);
+    }
+    if (client->resyncInterval > 0) {
+        pthread_t resyncThread;
+        pthread_create(&resyncThread, NULL, resync_roster, (void *) client);
+    }
+    if (!client->outputOnly) {
+        pthread_t inputThread;
+        pthread_create(&inputThread, NULL, handle_user_input,
+                (void *) client);
+    }
     handle_connection(client);
 }
 
+/*
+ * Function to parse the options given after the port on the command line.
+ *
+ * @param client: The Client struct to set the options on.
+ *
+ * @param argc: The argument count.
+ *
+ * @param argv: The arguments, the options start at argv[4].
+ *
+ * return's a bool indicating if every option was valid.
+*/
+bool parse_client_options(Client *client, int argc, char **argv) {
+    for (int i = 4; i < argc; ++i) {
+        if (strcmp(argv[i], POLL_OPTION) == 0) {
+            client->pollMode = true;
+        } else if (strcmp(argv[i], SHM_OPTION) == 0) {
+            client->shmMode = true;
+        } else if (strcmp(argv[i], OUTPUT_ONLY_OPTION) == 0) {
+            client->outputOnly = true;
+        } else if (strcmp(argv[i], BULK_OPTION) == 0) {
+            client->bulkMode = true;
+        } else if (strcmp(argv[i], MAX_LATENCY_OPTION) == 0 &&
+                i + 1 < argc) {
+            char *end;
+            long latency = strtol(argv[++i], &end, 10);
+            if (*argv[i] == '\0' || *end != '\0' || latency < 0 ||
+                    latency > INT_MAX) {
+                return false;
+            }
+            client->maxDisplayLatency = (int) latency;
+        } else if (strcmp(argv[i], RESYNC_OPTION) == 0 && i + 1 < argc) {
+            char *end;
+            long interval = strtol(argv[++i], &end, 10);
+            if (*argv[i] == '\0' || *end != '\0' || interval < 0 ||
+                    interval > INT_MAX) {
+                return false;
+            }
+            client->resyncInterval = (int) interval;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+#ifdef LOCK_STATS
+/*
+ * Function which prints what the client's locks cost once it exit's.
+ *
+ * return's nothing.
+*/
+void print_lock_stats(void) {
+    lock_stats_print(stderr);
+}
+#endif
+
 int main(int argc, char **argv) {
-    if (argc != 4) {
-        fprintf(stderr, "Usage: client name authfile port\n");
+    if (argc < 4) {
+        fprintf(stderr, "%s\n", USAGE);
         exit(BAD_ARGS);
     }
     if (!valid_authfile(argv[2])) {
-        fprintf(stderr, "Usage: client name authfile port\n");
+        fprintf(stderr, "%s\n", USAGE);
         exit(BAD_ARGS);
     }
     if (strlen(argv[1]) == 0 || strlen(argv[2]) == 0 || 
             strlen(argv[3]) == 0) {
-        fprintf(stderr, "Usage: client name authfile port\n");
+        fprintf(stderr, "%s\n", USAGE);
         exit(BAD_ARGS);
     }
+    signal(SIGPIPE, SIG_IGN);
+#ifdef LOCK_STATS
+    atexit(print_lock_stats);
+#endif
     Client *client = new_client(argv[1], argv[2], argv[3]);
+    if (!parse_client_options(client, argc, argv)) {
+        fprintf(stderr, "%s\n", USAGE);
+        exit(BAD_ARGS);
+    }
     start_client(client);
     return OK;
 }
@@ -1,8 +1,15 @@
 #ifndef CLIENT_H
 #define CLIENT_H
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // for fopencookie()
+#endif
+
 #include "comms.h"
 #include "shared.h"
+#include "shmring.h"
+#include "lockstat.h"
+#include "chatclient.h"
 #include <stdio.h>
 #include <stdio.h>
 #include <pthread.h>
@@ -11,8 +18,58 @@
 #include <arpa/inet.h>
 #include <zconf.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <ctype.h>
 #include <semaphore.h>
+#include <poll.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+
+#define USAGE "Usage: client name authfile port"
+#define POLL_OPTION "--poll"
+#define MAX_LATENCY_OPTION "--max-latency"
+#define OUTPUT_ONLY_OPTION "--output-only"
+// Option to move to a shared-memory channel when the port is a Unix socket.
+#define SHM_OPTION "--shm"
+// Option to ask the server for the list of chatters every so many seconds,
+// correcting the local roster if it has drifted.
+#define RESYNC_OPTION "--resync"
+// The user command answered from the local roster.
+#define LIST_COMMAND "*LIST:"
+// Size of the stdout buffer the incoming messages are rendered into.
+#define DISPLAY_BUFFSIZE 65536
+// How often and how far apart a dropped session is tried to be resumed.
+#define RESUME_ATTEMPTS 25
+#define RESUME_RETRY_DELAY 200000
+// Option to read stdin in large chunks and send its lines in batches, for
+// input piped from a file or another program.
+#define BULK_OPTION "--bulk"
+// How much of stdin is read at once in bulk mode.
+#define BULK_CHUNK (256 * 1024)
+// Stop reading stdin while this much output is waiting for the server and
+// start again once it has drained below the low water mark.
+#define BULK_HIGH_WATER (1024 * 1024)
+#define BULK_LOW_WATER (256 * 1024)
+
+// A chatter entering or leaving, kept while a LIST: is unanswered.
+typedef struct {
+    bool entered;
+    char *name;
+} RosterChange;
+
+// The chatters as seen by the client, seeded from a LIST: when it joins
+// and kept current from every ENTER: and LEAVE:.
+typedef struct {
+    char **names; // sorted the same way as the server's LIST:.
+    int count;
+    int capacity;
+    bool listPending; // a LIST: was sent and its reply not yet seen.
+    RosterChange *changes; // seen since the pending LIST: was sent.
+    int changeCount;
+    int changeCapacity;
+} Roster;
 
 //Client struct declaration
 //Client struct that holds the information of client.
@@ -21,16 +78,33 @@ typedef struct {
     char *port;
     char *authString;
     
-    FILE *fromServer;
+    LineReader *serverLines;
     FILE *toServer;
     FILE *fromUser;
     
     int serverSocket;
+    bool pollMode; // stdin and the server handled on one thread with poll.
+    bool bulkMode; // given BULK_OPTION, lines are sent in batches.
+    bool inputPaused; // stdin not read until the outbound buffer drains.
+    bool outputOnly; // stdin is never read, only messages are shown.
+    int maxDisplayLatency; // ms a rendered message may wait before a flush.
+    uint64_t displayPending; // time the oldest unflushed message was shown.
+    LineReader *userLines;
+    ByteBuffer outbound; // bytes queued for the server in poll mode.
+    bool outboundMidFrame; // a message in outbound was partly written.
+    char *token; // resumption token from the server, NULL if none.
+    uint64_t framesReceived; // messages received since the token.
+    bool shmMode; // offer the server a shared-memory channel.
+    ShmEndpoint *channel; // set once the server has taken up the channel.
+    Roster roster; // answers the user's LIST, under clientLock.
+    int resyncInterval; // seconds between LIST: resyncs, 0 for none.
+    uint64_t nextResync; // time the next resync is due in poll mode.
     pthread_mutex_t clientLock;
     pthread_mutex_t serverLock;
     sem_t clientSem;
-    char *nameSuffix;
+    int renames; // names tried after the first.
     int okCount;
+    bool leaving; // LEAVE: is being sent, the server will close on us.
 } Client;
 
 // Enum to store different error codes for the Client.
@@ -42,4 +116,7 @@ typedef enum {
     AUTH_ERR = 4
 } ClientError;
 
+// Defined after the connection code but needed by the readers before it.
+bool resume_connection(Client *client);
+
 #endif //ass4_client_h
@@ -4,45 +4,81 @@
  * Function to parse the AUTH: message from the server.
  * Check's if the message sent by the server is valid or not
  * and assigns the messID accordingly.
- * @param input: The FILE * used to read from the server's socket.
+ * @param line: The rest of the line after the characters used to pick
+ *        the parser, or NULL at end of file.
  * return's ServerMessage struct containing the information of the message
  * recieved from the server.
 */
-ServerMessage parse_auth_message_from_server(FILE *input) {
+ServerMessage parse_auth_message_from_server_line(char *line) {
     ServerMessage msg;
-    char *line = read_line(input);
+    if (line == NULL) {
+        msg.message = 0;
+        msg.messID = S_INVALID;
+        return msg;
+    }
     if (strncmp(line, "UTH:", strlen("UTH:")) != 0) {
         msg.message = 0;
         msg.messID = S_INVALID;
-        free(line);
         return msg;
     } else {
         msg.messID = S_AUTH;
         msg.message = "AUTH:";
-        free(line);
         return msg;
     }
 }
 
 /*
- * Function to parse the WHO: message from the server.
+ * Function to parse the AUTH: message from the server.
  * Check's if the message sent by the server is valid or not
  * and assigns the messID accordingly.
  * @param input: The FILE * used to read from the server's socket.
  * return's ServerMessage struct containing the information of the message
  * recieved from the server.
 */
-ServerMessage parse_who_message_from_server(FILE *input) {
-    ServerMessage msg;
+ServerMessage parse_auth_message_from_server(FILE *input) {
     char *line = read_line(input);
+    ServerMessage msg = parse_auth_message_from_server_line(line);
+    free(line);
+    return msg;
+}
+
+/*
+ * Function to parse the WHO: message from the server.
+ * Check's if the message sent by the server is valid or not
+ * and assigns the messID accordingly.
+ * @param line: The rest of the line after the characters used to pick
+ *        the parser, or NULL at end of file.
+ * return's ServerMessage struct containing the information of the message
+ * recieved from the server.
+*/
+ServerMessage parse_who_message_from_server_line(char *line) {
+    ServerMessage msg;
+    if (line == NULL) {
+        msg.message = 0;
+        msg.messID = S_INVALID;
+        return msg;
+    }
     if (strncmp(line, "HO:", 3) != 0) {
         msg.message = 0;
         msg.messID = S_INVALID;
-        free(line);
         return msg;
     }
     msg.message = "WHO:";
     msg.messID = S_WHO;
+    return msg;
+}
+
+/*
+ * Function to parse the WHO: message from the server.
+ * Check's if the message sent by the server is valid or not
+ * and assigns the messID accordingly.
+ * @param input: The FILE * used to read from the server's socket.
+ * return's ServerMessage struct containing the information of the message
+ * recieved from the server.
+*/
+ServerMessage parse_who_message_from_server(FILE *input) {
+    char *line = read_line(input);
+    ServerMessage msg = parse_who_message_from_server_line(line);
     free(line);
     return msg;
 }
@@ -51,29 +87,46 @@ ServerMessage parse_who_message_from_server(FILE *input) {
  * Function to parse the ENTER: message from the server.
  * Check's if the message sent by the server is valid or not
  * and assigns the messID accordingly.
- * @param input: The FILE * used to read from the server's socket.
+ * @param line: The rest of the line after the characters used to pick
+ *        the parser, or NULL at end of file.
  * return's ServerMessage struct containing the information of the message
  * recieved from the server.
 */
-ServerMessage parse_enter_message_from_server(FILE *input) {
+ServerMessage parse_enter_message_from_server_line(char *line) {
     ServerMessage msg;
-    char *line = read_line(input);
+    if (line == NULL) {
+        msg.message = 0;
+        msg.messID = S_INVALID;
+        return msg;
+    }
     if (strncmp(line, "NTER:", 5) != 0) {
         msg.message = 0;
         msg.messID = S_INVALID;
-        free(line);
         return msg;
     }
     char *name = strtok(&line[strlen("NTER:")], "\0");
     if (name == NULL) {
         msg.message = 0;
         msg.messID = S_INVALID;
-        free(line);
         return msg;
     }
-    msg.message = (char *) malloc(sizeof(char) * strlen(name));
+    msg.message = (char *) malloc(sizeof(char) * (strlen(name) + 1));
     strcpy(msg.message, name);
     msg.messID = S_ENTER;
+    return msg;
+}
+
+/*
+ * Function to parse the ENTER: message from the server.
+ * Check's if the message sent by the server is valid or not
+ * and assigns the messID accordingly.
+ * @param input: The FILE * used to read from the server's socket.
+ * return's ServerMessage struct containing the information of the message
+ * recieved from the server.
+*/
+ServerMessage parse_enter_message_from_server(FILE *input) {
+    char *line = read_line(input);
+    ServerMessage msg = parse_enter_message_from_server_line(line);
     free(line);
     return msg;
 }
@@ -82,21 +135,39 @@ ServerMessage parse_enter_message_from_server(FILE *input) {
  * Function to parse the NAME_TAKEN: message from the server.
  * Check's if the message sent by the server is valid or not
  * and assigns the messID accordingly.
- * @param input: The FILE * used to read from the server's socket.
+ * @param line: The rest of the line after the characters used to pick
+ *        the parser, or NULL at end of file.
  * return's ServerMessage struct containing the information of the message
  * recieved from the server.
 */
-ServerMessage parse_name_taken_message_from_server(FILE *input) {
+ServerMessage parse_name_taken_message_from_server_line(char *line) {
     ServerMessage msg;
-    char *line = read_line(input);
+    if (line == NULL) {
+        msg.message = 0;
+        msg.messID = S_INVALID;
+        return msg;
+    }
     if (strncmp(line, "AME_TAKEN:", 10) != 0) {
         msg.message = 0;
         msg.messID = S_INVALID;
-        free(line);
         return msg;
     }
     msg.messID = S_NAME_TAKEN;
     msg.message = "NAME_TAKEN:";
+    return msg;
+}
+
+/*
+ * Function to parse the NAME_TAKEN: message from the server.
+ * Check's if the message sent by the server is valid or not
+ * and assigns the messID accordingly.
+ * @param input: The FILE * used to read from the server's socket.
+ * return's ServerMessage struct containing the information of the message
+ * recieved from the server.
+*/
+ServerMessage parse_name_taken_message_from_server(FILE *input) {
+    char *line = read_line(input);
+    ServerMessage msg = parse_name_taken_message_from_server_line(line);
     free(line);
     return msg;
 }
@@ -111,7 +182,7 @@ ServerMessage parse_name_taken_message_from_server(FILE *input) {
 */
 char *construct_message(char *name, char *message) {
     char *line = (char *) malloc(sizeof(char) * (strlen(name) + 
-            strlen(message)));
+            strlen(message) + strlen(": ") + 1));
     int j = 0;
     j = sprintf(line, "%s", name);
     j += sprintf(line + j, "%s", ":");
@@ -123,35 +194,51 @@ char *construct_message(char *name, char *message) {
  * Function to parse the MSG: message from the server.
  * Check's if the message sent by the server is valid or not
  * and assigns the messID accordingly.
- * @param input: The FILE * used to read from the server's socket.
+ * @param line: The rest of the line after the characters used to pick
+ *        the parser, or NULL at end of file.
  * return's ServerMessage struct containing the information of the message
  * recieved from the server.
 */
-ServerMessage parse_msg_message_from_server(FILE *input) {
+ServerMessage parse_msg_message_from_server_line(char *line) {
     ServerMessage msg;
-    char *line = read_line(input);
+    if (line == NULL) {
+        msg.message = 0;
+        msg.messID = S_INVALID;
+        return msg;
+    }
     if (strncmp(line, "SG:", 3) != 0) {
         msg.message = 0;
         msg.messID = S_INVALID;
-        free(line);
         return msg;
     }
     char *name = strtok(&line[strlen("SG:")], ":");
     if (name == NULL) {
         msg.message = 0;
         msg.messID = S_INVALID;
-        free(line);
         return msg;
     }
     char *message = strtok(&line[strlen("SG:") + strlen(name) + 1], "\0");
     if (message == NULL) {
         msg.message = 0;
         msg.messID = S_INVALID;
-        free(line);
         return msg;
     }
     msg.message = construct_message(name, message);
     msg.messID = S_MSG;
+    return msg;
+}
+
+/*
+ * Function to parse the MSG: message from the server.
+ * Check's if the message sent by the server is valid or not
+ * and assigns the messID accordingly.
+ * @param input: The FILE * used to read from the server's socket.
+ * return's ServerMessage struct containing the information of the message
+ * recieved from the server.
+*/
+ServerMessage parse_msg_message_from_server(FILE *input) {
+    char *line = read_line(input);
+    ServerMessage msg = parse_msg_message_from_server_line(line);
     free(line);
     return msg;
 }
@@ -160,75 +247,229 @@ ServerMessage parse_msg_message_from_server(FILE *input) {
  * Function to parse the LEAVE: message from the server.
  * Check's if the message sent by the server is valid or not
  * and assigns the messID accordingly.
- * @param input: The FILE * used to read from the server's socket.
+ * @param line: The rest of the line after the characters used to pick
+ *        the parser, or NULL at end of file.
  * return's ServerMessage struct containing the information of the message
  * recieved from the server.
 */
-ServerMessage parse_leave_message_from_server(FILE *input) {
+ServerMessage parse_leave_message_from_server_line(char *line) {
     ServerMessage msg;
-    char *line = read_line(input);
+    if (line == NULL) {
+        msg.message = 0;
+        msg.messID = S_INVALID;
+        return msg;
+    }
     if (strncmp(line, "AVE:", 4) != 0) {
         msg.message = 0;
         msg.messID = S_INVALID;
-        free(line);
         return msg;
     }
     char *name = strtok(&line[strlen("AVE:")], "\0");
     if (name == NULL) {
         msg.message = 0;
         msg.messID = S_INVALID;
-        free(line);
         return msg;
     }
     msg.messID = S_LEAVE;
-    msg.message = (char *) malloc(sizeof(char) * strlen(name));
+    msg.message = (char *) malloc(sizeof(char) * (strlen(name) + 1));
     strcpy(msg.message, name);
+    return msg;
+}
+
+/*
+ * Function to parse the LEAVE: message from the server.
+ * Check's if the message sent by the server is valid or not
+ * and assigns the messID accordingly.
+ * @param input: The FILE * used to read from the server's socket.
+ * return's ServerMessage struct containing the information of the message
+ * recieved from the server.
+*/
+ServerMessage parse_leave_message_from_server(FILE *input) {
+    char *line = read_line(input);
+    ServerMessage msg = parse_leave_message_from_server_line(line);
     free(line);
     return msg;
 }
 
+/*
+ * Function to parse the TOKEN: message from the server.
+ * Check's if the message sent by the server is valid or not
+ * and assigns the messID accordingly.
+ * @param line: The rest of the line after the characters used to pick
+ *        the parser, or NULL at end of file.
+ * return's ServerMessage struct containing the information of the message
+ * recieved from the server. The message is the resumption token.
+*/
+ServerMessage parse_token_message_from_server_line(char *line) {
+    ServerMessage msg;
+    if (line == NULL || strncmp(line, "OKEN:", 5) != 0 ||
+            line[strlen("OKEN:")] == '\0') {
+        msg.message = 0;
+        msg.messID = S_INVALID;
+        return msg;
+    }
+    char *token = &line[strlen("OKEN:")];
+    msg.messID = S_TOKEN;
+    msg.message = (char *) malloc(sizeof(char) * (strlen(token) + 1));
+    strcpy(msg.message, token);
+    return msg;
+}
+
 /*
  * Function to parse the KICK: message from the server.
  * Check's if the message sent by the server is valid or not
  * and assigns the messID accordingly.
- * @param input: The FILE * used to read from the server's socket.
+ * @param line: The rest of the line after the characters used to pick
+ *        the parser, or NULL at end of file.
  * return's ServerMessage struct containing the information of the message
  * recieved from the server.
 */
-ServerMessage parse_kick_message_from_server(FILE *input) {
+ServerMessage parse_kick_message_from_server_line(char *line) {
     ServerMessage msg;
-    char *line = read_line(input);
+    if (line == NULL) {
+        msg.message = 0;
+        msg.messID = S_INVALID;
+        return msg;
+    }
     if (strncmp(line, "ICK:", 4) != 0) {
         msg.message = 0;
         msg.messID = S_INVALID;
-        free(line);
         return msg;
     }
     msg.message = "KICK:";
     msg.messID = S_KICK;
+    return msg;
+}
+
+/*
+ * Function to parse the KICK: message from the server.
+ * Check's if the message sent by the server is valid or not
+ * and assigns the messID accordingly.
+ * @param input: The FILE * used to read from the server's socket.
+ * return's ServerMessage struct containing the information of the message
+ * recieved from the server.
+*/
+ServerMessage parse_kick_message_from_server(FILE *input) {
+    char *line = read_line(input);
+    ServerMessage msg = parse_kick_message_from_server_line(line);
     free(line);
     return msg;
 }
 
+/*
+ * Function to parse the PING: message from the server, which the client
+ * answers with PONG: to show it is still there.
+ * Check's if the message sent by the server is valid or not
+ * and assigns the messID accordingly.
+ * @param line: The rest of the line after the characters used to pick
+ *        the parser, or NULL at end of file.
+ * return's ServerMessage struct containing the information of the message
+ * recieved from the server.
+*/
+ServerMessage parse_ping_message_from_server_line(char *line) {
+    ServerMessage msg;
+    if (line == NULL || strncmp(line, "ING:", 4) != 0) {
+        msg.message = 0;
+        msg.messID = S_INVALID;
+        return msg;
+    }
+    msg.messID = S_PING;
+    msg.message = "PING:";
+    return msg;
+}
+
+/*
+ * Function to parse the FOUND: message from the server, one message found
+ * by a search.
+ * Check's if the message sent by the server is valid or not
+ * and assigns the messID accordingly.
+ * @param line: The rest of the line after the characters used to pick
+ *        the parser, or NULL at end of file.
+ * return's ServerMessage struct containing the information of the message
+ * recieved from the server. The message is shown like a MSG: one.
+*/
+ServerMessage parse_found_message_from_server_line(char *line) {
+    ServerMessage msg;
+    if (line == NULL || strncmp(line, "OUND:", 5) != 0) {
+        msg.message = 0;
+        msg.messID = S_INVALID;
+        return msg;
+    }
+    char *name = &line[strlen("OUND:")];
+    char *text = strchr(name, ':');
+    if (text == NULL || text == name) {
+        msg.message = 0;
+        msg.messID = S_INVALID;
+        return msg;
+    }
+    *text = '\0';
+    msg.message = construct_message(name, text + 1);
+    msg.messID = S_FOUND;
+    return msg;
+}
+
+/*
+ * Function to parse the SEARCHED: message from the server, sent after the
+ * messages a search found.
+ * Check's if the message sent by the server is valid or not
+ * and assigns the messID accordingly.
+ * @param line: The rest of the line after the characters used to pick
+ *        the parser, or NULL at end of file.
+ * return's ServerMessage struct containing the information of the message
+ * recieved from the server. The message is the number found.
+*/
+ServerMessage parse_searched_message_from_server_line(char *line) {
+    ServerMessage msg;
+    if (line == NULL || strncmp(line, "EARCHED:", 8) != 0 ||
+            line[strlen("EARCHED:")] == '\0') {
+        msg.message = 0;
+        msg.messID = S_INVALID;
+        return msg;
+    }
+    char *count = &line[strlen("EARCHED:")];
+    msg.messID = S_SEARCHED;
+    msg.message = (char *) malloc(sizeof(char) * (strlen(count) + 1));
+    strcpy(msg.message, count);
+    return msg;
+}
+
 /*
  * Function to parse the OK: message from the server.
  * Check's if the message sent by the server is valid or not
  * and assigns the messID accordingly.
- * @param input: The FILE * used to read from the server's socket.
+ * @param line: The rest of the line after the characters used to pick
+ *        the parser, or NULL at end of file.
  * return's ServerMessage struct containing the information of the message
  * recieved from the server.
 */
-ServerMessage parse_ok_message_from_server(FILE *input) {
+ServerMessage parse_ok_message_from_server_line(char *line) {
     ServerMessage msg;
-    char *line = read_line(input);
+    if (line == NULL) {
+        msg.message = 0;
+        msg.messID = S_INVALID;
+        return msg;
+    }
     if (strncmp(line, "K:", 2) != 0) {
         msg.message = 0;
         msg.messID = S_INVALID;
-        free(line);
         return msg;
     }
     msg.messID = S_OK;
     msg.message = "OK:";
+    return msg;
+}
+
+/*
+ * Function to parse the OK: message from the server.
+ * Check's if the message sent by the server is valid or not
+ * and assigns the messID accordingly.
+ * @param input: The FILE * used to read from the server's socket.
+ * return's ServerMessage struct containing the information of the message
+ * recieved from the server.
+*/
+ServerMessage parse_ok_message_from_server(FILE *input) {
+    char *line = read_line(input);
+    ServerMessage msg = parse_ok_message_from_server_line(line);
     free(line);
     return msg;
 }
@@ -237,33 +478,113 @@ ServerMessage parse_ok_message_from_server(FILE *input) {
  * Function to parse the LIST: message from the server.
  * Check's if the message sent by the server is valid or not
  * and assigns the messID accordingly.
- * @param input: The FILE * used to read from the server's socket.
+ * @param line: The rest of the line after the characters used to pick
+ *        the parser, or NULL at end of file.
  * return's ServerMessage struct containing the information of the message
  * recieved from the server.
 */
-ServerMessage parse_list_message_from_server(FILE *input) {
+ServerMessage parse_list_message_from_server_line(char *line) {
     ServerMessage msg;
-    char *line = read_line(input);
+    if (line == NULL) {
+        msg.message = 0;
+        msg.messID = S_INVALID;
+        return msg;
+    }
     if (strncmp(line, "ST:", 3) != 0) {
         msg.message = 0;
         msg.messID = S_INVALID;
-        free(line);
         return msg;
     }
     char *list = strtok(&line[strlen("ST:")], "\0");
     if (list == NULL) {
         msg.message = 0;
         msg.messID = S_INVALID;
-        free(line);
         return msg;
     }
     msg.messID = S_LIST;
-    msg.message = (char *) malloc(sizeof(char) * strlen(list));
+    msg.message = (char *) malloc(sizeof(char) * (strlen(list) + 1));
     strcpy(msg.message, list);
+    return msg;
+}
+
+/*
+ * Function to parse the LIST: message from the server.
+ * Check's if the message sent by the server is valid or not
+ * and assigns the messID accordingly.
+ * @param input: The FILE * used to read from the server's socket.
+ * return's ServerMessage struct containing the information of the message
+ * recieved from the server.
+*/
+ServerMessage parse_list_message_from_server(FILE *input) {
+    char *line = read_line(input);
+    ServerMessage msg = parse_list_message_from_server_line(line);
     free(line);
     return msg;
 }
 
+/*
+ * Function to parse a whole line sent by the server. The first character
+ * (two for LEAVE: and LIST:) picks the parser, like parse_server_messages()
+ * does in the client when reading from a FILE *.
+ * @param line: The complete line without its newline.
+ * return's ServerMessage struct containing the information of the message
+ * recieved from the server.
+*/
+ServerMessage parse_server_message_line(char *line) {
+    ServerMessage msg;
+    msg.message = NULL;
+    msg.messID = S_INVALID;
+    if (line == NULL) {
+        return msg;
+    }
+    switch (line[0]) {
+        case 'A':
+            msg = parse_auth_message_from_server_line(line + 1);
+            break;
+        case 'M':
+            msg = parse_msg_message_from_server_line(line + 1);
+            break;
+        case 'N':
+            msg = parse_name_taken_message_from_server_line(line + 1);
+            break;
+        case 'W':
+            msg = parse_who_message_from_server_line(line + 1);
+            break;
+        case 'E':
+            msg = parse_enter_message_from_server_line(line + 1);
+            break;
+        case 'L':
+            if (line[1] == 'E') {
+                msg = parse_leave_message_from_server_line(line + 2);
+            }
+            if (line[1] == 'I') {
+                msg = parse_list_message_from_server_line(line + 2);
+            }
+            break;
+        case 'K':
+            msg = parse_kick_message_from_server_line(line + 1);
+            break;
+        case 'O':
+            msg = parse_ok_message_from_server_line(line + 1);
+            break;
+        case 'T':
+            msg = parse_token_message_from_server_line(line + 1);
+            break;
+        case 'P':
+            msg = parse_ping_message_from_server_line(line + 1);
+            break;
+        case 'F':
+            msg = parse_found_message_from_server_line(line + 1);
+            break;
+        case 'S':
+            msg = parse_searched_message_from_server_line(line + 1);
+            break;
+        default:
+            break;
+    }
+    return msg;
+}
+
 /*
  * Function to parse the AUTH: message from the client.
  * Check's if the message and the auth string sent by the client is 
@@ -277,7 +598,6 @@ ClientMessage parse_auth_message(FILE *input, char *authString) {
     ClientMessage msg;
     memset(&msg, 0, sizeof(ClientMessage));
     char *line = read_line(input);
-    char *auth = (char *) malloc(sizeof(char) * strlen(authString));
     if (line == NULL) {
         msg.message = 0;
         msg.messID = C_INVALID;
@@ -290,10 +610,12 @@ ClientMessage parse_auth_message(FILE *input, char *authString) {
         free(line);
         return msg;
     }
+    char *auth = (char *) malloc(sizeof(char) * (strlen(line) + 1));
     int check = sscanf(line + strlen("UTH:"), "%s", auth);
-    if (check == 0) {
+    if (check != 1) {
         msg.message = 0;
         msg.messID = C_AUTH;
+        free(auth);
         free(line);
         return msg;
     }
@@ -335,7 +657,7 @@ ClientMessage parse_name_message(FILE *input) {
         free(line);
         return msg;
     }
-    msg.message = (char *) malloc(sizeof(char) * strlen(name));
+    msg.message = (char *) malloc(sizeof(char) * (strlen(name) + 1));
     strcpy(msg.message, name);
     msg.messID = C_NAME;
     free(line);
@@ -373,13 +695,48 @@ ClientMessage parse_say_message(FILE *input) {
         free(line);
         return msg;
     }
-    msg.message = (char *) malloc(sizeof(char) * strlen(chat));
+    msg.message = (char *) malloc(sizeof(char) * (strlen(chat) + 1));
     strcpy(msg.message, chat);
     msg.messID = C_SAY;
     free(line);
     return msg;
 }
 
+/*
+ * Function to parse the SAY: message from the client, reading at most
+ * limit characters of its text. If the text is longer more is set and the
+ * rest of the line is left to be read.
+ * Check's if the message sent by the client is valid or not 
+ * and assigns the messID accordingly.
+ * @param input: The FILE * used to read from the client's socket.
+ * @param limit: The most characters of text to read.
+ * return's ClientMessage struct containing the information of the message
+ * recieved from the client.
+*/
+ClientMessage parse_say_message_bounded(FILE *input, size_t limit) {
+    ClientMessage msg;
+    memset(&msg, 0, sizeof(ClientMessage));
+    char *line = read_line_bounded(input, limit + strlen("AY:"), &msg.more);
+    if (line == NULL || strncmp(line, "AY:", 3) != 0) {
+        if (msg.more) {
+            skip_line(input);
+        }
+        msg.more = false;
+        msg.message = 0;
+        msg.messID = C_INVALID;
+        free(line);
+        return msg;
+    }
+    msg.messID = C_SAY;
+    if (line[strlen("AY:")] != '\0') {
+        msg.message = (char *) malloc(sizeof(char) *
+                (strlen(line) - strlen("AY:") + 1));
+        strcpy(msg.message, &line[strlen("AY:")]);
+    }
+    free(line);
+    return msg;
+}
+
 /*
  * Function to parse the LIST: message from the client.
  * Check's if the message sent by the client is valid or not 
@@ -392,7 +749,7 @@ ClientMessage parse_list_message(FILE *input) {
     ClientMessage msg;
     memset(&msg, 0, sizeof(ClientMessage));
     char *line = read_line(input);
-    if (strncmp(line, "ST:", 3) != 0) {
+    if (line == NULL || strncmp(line, "ST:", 3) != 0) {
         msg.message = 0;
         msg.messID = C_INVALID;
         free(line);
@@ -416,7 +773,7 @@ ClientMessage parse_leave_message(FILE *input) {
     ClientMessage msg;
     memset(&msg, 0, sizeof(ClientMessage));
     char *line = read_line(input);
-    if (strncmp(line, "AVE:", 4) != 0) {
+    if (line == NULL || strncmp(line, "AVE:", 4) != 0) {
         msg.message = 0;
         msg.messID = C_INVALID;
         free(line);
@@ -440,7 +797,7 @@ ClientMessage parse_kick_message(FILE *input) {
     ClientMessage msg;
     memset(&msg, 0, sizeof(ClientMessage));
     char *line = read_line(input);
-    if (strncmp(line, "ICK:", 4) != 0) {
+    if (line == NULL || strncmp(line, "ICK:", 4) != 0) {
         msg.message = 0;
         msg.messID = C_INVALID;
         free(line);
@@ -454,12 +811,91 @@ ClientMessage parse_kick_message(FILE *input) {
         free(line);
         return msg;
     }
-    msg.message = (char *) malloc(sizeof(char) * strlen(name));
+    msg.message = (char *) malloc(sizeof(char) * (strlen(name) + 1));
     strcpy(msg.message, name);
     free(line);
     return msg;
 }
 
+/*
+ * Function to parse the RESUME: message from the client, sent in place of
+ * AUTH: by a client resuming its session.
+ * Check's if the message sent by the client is valid or not
+ * and assigns the messID accordingly.
+ * @param input: The FILE * used to read from the client's socket.
+ * return's ClientMessage struct containing the information of the message
+ * recieved from the client. The message is "token:frames".
+*/
+ClientMessage parse_resume_message(FILE *input) {
+    ClientMessage msg;
+    memset(&msg, 0, sizeof(ClientMessage));
+    char *line = read_line(input);
+    if (line == NULL || strncmp(line, "ESUME:", 6) != 0 ||
+            strchr(line, ':') == strrchr(line, ':')) {
+        msg.message = 0;
+        msg.messID = C_INVALID;
+        free(line);
+        return msg;
+    }
+    char *request = &line[strlen("ESUME:")];
+    msg.messID = C_RESUME;
+    msg.message = (char *) malloc(sizeof(char) * (strlen(request) + 1));
+    strcpy(msg.message, request);
+    free(line);
+    return msg;
+}
+
+/*
+ * Function to parse the PONG: message from the client, its answer to PING:.
+ * Check's if the message sent by the client is valid or not
+ * and assigns the messID accordingly.
+ * @param input: The FILE * used to read from the client's socket.
+ * return's ClientMessage struct containing the information of the message
+ * recieved from the client.
+*/
+ClientMessage parse_pong_message(FILE *input) {
+    ClientMessage msg;
+    memset(&msg, 0, sizeof(ClientMessage));
+    char *line = read_line(input);
+    if (line == NULL || strncmp(line, "ONG:", 4) != 0) {
+        msg.messID = C_INVALID;
+        free(line);
+        return msg;
+    }
+    msg.message = "PONG:";
+    msg.messID = C_PONG;
+    free(line);
+    return msg;
+}
+
+/*
+ * Function to parse the SEARCH: message from the client.
+ * Check's if the message sent by the client is valid or not
+ * and assigns the messID accordingly.
+ * @param input: The FILE * used to read from the client's socket.
+ * return's ClientMessage struct containing the information of the message
+ * recieved from the client. The message is the words searched for, NULL
+ * if there are none.
+*/
+ClientMessage parse_search_message(FILE *input) {
+    ClientMessage msg;
+    memset(&msg, 0, sizeof(ClientMessage));
+    char *line = read_line(input);
+    if (line == NULL || strncmp(line, "EARCH:", 6) != 0) {
+        msg.messID = C_INVALID;
+        free(line);
+        return msg;
+    }
+    msg.messID = C_SEARCH;
+    if (line[strlen("EARCH:")] != '\0') {
+        msg.message = (char *) malloc(sizeof(char) *
+                (strlen(line) - strlen("EARCH:") + 1));
+        strcpy(msg.message, &line[strlen("EARCH:")]);
+    }
+    free(line);
+    return msg;
+}
+
 /*
  * Function to send the AUTH: message to the connecting client.
  * @param output: The FILE * used to write to the client's socket.
@@ -562,6 +998,53 @@ void send_kick_message(FILE *output, char *message) {
     fflush(output);
 }
 
+/*
+ * Function to send the TOKEN: message to the client. The token lets the
+ * client resume its session if the connection drops.
+ * @param output: The FILE * used to write to the client's socket.
+ * @param token: The resumption token.
+ * return's nothing.
+*/
+void send_token_message(FILE *output, char *token) {
+    fprintf(output, "TOKEN:%s\n", token);
+    fflush(output);
+}
+
+/*
+ * Function to send the PING: message to an idle client.
+ * @param output: The FILE * used to write to the client's socket.
+ * @param message: The message sent to the client.
+ * return's nothing.
+*/
+void send_ping_message(FILE *output, char *message) {
+    fprintf(output, "%s\n", message);
+    fflush(output);
+}
+
+/*
+ * Function to send the FOUND: message, one message a search found, to the
+ * client. It isn't flushed, the SEARCHED: after the last one is.
+ * @param output: The FILE * used to write to the client's socket.
+ * @param name: Who said the message.
+ * @param text: The message.
+ * return's nothing.
+*/
+void send_found_message(FILE *output, char *name, char *text) {
+    fprintf(output, "FOUND:%s:%s\n", name, text);
+}
+
+/*
+ * Function to send the SEARCHED: message to the client once the messages
+ * a search found have been sent.
+ * @param output: The FILE * used to write to the client's socket.
+ * @param count: The number of messages found.
+ * return's nothing.
+*/
+void send_searched_message(FILE *output, int count) {
+    fprintf(output, "SEARCHED:%d\n", count);
+    fflush(output);
+}
+
 //Clients
 /*
  * Function to send the AUTH: message to the server.
@@ -607,3 +1090,16 @@ void send_input_as_client_message(char *message, FILE *output) {
     fprintf(output, "SAY:%s\n", message);
     fflush(output);
 }
+
+/*
+ * Function to send the RESUME: message to the server in place of AUTH:.
+ * @param output: The FILE * used to write to the server's socket.
+ * @param token: The resumption token given by the server.
+ * @param frames: The number of messages received since the token.
+ * return's nothing.
+*/
+void send_resume_message(FILE *output, char *token,
+        unsigned long long frames) {
+    fprintf(output, "RESUME:%s:%llu\n", token, frames);
+    fflush(output);
+}
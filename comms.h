@@ -15,6 +15,9 @@ typedef enum {
     C_KICK,
     C_LIST,
     C_LEAVE,
+    C_RESUME,
+    C_PONG,
+    C_SEARCH,
     C_INVALID
 } ClientID;
 
@@ -29,6 +32,10 @@ typedef enum {
     S_LIST,
     S_ENTER,
     S_LEAVE,
+    S_TOKEN,
+    S_PING,
+    S_FOUND,
+    S_SEARCHED,
     S_INVALID
 } ServerID;
 
@@ -36,6 +43,7 @@ typedef enum {
 typedef struct {
     ClientID messID; // the particular message id
     char *message; // the message sent by the client.
+    bool more; // a SAY: whose text was cut short, the rest is still unread.
 } ClientMessage;
 
 // struct to store the message info sent by the server. Used by the client.
@@ -56,15 +64,23 @@ void send_chat_message_to_clients(FILE *output, char *fmt, char *name,
 void send_leave_message(FILE *output, char *fmt, char *name);
 void send_list_to_client(FILE *output, char *list);
 void send_kick_message(FILE *output, char *message);
+void send_token_message(FILE *output, char *token);
+void send_ping_message(FILE *output, char *message);
+void send_found_message(FILE *output, char *name, char *text);
+void send_searched_message(FILE *output, int count);
 
 /* Function declarations of the functions used to parse messages from the
  * clients */
 ClientMessage parse_auth_message(FILE *input, char *authString);
 ClientMessage parse_name_message(FILE *input);
 ClientMessage parse_say_message(FILE *input);
+ClientMessage parse_say_message_bounded(FILE *input, size_t limit);
 ClientMessage parse_list_message(FILE *input);
 ClientMessage parse_leave_message(FILE *input);
 ClientMessage parse_kick_message(FILE *input);
+ClientMessage parse_resume_message(FILE *input);
+ClientMessage parse_pong_message(FILE *input);
+ClientMessage parse_search_message(FILE *input);
 
 /* Function declarations used to parse messages from the server */
 ServerMessage parse_who_message_from_server(FILE *input);
@@ -77,10 +93,28 @@ ServerMessage parse_kick_message_from_server(FILE *input);
 ServerMessage parse_ok_message_from_server(FILE *input);
 ServerMessage parse_name_taken_message_from_server(FILE *input);
 
+/* Function declarations used to parse a line already read from the server */
+ServerMessage parse_server_message_line(char *line);
+ServerMessage parse_who_message_from_server_line(char *line);
+ServerMessage parse_auth_message_from_server_line(char *line);
+ServerMessage parse_enter_message_from_server_line(char *line);
+ServerMessage parse_leave_message_from_server_line(char *line);
+ServerMessage parse_list_message_from_server_line(char *line);
+ServerMessage parse_msg_message_from_server_line(char *line);
+ServerMessage parse_kick_message_from_server_line(char *line);
+ServerMessage parse_ok_message_from_server_line(char *line);
+ServerMessage parse_name_taken_message_from_server_line(char *line);
+ServerMessage parse_token_message_from_server_line(char *line);
+ServerMessage parse_ping_message_from_server_line(char *line);
+ServerMessage parse_found_message_from_server_line(char *line);
+ServerMessage parse_searched_message_from_server_line(char *line);
+
 /* Function Declarations used to send messages to the server */
 void send_auth_string(FILE *output, char *authString);
 void send_client_name(FILE *output, char *fmt, char *name);
 void send_client_command_to_server(char *command, FILE *output);
 void send_input_as_client_message(char *message, FILE *output);
+void send_resume_message(FILE *output, char *token,
+        unsigned long long frames);
 
 #endif //ass4_comms_h
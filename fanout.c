@@ -0,0 +1,109 @@
+#include "fanout.h"
+
+/*
+ * Function run by each worker of a fan-out pool. It takes its tasks in
+ * order and runs the partitions it owns of each job.
+ *
+ * @param workerInfo: The worker.
+ *
+ * return's NULL.
+*/
+static void *run_fanout_worker(void *workerInfo) {
+    FanoutWorker *worker = (FanoutWorker *) workerInfo;
+    while (1) {
+        pthread_mutex_lock(&worker->lock);
+        while (worker->head == NULL) {
+            pthread_cond_wait(&worker->ready, &worker->lock);
+        }
+        FanoutTask *task = worker->head;
+        worker->head = task->next;
+        if (worker->head == NULL) {
+            worker->tail = NULL;
+        }
+        pthread_mutex_unlock(&worker->lock);
+        FanoutJob *job = task->job;
+        for (int p = worker->index; p < worker->partitions;
+                p += worker->threads) {
+            job->work(job->context, p);
+        }
+        pthread_mutex_lock(&job->lock);
+        if (--job->pending == 0) {
+            pthread_cond_signal(&job->finished);
+        }
+        pthread_mutex_unlock(&job->lock);
+    }
+    return NULL;
+}
+
+/*
+ * Function to create a fan-out pool and start its threads.
+ *
+ * @param threads: The number of workers, at most partitions are used.
+ *
+ * @param partitions: The number of partitions every job is split into.
+ *
+ * return's the pool.
+*/
+FanoutPool *fanout_start(int threads, int partitions) {
+    FanoutPool *pool = (FanoutPool *) malloc(sizeof(FanoutPool));
+    pool->threads = threads < partitions ? threads : partitions;
+    pool->partitions = partitions;
+    pool->workers = (FanoutWorker *) calloc(pool->threads,
+            sizeof(FanoutWorker));
+    for (int i = 0; i < pool->threads; ++i) {
+        FanoutWorker *worker = &pool->workers[i];
+        worker->index = i;
+        worker->threads = pool->threads;
+        worker->partitions = partitions;
+        pthread_mutex_init(&worker->lock, NULL);
+        pthread_cond_init(&worker->ready, NULL);
+        pthread_create(&worker->thread, NULL, run_fanout_worker,
+                (void *) worker);
+        pthread_detach(worker->thread);
+    }
+    return pool;
+}
+
+/*
+ * Function to run every partition of a job on the pool, returning once
+ * all of them are done. Jobs queued by different threads are run by each
+ * worker in the order they were queued.
+ *
+ * @param pool: The fan-out pool.
+ *
+ * @param work: Called once for each partition.
+ *
+ * @param context: Passed to work.
+ *
+ * return's nothing.
+*/
+void fanout_run(FanoutPool *pool, FanoutWork work, void *context) {
+    FanoutJob job;
+    FanoutTask tasks[pool->threads];
+    job.work = work;
+    job.context = context;
+    job.pending = pool->threads;
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_cond_init(&job.finished, NULL);
+    for (int i = 0; i < pool->threads; ++i) {
+        FanoutWorker *worker = &pool->workers[i];
+        tasks[i].next = NULL;
+        tasks[i].job = &job;
+        pthread_mutex_lock(&worker->lock);
+        if (worker->tail != NULL) {
+            worker->tail->next = &tasks[i];
+        } else {
+            worker->head = &tasks[i];
+        }
+        worker->tail = &tasks[i];
+        pthread_cond_signal(&worker->ready);
+        pthread_mutex_unlock(&worker->lock);
+    }
+    pthread_mutex_lock(&job.lock);
+    while (job.pending > 0) {
+        pthread_cond_wait(&job.finished, &job.lock);
+    }
+    pthread_mutex_unlock(&job.lock);
+    pthread_mutex_destroy(&job.lock);
+    pthread_cond_destroy(&job.finished);
+}
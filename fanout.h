@@ -0,0 +1,51 @@
+#ifndef FANOUT_H
+#define FANOUT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+// Called on a worker of the pool for one partition of a job.
+typedef void (*FanoutWork)(void *context, int partition);
+
+// A job spread over the pool, on the stack of the thread waiting for it.
+typedef struct {
+    FanoutWork work;
+    void *context;
+    int pending; // workers not yet done with their partitions.
+    pthread_mutex_t lock;
+    pthread_cond_t finished;
+} FanoutJob;
+
+// A job as queued on one worker.
+typedef struct FanoutTask {
+    struct FanoutTask *next;
+    FanoutJob *job;
+} FanoutTask;
+
+// A thread of the pool. Worker w runs every partition p with
+// p % threads == w, so a partition is always handled by the same thread.
+typedef struct {
+    int index;
+    int threads; // workers in the pool.
+    int partitions;
+    FanoutTask *head; // tasks waiting, oldest first.
+    FanoutTask *tail;
+    pthread_mutex_t lock;
+    pthread_cond_t ready; // signalled when a task is queued.
+    pthread_t thread;
+} FanoutWorker;
+
+// A fixed pool of threads that runs the partitions of a job in parallel.
+typedef struct {
+    int threads;
+    int partitions;
+    FanoutWorker *workers;
+} FanoutPool;
+
+FanoutPool *fanout_start(int threads, int partitions);
+void fanout_run(FanoutPool *pool, FanoutWork work, void *context);
+
+#endif //ass4_fanout_h
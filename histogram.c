@@ -0,0 +1,171 @@
+#include "histogram.h"
+
+/*
+ * Function to get the bucket a value is recorded in.
+ * Values below HIST_SUB_COUNT get a bucket each, larger values share a
+ * bucket with the values that have the same top HIST_SUB_BITS + 1 bits.
+ *
+ * @param value: The value to be recorded.
+ *
+ * return's the index of the bucket.
+*/
+static int get_bucket_index(uint64_t value) {
+    if (value < HIST_SUB_COUNT) {
+        return (int) value;
+    }
+    int msb = 63 - __builtin_clzll(value);
+    int shift = msb - HIST_SUB_BITS;
+    return (shift + 1) * HIST_SUB_COUNT +
+            (int) ((value >> shift) - HIST_SUB_COUNT);
+}
+
+/*
+ * Function to get the highest value that falls into a bucket.
+ *
+ * @param index: The index of the bucket.
+ *
+ * return's the highest value of that bucket.
+*/
+static uint64_t get_bucket_value(int index) {
+    int group = index / HIST_SUB_COUNT;
+    uint64_t sub = index % HIST_SUB_COUNT;
+    if (group == 0) {
+        return sub;
+    }
+    int shift = group - 1;
+    return (((sub + HIST_SUB_COUNT) << shift) + ((1ULL << shift) - 1));
+}
+
+/*
+ * Function to record a value into the histogram. Safe to call from many
+ * threads at once.
+ *
+ * @param hist: The histogram to record into.
+ *
+ * @param value: The value (usually nanoseconds) to record.
+ *
+ * return's nothing.
+*/
+void histogram_record(Histogram *hist, uint64_t value) {
+    __atomic_fetch_add(&hist->counts[get_bucket_index(value)], 1,
+            __ATOMIC_RELAXED);
+    __atomic_fetch_add(&hist->total, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&hist->sum, value, __ATOMIC_RELAXED);
+    uint64_t max = __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+    while (value > max && !__atomic_compare_exchange_n(&hist->max, &max,
+            value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+/*
+ * Function to clear all the values recorded in a histogram.
+ *
+ * @param hist: The histogram to reset.
+ *
+ * return's nothing.
+*/
+void histogram_reset(Histogram *hist) {
+    for (int i = 0; i < HIST_BUCKETS; ++i) {
+        __atomic_store_n(&hist->counts[i], 0, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&hist->total, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&hist->sum, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&hist->max, 0, __ATOMIC_RELAXED);
+}
+
+/*
+ * Function to add all the values of one histogram into another.
+ *
+ * @param dest: The histogram which receives the values.
+ *
+ * @param src: The histogram whose values are added.
+ *
+ * return's nothing.
+*/
+void histogram_merge(Histogram *dest, Histogram *src) {
+    for (int i = 0; i < HIST_BUCKETS; ++i) {
+        uint64_t count = __atomic_load_n(&src->counts[i], __ATOMIC_RELAXED);
+        if (count) {
+            __atomic_fetch_add(&dest->counts[i], count, __ATOMIC_RELAXED);
+        }
+    }
+    __atomic_fetch_add(&dest->total, histogram_count(src), __ATOMIC_RELAXED);
+    __atomic_fetch_add(&dest->sum,
+            __atomic_load_n(&src->sum, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    uint64_t max = histogram_max(src);
+    uint64_t current = __atomic_load_n(&dest->max, __ATOMIC_RELAXED);
+    while (max > current && !__atomic_compare_exchange_n(&dest->max,
+            &current, max, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+/*
+ * Function to get the number of values recorded.
+ *
+ * @param hist: The histogram.
+ *
+ * return's the number of values.
+*/
+uint64_t histogram_count(Histogram *hist) {
+    return __atomic_load_n(&hist->total, __ATOMIC_RELAXED);
+}
+
+/*
+ * Function to get the mean of the values recorded.
+ *
+ * @param hist: The histogram.
+ *
+ * return's the mean or 0 if the histogram is empty.
+*/
+uint64_t histogram_mean(Histogram *hist) {
+    uint64_t total = histogram_count(hist);
+    if (total == 0) {
+        return 0;
+    }
+    return __atomic_load_n(&hist->sum, __ATOMIC_RELAXED) / total;
+}
+
+/*
+ * Function to get the largest value recorded.
+ *
+ * @param hist: The histogram.
+ *
+ * return's the largest value.
+*/
+uint64_t histogram_max(Histogram *hist) {
+    return __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+}
+
+/*
+ * Function to get the value at a given percentile. The value returned is the
+ * upper edge of the bucket the percentile falls into, capped at the max.
+ *
+ * @param hist: The histogram.
+ *
+ * @param percentile: The percentile wanted, from 0 to 100.
+ *
+ * return's the value at that percentile or 0 if the histogram is empty.
+*/
+uint64_t histogram_percentile(Histogram *hist, double percentile) {
+    uint64_t total = 0;
+    for (int i = 0; i < HIST_BUCKETS; ++i) {
+        total += __atomic_load_n(&hist->counts[i], __ATOMIC_RELAXED);
+    }
+    if (total == 0) {
+        return 0;
+    }
+    uint64_t wanted = (uint64_t) ((percentile / 100.0) * total + 0.5);
+    if (wanted == 0) {
+        wanted = 1;
+    }
+    uint64_t seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; ++i) {
+        seen += __atomic_load_n(&hist->counts[i], __ATOMIC_RELAXED);
+        if (seen >= wanted) {
+            uint64_t value = get_bucket_value(i);
+            uint64_t max = histogram_max(hist);
+            return value > max ? max : value;
+        }
+    }
+    return histogram_max(hist);
+}
@@ -0,0 +1,31 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Number of bits of precision kept below the most significant bit.
+// 5 bits gives 32 sub-buckets per power of two (about 3% error).
+#define HIST_SUB_BITS 5
+#define HIST_SUB_COUNT (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_SUB_COUNT)
+
+// HDR-style log/linear histogram of nanosecond values. Every field is
+// updated with atomic operations so many threads can record into the same
+// histogram without taking a lock.
+typedef struct {
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t total;
+    uint64_t sum;
+    uint64_t max;
+} Histogram;
+
+void histogram_record(Histogram *hist, uint64_t value);
+void histogram_reset(Histogram *hist);
+void histogram_merge(Histogram *dest, Histogram *src);
+uint64_t histogram_count(Histogram *hist);
+uint64_t histogram_mean(Histogram *hist);
+uint64_t histogram_max(Histogram *hist);
+uint64_t histogram_percentile(Histogram *hist, double percentile);
+
+#endif //ass4_histogram_h
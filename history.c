@@ -0,0 +1,429 @@
+#include "history.h"
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+
+// Part of a segment a replay sends, with its own descriptor so the segment
+// can be deleted while the replay runs.
+typedef struct {
+    int fd;
+    off_t start;
+    off_t end;
+} HistoryRange;
+
+/*
+ * Function to open a segment file.
+ *
+ * @param log: The history log.
+ *
+ * @param number: The segment's number.
+ *
+ * @param create: If the file is created when it doesn't exist.
+ *
+ * return's the file descriptor, -1 if it couldn't be opened.
+*/
+static int open_segment(HistoryLog *log, uint64_t number, bool create) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), HISTORY_SEGMENT_NAME, log->directory,
+            (unsigned long long) number);
+    return open(path, create ? O_RDWR | O_CREAT : O_RDWR, 0644);
+}
+
+/*
+ * Function to note where a record starts, so a replay knows where the last
+ * records begin. Must be called with the log's lock held.
+ *
+ * @param log: The history log.
+ *
+ * @param segment: The segment the record is in.
+ *
+ * @param offset: Where in the segment it starts.
+ *
+ * return's nothing.
+*/
+static void mark_record(HistoryLog *log, uint64_t segment, off_t offset) {
+    if (log->replay > 0) {
+        log->marks[log->records % log->replay].segment = segment;
+        log->marks[log->records % log->replay].offset = offset;
+    }
+    log->records++;
+}
+
+/*
+ * Function to close the oldest segment and delete its file. A replay still
+ * sending from it holds its own descriptor. Must be called with the log's
+ * lock held.
+ *
+ * @param log: The history log.
+ *
+ * return's nothing.
+*/
+static void drop_oldest_segment(HistoryLog *log) {
+    HistorySegment *segment = &log->segments[log->firstSegment %
+            HISTORY_SEGMENTS];
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), HISTORY_SEGMENT_NAME, log->directory,
+            (unsigned long long) log->firstSegment);
+    if (segment->fd >= 0) {
+        close(segment->fd);
+    }
+    unlink(path);
+    segment->fd = -1;
+    segment->size = 0;
+    log->firstSegment++;
+}
+
+/*
+ * Function to start writing to a new segment, dropping the oldest one if
+ * more than HISTORY_SEGMENTS would be kept. Must be called with the log's
+ * lock held.
+ *
+ * @param log: The history log.
+ *
+ * return's nothing.
+*/
+static void start_segment(HistoryLog *log) {
+    log->lastSegment++;
+    while (log->lastSegment - log->firstSegment >= HISTORY_SEGMENTS) {
+        drop_oldest_segment(log);
+    }
+    HistorySegment *segment = &log->segments[log->lastSegment %
+            HISTORY_SEGMENTS];
+    segment->fd = open_segment(log, log->lastSegment, true);
+    segment->size = 0;
+    if (segment->fd >= 0 && ftruncate(segment->fd, 0) != 0) {
+        close(segment->fd);
+        segment->fd = -1;
+    }
+}
+
+/*
+ * Function to mark the records of a segment left by an earlier run. Bytes
+ * after the last newline, from a record cut short, are cut off the file.
+ *
+ * @param log: The history log.
+ *
+ * @param number: The segment's number.
+ *
+ * return's nothing.
+*/
+static void scan_segment(HistoryLog *log, uint64_t number) {
+    HistorySegment *segment = &log->segments[number % HISTORY_SEGMENTS];
+    segment->fd = open_segment(log, number, false);
+    segment->size = 0;
+    if (segment->fd < 0) {
+        return;
+    }
+    char *chunk = (char *) malloc(HISTORY_CHUNK);
+    off_t offset = 0, recordStart = 0;
+    ssize_t count;
+    while ((count = pread(segment->fd, chunk, HISTORY_CHUNK, offset)) > 0) {
+        for (ssize_t i = 0; i < count; ++i) {
+            if (chunk[i] == '\n') {
+                mark_record(log, number, recordStart);
+                recordStart = offset + i + 1;
+            }
+        }
+        offset += count;
+    }
+    free(chunk);
+    if (offset > recordStart && ftruncate(segment->fd, recordStart) != 0) {
+        recordStart = 0; // nothing of it is trusted.
+    }
+    segment->size = recordStart;
+}
+
+/*
+ * Function to find the oldest and newest segment files in the history
+ * directory.
+ *
+ * @param directory: The history directory.
+ *
+ * @param first: Set to the oldest segment's number.
+ *
+ * @param last: Set to the newest segment's number.
+ *
+ * return's a bool indicating if there are any segments.
+*/
+static bool find_segments(const char *directory, uint64_t *first,
+        uint64_t *last) {
+    DIR *dir = opendir(directory);
+    if (dir == NULL) {
+        return false;
+    }
+    bool found = false;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        unsigned long long number;
+        int length = 0;
+        if (sscanf(entry->d_name, "%llu.log%n", &number, &length) != 1 ||
+                length == 0 || entry->d_name[length] != '\0' ||
+                number == 0) {
+            continue;
+        }
+        if (!found || number < *first) {
+            *first = number;
+        }
+        if (!found || number > *last) {
+            *last = number;
+        }
+        found = true;
+    }
+    closedir(dir);
+    return found;
+}
+
+/*
+ * Function to open the history kept in a directory, creating the directory
+ * if needed. The records of segments left by an earlier run can be
+ * replayed, new records go to a new segment.
+ *
+ * @param directory: The history directory.
+ *
+ * @param replay: The most records replayed to a client.
+ *
+ * return's the history log, NULL if no segment could be written.
+*/
+HistoryLog *history_open(const char *directory, size_t replay) {
+    if (mkdir(directory, 0755) != 0 && errno != EEXIST) {
+        return NULL;
+    }
+    HistoryLog *log = (HistoryLog *) calloc(1, sizeof(HistoryLog));
+    log->directory = strdup(directory);
+    log->replay = replay;
+    log->marks = (HistoryMark *) calloc(replay ? replay : 1,
+            sizeof(HistoryMark));
+    for (int i = 0; i < HISTORY_SEGMENTS; ++i) {
+        log->segments[i].fd = -1;
+    }
+    uint64_t first, last;
+    if (find_segments(directory, &first, &last)) {
+        while (last - first >= HISTORY_SEGMENTS) {
+            log->firstSegment = first++;
+            drop_oldest_segment(log);
+        }
+        for (uint64_t number = first; number <= last; ++number) {
+            scan_segment(log, number);
+        }
+        log->firstSegment = first;
+        log->lastSegment = last;
+    } else {
+        log->firstSegment = 1;
+        log->lastSegment = 0;
+    }
+    start_segment(log);
+    if (log->segments[log->lastSegment % HISTORY_SEGMENTS].fd < 0) {
+        for (int i = 0; i < HISTORY_SEGMENTS; ++i) {
+            if (log->segments[i].fd >= 0) {
+                close(log->segments[i].fd);
+            }
+        }
+        free(log->marks);
+        free(log->directory);
+        free(log);
+        return NULL;
+    }
+    pthread_mutex_init(&log->lock, NULL);
+    return log;
+}
+
+/*
+ * Function to add a record to the end of the log, starting a new segment
+ * if it would take the one written to past HISTORY_SEGMENT_BYTES.
+ *
+ * @param log: The history log.
+ *
+ * @param record: The record, a line as it is sent to clients.
+ *
+ * @param length: The length of the record, its newline included.
+ *
+ * return's the number of the record, or if it couldn't be written the
+ * number the next record will get.
+*/
+uint64_t history_append(HistoryLog *log, const char *record,
+        size_t length) {
+    pthread_mutex_lock(&log->lock);
+    HistorySegment *segment = &log->segments[log->lastSegment %
+            HISTORY_SEGMENTS];
+    if (segment->size > 0 &&
+            segment->size + (off_t) length > HISTORY_SEGMENT_BYTES) {
+        start_segment(log);
+        segment = &log->segments[log->lastSegment % HISTORY_SEGMENTS];
+    }
+    size_t done = 0;
+    while (segment->fd >= 0 && done < length) {
+        ssize_t count = pwrite(segment->fd, record + done, length - done,
+                segment->size + done);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            break;
+        }
+        done += count;
+    }
+    if (done == length) {
+        mark_record(log, log->lastSegment, segment->size);
+        segment->size += length;
+        log->written++;
+    } else {
+        // What was written is past the segment's size, so it is never
+        // replayed and the next record is written over it.
+        log->failed++;
+    }
+    uint64_t number = done == length ? log->records - 1 : log->records;
+    pthread_mutex_unlock(&log->lock);
+    return number;
+}
+
+/*
+ * Function to send part of a segment straight from the file to a socket.
+ *
+ * @param range: The part of the segment.
+ *
+ * @param socket: The socket.
+ *
+ * return's the number of bytes sent.
+*/
+static uint64_t send_range(HistoryRange *range, int socket) {
+    off_t offset = range->start;
+    while (offset < range->end) {
+        ssize_t count = sendfile(socket, range->fd, &offset,
+                range->end - offset);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            break;
+        }
+    }
+    return offset - range->start;
+}
+
+/*
+ * Function to copy part of a segment to a stream, for connections whose
+ * stream doesn't write to a socket.
+ *
+ * @param range: The part of the segment.
+ *
+ * @param stream: The stream.
+ *
+ * return's the number of bytes copied.
+*/
+static uint64_t copy_range(HistoryRange *range, FILE *stream) {
+    char *chunk = (char *) malloc(HISTORY_CHUNK);
+    off_t offset = range->start;
+    while (offset < range->end) {
+        size_t want = range->end - offset < HISTORY_CHUNK ?
+                range->end - offset : HISTORY_CHUNK;
+        ssize_t count = pread(range->fd, chunk, want, offset);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0 || fwrite(chunk, 1, count, stream) != (size_t) count) {
+            break;
+        }
+        offset += count;
+    }
+    free(chunk);
+    fflush(stream);
+    return offset - range->start;
+}
+
+/*
+ * Function to replay the last records of the log to a client. The parts
+ * of the segments to send are picked with the log locked, then sent with
+ * it unlocked so records can be added meanwhile.
+ *
+ * @param log: The history log.
+ *
+ * @param socket: The client's socket, anything buffered for it must have
+ *                been flushed.
+ *
+ * @param stream: If not NULL the records are written to this stream in
+ *                place of being sent on the socket.
+ *
+ * @param picked: If not NULL called with the log still locked once the
+ *                records are picked, with the number of the first record
+ *                not replayed.
+ *
+ * @param context: Passed to picked.
+ *
+ * return's the number of bytes replayed.
+*/
+uint64_t history_replay(HistoryLog *log, int socket, FILE *stream,
+        void (*picked)(void *context, uint64_t end), void *context) {
+    HistoryRange ranges[HISTORY_SEGMENTS];
+    int count = 0;
+    pthread_mutex_lock(&log->lock);
+    uint64_t records = log->records < log->replay ? log->records :
+            log->replay;
+    if (picked != NULL) {
+        picked(context, log->records);
+    }
+    if (records == 0) {
+        pthread_mutex_unlock(&log->lock);
+        return 0;
+    }
+    HistoryMark start = log->marks[(log->records - records) % log->replay];
+    if (start.segment < log->firstSegment) {
+        start.segment = log->firstSegment;
+        start.offset = 0;
+    }
+    for (uint64_t number = start.segment; number <= log->lastSegment;
+            ++number) {
+        HistorySegment *segment = &log->segments[number % HISTORY_SEGMENTS];
+        off_t from = number == start.segment ? start.offset : 0;
+        if (segment->fd < 0 || segment->size <= from) {
+            continue;
+        }
+        ranges[count].fd = dup(segment->fd);
+        ranges[count].start = from;
+        ranges[count].end = segment->size;
+        if (ranges[count].fd >= 0) {
+            count++;
+        }
+    }
+    log->replays++;
+    pthread_mutex_unlock(&log->lock);
+    uint64_t total = 0;
+    for (int i = 0; i < count; ++i) {
+        total += stream != NULL ? copy_range(&ranges[i], stream) :
+                send_range(&ranges[i], socket);
+        close(ranges[i].fd);
+    }
+    __atomic_fetch_add(stream != NULL ? &log->copiedBytes : &log->sentBytes,
+            total, __ATOMIC_RELAXED);
+    return total;
+}
+
+/*
+ * Function to print what the log holds and how it has been replayed: the
+ * records written and failed since start up, the segments kept, the
+ * replays made and the bytes sent by sendfile() and copied through
+ * streams.
+ *
+ * @param log: The history log.
+ *
+ * @param output: Where the stats are printed.
+ *
+ * return's nothing.
+*/
+void history_print_stats(HistoryLog *log, FILE *output) {
+    pthread_mutex_lock(&log->lock);
+    fprintf(output, "RECORDS:%llu:FAILED:%llu:SEGMENTS:%llu:REPLAYS:%llu:"
+            "SENT:%llu:COPIED:%llu\n", (unsigned long long) log->written,
+            (unsigned long long) log->failed,
+            (unsigned long long) (log->lastSegment - log->firstSegment + 1),
+            (unsigned long long) log->replays,
+            (unsigned long long) __atomic_load_n(&log->sentBytes,
+            __ATOMIC_RELAXED),
+            (unsigned long long) __atomic_load_n(&log->copiedBytes,
+            __ATOMIC_RELAXED));
+    pthread_mutex_unlock(&log->lock);
+    fflush(output);
+}
@@ -0,0 +1,64 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+// A segment is closed and a new one started once a record would take it
+// past this many bytes.
+#define HISTORY_SEGMENT_BYTES (1024 * 1024)
+// Segments kept, the oldest file is deleted when another is started.
+#define HISTORY_SEGMENTS 8
+// Name of a segment file in the history directory, by segment number.
+#define HISTORY_SEGMENT_NAME "%s/%016llu.log"
+// Largest piece of a segment read at a time when it is scanned or copied.
+#define HISTORY_CHUNK 65536
+
+// One file of the log.
+typedef struct {
+    int fd; // -1 if the segment isn't kept.
+    off_t size; // bytes of whole records in it.
+} HistorySegment;
+
+// Where a record starts.
+typedef struct {
+    uint64_t segment;
+    off_t offset;
+} HistoryMark;
+
+// Chat messages kept on disk as the MSG: lines clients are sent, in
+// numbered segment files. Segment n is kept in segments[n %
+// HISTORY_SEGMENTS].
+typedef struct {
+    char *directory;
+    HistorySegment segments[HISTORY_SEGMENTS];
+    uint64_t firstSegment; // oldest segment kept.
+    uint64_t lastSegment; // the segment written to.
+    HistoryMark *marks; // record n starts at marks[n % replay].
+    size_t replay; // most records replayed to a client.
+    uint64_t records; // records marked, those found at start up included.
+    uint64_t written; // records written since start up.
+    uint64_t failed; // records that couldn't be written.
+    uint64_t replays;
+    uint64_t sentBytes; // replayed by sendfile().
+    uint64_t copiedBytes; // replayed through a stream.
+    pthread_mutex_t lock;
+} HistoryLog;
+
+HistoryLog *history_open(const char *directory, size_t replay);
+uint64_t history_append(HistoryLog *log, const char *record,
+        size_t length);
+uint64_t history_replay(HistoryLog *log, int socket, FILE *stream,
+        void (*picked)(void *context, uint64_t end), void *context);
+void history_print_stats(HistoryLog *log, FILE *output);
+
+#endif //ass4_history_h
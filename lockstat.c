@@ -0,0 +1,159 @@
+#include "lockstat.h"
+#include "shared.h"
+
+// Every site that has taken a lock, newest first.
+static LockSite *lockSites = NULL;
+
+// A lock held by this thread, with where and when it was taken.
+typedef struct {
+    pthread_mutex_t *mutex;
+    LockSite *site;
+    uint64_t since;
+} HeldLock;
+
+static __thread HeldLock heldLocks[LOCK_STATS_DEPTH];
+static __thread int heldCount = 0;
+
+/*
+ * Function to add a site to the list of sites the first time it takes its
+ * lock.
+ *
+ * @param site: The site.
+ *
+ * return's nothing.
+*/
+static void add_lock_site(LockSite *site) {
+    int unseen = 0;
+    if (!__atomic_compare_exchange_n(&site->seen, &unseen, 1, false,
+            __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+        return;
+    }
+    LockSite *head = __atomic_load_n(&lockSites, __ATOMIC_ACQUIRE);
+    do {
+        site->next = head;
+    } while (!__atomic_compare_exchange_n(&lockSites, &head, site, true,
+            __ATOMIC_RELEASE, __ATOMIC_ACQUIRE));
+}
+
+/*
+ * Function to note that this thread now holds a lock.
+ *
+ * @param site: Where the lock was taken.
+ *
+ * @param mutex: The lock.
+ *
+ * return's nothing.
+*/
+static void push_held_lock(LockSite *site, pthread_mutex_t *mutex) {
+    if (heldCount < LOCK_STATS_DEPTH) {
+        heldLocks[heldCount].mutex = mutex;
+        heldLocks[heldCount].site = site;
+        heldLocks[heldCount].since = get_time_ns();
+        heldCount++;
+    }
+}
+
+/*
+ * Function to note that this thread no longer holds a lock, recording how
+ * long it was held against the site that took it.
+ *
+ * @param mutex: The lock.
+ *
+ * return's the site the lock was taken at, NULL if it wasn't tracked.
+*/
+static LockSite *pop_held_lock(pthread_mutex_t *mutex) {
+    for (int i = heldCount - 1; i >= 0; --i) {
+        if (heldLocks[i].mutex != mutex) {
+            continue;
+        }
+        LockSite *site = heldLocks[i].site;
+        uint64_t held = get_time_ns() - heldLocks[i].since;
+        uint64_t most = __atomic_load_n(&site->maxHold, __ATOMIC_RELAXED);
+        while (held > most && !__atomic_compare_exchange_n(&site->maxHold,
+                &most, held, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            continue;
+        }
+        heldLocks[i] = heldLocks[--heldCount];
+        return site;
+    }
+    return NULL;
+}
+
+/*
+ * Function to take a lock, counting the acquisition against its site and
+ * timing the wait if the lock was held.
+ *
+ * @param site: Where the lock is taken.
+ *
+ * @param mutex: The lock.
+ *
+ * return's nothing.
+*/
+void lock_site_acquire(LockSite *site, pthread_mutex_t *mutex) {
+    add_lock_site(site);
+    if (pthread_mutex_trylock(mutex) != 0) {
+        uint64_t start = get_time_ns();
+        pthread_mutex_lock(mutex);
+        __atomic_fetch_add(&site->contended, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&site->waited, get_time_ns() - start,
+                __ATOMIC_RELAXED);
+    }
+    __atomic_fetch_add(&site->acquired, 1, __ATOMIC_RELAXED);
+    push_held_lock(site, mutex);
+}
+
+/*
+ * Function to give up a lock taken with lock_site_acquire().
+ *
+ * @param mutex: The lock.
+ *
+ * return's nothing.
+*/
+void lock_site_release(pthread_mutex_t *mutex) {
+    pop_held_lock(mutex);
+    pthread_mutex_unlock(mutex);
+}
+
+/*
+ * Function to wait on a condition. The time spent waiting doesn't count
+ * towards the lock's hold time.
+ *
+ * @param cond: The condition.
+ *
+ * @param mutex: The lock, taken with lock_site_acquire().
+ *
+ * return's nothing.
+*/
+void lock_site_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex) {
+    LockSite *site = pop_held_lock(mutex);
+    pthread_cond_wait(cond, mutex);
+    if (site != NULL) {
+        push_held_lock(site, mutex);
+    }
+}
+
+/*
+ * Function to print what every site has spent on its lock, one line per
+ * site: acquisitions, contended acquisitions, the total wait and the
+ * longest hold, both in microseconds.
+ *
+ * @param output: Where the stats are printed.
+ *
+ * return's nothing.
+*/
+void lock_stats_print(FILE *output) {
+    LockSite *site = __atomic_load_n(&lockSites, __ATOMIC_ACQUIRE);
+    for (; site != NULL; site = site->next) {
+        fprintf(output, "%s:%d:%s:ACQUIRED:%llu:CONTENDED:%llu:WAIT:%llu:"
+                "MAX_HOLD:%llu\n", site->file, site->line, site->lock,
+                (unsigned long long) __atomic_load_n(&site->acquired,
+                __ATOMIC_RELAXED),
+                (unsigned long long) __atomic_load_n(&site->contended,
+                __ATOMIC_RELAXED),
+                (unsigned long long) __atomic_load_n(&site->waited,
+                __ATOMIC_RELAXED) / 1000,
+                (unsigned long long) __atomic_load_n(&site->maxHold,
+                __ATOMIC_RELAXED) / 1000);
+    }
+    fflush(output);
+}
@@ -0,0 +1,48 @@
+#ifndef LOCKSTAT_H
+#define LOCKSTAT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+
+// Most locks one thread can hold at once and still have their hold time
+// measured.
+#define LOCK_STATS_DEPTH 8
+
+// What the locking done at one place in the code has cost. Only filled in
+// by a build with LOCK_STATS defined ("make LOCK_STATS=1").
+typedef struct LockSite {
+    struct LockSite *next; // next site in the list of sites seen so far.
+    const char *file;
+    int line;
+    const char *lock; // the lock as written at the site.
+    int seen; // set once the site is in the list.
+    uint64_t acquired;
+    uint64_t contended; // acquisitions that found the lock held.
+    uint64_t waited; // nanoseconds spent waiting for the lock in total.
+    uint64_t maxHold; // most nanoseconds the lock was held from here.
+} LockSite;
+
+// Every mutex in server.c and client.c is taken and given up through these.
+// Without LOCK_STATS they are the plain pthread calls.
+#ifdef LOCK_STATS
+#define MUTEX_LOCK(mutex) do { \
+        static LockSite lockSite = {NULL, __FILE__, __LINE__, #mutex, 0, 0, \
+                0, 0, 0}; \
+        lock_site_acquire(&lockSite, (mutex)); \
+    } while (0)
+#define MUTEX_UNLOCK(mutex) lock_site_release(mutex)
+#define COND_WAIT(cond, mutex) lock_site_cond_wait((cond), (mutex))
+#else
+#define MUTEX_LOCK(mutex) pthread_mutex_lock(mutex)
+#define MUTEX_UNLOCK(mutex) pthread_mutex_unlock(mutex)
+#define COND_WAIT(cond, mutex) pthread_cond_wait((cond), (mutex))
+#endif
+
+void lock_site_acquire(LockSite *site, pthread_mutex_t *mutex);
+void lock_site_release(pthread_mutex_t *mutex);
+void lock_site_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex);
+void lock_stats_print(FILE *output);
+
+#endif //ass4_lockstat_h
@@ -0,0 +1,223 @@
+#include "logger.h"
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * Function to wake the logger thread if it is waiting for records. The
+ * fence keeps the record's sequence store from being ordered after the
+ * load of sleeping, pairing with the one in run_logger(), so either the
+ * producer sees the thread sleeping or the thread sees the record.
+ *
+ * @param logger: The logger.
+ *
+ * return's nothing.
+*/
+static void wake_logger(ChatLogger *logger) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&logger->sleeping, __ATOMIC_SEQ_CST) &&
+            __atomic_exchange_n(&logger->sleeping, 0, __ATOMIC_SEQ_CST)) {
+        sem_post(&logger->wakeup);
+    }
+}
+
+/*
+ * Function to check if the slot at the tail of the ring holds a record.
+ *
+ * @param logger: The logger.
+ *
+ * return's 1 if a record is ready and 0 otherwise.
+*/
+static int record_ready(ChatLogger *logger) {
+    LogRecord *record = &logger->records[logger->tail & logger->mask];
+    return __atomic_load_n(&record->sequence, __ATOMIC_ACQUIRE) ==
+            logger->tail + 1;
+}
+
+/*
+ * Function to write the buffered batch to the output.
+ *
+ * @param logger: The logger.
+ *
+ * @param length: The number of bytes in the batch.
+ *
+ * return's nothing.
+*/
+static void write_batch(ChatLogger *logger, size_t length) {
+    if (length) {
+        fwrite(logger->batch, sizeof(char), length, logger->output);
+        fflush(logger->output);
+    }
+}
+
+/*
+ * Function to move every ready record into the batch buffer, writing the
+ * buffer out whenever it fills up and once more at the end.
+ *
+ * @param logger: The logger.
+ *
+ * return's the number of records drained.
+*/
+static int drain_records(ChatLogger *logger) {
+    size_t length = 0;
+    int count = 0;
+    while (record_ready(logger)) {
+        LogRecord *record = &logger->records[logger->tail & logger->mask];
+        char *text = record->overflow ? record->overflow : record->text;
+        if (length + record->length > LOG_BATCH_SIZE) {
+            write_batch(logger, length);
+            length = 0;
+        }
+        if (record->length > LOG_BATCH_SIZE) {
+            fwrite(text, sizeof(char), record->length, logger->output);
+        } else {
+            memcpy(logger->batch + length, text, record->length);
+            length += record->length;
+        }
+        free(record->overflow);
+        record->overflow = NULL;
+        __atomic_store_n(&record->sequence, logger->tail + logger->mask + 1,
+                __ATOMIC_RELEASE);
+        __atomic_store_n(&logger->tail, logger->tail + 1, __ATOMIC_RELEASE);
+        count++;
+    }
+    write_batch(logger, length);
+    __atomic_fetch_add(&logger->written, count, __ATOMIC_RELAXED);
+    return count;
+}
+
+/*
+ * Function run by the logger thread. Drains the ring in batches and sleeps
+ * on the semaphore when there is nothing to write.
+ *
+ * @param loggerInfo: The logger.
+ *
+ * return's NULL.
+*/
+static void *run_logger(void *loggerInfo) {
+    ChatLogger *logger = (ChatLogger *) loggerInfo;
+    while (1) {
+        if (drain_records(logger)) {
+            continue;
+        }
+        __atomic_store_n(&logger->sleeping, 1, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (record_ready(logger)) {
+            __atomic_store_n(&logger->sleeping, 0, __ATOMIC_SEQ_CST);
+            continue;
+        }
+        sem_wait(&logger->wakeup);
+    }
+    return NULL;
+}
+
+/*
+ * Function to create a logger and start its thread.
+ *
+ * @param output: The stream the records are written to.
+ *
+ * @param ringSize: The number of records the ring holds, rounded up to a
+ *                  power of two.
+ *
+ * return's the logger.
+*/
+ChatLogger *logger_start(FILE *output, size_t ringSize) {
+    ChatLogger *logger = calloc(1, sizeof(ChatLogger));
+    size_t size = 1;
+    while (size < ringSize) {
+        size <<= 1;
+    }
+    logger->records = calloc(size, sizeof(LogRecord));
+    logger->mask = size - 1;
+    for (size_t i = 0; i < size; ++i) {
+        logger->records[i].sequence = i;
+    }
+    logger->output = output;
+    logger->batch = malloc(LOG_BATCH_SIZE);
+    sem_init(&logger->wakeup, 0, 0);
+    pthread_create(&logger->thread, NULL, run_logger, (void *) logger);
+    pthread_detach(logger->thread);
+    return logger;
+}
+
+/*
+ * Function to format a record into the ring. Never blocks; if the logger
+ * thread has fallen a whole ring behind the record is dropped and counted.
+ *
+ * @param logger: The logger.
+ *
+ * @param fmt: printf style format of the record.
+ *
+ * return's nothing.
+*/
+void logger_printf(ChatLogger *logger, const char *fmt, ...) {
+    uint64_t position = __atomic_load_n(&logger->head, __ATOMIC_RELAXED);
+    LogRecord *record;
+    while (1) {
+        record = &logger->records[position & logger->mask];
+        uint64_t sequence = __atomic_load_n(&record->sequence,
+                __ATOMIC_ACQUIRE);
+        int64_t diff = (int64_t) (sequence - position);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&logger->head, &position,
+                    position + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            __atomic_fetch_add(&logger->dropped, 1, __ATOMIC_RELAXED);
+            return;
+        } else {
+            position = __atomic_load_n(&logger->head, __ATOMIC_RELAXED);
+        }
+    }
+    va_list args, copy;
+    va_start(args, fmt);
+    va_copy(copy, args);
+    int length = vsnprintf(record->text, LOG_RECORD_SIZE, fmt, args);
+    if (length >= LOG_RECORD_SIZE) {
+        record->overflow = malloc(length + 1);
+        vsnprintf(record->overflow, length + 1, fmt, copy);
+    }
+    va_end(copy);
+    va_end(args);
+    record->length = length < 0 ? 0 : length;
+    __atomic_store_n(&record->sequence, position + 1, __ATOMIC_RELEASE);
+    wake_logger(logger);
+}
+
+/*
+ * Function to wait until every record handed to the logger so far has been
+ * written out.
+ *
+ * @param logger: The logger.
+ *
+ * return's nothing.
+*/
+void logger_flush(ChatLogger *logger) {
+    uint64_t head = __atomic_load_n(&logger->head, __ATOMIC_ACQUIRE);
+    while (__atomic_load_n(&logger->tail, __ATOMIC_ACQUIRE) < head) {
+        wake_logger(logger);
+        usleep(1000);
+    }
+}
+
+/*
+ * Function to get the number of records written out.
+ *
+ * @param logger: The logger.
+ *
+ * return's the number of records.
+*/
+uint64_t logger_written(ChatLogger *logger) {
+    return __atomic_load_n(&logger->written, __ATOMIC_RELAXED);
+}
+
+/*
+ * Function to get the number of records dropped because the ring was full.
+ *
+ * @param logger: The logger.
+ *
+ * return's the number of records.
+*/
+uint64_t logger_dropped(ChatLogger *logger) {
+    return __atomic_load_n(&logger->dropped, __ATOMIC_RELAXED);
+}
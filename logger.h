@@ -0,0 +1,54 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+// Number of records the ring holds, must be a power of two.
+#define LOG_RING_SIZE 4096
+// Records up to this long are stored inside the ring itself.
+#define LOG_RECORD_SIZE 240
+// Size of the buffer the logger thread fills before each write.
+#define LOG_BATCH_SIZE 65536
+
+// A slot of the ring. The sequence tells producers and the consumer whose
+// turn it is to use the slot.
+typedef struct {
+    uint64_t sequence;
+    size_t length;
+    char *overflow; // heap copy of a record too long for text.
+    char text[LOG_RECORD_SIZE];
+} LogRecord;
+
+// A multi-producer single-consumer ring of formatted log records drained
+// by one logger thread into an output stream.
+typedef struct {
+    LogRecord *records;
+    uint64_t mask;
+
+    uint64_t head; // next slot handed to a producer.
+    uint64_t tail; // next slot read by the logger thread.
+
+    uint64_t written;
+    uint64_t dropped;
+
+    int sleeping; // set while the logger thread waits for records.
+    sem_t wakeup;
+
+    FILE *output;
+    char *batch;
+
+    pthread_t thread;
+} ChatLogger;
+
+ChatLogger *logger_start(FILE *output, size_t ringSize);
+void logger_printf(ChatLogger *logger, const char *fmt, ...);
+void logger_flush(ChatLogger *logger);
+uint64_t logger_written(ChatLogger *logger);
+uint64_t logger_dropped(ChatLogger *logger);
+
+#endif //ass4_logger_h
@@ -0,0 +1,591 @@
+#include "microbench.h"
+#include <unistd.h>
+
+// Allocation counter, bumped by the linker-wrapped allocator below.
+static uint64_t allocCount = 0;
+
+// Payloads used by the writer cases, generated once at start up.
+static char *chatTexts[CORPUS_LINES];
+static char *chatNames[CORPUS_LINES];
+
+// The server whose clients list the get_client_list() cases format.
+static Server *listServer = NULL;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *pointer, size_t size);
+
+/*
+ * Allocation wrappers. The microbench target is linked with
+ * --wrap=malloc,--wrap=calloc,--wrap=realloc so every allocation made by
+ * comms.c, shared.c and server.c goes through these and is counted.
+*/
+void *__wrap_malloc(size_t size) {
+    allocCount++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+    allocCount++;
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *pointer, size_t size) {
+    allocCount++;
+    return __real_realloc(pointer, size);
+}
+
+/*
+ * Function to pick a chat message length. Most chat lines are short, a
+ * quarter are a sentence or two and a few are pasted blocks of text.
+ *
+ * @param seed: The random seed.
+ *
+ * return's the length of the message.
+*/
+int random_chat_length(unsigned int *seed) {
+    int pick = rand_r(seed) % 100;
+    if (pick < 70) {
+        return 10 + rand_r(seed) % 50;
+    } else if (pick < 95) {
+        return 60 + rand_r(seed) % 140;
+    }
+    return 200 + rand_r(seed) % (MAX_CHAT_LENGTH - 200);
+}
+
+/*
+ * Function to fill a buffer with random printable words.
+ *
+ * @param buffer: The buffer to fill, must hold length + 1 characters.
+ *
+ * @param length: The number of characters wanted.
+ *
+ * @param seed: The random seed.
+ *
+ * return's nothing.
+*/
+void random_text(char *buffer, int length, unsigned int *seed) {
+    for (int i = 0; i < length; ++i) {
+        buffer[i] = (rand_r(seed) % 6 == 0) ? ' ' : 'a' + rand_r(seed) % 26;
+    }
+    buffer[length] = '\0';
+}
+
+/*
+ * Function to make a random client name.
+ *
+ * @param buffer: The buffer to fill, must hold MAX_NAME_LENGTH characters.
+ *
+ * @param seed: The random seed.
+ *
+ * return's nothing.
+*/
+void random_name(char *buffer, unsigned int *seed) {
+    int length = 3 + rand_r(seed) % (MAX_NAME_LENGTH - 4);
+    for (int i = 0; i < length; ++i) {
+        buffer[i] = 'a' + rand_r(seed) % 26;
+    }
+    buffer[length] = '\0';
+}
+
+/*
+ * Corpus line builders. Each one writes a line the way it appears on the
+ * wire after the parser's caller has consumed the dispatch characters.
+*/
+void make_say_line(char *line, size_t size, unsigned int *seed) {
+    char text[MAX_CHAT_LENGTH + 1];
+    random_text(text, random_chat_length(seed), seed);
+    snprintf(line, size, "AY:%s\n", text);
+}
+
+void make_name_line(char *line, size_t size, unsigned int *seed) {
+    char name[MAX_NAME_LENGTH];
+    random_name(name, seed);
+    snprintf(line, size, "NAME:%s\n", name);
+}
+
+void make_auth_line(char *line, size_t size, unsigned int *seed) {
+    snprintf(line, size, "UTH:ToPSeKrit\n");
+}
+
+void make_kick_line(char *line, size_t size, unsigned int *seed) {
+    char name[MAX_NAME_LENGTH];
+    random_name(name, seed);
+    snprintf(line, size, "ICK:%s\n", name);
+}
+
+void make_list_line(char *line, size_t size, unsigned int *seed) {
+    snprintf(line, size, "ST:\n");
+}
+
+void make_leave_line(char *line, size_t size, unsigned int *seed) {
+    snprintf(line, size, "AVE:\n");
+}
+
+void make_msg_line(char *line, size_t size, unsigned int *seed) {
+    char name[MAX_NAME_LENGTH];
+    char text[MAX_CHAT_LENGTH + 1];
+    random_name(name, seed);
+    random_text(text, random_chat_length(seed), seed);
+    snprintf(line, size, "SG:%s:%s\n", name, text);
+}
+
+void make_enter_line(char *line, size_t size, unsigned int *seed) {
+    char name[MAX_NAME_LENGTH];
+    random_name(name, seed);
+    snprintf(line, size, "NTER:%s\n", name);
+}
+
+void make_server_leave_line(char *line, size_t size, unsigned int *seed) {
+    char name[MAX_NAME_LENGTH];
+    random_name(name, seed);
+    snprintf(line, size, "AVE:%s\n", name);
+}
+
+void make_server_list_line(char *line, size_t size, unsigned int *seed) {
+    int names = 1 + rand_r(seed) % 32;
+    int j = snprintf(line, size, "ST:");
+    for (int i = 0; i < names; ++i) {
+        char name[MAX_NAME_LENGTH];
+        random_name(name, seed);
+        j += snprintf(line + j, size - j, "%s%s", i ? "," : "", name);
+    }
+    snprintf(line + j, size - j, "\n");
+}
+
+void make_server_kick_line(char *line, size_t size, unsigned int *seed) {
+    snprintf(line, size, "ICK:\n");
+}
+
+void make_ok_line(char *line, size_t size, unsigned int *seed) {
+    snprintf(line, size, "K:\n");
+}
+
+void make_who_line(char *line, size_t size, unsigned int *seed) {
+    snprintf(line, size, "HO:\n");
+}
+
+void make_server_auth_line(char *line, size_t size, unsigned int *seed) {
+    snprintf(line, size, "UTH:\n");
+}
+
+void make_name_taken_line(char *line, size_t size, unsigned int *seed) {
+    snprintf(line, size, "AME_TAKEN:\n");
+}
+
+void make_chat_line(char *line, size_t size, unsigned int *seed) {
+    char text[MAX_CHAT_LENGTH + 1];
+    random_text(text, random_chat_length(seed), seed);
+    snprintf(line, size, "%s\n", text);
+}
+
+/*
+ * Reader operations. Each parses one message and frees what the parser
+ * allocated so the benchmark doesn't grow without bound.
+*/
+void run_parse_auth(FILE *stream, int op) {
+    ClientMessage msg = parse_auth_message(stream, "ToPSeKrit");
+    if (msg.messID == C_AUTH) {
+        free(msg.message);
+    }
+}
+
+void run_parse_name(FILE *stream, int op) {
+    ClientMessage msg = parse_name_message(stream);
+    if (msg.messID == C_NAME) {
+        free(msg.message);
+    }
+}
+
+void run_parse_say(FILE *stream, int op) {
+    ClientMessage msg = parse_say_message(stream);
+    if (msg.messID == C_SAY) {
+        free(msg.message);
+    }
+}
+
+void run_parse_list(FILE *stream, int op) {
+    parse_list_message(stream);
+}
+
+void run_parse_leave(FILE *stream, int op) {
+    parse_leave_message(stream);
+}
+
+void run_parse_kick(FILE *stream, int op) {
+    ClientMessage msg = parse_kick_message(stream);
+    if (msg.messID == C_KICK) {
+        free(msg.message);
+    }
+}
+
+void run_parse_who_from_server(FILE *stream, int op) {
+    parse_who_message_from_server(stream);
+}
+
+void run_parse_auth_from_server(FILE *stream, int op) {
+    parse_auth_message_from_server(stream);
+}
+
+void run_parse_ok_from_server(FILE *stream, int op) {
+    parse_ok_message_from_server(stream);
+}
+
+void run_parse_name_taken_from_server(FILE *stream, int op) {
+    parse_name_taken_message_from_server(stream);
+}
+
+void run_parse_kick_from_server(FILE *stream, int op) {
+    parse_kick_message_from_server(stream);
+}
+
+void run_parse_msg_from_server(FILE *stream, int op) {
+    ServerMessage msg = parse_msg_message_from_server(stream);
+    if (msg.messID == S_MSG) {
+        free(msg.message);
+    }
+}
+
+void run_parse_enter_from_server(FILE *stream, int op) {
+    ServerMessage msg = parse_enter_message_from_server(stream);
+    if (msg.messID == S_ENTER) {
+        free(msg.message);
+    }
+}
+
+void run_parse_leave_from_server(FILE *stream, int op) {
+    ServerMessage msg = parse_leave_message_from_server(stream);
+    if (msg.messID == S_LEAVE) {
+        free(msg.message);
+    }
+}
+
+void run_parse_list_from_server(FILE *stream, int op) {
+    ServerMessage msg = parse_list_message_from_server(stream);
+    if (msg.messID == S_LIST) {
+        free(msg.message);
+    }
+}
+
+void run_read_line(FILE *stream, int op) {
+    free(read_line(stream));
+}
+
+/*
+ * Writer operations. The op number picks the payload so every size in the
+ * distribution is exercised.
+*/
+void run_send_auth_to_client(FILE *stream, int op) {
+    send_auth_message_to_client(stream, "AUTH:");
+}
+
+void run_send_who(FILE *stream, int op) {
+    send_who_message(stream, "WHO:");
+}
+
+void run_send_name_taken(FILE *stream, int op) {
+    send_name_taken_message(stream, "NAME_TAKEN:");
+}
+
+void run_send_ok(FILE *stream, int op) {
+    send_ok_message(stream, "OK:");
+}
+
+void run_send_enter(FILE *stream, int op) {
+    send_enter_message(stream, "ENTER", chatNames[op % CORPUS_LINES]);
+}
+
+void run_send_chat(FILE *stream, int op) {
+    send_chat_message_to_clients(stream, "MSG", chatNames[op % CORPUS_LINES],
+            chatTexts[op % CORPUS_LINES]);
+}
+
+void run_send_leave(FILE *stream, int op) {
+    send_leave_message(stream, "LEAVE", chatNames[op % CORPUS_LINES]);
+}
+
+void run_send_list(FILE *stream, int op) {
+    send_list_to_client(stream, "LIST:alice,bob,carol,dave,eve");
+}
+
+void run_send_kick(FILE *stream, int op) {
+    send_kick_message(stream, "KICK:");
+}
+
+void run_send_auth_string(FILE *stream, int op) {
+    send_auth_string(stream, "ToPSeKrit");
+}
+
+void run_send_client_name(FILE *stream, int op) {
+    send_client_name(stream, "NAME", chatNames[op % CORPUS_LINES]);
+}
+
+void run_send_command(FILE *stream, int op) {
+    send_client_command_to_server("LIST:", stream);
+}
+
+void run_send_say(FILE *stream, int op) {
+    send_input_as_client_message(chatTexts[op % CORPUS_LINES], stream);
+}
+
+/*
+ * Plain function call operations.
+*/
+void run_int_to_string(FILE *stream, int op) {
+    free(int_to_string(op * 7919));
+}
+
+void run_get_client_list(FILE *stream, int op) {
+    free(get_client_list(listServer));
+}
+
+// Every benchmark case, in the order they are reported.
+static MicroCase cases[] = {
+    {"parse_auth_message", MB_READER, make_auth_line, run_parse_auth, 0},
+    {"parse_name_message", MB_READER, make_name_line, run_parse_name, 0},
+    {"parse_say_message", MB_READER, make_say_line, run_parse_say, 0},
+    {"parse_list_message", MB_READER, make_list_line, run_parse_list, 0},
+    {"parse_leave_message", MB_READER, make_leave_line, run_parse_leave, 0},
+    {"parse_kick_message", MB_READER, make_kick_line, run_parse_kick, 0},
+    {"parse_who_message_from_server", MB_READER, make_who_line,
+            run_parse_who_from_server, 0},
+    {"parse_auth_message_from_server", MB_READER, make_server_auth_line,
+            run_parse_auth_from_server, 0},
+    {"parse_ok_message_from_server", MB_READER, make_ok_line,
+            run_parse_ok_from_server, 0},
+    {"parse_name_taken_message_from_server", MB_READER,
+            make_name_taken_line, run_parse_name_taken_from_server, 0},
+    {"parse_kick_message_from_server", MB_READER, make_server_kick_line,
+            run_parse_kick_from_server, 0},
+    {"parse_msg_message_from_server", MB_READER, make_msg_line,
+            run_parse_msg_from_server, 0},
+    {"parse_enter_message_from_server", MB_READER, make_enter_line,
+            run_parse_enter_from_server, 0},
+    {"parse_leave_message_from_server", MB_READER, make_server_leave_line,
+            run_parse_leave_from_server, 0},
+    {"parse_list_message_from_server", MB_READER, make_server_list_line,
+            run_parse_list_from_server, 0},
+    {"read_line", MB_READER, make_chat_line, run_read_line, 0},
+    {"send_auth_message_to_client", MB_WRITER, NULL,
+            run_send_auth_to_client, 0},
+    {"send_who_message", MB_WRITER, NULL, run_send_who, 0},
+    {"send_name_taken_message", MB_WRITER, NULL, run_send_name_taken, 0},
+    {"send_ok_message", MB_WRITER, NULL, run_send_ok, 0},
+    {"send_enter_message", MB_WRITER, NULL, run_send_enter, 0},
+    {"send_chat_message_to_clients", MB_WRITER, NULL, run_send_chat, 0},
+    {"send_leave_message", MB_WRITER, NULL, run_send_leave, 0},
+    {"send_list_to_client", MB_WRITER, NULL, run_send_list, 0},
+    {"send_kick_message", MB_WRITER, NULL, run_send_kick, 0},
+    {"send_auth_string", MB_WRITER, NULL, run_send_auth_string, 0},
+    {"send_client_name", MB_WRITER, NULL, run_send_client_name, 0},
+    {"send_client_command_to_server", MB_WRITER, NULL, run_send_command, 0},
+    {"send_input_as_client_message", MB_WRITER, NULL, run_send_say, 0},
+    {"int_to_string", MB_CALL, NULL, run_int_to_string, 0},
+    {"get_client_list/16", MB_CALL, NULL, run_get_client_list, 16},
+    {"get_client_list/256", MB_CALL, NULL, run_get_client_list, 256},
+};
+
+/*
+ * Function to build the corpus of a reader case.
+ *
+ * @param microCase: The case whose make_line function builds the lines.
+ *
+ * @param corpus: The corpus to fill.
+ *
+ * return's nothing.
+*/
+void build_corpus(MicroCase *microCase, Corpus *corpus) {
+    unsigned int seed = 2310;
+    size_t capacity = CORPUS_LINES * 64;
+    char line[MAX_CHAT_LENGTH * 2];
+    corpus->data = malloc(capacity);
+    corpus->length = 0;
+    corpus->lines = CORPUS_LINES;
+    for (int i = 0; i < CORPUS_LINES; ++i) {
+        microCase->make_line(line, sizeof(line), &seed);
+        size_t length = strlen(line);
+        while (corpus->length + length >= capacity) {
+            capacity *= 2;
+            corpus->data = realloc(corpus->data, capacity);
+        }
+        memcpy(corpus->data + corpus->length, line, length);
+        corpus->length += length;
+    }
+}
+
+/*
+ * Function to build the payloads used by the writer cases.
+ *
+ * return's nothing.
+*/
+void build_payloads(void) {
+    unsigned int seed = 4310;
+    for (int i = 0; i < CORPUS_LINES; ++i) {
+        chatNames[i] = malloc(MAX_NAME_LENGTH);
+        random_name(chatNames[i], &seed);
+        chatTexts[i] = malloc(MAX_CHAT_LENGTH + 1);
+        random_text(chatTexts[i], random_chat_length(&seed), &seed);
+    }
+}
+
+/*
+ * Function to build a server with a given number of listed chatters in its
+ * roster shards for the get_client_list() cases.
+ *
+ * @param count: The number of chatters.
+ *
+ * return's the server.
+*/
+Server *build_list_server(int count) {
+    unsigned int seed = 5310;
+    Server *server = calloc(1, sizeof(Server));
+    for (int i = 0; i < CLIENT_SHARDS; ++i) {
+        pthread_mutex_init(&server->shards[i].lock, NULL);
+    }
+    for (int i = 0; i < count; ++i) {
+        Clients *client = calloc(1, sizeof(Clients));
+        client->name = malloc(MAX_NAME_LENGTH);
+        random_name(client->name, &seed);
+        client->server = server;
+        client->listed = true;
+        add_shard_member(name_shard(server, client->name), client);
+        client->prev = server->clients;
+        server->clients = client;
+    }
+    return server;
+}
+
+/*
+ * Function to free a server made by build_list_server().
+ *
+ * @param server: The server to free.
+ *
+ * return's nothing.
+*/
+void free_list_server(Server *server) {
+    Clients *client = server->clients;
+    while (client != NULL) {
+        Clients *prev = client->prev;
+        free(client->name);
+        free(client);
+        client = prev;
+    }
+    for (int i = 0; i < CLIENT_SHARDS; ++i) {
+        free(server->shards[i].members);
+        pthread_mutex_destroy(&server->shards[i].lock);
+    }
+    free(server);
+}
+
+/*
+ * Function to run a case for a number of iterations.
+ *
+ * @param microCase: The case to run.
+ *
+ * @param iterations: The number of operations to perform.
+ *
+ * @param corpus: The corpus of a reader case, NULL otherwise.
+ *
+ * @param bytes: Set to the number of bytes read or written.
+ *
+ * return's the elapsed time in nanoseconds.
+*/
+uint64_t run_case(MicroCase *microCase, long iterations, Corpus *corpus,
+        uint64_t *bytes) {
+    FILE *stream = NULL;
+    char *sink = NULL;
+    *bytes = 0;
+    if (microCase->kind == MB_READER) {
+        stream = fmemopen(corpus->data, corpus->length, "r");
+    } else if (microCase->kind == MB_WRITER) {
+        sink = malloc(SINK_SIZE);
+        stream = fmemopen(sink, SINK_SIZE, "w");
+    }
+    uint64_t start = get_time_ns();
+    for (long i = 0; i < iterations; ++i) {
+        if (microCase->kind == MB_READER && i % corpus->lines == 0 && i) {
+            rewind(stream);
+            *bytes += corpus->length;
+        }
+        if (microCase->kind == MB_WRITER &&
+                ftell(stream) > SINK_SIZE - MAX_CHAT_LENGTH * 2) {
+            *bytes += ftell(stream);
+            rewind(stream);
+        }
+        microCase->run(stream, (int) i);
+    }
+    uint64_t elapsed = get_time_ns() - start;
+    if (stream != NULL) {
+        *bytes += ftell(stream);
+        fclose(stream);
+    }
+    free(sink);
+    return elapsed;
+}
+
+/*
+ * Function to run a case and print a line of the report.
+ *
+ * @param microCase: The case to run.
+ *
+ * @param iterations: The number of operations to time.
+ *
+ * return's nothing.
+*/
+void report_case(MicroCase *microCase, long iterations) {
+    Corpus corpus;
+    uint64_t bytes;
+    memset(&corpus, 0, sizeof(Corpus));
+    if (microCase->kind == MB_READER) {
+        build_corpus(microCase, &corpus);
+    }
+    if (microCase->listSize) {
+        listServer = build_list_server(microCase->listSize);
+    }
+    run_case(microCase, iterations / 10 + 1, &corpus, &bytes);
+    uint64_t allocs = allocCount;
+    uint64_t elapsed = run_case(microCase, iterations, &corpus, &bytes);
+    allocs = allocCount - allocs;
+    printf("%-38s %10.1f %10.1f %10.2f\n", microCase->name,
+            (double) elapsed / iterations,
+            bytes ? (bytes / 1e6) / (elapsed / 1e9) : 0.0,
+            (double) allocs / iterations);
+    fflush(stdout);
+    if (microCase->listSize) {
+        free_list_server(listServer);
+        listServer = NULL;
+    }
+    free(corpus.data);
+}
+
+int main(int argc, char **argv) {
+    long iterations = DEFAULT_ITERATIONS;
+    char *filter = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:f:")) != -1) {
+        switch (opt) {
+            case 'n':
+                iterations = atol(optarg);
+                break;
+            case 'f':
+                filter = optarg;
+                break;
+            default:
+                fprintf(stderr, "%s\n", MICROBENCH_USAGE);
+                exit(1);
+        }
+    }
+    if (iterations <= 0 || optind != argc) {
+        fprintf(stderr, "%s\n", MICROBENCH_USAGE);
+        exit(1);
+    }
+    build_payloads();
+    printf("%-38s %10s %10s %10s\n", "benchmark", "ns/op", "MB/s",
+            "allocs/op");
+    for (size_t i = 0; i < sizeof(cases) / sizeof(MicroCase); ++i) {
+        if (filter == NULL || strstr(cases[i].name, filter) != NULL) {
+            report_case(&cases[i], iterations);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,55 @@
+#ifndef MICROBENCH_H
+#define MICROBENCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "comms.h"
+#include "shared.h"
+#include "server.h"
+
+#define MICROBENCH_USAGE "Usage: microbench [-n iterations] [-f filter]"
+#define DEFAULT_ITERATIONS 200000
+// Number of lines in each generated corpus before it is read again.
+#define CORPUS_LINES 4096
+// Size of the in-memory stream the send_* benchmarks write into.
+#define SINK_SIZE (4 * 1024 * 1024)
+#define MAX_CHAT_LENGTH 2048
+#define MAX_NAME_LENGTH 16
+
+// A buffer of newline separated lines that a benchmark reads from.
+typedef struct {
+    char *data;
+    size_t length;
+    int lines;
+} Corpus;
+
+// Kinds of benchmark, decides how the case's function is driven.
+typedef enum {
+    MB_READER, // reads one line from a stream made from the corpus
+    MB_WRITER, // writes one message into an in-memory sink
+    MB_CALL    // plain function call, no stream
+} MicroKind;
+
+typedef struct MicroCase MicroCase;
+
+// A single benchmark case.
+struct MicroCase {
+    const char *name;
+    MicroKind kind;
+    // Builds the line for the corpus of a MB_READER case.
+    void (*make_line)(char *line, size_t size, unsigned int *seed);
+    // Performs one operation. The stream is NULL for MB_CALL cases.
+    void (*run)(FILE *stream, int op);
+    // Size of the clients list used by the get_client_list() cases.
+    int listSize;
+};
+
+// Declared in server.c which is linked in with its main renamed.
+char *get_client_list(Server *server);
+ClientShard *name_shard(Server *server, const char *name);
+void add_shard_member(ClientShard *shard, Clients *client);
+
+#endif //ass4_microbench_h
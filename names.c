@@ -0,0 +1,146 @@
+#include "names.h"
+#include <stddef.h>
+
+/*
+ * Function to hash a name (32 bit FNV-1a).
+ *
+ * @param name: The name to hash.
+ *
+ * return's the hash of the name.
+*/
+uint32_t name_hash(const char *name) {
+    uint32_t hash = 2166136261u;
+    for (; *name != '\0'; ++name) {
+        hash ^= (unsigned char) *name;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/*
+ * Function to create an empty name table.
+ *
+ * return's the new table.
+*/
+NameTable *name_table_new(void) {
+    NameTable *table = (NameTable *) malloc(sizeof(NameTable));
+    table->bucketCount = NAME_TABLE_BUCKETS;
+    table->buckets = (InternedName **) calloc(table->bucketCount,
+            sizeof(InternedName *));
+    table->count = 0;
+    table->bytes = 0;
+    pthread_mutex_init(&table->lock, NULL);
+    return table;
+}
+
+/*
+ * Function to double the buckets of a table and rehash its names. Must be
+ * called with the table's lock held.
+ *
+ * @param table: The name table.
+ *
+ * return's nothing.
+*/
+static void grow_name_table(NameTable *table) {
+    size_t count = table->bucketCount * 2;
+    InternedName **buckets = (InternedName **) calloc(count,
+            sizeof(InternedName *));
+    for (size_t i = 0; i < table->bucketCount; ++i) {
+        InternedName *entry = table->buckets[i];
+        while (entry != NULL) {
+            InternedName *next = entry->next;
+            size_t index = entry->hash & (count - 1);
+            entry->next = buckets[index];
+            buckets[index] = entry;
+            entry = next;
+        }
+    }
+    free(table->buckets);
+    table->buckets = buckets;
+    table->bucketCount = count;
+}
+
+/*
+ * Function to get the interned copy of a name, adding it to the table if it
+ * is not there yet. Every call must be matched by a name_release().
+ *
+ * @param table: The name table.
+ *
+ * @param name: The name to intern.
+ *
+ * return's the interned name, valid until its last release.
+*/
+char *name_intern(NameTable *table, const char *name) {
+    uint32_t hash = name_hash(name);
+    pthread_mutex_lock(&table->lock);
+    InternedName *entry = table->buckets[hash & (table->bucketCount - 1)];
+    for (; entry != NULL; entry = entry->next) {
+        if (entry->hash == hash && strcmp(entry->text, name) == 0) {
+            entry->refs++;
+            pthread_mutex_unlock(&table->lock);
+            return entry->text;
+        }
+    }
+    if (table->count >= table->bucketCount * 2) {
+        grow_name_table(table);
+    }
+    size_t length = strlen(name) + 1;
+    entry = (InternedName *) malloc(sizeof(InternedName) + length);
+    memcpy(entry->text, name, length);
+    entry->hash = hash;
+    entry->refs = 1;
+    size_t index = hash & (table->bucketCount - 1);
+    entry->next = table->buckets[index];
+    table->buckets[index] = entry;
+    table->count++;
+    table->bytes += sizeof(InternedName) + length;
+    pthread_mutex_unlock(&table->lock);
+    return entry->text;
+}
+
+/*
+ * Function to drop a reference to an interned name, freeing it once
+ * nothing refers to it.
+ *
+ * @param table: The name table.
+ *
+ * @param name: A name returned by name_intern(), or NULL.
+ *
+ * return's nothing.
+*/
+void name_release(NameTable *table, char *name) {
+    if (name == NULL) {
+        return;
+    }
+    InternedName *released = (InternedName *) (name -
+            offsetof(InternedName, text));
+    pthread_mutex_lock(&table->lock);
+    if (--released->refs > 0) {
+        pthread_mutex_unlock(&table->lock);
+        return;
+    }
+    InternedName **link = &table->buckets[released->hash &
+            (table->bucketCount - 1)];
+    while (*link != released) {
+        link = &(*link)->next;
+    }
+    *link = released->next;
+    table->count--;
+    table->bytes -= sizeof(InternedName) + strlen(released->text) + 1;
+    pthread_mutex_unlock(&table->lock);
+    free(released);
+}
+
+/*
+ * Function to get the bytes used by a table's names and buckets.
+ *
+ * @param table: The name table.
+ *
+ * return's the number of bytes.
+*/
+size_t name_table_bytes(NameTable *table) {
+    pthread_mutex_lock(&table->lock);
+    size_t bytes = table->bytes + table->bucketCount * sizeof(InternedName *);
+    pthread_mutex_unlock(&table->lock);
+    return bytes;
+}
@@ -0,0 +1,38 @@
+#ifndef NAMES_H
+#define NAMES_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+// Buckets a name table starts with, must be a power of two. The table
+// doubles once it holds twice as many names as buckets.
+#define NAME_TABLE_BUCKETS 256
+
+// A name held once however many structs refer to it. The text lives in the
+// same allocation so a name costs a single block.
+typedef struct InternedName {
+    struct InternedName *next; // next name in the same bucket.
+    uint32_t hash;
+    int refs;
+    char text[];
+} InternedName;
+
+// Table of interned names, chained by hash.
+typedef struct {
+    InternedName **buckets;
+    size_t bucketCount;
+    size_t count;
+    size_t bytes; // bytes held by the names themselves.
+    pthread_mutex_t lock;
+} NameTable;
+
+uint32_t name_hash(const char *name);
+NameTable *name_table_new(void);
+char *name_intern(NameTable *table, const char *name);
+void name_release(NameTable *table, char *name);
+size_t name_table_bytes(NameTable *table);
+
+#endif //ass4_names_h
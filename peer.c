@@ -0,0 +1,915 @@
+#include "peer.h"
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+static const char *eventNames[PEER_INVALID] = {"ENTER", "LEAVE", "SAY",
+        "KICK", "ROSTER", "LOST", "FOUND"};
+
+/*
+ * Function to make the random id a server is known by to its peers.
+ *
+ * @param node: Buffer of PEER_NODE_BYTES * 2 + 1 characters.
+ *
+ * return's nothing.
+*/
+static void generate_node_id(char *node) {
+    unsigned char bytes[PEER_NODE_BYTES];
+    FILE *random = fopen("/dev/urandom", "r");
+    if (random == NULL || fread(bytes, 1, PEER_NODE_BYTES, random) !=
+            PEER_NODE_BYTES) {
+        uint64_t seed = get_time_ns() ^ ((uint64_t) getpid() << 32);
+        memcpy(bytes, &seed, PEER_NODE_BYTES);
+    }
+    if (random != NULL) {
+        fclose(random);
+    }
+    for (int i = 0; i < PEER_NODE_BYTES; ++i) {
+        sprintf(node + i * 2, "%02x", bytes[i]);
+    }
+}
+
+/*
+ * Function to queue a line on a link and wake its writer thread. A link
+ * with PEER_OUTBOUND_LIMIT bytes already queued is taken down instead: its
+ * socket is shut down so its reader sees it close and runs link_down().
+ *
+ * @param link: The link.
+ *
+ * @param line: The line, ending in a newline.
+ *
+ * return's nothing.
+*/
+static void link_queue(PeerLink *link, const char *line) {
+    size_t length = strlen(line);
+    pthread_mutex_lock(&link->lock);
+    if (link->up && byte_buffer_pending(&link->outbound) + length >
+            PEER_OUTBOUND_LIMIT) {
+        link->up = false;
+        link->outbound.start = link->outbound.length = 0;
+        shutdown(link->socket, SHUT_RDWR);
+        pthread_cond_signal(&link->ready);
+    }
+    if (link->up) {
+        byte_buffer_append(&link->outbound, line, length);
+        __atomic_fetch_add(&link->sent, 1, __ATOMIC_RELAXED);
+        pthread_cond_signal(&link->ready);
+    }
+    pthread_mutex_unlock(&link->lock);
+}
+
+/*
+ * Function to queue a line on every link that has finished its hello,
+ * except one. Must be called with the peers lock held so every link gets
+ * the events of a node in the order of their sequence numbers.
+ *
+ * @param peers: The federation state.
+ *
+ * @param line: The line, ending in a newline.
+ *
+ * @param except: The link not to send on, or NULL.
+ *
+ * return's the number of links the line was queued on.
+*/
+static int queue_on_links(Peers *peers, const char *line, PeerLink *except) {
+    int count = 0;
+    for (PeerLink *link = peers->links; link != NULL; link = link->next) {
+        if (link != except && link->node != NULL) {
+            link_queue(link, line);
+            count++;
+        }
+    }
+    return count;
+}
+
+/*
+ * Function to format an event as a line for the links.
+ *
+ * @param kind: The kind of event.
+ *
+ * @param origin: The node the event started on.
+ *
+ * @param sequence: The event's sequence number from the origin.
+ *
+ * @param name: The chatter the event is about.
+ *
+ * @param text: The text of a PEER_SAY event, the chatter's node for a
+ *              PEER_LOST event, otherwise NULL.
+ *
+ * return's the line, to be freed by the caller.
+*/
+static char *format_event(PeerEventKind kind, const char *origin,
+        uint64_t sequence, const char *name, const char *text) {
+    size_t length = strlen(eventNames[kind]) + strlen(origin) +
+            strlen(name) + (text ? strlen(text) + 1 : 0) + 32;
+    char *line = (char *) malloc(sizeof(char) * length);
+    if (text != NULL) {
+        snprintf(line, length, "%s:%s:%llu:%s:%s\n", eventNames[kind],
+                origin, (unsigned long long) sequence, name, text);
+    } else {
+        snprintf(line, length, "%s:%s:%llu:%s\n", eventNames[kind],
+                origin, (unsigned long long) sequence, name);
+    }
+    return line;
+}
+
+/*
+ * Function to split a line read from a link into an event. The line is
+ * modified and the event points into it.
+ *
+ * @param line: The line without its newline.
+ *
+ * @param event: Where the event is stored.
+ *
+ * return's a bool indicating if the line was a valid event.
+*/
+static bool parse_event(char *line, PeerEvent *event) {
+    char *origin = strchr(line, ':');
+    char *sequence = origin ? strchr(origin + 1, ':') : NULL;
+    char *name = sequence ? strchr(sequence + 1, ':') : NULL;
+    event->kind = PEER_INVALID;
+    if (name == NULL) {
+        return false;
+    }
+    *origin++ = '\0';
+    *sequence++ = '\0';
+    *name++ = '\0';
+    for (int i = 0; i < PEER_INVALID; ++i) {
+        if (strcmp(line, eventNames[i]) == 0) {
+            event->kind = (PeerEventKind) i;
+        }
+    }
+    char *end;
+    event->sequence = strtoull(sequence, &end, 10);
+    event->origin = origin;
+    event->name = name;
+    event->text = NULL;
+    if (*end != '\0' || *origin == '\0' || *name == '\0') {
+        return false;
+    }
+    if (event->kind == PEER_SAY || event->kind == PEER_LOST) {
+        event->text = strchr(name, ':');
+        if (event->text == NULL) {
+            return false;
+        }
+        *event->text++ = '\0';
+    }
+    return event->kind != PEER_INVALID;
+}
+
+/*
+ * Function to find a chatter in the federation roster. Must be called with
+ * the peers lock held.
+ *
+ * @param peers: The federation state.
+ *
+ * @param origin: The node the chatter is on.
+ *
+ * @param name: The chatter's name.
+ *
+ * return's the index of the chatter or -1.
+*/
+static int find_member(Peers *peers, const char *origin, const char *name) {
+    for (int i = 0; i < peers->memberCount; ++i) {
+        PeerMember *member = &peers->members[i];
+        if (strcmp(member->name, name) == 0 &&
+                strcmp(member->origin, origin) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Function to add a chatter to the federation roster. Must be called with
+ * the peers lock held.
+ *
+ * @param peers: The federation state.
+ *
+ * @param origin: The node the chatter is on.
+ *
+ * @param name: The chatter's name.
+ *
+ * @param link: The link the chatter was learned from, NULL if local.
+ *
+ * return's nothing.
+*/
+static void add_member(Peers *peers, const char *origin, const char *name,
+        PeerLink *link) {
+    if (find_member(peers, origin, name) >= 0) {
+        return;
+    }
+    peers->members = (PeerMember *) realloc(peers->members,
+            sizeof(PeerMember) * (peers->memberCount + 1));
+    PeerMember *member = &peers->members[peers->memberCount++];
+    member->origin = strdup(origin);
+    member->name = strdup(name);
+    member->link = link;
+}
+
+/*
+ * Function to remove a chatter from the federation roster. Must be called
+ * with the peers lock held.
+ *
+ * @param peers: The federation state.
+ *
+ * @param index: The index of the chatter.
+ *
+ * return's nothing.
+*/
+static void remove_member(Peers *peers, int index) {
+    free(peers->members[index].origin);
+    free(peers->members[index].name);
+    peers->members[index] = peers->members[--peers->memberCount];
+}
+
+/*
+ * Function to drop a chatter that can no longer be reached and tell the
+ * other links with a PEER_LOST event of this server's own. Must be called
+ * with the peers lock held.
+ *
+ * @param peers: The federation state.
+ *
+ * @param index: The index of the chatter.
+ *
+ * @param except: The link not to tell, or NULL.
+ *
+ * @param gone: The chatter is moved to the end of it, for deliver_lost().
+ *
+ * @param goneCount: The number of chatters in gone.
+ *
+ * return's nothing.
+*/
+static void lose_member(Peers *peers, int index, PeerLink *except,
+        PeerMember **gone, int *goneCount) {
+    PeerMember *member = &peers->members[index];
+    char *line = format_event(PEER_LOST, peers->node, ++peers->nextSequence,
+            member->name, member->origin);
+    queue_on_links(peers, line, except);
+    free(line);
+    *gone = (PeerMember *) realloc(*gone,
+            sizeof(PeerMember) * (*goneCount + 1));
+    (*gone)[(*goneCount)++] = *member;
+    *member = peers->members[--peers->memberCount];
+}
+
+/*
+ * Function to tell the server the chatters dropped by lose_member() have
+ * left, and free them. Must be called without the peers lock held.
+ *
+ * @param peers: The federation state.
+ *
+ * @param gone: The chatters.
+ *
+ * @param goneCount: The number of chatters.
+ *
+ * return's nothing.
+*/
+static void deliver_lost(Peers *peers, PeerMember *gone, int goneCount) {
+    for (int i = 0; i < goneCount; ++i) {
+        PeerEvent event = {PEER_LEAVE, gone[i].origin, 0, gone[i].name,
+                NULL};
+        peers->deliver(peers->context, &event);
+        free(gone[i].origin);
+        free(gone[i].name);
+    }
+    free(gone);
+}
+
+/*
+ * Function to handle a PEER_LOST event, the server at the other end of a
+ * link no longer reaching a chatter. If this server reaches the chatter
+ * through that link too it drops the chatter and passes the loss on.
+ * Otherwise it still has a way to the chatter and sends it back as a
+ * PEER_FOUND, so the other server learns it through this one. Must be
+ * called with the peers lock held.
+ *
+ * @param peers: The federation state.
+ *
+ * @param link: The link the event was read from.
+ *
+ * @param event: The event.
+ *
+ * @param gone: A dropped chatter is added to it, for deliver_lost().
+ *
+ * @param goneCount: The number of chatters in gone.
+ *
+ * return's nothing.
+*/
+static void accept_lost(Peers *peers, PeerLink *link, PeerEvent *event,
+        PeerMember **gone, int *goneCount) {
+    int index = find_member(peers, event->text, event->name);
+    if (index < 0) {
+        return;
+    }
+    if (peers->members[index].link == link) {
+        lose_member(peers, index, link, gone, goneCount);
+    } else {
+        char *found = format_event(PEER_FOUND, event->text, 0,
+                event->name, NULL);
+        link_queue(link, found);
+        free(found);
+    }
+}
+
+/*
+ * Function to decide if an event read from a link is new and to apply it
+ * to the roster. An event is new if its sequence number is above the last
+ * one seen from its origin; anything else came round a loop of links. A
+ * PEER_ROSTER or PEER_FOUND is new if its chatter isn't known. Must be
+ * called with the peers lock held.
+ *
+ * @param peers: The federation state.
+ *
+ * @param link: The link the event was read from.
+ *
+ * @param event: The event.
+ *
+ * return's a bool indicating if the event is new.
+*/
+static bool accept_event(Peers *peers, PeerLink *link, PeerEvent *event) {
+    if (strcmp(event->origin, peers->node) == 0) {
+        return false;
+    }
+    if (event->kind == PEER_ROSTER || event->kind == PEER_FOUND) {
+        if (find_member(peers, event->origin, event->name) >= 0) {
+            return false;
+        }
+        add_member(peers, event->origin, event->name, link);
+        return true;
+    }
+    PeerSeen *seen = NULL;
+    for (int i = 0; i < peers->seenCount; ++i) {
+        if (strcmp(peers->seen[i].origin, event->origin) == 0) {
+            seen = &peers->seen[i];
+        }
+    }
+    if (seen == NULL) {
+        peers->seen = (PeerSeen *) realloc(peers->seen,
+                sizeof(PeerSeen) * (peers->seenCount + 1));
+        seen = &peers->seen[peers->seenCount++];
+        seen->origin = strdup(event->origin);
+        seen->sequence = 0;
+    }
+    if (event->sequence <= seen->sequence) {
+        return false;
+    }
+    seen->sequence = event->sequence;
+    if (event->kind == PEER_ENTER) {
+        add_member(peers, event->origin, event->name, link);
+    } else if (event->kind == PEER_LEAVE) {
+        int index = find_member(peers, event->origin, event->name);
+        if (index >= 0) {
+            remove_member(peers, index);
+        }
+    }
+    return true;
+}
+
+/*
+ * Function to handle a line read from a link. New events are relayed to
+ * every other link and handed to the server to show its clients. A
+ * PEER_LOST event is only for the server it is sent to, which sends its
+ * own if it drops the chatter.
+ *
+ * @param link: The link the line was read from.
+ *
+ * @param line: The line without its newline.
+ *
+ * return's nothing.
+*/
+static void handle_link_line(PeerLink *link, char *line) {
+    Peers *peers = link->peers;
+    size_t length = strlen(line);
+    char *relay = (char *) malloc(sizeof(char) * (length + 2));
+    memcpy(relay, line, length);
+    strcpy(relay + length, "\n");
+    PeerEvent event;
+    __atomic_fetch_add(&link->received, 1, __ATOMIC_RELAXED);
+    if (!parse_event(line, &event)) {
+        free(relay);
+        return;
+    }
+    pthread_mutex_lock(&peers->lock);
+    if (event.kind == PEER_LOST) {
+        PeerMember *gone = NULL;
+        int goneCount = 0;
+        accept_lost(peers, link, &event, &gone, &goneCount);
+        pthread_mutex_unlock(&peers->lock);
+        free(relay);
+        deliver_lost(peers, gone, goneCount);
+        return;
+    }
+    bool fresh = accept_event(peers, link, &event);
+    if (fresh && queue_on_links(peers, relay, link) > 0) {
+        __atomic_fetch_add(&link->relayed, 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&peers->lock);
+    free(relay);
+    if (!fresh) {
+        __atomic_fetch_add(&link->duplicates, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    if (event.kind != PEER_ROSTER) {
+        peers->deliver(peers->context, &event);
+    }
+}
+
+/*
+ * Function to check the hello a server sends first on a link, of the form
+ * PEER:<node>:<auth string>. Once accepted the link is sent the whole
+ * roster and starts getting events.
+ *
+ * @param link: The link.
+ *
+ * @param line: The first line read, NULL if the link closed.
+ *
+ * return's a bool indicating if the hello was accepted.
+*/
+static bool accept_hello(PeerLink *link, char *line) {
+    Peers *peers = link->peers;
+    if (line == NULL || strncmp(line, "PEER:", strlen("PEER:")) != 0) {
+        return false;
+    }
+    char *node = line + strlen("PEER:");
+    char *auth = strchr(node, ':');
+    if (auth == NULL) {
+        return false;
+    }
+    *auth++ = '\0';
+    if (strcmp(auth, peers->authString) != 0 ||
+            strcmp(node, peers->node) == 0) {
+        return false;
+    }
+    pthread_mutex_lock(&peers->lock);
+    for (int i = 0; i < peers->memberCount; ++i) {
+        PeerMember *member = &peers->members[i];
+        char *roster = format_event(PEER_ROSTER, member->origin, 0,
+                member->name, NULL);
+        link_queue(link, roster);
+        free(roster);
+    }
+    link->node = strdup(node);
+    pthread_mutex_unlock(&peers->lock);
+    return true;
+}
+
+/*
+ * Function run by a link's writer thread. Everything queued while the
+ * previous write was in progress is sent with the next write.
+ *
+ * @param linkInfo: The link.
+ *
+ * return's NULL once the link is down.
+*/
+static void *run_link_writer(void *linkInfo) {
+    PeerLink *link = (PeerLink *) linkInfo;
+    ByteBuffer batch;
+    memset(&batch, 0, sizeof(ByteBuffer));
+    pthread_mutex_lock(&link->lock);
+    while (1) {
+        while (link->up && byte_buffer_pending(&link->outbound) == 0) {
+            pthread_cond_wait(&link->ready, &link->lock);
+        }
+        if (!link->up) {
+            break;
+        }
+        ByteBuffer queued = link->outbound;
+        link->outbound = batch;
+        batch = queued;
+        pthread_mutex_unlock(&link->lock);
+        ssize_t written = byte_buffer_write(&batch, link->socket);
+        __atomic_fetch_add(&link->batches, 1, __ATOMIC_RELAXED);
+        pthread_mutex_lock(&link->lock);
+        if (written < 0) {
+            // The reader sees the link close and takes it down.
+            shutdown(link->socket, SHUT_RDWR);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&link->lock);
+    free(batch.data);
+    return NULL;
+}
+
+/*
+ * Function to take a link down. The chatters first learned from it are
+ * removed from the roster, the other links are sent a PEER_LOST for each
+ * and the server is told they left. A server still reaching one of them
+ * another way sends it back.
+ *
+ * @param link: The link.
+ *
+ * @param writer: The link's writer thread.
+ *
+ * return's nothing.
+*/
+static void link_down(PeerLink *link, pthread_t writer) {
+    Peers *peers = link->peers;
+    PeerMember *gone = NULL;
+    int goneCount = 0;
+    pthread_mutex_lock(&peers->lock);
+    free(link->node);
+    link->node = NULL;
+    for (int i = 0; i < peers->memberCount; ++i) {
+        if (peers->members[i].link == link) {
+            lose_member(peers, i--, NULL, &gone, &goneCount);
+        }
+    }
+    pthread_mutex_unlock(&peers->lock);
+    pthread_mutex_lock(&link->lock);
+    link->up = false;
+    link->outbound.start = link->outbound.length = 0;
+    pthread_cond_signal(&link->ready);
+    pthread_mutex_unlock(&link->lock);
+    pthread_join(writer, NULL);
+    close(link->socket);
+    deliver_lost(peers, gone, goneCount);
+}
+
+/*
+ * Function to run a link over a connected socket until it closes.
+ *
+ * @param link: The link.
+ *
+ * @param socket: The connected socket.
+ *
+ * return's nothing.
+*/
+static void run_link(PeerLink *link, int socket) {
+    Peers *peers = link->peers;
+    size_t length = strlen(peers->node) + strlen(peers->authString) + 8;
+    char *hello = (char *) malloc(sizeof(char) * length);
+    snprintf(hello, length, "PEER:%s:%s\n", peers->node, peers->authString);
+    pthread_mutex_lock(&link->lock);
+    link->socket = socket;
+    link->up = true;
+    byte_buffer_append(&link->outbound, hello, strlen(hello));
+    pthread_mutex_unlock(&link->lock);
+    free(hello);
+    pthread_t writer;
+    pthread_create(&writer, NULL, run_link_writer, (void *) link);
+    LineReader *reader = new_line_reader(socket);
+    if (accept_hello(link, read_line_blocking(reader))) {
+        char *line;
+        while ((line = read_line_blocking(reader)) != NULL) {
+            handle_link_line(link, line);
+        }
+    }
+    free_line_reader(reader);
+    link_down(link, writer);
+}
+
+/*
+ * Function to make a link and add it to the federation.
+ *
+ * @param peers: The federation state.
+ *
+ * @param address: host:port of an outgoing link, NULL if accepted.
+ *
+ * return's the link.
+*/
+static PeerLink *new_link(Peers *peers, char *address) {
+    PeerLink *link = (PeerLink *) calloc(1, sizeof(PeerLink));
+    link->address = address;
+    link->socket = -1;
+    link->peers = peers;
+    pthread_mutex_init(&link->lock, NULL);
+    pthread_cond_init(&link->ready, NULL);
+    pthread_mutex_lock(&peers->lock);
+    link->next = peers->links;
+    peers->links = link;
+    pthread_mutex_unlock(&peers->lock);
+    return link;
+}
+
+/*
+ * Function run by the thread of an accepted link. The link is removed and
+ * freed once it closes, the other server connects again if it wants to.
+ *
+ * @param linkInfo: The link.
+ *
+ * return's NULL.
+*/
+static void *run_accepted_link(void *linkInfo) {
+    PeerLink *link = (PeerLink *) linkInfo;
+    Peers *peers = link->peers;
+    run_link(link, link->socket);
+    pthread_mutex_lock(&peers->lock);
+    PeerLink **next = &peers->links;
+    while (*next != link) {
+        next = &(*next)->next;
+    }
+    *next = link->next;
+    pthread_mutex_unlock(&peers->lock);
+    free(link->outbound.data);
+    pthread_mutex_destroy(&link->lock);
+    pthread_cond_destroy(&link->ready);
+    free(link);
+    return NULL;
+}
+
+/*
+ * Function run by the thread accepting links from other servers.
+ *
+ * @param peersInfo: The federation state.
+ *
+ * return's NULL.
+*/
+static void *run_listener(void *peersInfo) {
+    Peers *peers = (Peers *) peersInfo;
+    while (1) {
+        int socket = accept(peers->listenSocket, NULL, NULL);
+        if (socket == -1) {
+            if (errno != EINTR) {
+                sleep(PEER_RETRY_DELAY);
+            }
+            continue;
+        }
+        PeerLink *link = new_link(peers, NULL);
+        link->socket = socket;
+        pthread_t thread;
+        pthread_create(&thread, NULL, run_accepted_link, (void *) link);
+        pthread_detach(thread);
+    }
+    return NULL;
+}
+
+/*
+ * Function to connect to another server.
+ *
+ * @param address: host:port, or just the port for this host.
+ *
+ * return's the connected socket or -1.
+*/
+static int open_peer_socket(char *address) {
+    char host[BUFFSIZE];
+    char *port = strrchr(address, ':');
+    if (port == NULL) {
+        strcpy(host, LOCALHOST);
+        port = address;
+    } else {
+        snprintf(host, sizeof(host), "%.*s", (int) (port - address),
+                address);
+        port++;
+    }
+    struct addrinfo hints, *result;
+    memset(&hints, 0, sizeof(struct addrinfo));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = DEFAULT_PROTOCOL;
+    if (getaddrinfo(host, port, &hints, &result) != 0) {
+        return -1;
+    }
+    int peerSocket = -1;
+    for (struct addrinfo *attempt = result; attempt != NULL;
+            attempt = attempt->ai_next) {
+        peerSocket = socket(attempt->ai_family, attempt->ai_socktype,
+                attempt->ai_protocol);
+        if (peerSocket == -1) {
+            continue;
+        }
+        if (connect(peerSocket, attempt->ai_addr,
+                attempt->ai_addrlen) == 0) {
+            break;
+        }
+        close(peerSocket);
+        peerSocket = -1;
+    }
+    freeaddrinfo(result);
+    return peerSocket;
+}
+
+/*
+ * Function run by the thread of an outgoing link. Connects, runs the link
+ * and connects again every PEER_RETRY_DELAY seconds after it closes.
+ *
+ * @param linkInfo: The link.
+ *
+ * return's NULL.
+*/
+static void *run_connector(void *linkInfo) {
+    PeerLink *link = (PeerLink *) linkInfo;
+    while (1) {
+        int socket = open_peer_socket(link->address);
+        if (socket != -1) {
+            run_link(link, socket);
+        }
+        sleep(PEER_RETRY_DELAY);
+    }
+    return NULL;
+}
+
+/*
+ * Function to create the federation state of a server.
+ *
+ * @param authString: The auth string other servers must present.
+ *
+ * @param deliver: Called with every new event from another server.
+ *
+ * @param context: Passed to deliver.
+ *
+ * return's the federation state.
+*/
+Peers *peers_create(char *authString, PeerDeliver deliver, void *context) {
+    Peers *peers = (Peers *) calloc(1, sizeof(Peers));
+    generate_node_id(peers->node);
+    peers->authString = authString ? authString : "";
+    peers->listenSocket = -1;
+    peers->deliver = deliver;
+    peers->context = context;
+    pthread_mutex_init(&peers->lock, NULL);
+    return peers;
+}
+
+/*
+ * Function to start accepting links from other servers.
+ *
+ * @param peers: The federation state.
+ *
+ * @param port: The port to listen on, "0" for any free port.
+ *
+ * return's a bool indicating if the server is listening for links.
+*/
+bool peers_listen(Peers *peers, char *port) {
+    struct addrinfo hints, *result;
+    memset(&hints, 0, sizeof(struct addrinfo));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = DEFAULT_PROTOCOL;
+    hints.ai_flags = AI_PASSIVE;
+    if (getaddrinfo(NULL, port, &hints, &result) != 0) {
+        return false;
+    }
+    peers->listenSocket = socket(result->ai_family, result->ai_socktype,
+            result->ai_protocol);
+    int v = 1;
+    setsockopt(peers->listenSocket, SOL_SOCKET, SO_REUSEADDR, &v, sizeof(v));
+    bool listening = peers->listenSocket != -1 &&
+            bind(peers->listenSocket, result->ai_addr,
+            result->ai_addrlen) == 0 &&
+            listen(peers->listenSocket, SOMAXCONN) == 0;
+    freeaddrinfo(result);
+    return listening && peers_listen_on(peers, peers->listenSocket);
+}
+
+/*
+ * Function to start accepting links on a socket which is already
+ * listening, such as one inherited in a hot upgrade.
+ *
+ * @param peers: The federation state.
+ *
+ * @param listenSocket: The listening socket.
+ *
+ * return's a bool indicating if the server is listening for links.
+*/
+bool peers_listen_on(Peers *peers, int listenSocket) {
+    struct sockaddr_in address;
+    socklen_t length = sizeof(address);
+    peers->listenSocket = listenSocket;
+    if (getsockname(peers->listenSocket, (struct sockaddr *) &address,
+            &length) == -1) {
+        return false;
+    }
+    peers->listenPort = ntohs(address.sin_port);
+    pthread_t thread;
+    pthread_create(&thread, NULL, run_listener, (void *) peers);
+    pthread_detach(thread);
+    return true;
+}
+
+/*
+ * Function to keep a link open to another server.
+ *
+ * @param peers: The federation state.
+ *
+ * @param address: host:port of the other server's peer port, or just the
+ *                 port for this host.
+ *
+ * return's nothing.
+*/
+void peers_connect(Peers *peers, char *address) {
+    PeerLink *link = new_link(peers, address);
+    pthread_t thread;
+    pthread_create(&thread, NULL, run_connector, (void *) link);
+    pthread_detach(thread);
+}
+
+/*
+ * Function to send an event that happened on this server to every other
+ * server.
+ *
+ * @param peers: The federation state, NULL if federation is off.
+ *
+ * @param kind: The kind of event.
+ *
+ * @param name: The chatter the event is about.
+ *
+ * @param text: The text of a PEER_SAY event, otherwise NULL.
+ *
+ * return's nothing.
+*/
+void peer_publish(Peers *peers, PeerEventKind kind, char *name, char *text) {
+    if (peers == NULL || name == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&peers->lock);
+    uint64_t sequence = ++peers->nextSequence;
+    if (kind == PEER_ENTER) {
+        add_member(peers, peers->node, name, NULL);
+    } else if (kind == PEER_LEAVE) {
+        int index = find_member(peers, peers->node, name);
+        if (index >= 0) {
+            remove_member(peers, index);
+        }
+    }
+    char *line = format_event(kind, peers->node, sequence, name,
+            kind == PEER_SAY ? (text ? text : "") : NULL);
+    queue_on_links(peers, line, NULL);
+    pthread_mutex_unlock(&peers->lock);
+    free(line);
+}
+
+/*
+ * Function to check if a chatter on another server has a name.
+ *
+ * @param peers: The federation state, NULL if federation is off.
+ *
+ * @param name: The name.
+ *
+ * return's a bool indicating if the name is taken on another server.
+*/
+bool peer_has_name(Peers *peers, char *name) {
+    bool found = false;
+    if (peers == NULL || name == NULL) {
+        return false;
+    }
+    pthread_mutex_lock(&peers->lock);
+    for (int i = 0; i < peers->memberCount && !found; ++i) {
+        found = peers->members[i].link != NULL &&
+                strcmp(peers->members[i].name, name) == 0;
+    }
+    pthread_mutex_unlock(&peers->lock);
+    return found;
+}
+
+/*
+ * Function to get the names of the chatters on other servers.
+ *
+ * @param peers: The federation state, NULL if federation is off.
+ *
+ * @param count: Set to the number of names.
+ *
+ * return's an array of names. The array and the names are to be freed by
+ * the caller.
+*/
+char **peer_remote_names(Peers *peers, int *count) {
+    *count = 0;
+    if (peers == NULL) {
+        return NULL;
+    }
+    pthread_mutex_lock(&peers->lock);
+    char **names = (char **) malloc(sizeof(char *) *
+            (peers->memberCount + 1));
+    for (int i = 0; i < peers->memberCount; ++i) {
+        if (peers->members[i].link != NULL) {
+            names[(*count)++] = strdup(peers->members[i].name);
+        }
+    }
+    pthread_mutex_unlock(&peers->lock);
+    return names;
+}
+
+/*
+ * Function to print the counters of every link.
+ *
+ * @param peers: The federation state.
+ *
+ * @param output: The stream to print to.
+ *
+ * return's nothing.
+*/
+void peer_print_stats(Peers *peers, FILE *output) {
+    pthread_mutex_lock(&peers->lock);
+    for (PeerLink *link = peers->links; link != NULL; link = link->next) {
+        fprintf(output, "%s:NODE:%s:UP:%d:SENT:%llu:RECEIVED:%llu:"
+                "RELAYED:%llu:DUPLICATES:%llu:BATCHES:%llu\n",
+                link->address ? link->address : "accepted",
+                link->node ? link->node : "-", link->node != NULL,
+                (unsigned long long) __atomic_load_n(&link->sent,
+                __ATOMIC_RELAXED),
+                (unsigned long long) __atomic_load_n(&link->received,
+                __ATOMIC_RELAXED),
+                (unsigned long long) __atomic_load_n(&link->relayed,
+                __ATOMIC_RELAXED),
+                (unsigned long long) __atomic_load_n(&link->duplicates,
+                __ATOMIC_RELAXED),
+                (unsigned long long) __atomic_load_n(&link->batches,
+                __ATOMIC_RELAXED));
+    }
+    pthread_mutex_unlock(&peers->lock);
+    fflush(output);
+}
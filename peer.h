@@ -0,0 +1,116 @@
+#ifndef PEER_H
+#define PEER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "shared.h"
+
+// Random bytes in a node id, sent as twice as many hex digits.
+#define PEER_NODE_BYTES 8
+// Seconds between attempts to (re)connect an outgoing link.
+#define PEER_RETRY_DELAY 1
+// Most bytes queued on a link. A server that falls this far behind is
+// dropped, as if its link had closed.
+#define PEER_OUTBOUND_LIMIT (4 * 1024 * 1024)
+
+// Kinds of event relayed between servers.
+typedef enum {
+    PEER_ENTER,
+    PEER_LEAVE,
+    PEER_SAY,
+    PEER_KICK,
+    PEER_ROSTER, // a chatter already present when a link came up
+    PEER_LOST, // a chatter the sender can no longer reach
+    PEER_FOUND, // a chatter the sender still reaches, sent after a PEER_LOST
+    PEER_INVALID
+} PeerEventKind;
+
+// An event as read from a link. The strings point into the line read.
+typedef struct {
+    PeerEventKind kind;
+    char *origin; // node id of the server the event started on.
+    // per origin, increasing. 0 for PEER_ROSTER and PEER_FOUND.
+    uint64_t sequence;
+    char *name;
+    char *text; // text of a PEER_SAY, the chatter's node for PEER_LOST.
+} PeerEvent;
+
+typedef struct PeerLink PeerLink;
+
+// A connection to another server. Outgoing events are queued on the link
+// and written by its writer thread, so whatever queues up while a write is
+// in progress goes out together in the next one.
+struct PeerLink {
+    char *address; // host:port of an outgoing link, NULL if accepted.
+    char *node; // node id of the server at the other end once known.
+    int socket;
+    bool up;
+
+    ByteBuffer outbound;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+
+    uint64_t sent; // events queued on the link.
+    uint64_t received; // events read from the link.
+    uint64_t relayed; // received events passed on to other links.
+    uint64_t duplicates; // received events already seen on another link.
+    uint64_t batches; // writes made by the writer thread.
+
+    struct Peers *peers;
+    PeerLink *next;
+};
+
+// A chatter known to the federation.
+typedef struct {
+    char *origin; // node the chatter is connected to.
+    char *name;
+    // link the chatter was first learned from, NULL if local. Following
+    // these links from server to server leads back to the chatter's node.
+    PeerLink *link;
+} PeerMember;
+
+// Highest sequence number seen from a node, used to drop events that
+// reach this server a second time round a loop of links.
+typedef struct {
+    char *origin;
+    uint64_t sequence;
+} PeerSeen;
+
+// Called for every event from another server that has to be shown to the
+// local clients.
+typedef void (*PeerDeliver)(void *context, PeerEvent *event);
+
+// The federation state of one server.
+typedef struct Peers {
+    char node[PEER_NODE_BYTES * 2 + 1];
+    char *authString;
+    uint64_t nextSequence;
+
+    int listenSocket;
+    int listenPort;
+
+    PeerLink *links;
+    PeerMember *members;
+    int memberCount;
+    PeerSeen *seen;
+    int seenCount;
+
+    PeerDeliver deliver;
+    void *context;
+
+    pthread_mutex_t lock;
+} Peers;
+
+Peers *peers_create(char *authString, PeerDeliver deliver, void *context);
+bool peers_listen(Peers *peers, char *port);
+bool peers_listen_on(Peers *peers, int listenSocket);
+void peers_connect(Peers *peers, char *address);
+void peer_publish(Peers *peers, PeerEventKind kind, char *name, char *text);
+bool peer_has_name(Peers *peers, char *name);
+char **peer_remote_names(Peers *peers, int *count);
+void peer_print_stats(Peers *peers, FILE *output);
+
+#endif //ass4_peer_h
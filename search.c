@@ -0,0 +1,426 @@
+#include "search.h"
+#include "names.h"
+#include "shared.h"
+#include <ctype.h>
+
+// Called for every word of a text, already lower case.
+typedef void (*TokenFunction)(void *context, const char *token);
+
+/*
+ * Function to split a text into words: runs of letters and digits, lower
+ * cased and cut to SEARCH_TOKEN_MAX characters.
+ *
+ * @param text: The text.
+ *
+ * @param function: Called once for every word, in order.
+ *
+ * @param context: Passed to function.
+ *
+ * return's nothing.
+*/
+static void for_each_token(const char *text, TokenFunction function,
+        void *context) {
+    char token[SEARCH_TOKEN_MAX + 1];
+    size_t length = 0;
+    for (;; ++text) {
+        unsigned char c = (unsigned char) *text;
+        if (isalnum(c)) {
+            if (length < SEARCH_TOKEN_MAX) {
+                token[length++] = tolower(c);
+            }
+            continue;
+        }
+        if (length > 0) {
+            token[length] = '\0';
+            function(context, token);
+            length = 0;
+        }
+        if (c == '\0') {
+            return;
+        }
+    }
+}
+
+/*
+ * Function to create an empty index.
+ *
+ * @param retain: The most messages kept, at least 1.
+ *
+ * @param maxAge: Nanoseconds a message is kept, 0 for no limit.
+ *
+ * return's the new index.
+*/
+SearchIndex *search_index_new(size_t retain, uint64_t maxAge) {
+    SearchIndex *index = (SearchIndex *) calloc(1, sizeof(SearchIndex));
+    index->retain = retain;
+    index->maxAge = maxAge;
+    index->messages = (RetainedMessage *) calloc(retain,
+            sizeof(RetainedMessage));
+    index->bucketCount = SEARCH_BUCKETS;
+    index->buckets = (SearchToken **) calloc(index->bucketCount,
+            sizeof(SearchToken *));
+    pthread_mutex_init(&index->lock, NULL);
+    return index;
+}
+
+/*
+ * Function to find a word in the index. Must be called with the index's
+ * lock held.
+ *
+ * @param index: The index.
+ *
+ * @param token: The word.
+ *
+ * @param hash: The hash of the word.
+ *
+ * @param previous: If not NULL, set to the link pointing at the word, so
+ *                  it can be unlinked.
+ *
+ * return's the word, NULL if it isn't in the index.
+*/
+static SearchToken *find_token(SearchIndex *index, const char *token,
+        uint32_t hash, SearchToken ***previous) {
+    SearchToken **link = &index->buckets[hash & (index->bucketCount - 1)];
+    for (; *link != NULL; link = &(*link)->next) {
+        if ((*link)->hash == hash && strcmp((*link)->text, token) == 0) {
+            if (previous != NULL) {
+                *previous = link;
+            }
+            return *link;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Function to double the buckets of the index and rehash its words. Must
+ * be called with the index's lock held.
+ *
+ * @param index: The index.
+ *
+ * return's nothing.
+*/
+static void grow_search_index(SearchIndex *index) {
+    size_t count = index->bucketCount * 2;
+    SearchToken **buckets = (SearchToken **) calloc(count,
+            sizeof(SearchToken *));
+    for (size_t i = 0; i < index->bucketCount; ++i) {
+        SearchToken *entry = index->buckets[i];
+        while (entry != NULL) {
+            SearchToken *next = entry->next;
+            size_t slot = entry->hash & (count - 1);
+            entry->next = buckets[slot];
+            buckets[slot] = entry;
+            entry = next;
+        }
+    }
+    free(index->buckets);
+    index->buckets = buckets;
+    index->bucketCount = count;
+}
+
+/*
+ * Function used with for_each_token() to add the message being added to
+ * the posting list of one of its words.
+ *
+ * @param context: The index.
+ *
+ * @param token: The word.
+ *
+ * return's nothing.
+*/
+static void post_token(void *context, const char *token) {
+    SearchIndex *index = (SearchIndex *) context;
+    uint64_t id = index->next;
+    uint32_t hash = name_hash(token);
+    SearchToken *entry = find_token(index, token, hash, NULL);
+    if (entry == NULL) {
+        if (index->tokenCount >= index->bucketCount * 2) {
+            grow_search_index(index);
+        }
+        size_t length = strlen(token) + 1;
+        entry = (SearchToken *) calloc(1, sizeof(SearchToken) + length);
+        memcpy(entry->text, token, length);
+        entry->hash = hash;
+        size_t slot = hash & (index->bucketCount - 1);
+        entry->next = index->buckets[slot];
+        index->buckets[slot] = entry;
+        index->tokenCount++;
+    }
+    PostingList *postings = &entry->postings;
+    if (postings->end > postings->start &&
+            postings->ids[postings->end - 1] == id) {
+        return; // the word was already seen in this message.
+    }
+    if (postings->end == postings->capacity) {
+        if (postings->start > 0) {
+            memmove(postings->ids, postings->ids + postings->start,
+                    sizeof(uint64_t) * (postings->end - postings->start));
+            postings->end -= postings->start;
+            postings->start = 0;
+        }
+        if (postings->end == postings->capacity) {
+            postings->capacity = postings->capacity ?
+                    postings->capacity * 2 : 4;
+            postings->ids = (uint64_t *) realloc(postings->ids,
+                    sizeof(uint64_t) * postings->capacity);
+        }
+    }
+    postings->ids[postings->end++] = id;
+}
+
+/*
+ * Function used with for_each_token() to take the oldest message off the
+ * posting list of one of its words, freeing the word once it is in no
+ * message.
+ *
+ * @param context: The index.
+ *
+ * @param token: The word.
+ *
+ * return's nothing.
+*/
+static void unpost_token(void *context, const char *token) {
+    SearchIndex *index = (SearchIndex *) context;
+    SearchToken **link;
+    SearchToken *entry = find_token(index, token, name_hash(token), &link);
+    if (entry == NULL) {
+        return;
+    }
+    PostingList *postings = &entry->postings;
+    if (postings->end == postings->start ||
+            postings->ids[postings->start] != index->first) {
+        return; // the word was seen twice in the message.
+    }
+    if (++postings->start < postings->end) {
+        return;
+    }
+    *link = entry->next;
+    free(postings->ids);
+    free(entry);
+    index->tokenCount--;
+}
+
+/*
+ * Function to drop the oldest message from the index. Must be called with
+ * the index's lock held.
+ *
+ * @param index: The index, holding at least one message.
+ *
+ * return's nothing.
+*/
+static void drop_oldest_message(SearchIndex *index) {
+    RetainedMessage *message = &index->messages[index->first %
+            index->retain];
+    for_each_token(message->text, unpost_token, index);
+    free(message->name);
+    free(message->text);
+    message->name = message->text = NULL;
+    index->first++;
+}
+
+/*
+ * Function to drop the messages older than the index keeps them. Must be
+ * called with the index's lock held.
+ *
+ * @param index: The index.
+ *
+ * @param now: The time now.
+ *
+ * return's nothing.
+*/
+static void drop_expired_messages(SearchIndex *index, uint64_t now) {
+    while (index->maxAge && index->first < index->next &&
+            now - index->messages[index->first % index->retain].time >
+            index->maxAge) {
+        drop_oldest_message(index);
+    }
+}
+
+/*
+ * Function to add a message to the index, dropping the oldest message if
+ * the index is full.
+ *
+ * @param index: The index.
+ *
+ * @param name: Who said it.
+ *
+ * @param text: The message.
+ *
+ * return's nothing.
+*/
+void search_index_add(SearchIndex *index, const char *name,
+        const char *text) {
+    uint64_t now = get_time_ns();
+    pthread_mutex_lock(&index->lock);
+    drop_expired_messages(index, now);
+    if (index->next - index->first == index->retain) {
+        drop_oldest_message(index);
+    }
+    RetainedMessage *message = &index->messages[index->next %
+            index->retain];
+    message->time = now;
+    message->name = strdup(name);
+    message->text = strdup(text);
+    for_each_token(text, post_token, index);
+    index->next++;
+    pthread_mutex_unlock(&index->lock);
+}
+
+/*
+ * Function to check if a posting list holds an id.
+ *
+ * @param postings: The posting list.
+ *
+ * @param id: The message id.
+ *
+ * return's a bool indicating if the id is in the list.
+*/
+static bool has_posting(PostingList *postings, uint64_t id) {
+    size_t low = postings->start, high = postings->end;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (postings->ids[middle] == id) {
+            return true;
+        }
+        if (postings->ids[middle] < id) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return false;
+}
+
+// The words of a search as they are looked up.
+typedef struct {
+    SearchIndex *index;
+    PostingList *lists[SEARCH_QUERY_TOKENS];
+    int count;
+    bool missing; // a word is in no message, so nothing matches.
+} SearchQuery;
+
+/*
+ * Function used with for_each_token() to look up one word of a search.
+ *
+ * @param context: The SearchQuery.
+ *
+ * @param token: The word.
+ *
+ * return's nothing.
+*/
+static void look_up_token(void *context, const char *token) {
+    SearchQuery *query = (SearchQuery *) context;
+    if (query->count == SEARCH_QUERY_TOKENS) {
+        return;
+    }
+    SearchToken *entry = find_token(query->index, token, name_hash(token),
+            NULL);
+    if (entry == NULL) {
+        query->missing = true;
+        return;
+    }
+    query->lists[query->count++] = &entry->postings;
+}
+
+/*
+ * Function to find the newest messages holding every word of a search.
+ * Only the shortest posting list is walked; the others are binary
+ * searched, so the cost depends on how rare the rarest word is rather
+ * than on how many messages are kept.
+ *
+ * @param index: The index.
+ *
+ * @param query: The words to search for, in any case.
+ *
+ * @param hits: Filled with the matching messages, oldest first.
+ *
+ * @param most: The most hits returned, the newest ones.
+ *
+ * return's the number of hits, to be freed with search_hits_free().
+*/
+int search_index_find(SearchIndex *index, const char *query,
+        SearchHit *hits, int most) {
+    uint64_t start = get_time_ns();
+    SearchQuery words;
+    memset(&words, 0, sizeof(SearchQuery));
+    words.index = index;
+    pthread_mutex_lock(&index->lock);
+    drop_expired_messages(index, start);
+    for_each_token(query, look_up_token, &words);
+    int found = 0;
+    if (!words.missing && words.count > 0) {
+        PostingList *shortest = words.lists[0];
+        for (int i = 1; i < words.count; ++i) {
+            if (words.lists[i]->end - words.lists[i]->start <
+                    shortest->end - shortest->start) {
+                shortest = words.lists[i];
+            }
+        }
+        for (size_t i = shortest->end; i > shortest->start &&
+                found < most; --i) {
+            uint64_t id = shortest->ids[i - 1];
+            bool match = true;
+            for (int j = 0; j < words.count && match; ++j) {
+                match = words.lists[j] == shortest ||
+                        has_posting(words.lists[j], id);
+            }
+            if (match) {
+                RetainedMessage *message = &index->messages[id %
+                        index->retain];
+                hits[found].name = strdup(message->name);
+                hits[found].text = strdup(message->text);
+                found++;
+            }
+        }
+    }
+    uint64_t took = get_time_ns() - start;
+    index->searches++;
+    if (took > index->maxSearch) {
+        index->maxSearch = took;
+    }
+    pthread_mutex_unlock(&index->lock);
+    for (int i = 0; i < found / 2; ++i) {
+        SearchHit newer = hits[i];
+        hits[i] = hits[found - 1 - i];
+        hits[found - 1 - i] = newer;
+    }
+    return found;
+}
+
+/*
+ * Function to free the copies held by search hits.
+ *
+ * @param hits: The hits.
+ *
+ * @param count: The number of hits.
+ *
+ * return's nothing.
+*/
+void search_hits_free(SearchHit *hits, int count) {
+    for (int i = 0; i < count; ++i) {
+        free(hits[i].name);
+        free(hits[i].text);
+    }
+}
+
+/*
+ * Function to print the size of the index and how its searches went: the
+ * messages and words held, the searches made and the longest search in
+ * microseconds.
+ *
+ * @param index: The index.
+ *
+ * @param output: Where the stats are printed.
+ *
+ * return's nothing.
+*/
+void search_index_print_stats(SearchIndex *index, FILE *output) {
+    pthread_mutex_lock(&index->lock);
+    fprintf(output, "MESSAGES:%llu:WORDS:%zu:SEARCHES:%llu:MAX_SEARCH:%llu\n",
+            (unsigned long long) (index->next - index->first),
+            index->tokenCount, (unsigned long long) index->searches,
+            (unsigned long long) index->maxSearch / 1000);
+    pthread_mutex_unlock(&index->lock);
+    fflush(output);
+}
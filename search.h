@@ -0,0 +1,73 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+
+// Longest word indexed, longer words are cut to this many characters.
+#define SEARCH_TOKEN_MAX 32
+// Most words of a search that are used, the rest are ignored.
+#define SEARCH_QUERY_TOKENS 8
+// Buckets the word table starts with, must be a power of two. The table
+// doubles once it holds twice as many words as buckets.
+#define SEARCH_BUCKETS 1024
+
+// Ids of the retained messages a word is in, oldest first. Messages are
+// only ever dropped oldest first, so ids only leave from the front.
+typedef struct {
+    uint64_t *ids;
+    size_t start; // first id still in use.
+    size_t end;
+    size_t capacity;
+} PostingList;
+
+// A word of the index. The text lives in the same allocation.
+typedef struct SearchToken {
+    struct SearchToken *next; // next word in the same bucket.
+    uint32_t hash;
+    PostingList postings;
+    char text[];
+} SearchToken;
+
+// A message kept for searching.
+typedef struct {
+    uint64_t time; // when it was said.
+    char *name;
+    char *text;
+} RetainedMessage;
+
+// A message found by a search, with copies of its name and text.
+typedef struct {
+    char *name;
+    char *text;
+} SearchHit;
+
+// Inverted index over the last messages said: every word maps to the ids
+// of the messages it is in. Message id n is kept in slot n % retain.
+typedef struct {
+    RetainedMessage *messages;
+    size_t retain; // most messages kept.
+    uint64_t maxAge; // nanoseconds a message is kept, 0 for no limit.
+    uint64_t first; // id of the oldest message kept.
+    uint64_t next; // id the next message gets.
+    SearchToken **buckets;
+    size_t bucketCount;
+    size_t tokenCount;
+    uint64_t searches;
+    uint64_t maxSearch; // nanoseconds the longest search took.
+    pthread_mutex_t lock;
+} SearchIndex;
+
+SearchIndex *search_index_new(size_t retain, uint64_t maxAge);
+void search_index_add(SearchIndex *index, const char *name,
+        const char *text);
+int search_index_find(SearchIndex *index, const char *query,
+        SearchHit *hits, int most);
+void search_hits_free(SearchHit *hits, int count);
+void search_index_print_stats(SearchIndex *index, FILE *output);
+
+#endif //ass4_search_h
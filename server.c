@@ -1,6 +1,8 @@
 #include "server.h"
 
 bool sigHup = false; // Global variable to indicate if SigHup happend
+bool sigUsr1 = false; // Global variable to indicate a latency reset request
+bool sigUsr2 = false; // Global variable to indicate a hot upgrade request
 
 /*
  * Function to update a SAY: message count of the client and server.
@@ -76,7 +78,370 @@ void update_kick_message_count(Server *server, Clients *client) {
 }
 
 /*
- * Function to broadcast a message to the clients.
+ * Function to wait for a chatter's stream before writing a frame to it. A
+ * chat frame also waits while any control frame is waiting, so control
+ * frames never queue behind the chat backlog. Writers on the same lane go
+ * in the order they came. Every call must be matched by a lane_leave().
+ *
+ * @param client: The chatter written to.
+ *
+ * @param lane: The Lane of the frame.
+ *
+ * return's nothing.
+*/
+void lane_enter(Clients *client, Lane lane) {
+    Outbound *outbound = &client->outbound;
+    LaneCount *count = &outbound->lanes[lane];
+    uint64_t start = get_time_ns();
+    MUTEX_LOCK(&outbound->lock);
+    uint64_t ticket = count->tickets++;
+    if (count->tickets - count->serving > count->deepest) {
+        count->deepest = count->tickets - count->serving;
+    }
+    LaneCount *control = &outbound->lanes[LANE_CONTROL];
+    while (outbound->writing || count->serving != ticket ||
+            (lane == LANE_CHAT && control->tickets != control->serving)) {
+        COND_WAIT(&outbound->open, &outbound->lock);
+    }
+    count->serving++;
+    outbound->writing = true;
+    uint64_t waited = get_time_ns() - start;
+    if (waited > count->maxWait) {
+        count->maxWait = waited;
+    }
+    MUTEX_UNLOCK(&outbound->lock);
+}
+
+/*
+ * Function to give up a chatter's stream once a frame has been written.
+ *
+ * @param client: The chatter written to.
+ *
+ * @param lane: The Lane passed to lane_enter().
+ *
+ * return's nothing.
+*/
+void lane_leave(Clients *client, Lane lane) {
+    Outbound *outbound = &client->outbound;
+    MUTEX_LOCK(&outbound->lock);
+    outbound->lanes[lane].frames++;
+    outbound->writing = false;
+    pthread_cond_broadcast(&outbound->open);
+    MUTEX_UNLOCK(&outbound->lock);
+}
+
+/*
+ * Function to check if a client thread's node is still its client's. The
+ * node may have been deleted, by a kick, and even reused since.
+ *
+ * @param client: The node the thread was started with.
+ *
+ * @param id: The id the node had then.
+ *
+ * return's a bool indicating if the client was deleted.
+*/
+bool is_client_gone(Clients *client, ClientHandle id) {
+    return client->isDeleted ||
+            __atomic_load_n(&client->id, __ATOMIC_ACQUIRE) != id;
+}
+
+/*
+ * Function to get the shard of the roster a name belongs in.
+ *
+ * @param server: The server struct.
+ *
+ * @param name: The name.
+ *
+ * return's the shard.
+*/
+ClientShard *name_shard(Server *server, const char *name) {
+    return &server->shards[SHARD_OF(name_hash(name))];
+}
+
+/*
+ * Function to add a chatter to a shard. Must be called with the shard's
+ * lock held.
+ *
+ * @param shard: The shard of the chatter's name.
+ *
+ * @param client: The chatter.
+ *
+ * return's nothing.
+*/
+void add_shard_member(ClientShard *shard, Clients *client) {
+    if (shard->count == shard->capacity) {
+        shard->capacity = shard->capacity ? shard->capacity * 2 :
+                CLIENT_SLAB_SLOTS;
+        shard->members = (Clients **) realloc(shard->members,
+                sizeof(Clients *) * shard->capacity);
+    }
+    client->rosterIndex = shard->count;
+    shard->members[shard->count++] = client;
+    __atomic_fetch_add(&client->server->rosterCount, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * Function to take a chatter out of its shard, moving the shard's last
+ * member into its place. Must be called with the shard's lock held.
+ *
+ * @param shard: The shard of the chatter's name.
+ *
+ * @param client: The chatter, a member of the shard.
+ *
+ * return's nothing.
+*/
+void remove_shard_member(ClientShard *shard, Clients *client) {
+    Clients *last = shard->members[--shard->count];
+    shard->members[client->rosterIndex] = last;
+    last->rosterIndex = client->rosterIndex;
+    client->rosterIndex = -1;
+    __atomic_fetch_sub(&client->server->rosterCount, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * Function to give a client a name if no other chatter has it. The client
+ * joins the name's shard but is not shown to the other chatters until
+ * list_client().
+ *
+ * @param server: The server struct.
+ *
+ * @param client: The client, not yet named.
+ *
+ * @param name: The name given by the client, NULL if it gave none.
+ *
+ * return's a bool indicating if the name was free.
+*/
+bool claim_client_name(Server *server, Clients *client, char *name) {
+    if (name == NULL || peer_has_name(server->peers, name)) {
+        return false;
+    }
+    ClientShard *shard = name_shard(server, name);
+    MUTEX_LOCK(&shard->lock);
+    for (int i = 0; i < shard->count; ++i) {
+        if (strcmp(shard->members[i]->name, name) == 0) {
+            MUTEX_UNLOCK(&shard->lock);
+            return false;
+        }
+    }
+    client->name = name_intern(server->names, name);
+    client->listed = false;
+    add_shard_member(shard, client);
+    MUTEX_UNLOCK(&shard->lock);
+    return true;
+}
+
+/*
+ * Function to show a named client to the other chatters, once it has been
+ * told its name was accepted.
+ *
+ * @param server: The server struct.
+ *
+ * @param client: The client.
+ *
+ * return's nothing.
+*/
+void list_client(Server *server, Clients *client) {
+    ClientShard *shard = name_shard(server, client->name);
+    MUTEX_LOCK(&shard->lock);
+    client->listed = true;
+    MUTEX_UNLOCK(&shard->lock);
+}
+
+/*
+ * Function to take a client out of the roster and mark it deleted before
+ * its connection is closed. A kick takes the chatter out itself, marking it
+ * deleted under the shard lock, and announces its leave. Only the client's
+ * own thread calls this, so once it returns true no kick can take the
+ * client.
+ *
+ * @param server: The server struct.
+ *
+ * @param client: The client.
+ *
+ * return's a bool indicating if the caller is to announce the leave, false
+ * if a kick has taken it out.
+*/
+bool leave_roster(Server *server, Clients *client) {
+    if (client->name == NULL) {
+        client->isDeleted = true;
+        return true;
+    }
+    ClientShard *shard = name_shard(server, client->name);
+    MUTEX_LOCK(&shard->lock);
+    bool kicked = client->isDeleted;
+    client->isDeleted = true;
+    if (client->rosterIndex >= 0) {
+        remove_shard_member(shard, client);
+    }
+    MUTEX_UNLOCK(&shard->lock);
+    return !kicked;
+}
+
+/*
+ * Function to append the listed chatters of a shard to a snapshot of the
+ * roster.
+ *
+ * @param shard: The shard.
+ *
+ * @param entries: The snapshot, grown as needed.
+ *
+ * @param count: The number of entries, updated.
+ *
+ * @param capacity: The entries the snapshot has room for, updated.
+ *
+ * return's nothing.
+*/
+void snapshot_shard(ClientShard *shard, RosterEntry **entries, int *count,
+        int *capacity) {
+    MUTEX_LOCK(&shard->lock);
+    if (*count + shard->count > *capacity) {
+        *capacity = (*count + shard->count) * 2;
+        *entries = (RosterEntry *) realloc(*entries,
+                sizeof(RosterEntry) * *capacity);
+    }
+    for (int j = 0; j < shard->count; ++j) {
+        Clients *member = shard->members[j];
+        if (member->listed && !member->isDeleted) {
+            (*entries)[*count].client = member;
+            (*entries)[(*count)++].id = member->id;
+        }
+    }
+    MUTEX_UNLOCK(&shard->lock);
+}
+
+/*
+ * Function to get every listed chatter, going through the shards in order
+ * and locking one at a time. Nothing is locked while the caller goes
+ * through the entries, so a chatter may be gone by the time it is used.
+ *
+ * @param server: The server struct.
+ *
+ * @param count: Set to the number of entries.
+ *
+ * return's the entries, to be freed by the caller.
+*/
+RosterEntry *snapshot_roster(Server *server, int *count) {
+    RosterEntry *entries = NULL;
+    int capacity = 0;
+    *count = 0;
+    for (int i = 0; i < CLIENT_SHARDS; ++i) {
+        snapshot_shard(&server->shards[i], &entries, count, &capacity);
+    }
+    return entries;
+}
+
+/*
+ * Function to lock every shard, in order, to read the whole roster as it
+ * is at one time.
+ *
+ * @param server: The server struct.
+ *
+ * return's nothing.
+*/
+void lock_roster(Server *server) {
+    for (int i = 0; i < CLIENT_SHARDS; ++i) {
+        MUTEX_LOCK(&server->shards[i].lock);
+    }
+}
+
+/*
+ * Function to unlock every shard locked by lock_roster().
+ *
+ * @param server: The server struct.
+ *
+ * return's nothing.
+*/
+void unlock_roster(Server *server) {
+    for (int i = CLIENT_SHARDS - 1; i >= 0; --i) {
+        MUTEX_UNLOCK(&server->shards[i].lock);
+    }
+}
+
+/*
+ * Function to write a broadcast to some of the chatters. The time each
+ * recipient's write completes is recorded in the STAGE_WRITE histogram.
+ *
+ * @param broadcast: The broadcast.
+ *
+ * @param roster: The chatters to write it to.
+ *
+ * @param count: The number of chatters.
+ *
+ * return's nothing.
+*/
+void write_broadcast(Broadcast *broadcast, RosterEntry *roster, int count) {
+    Server *server = broadcast->server;
+    for (int i = 0; i < count; ++i) {
+        Clients *temp = roster[i].client;
+        if (is_client_gone(temp, roster[i].id) ||
+                broadcast->record < temp->historyCutoff) {
+            continue; // gone, or it was replayed to the chatter
+        }
+        lane_enter(temp, LANE_CHAT);
+        // Checked again, its thread may have closed it while this waited.
+        if (!is_client_gone(temp, roster[i].id)) {
+            send_chat_message_to_clients(temp->toClient, "MSG",
+                    broadcast->name, broadcast->chat);
+        }
+        lane_leave(temp, LANE_CHAT);
+        uint64_t done = get_time_ns();
+        histogram_record(&server->latency[STAGE_WRITE],
+                done - broadcast->start);
+        uint64_t last = __atomic_load_n(&broadcast->done, __ATOMIC_RELAXED);
+        while (done > last && !__atomic_compare_exchange_n(&broadcast->done,
+                &last, done, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            continue;
+        }
+    }
+}
+
+/*
+ * Function run on a fan-out thread to write a broadcast to the chatters
+ * of one shard.
+ *
+ * @param context: The Broadcast.
+ *
+ * @param shard: The index of the shard.
+ *
+ * return's nothing.
+*/
+void broadcast_to_shard(void *context, int shard) {
+    Broadcast *broadcast = (Broadcast *) context;
+    RosterEntry *roster = NULL;
+    int count = 0, capacity = 0;
+    snapshot_shard(&broadcast->server->shards[shard], &roster, &count,
+            &capacity);
+    write_broadcast(broadcast, roster, count);
+    free(roster);
+}
+
+/*
+ * Function to keep a chat message in the history, as the MSG: line the
+ * clients are sent.
+ *
+ * @param server: The server struct.
+ *
+ * @param chat: The chat message sent.
+ *
+ * @param name: The name of the client that sent the message.
+ *
+ * return's the number of the record, UINT64_MAX if it couldn't be made.
+*/
+uint64_t record_history(Server *server, char *chat, char *name) {
+    char *line;
+    int length = asprintf(&line, "MSG:%s:%s\n", name, chat);
+    if (length < 0) {
+        return UINT64_MAX;
+    }
+    uint64_t record = history_append(server->history, line, length);
+    free(line);
+    return record;
+}
+
+/*
+ * Function to broadcast a message to the clients. A large roster is
+ * written from the fan-out threads, each taking the shards it owns, while
+ * the sender waits for them.
  *
  * @param server: The server struct which has all the information of the
  *                clients.
@@ -85,33 +450,107 @@ void update_kick_message_count(Server *server, Clients *client) {
  *
  * @param name: The name of the client that sent the message.
  *
- * return nothing.
+ * return's the time the last recipient was flushed.
+*/
+uint64_t broadcast_chat_message(Server *server, char *chat, char *name) {
+    Broadcast broadcast = {server, name, chat, get_time_ns(), 0, UINT64_MAX};
+    broadcast.done = broadcast.start;
+    if (server->history != NULL) {
+        broadcast.record = record_history(server, chat, name);
+    }
+    if (server->fanout != NULL && __atomic_load_n(&server->rosterCount,
+            __ATOMIC_RELAXED) >= FANOUT_MIN_RECIPIENTS) {
+        __atomic_fetch_add(&server->fanoutCount.parallel, 1,
+                __ATOMIC_RELAXED);
+        fanout_run(server->fanout, broadcast_to_shard, &broadcast);
+    } else {
+        __atomic_fetch_add(&server->fanoutCount.sequential, 1,
+                __ATOMIC_RELAXED);
+        int count;
+        RosterEntry *roster = snapshot_roster(server, &count);
+        write_broadcast(&broadcast, roster, count);
+        free(roster);
+    }
+    return broadcast.done;
+}
+
+/*
+ * Function to record the latency of a message that has been handled.
+ *
+ * @param server: The server struct holding the histograms.
+ *
+ * @param readTime: When the first byte of the message was read.
+ *
+ * @param parseTime: When the message was parsed.
+ *
+ * @param dispatchTime: When the fan out of the message started.
+ *
+ * @param doneTime: When the last recipient was flushed.
+ *
+ * return's nothing.
+*/
+void record_message_latency(Server *server, uint64_t readTime,
+        uint64_t parseTime, uint64_t dispatchTime, uint64_t doneTime) {
+    histogram_record(&server->latency[STAGE_PARSE], parseTime - readTime);
+    histogram_record(&server->latency[STAGE_DISPATCH], 
+            dispatchTime - parseTime);
+    histogram_record(&server->latency[STAGE_DELIVERED], doneTime - readTime);
+}
+
+/*
+ * Function to send the clients an ENTER: message. Clients that haven't
+ * finished naming themselves are skipped so their handshake isn't broken.
+ *
+ * @param server: The server struct.
+ *
+ * @param name: The name of the chatter which entered.
+ *
+ * return's nothing.
 */
-void broadcast_chat_message(Server *server, char *chat, char *name) {
-    Clients *temp = server->clients;
-    for (; temp != NULL; temp = temp->prev) {
-        if (!temp->isDeleted) {
-            send_chat_message_to_clients(temp->toClient, "MSG", name, chat); 
+void send_enter_message_to_clients(Server *server, char *name) {
+    int count;
+    RosterEntry *roster = snapshot_roster(server, &count);
+    for (int i = 0; i < count; ++i) {
+        Clients *temp = roster[i].client;
+        if (!is_client_gone(temp, roster[i].id)) {
+            lane_enter(temp, LANE_CHAT);
+            if (!is_client_gone(temp, roster[i].id)) {
+                send_enter_message(temp->toClient, "ENTER", name);
+            }
+            lane_leave(temp, LANE_CHAT);
         }
     }
+    free(roster);
 }
 
 /*
- * Function to send the clients an ENTER: message.
+ * Function to send the clients connected to this server a LEAVE: message.
+ *
+ * @param server: The server struct.
  *
- * @param clients: the clients that are connected.
+ * @param name: The name of the chatter which left.
  *
  * return's nothing.
 */
-void send_enter_message_to_clients(Clients *clients, char *name) {
-    Clients *temp = clients;
-    for (; temp != NULL; temp = temp->prev) {
-        send_enter_message(temp->toClient, "ENTER", name);
+void send_leave_to_local_clients(Server *server, char *name) {
+    int count;
+    RosterEntry *roster = snapshot_roster(server, &count);
+    for (int i = 0; i < count; ++i) {
+        Clients *temp = roster[i].client;
+        if (!is_client_gone(temp, roster[i].id)) {
+            lane_enter(temp, LANE_CHAT);
+            if (!is_client_gone(temp, roster[i].id)) {
+                send_leave_message(temp->toClient, "LEAVE", name);
+            }
+            lane_leave(temp, LANE_CHAT);
+        }
     }
+    free(roster);
 }
 
 /*
- * Function to send the clients a LEAVE: message.
+ * Function to send the clients a LEAVE: message, here and on every linked
+ * server.
  *
  * @param server: The server struct.
  *
@@ -120,54 +559,48 @@ void send_enter_message_to_clients(Clients *clients, char *name) {
  * return's nothing.
 */
 void send_left_message_to_clients(Server *server, Clients *leavingClient) {
-    Clients *temp = server->clients;
-    char *name = leavingClient->name;
-    for (; temp != NULL; temp = temp->prev) {
-        send_leave_message(temp->toClient, "LEAVE", name);
-    }
+    send_leave_to_local_clients(server, leavingClient->name);
+    peer_publish(server->peers, PEER_LEAVE, leavingClient->name, NULL);
 }
 
 /*
  * Function to print the name of the entering client.
  *
- * @param output: The FILE* indicating the standard output of the server.
+ * @param logger: The logger writing to the standard output of the server.
  *
  * @param name: The name of the client which is entering.
  *
  * return's nothing.
 */
-void print_client_name(FILE *output, char *name) {
-    fprintf(output, "(%s has entered the chat)\n", name);
-    fflush(output);
+void print_client_name(ChatLogger *logger, char *name) {
+    logger_printf(logger, "(%s has entered the chat)\n", name);
 }
 
 /*
  * Function to print the leaving client's name to standard out.
  *
- * @param output: The FILE* indicating the standard output of the server.
+ * @param logger: The logger writing to the standard output of the server.
  *
  * @param name: The name of the client which is leaving.
  *
  * return's nothing.
 */
-void print_left_client_info(FILE *output, char *name) {
-    fprintf(output, "(%s has left the chat)\n", name);
-    fflush(output);
+void print_left_client_info(ChatLogger *logger, char *name) {
+    logger_printf(logger, "(%s has left the chat)\n", name);
 }
 
 /*
  * Function to print the message sent by the client in the chat.
  *
- * @param output: The FILE * indicating the standard output of the server.
+ * @param logger: The logger writing to the standard output of the server.
  *
  * @param name: The name of the client who has sent the message.
  *
  * @param message: The message of the client.
  * return's nothing.
 */
-void print_chat_message(FILE *output, char *name, char *message) {
-    fprintf(output, "%s: %s\n", name, message);
-    fflush(output);
+void print_chat_message(ChatLogger *logger, char *name, char *message) {
+    logger_printf(logger, "%s: %s\n", name, message);
 }
 
 /*
@@ -183,6 +616,47 @@ int compare_names(const void *n1, const void *n2) {
     return strcmp(*((char **) n1), *((char **) n2));
 }
 
+/*
+ * Function to compare the names of two chatters.
+ *
+ * @param c1: chatter 1
+ *
+ * @param c2: chatter 2
+ *
+ * return's an int indicating which name is smaller.
+*/
+int compare_client_names(const void *c1, const void *c2) {
+    return strcmp((*((Clients **) c1))->name, (*((Clients **) c2))->name);
+}
+
+/*
+ * Function to copy the names of every listed chatter, going through the
+ * shards in order.
+ *
+ * @param server: The server struct.
+ *
+ * @param names: The names are appended to it, each ended by a '\0'.
+ *
+ * return's the number of names.
+*/
+int copy_roster_names(Server *server, ByteBuffer *names) {
+    int count = 0;
+    for (int i = 0; i < CLIENT_SHARDS; ++i) {
+        ClientShard *shard = &server->shards[i];
+        MUTEX_LOCK(&shard->lock);
+        for (int j = 0; j < shard->count; ++j) {
+            Clients *member = shard->members[j];
+            if (member->listed && !member->isDeleted) {
+                byte_buffer_append(names, member->name,
+                        strlen(member->name) + 1);
+                count++;
+            }
+        }
+        MUTEX_UNLOCK(&shard->lock);
+    }
+    return count;
+}
+
 /*
  * Function to get a client list.
  *
@@ -191,22 +665,27 @@ int compare_names(const void *n1, const void *n2) {
  * return's a string of the names of clients in a lexicographic order.
 */
 char *get_client_list(Server *server) {
-    char *buffer = (char *) malloc(sizeof(char) * 128);
-    int j = 0, names = 0;
-    Clients *clients = server->clients;
-    for (; clients != NULL; clients = clients->prev) {
-        if (!clients->isDeleted && clients->name != NULL) {
-            names++;
-        }
+    int j = 0, remoteCount;
+    size_t length = strlen("LIST:") + 1;
+    char **remoteNames = peer_remote_names(server->peers, &remoteCount);
+    for (int i = 0; i < remoteCount; ++i) {
+        length += strlen(remoteNames[i]) + 1;
     }
+    ByteBuffer local;
+    memset(&local, 0, sizeof(ByteBuffer));
+    int names = copy_roster_names(server, &local);
+    length += local.length;
+    char *buffer = (char *) malloc(sizeof(char) * length);
     int pos = 0;
-    char *clientNames[names];
-    clients = server->clients;
-    for (; clients != NULL; clients = clients->prev) {
-        if (!clients->isDeleted && clients->name != NULL) {
-            clientNames[pos++] = clients->name;
-        }
+    char *clientNames[names + remoteCount];
+    for (size_t offset = 0; pos < names; ++pos) {
+        clientNames[pos] = local.data + offset;
+        offset += strlen(clientNames[pos]) + 1;
+    }
+    for (int i = 0; i < remoteCount; ++i) {
+        clientNames[pos++] = remoteNames[i];
     }
+    names = pos;
     size_t size = sizeof(clientNames) / sizeof(char *);
     qsort(clientNames, size, sizeof(char *), compare_names);
     j = sprintf(buffer, "%s", "LIST:");
@@ -217,34 +696,102 @@ char *get_client_list(Server *server) {
         j += sprintf(buffer + j, "%s", clientNames[i]);
     }
     buffer[strlen(buffer)] = '\0';
+    for (int i = 0; i < remoteCount; ++i) {
+        free(remoteNames[i]);
+    }
+    free(remoteNames);
+    free(local.data);
     return buffer;
 }
 
 /*
- * Function to send a client a kick message.
+ * Function to answer a SEARCH: with the newest retained messages holding
+ * every word searched for, oldest first, followed by SEARCHED:.
  *
  * @param server: The server struct.
  *
- * @param name: The name of the client which is to be kicked.
+ * @param client: The client which searched.
+ *
+ * @param query: The words searched for, NULL if none were given.
  *
  * return's nothing.
 */
-void send_kick_message_to_client(Server *server, char *name) {
-    Clients *temp = server->clients;
-    if (name == NULL) {
-        return;
+void answer_search(Server *server, Clients *client, char *query) {
+    SearchHit hits[SEARCH_MAX_RESULTS];
+    int found = 0;
+    if (server->search != NULL && query != NULL) {
+        found = search_index_find(server->search, query, hits,
+                SEARCH_MAX_RESULTS);
     }
-    for (; temp != NULL; temp = temp->prev) {
-        if (strcmp(temp->name, name) == 0) {
-            send_kick_message(temp->toClient, "KICK:");
-            close(temp->socket);
-            send_left_message_to_clients(server, temp);
-            print_left_client_info(server->serverOut, name);
+    lane_enter(client, LANE_CONTROL);
+    for (int i = 0; i < found; ++i) {
+        send_found_message(client->toClient, hits[i].name, hits[i].text);
+    }
+    send_searched_message(client->toClient, found);
+    lane_leave(client, LANE_CONTROL);
+    search_hits_free(hits, found);
+}
+
+/*
+ * Function to kick a client connected to this server. The chatter is taken
+ * out of the roster, sent KICK: and its connection shut down, which ends
+ * its thread's read. Only that thread deletes the client, once the kick is
+ * done with it.
+ *
+ * @param server: The server struct.
+ *
+ * @param name: The name of the client which is to be kicked.
+ *
+ * return's a bool indicating if the client was found.
+*/
+bool kick_local_client(Server *server, char *name) {
+    ClientShard *shard = name_shard(server, name);
+    Clients *temp = NULL;
+    MUTEX_LOCK(&shard->lock);
+    for (int i = 0; i < shard->count && temp == NULL; ++i) {
+        Clients *member = shard->members[i];
+        if (member->listed && strcmp(member->name, name) == 0) {
+            temp = member;
+            remove_shard_member(shard, temp);
             temp->isDeleted = true;
-            delete_client(server, temp);
-            return;
+            temp->kicking = true;
         }
     }
+    MUTEX_UNLOCK(&shard->lock);
+    if (temp == NULL) {
+        return false;
+    }
+    // Out of the roster the chatter is this kick's to announce.
+    lane_enter(temp, LANE_CONTROL);
+    send_kick_message(temp->toClient, "KICK:");
+    lane_leave(temp, LANE_CONTROL);
+    shutdown(temp->socket, SHUT_RDWR);
+    if (temp->channel != NULL) {
+        shm_endpoint_close(temp->channel);
+    }
+    send_left_message_to_clients(server, temp);
+    print_left_client_info(server->logger, temp->name);
+    MUTEX_LOCK(&server->serverLock);
+    temp->kicking = false;
+    pthread_cond_broadcast(&server->kickDone);
+    MUTEX_UNLOCK(&server->serverLock);
+    return true;
+}
+
+/*
+ * Function to send a client a kick message. A name not connected to this
+ * server is passed on to the linked servers.
+ *
+ * @param server: The server struct.
+ *
+ * @param name: The name of the client which is to be kicked.
+ *
+ * return's nothing.
+*/
+void send_kick_message_to_client(Server *server, char *name) {
+    if (name != NULL && !kick_local_client(server, name)) {
+        peer_publish(server->peers, PEER_KICK, name, NULL);
+    }
 }
 
 /*
@@ -277,471 +824,2367 @@ void update_message_count(Clients *client, Server *server, ClientID messType) {
 }
 
 /*
- * Function to delete a client from the server.
+ * Function to write a whole buffer to a socket.
  *
- * @param server: The server struct which holds all the clients
+ * @param socket: The socket to write to.
  *
- * @param client: The client struct who is to be deleted.
+ * @param data: The bytes to write.
  *
- * return's nothing.
+ * @param length: The number of bytes.
+ *
+ * return's a bool indicating if everything was written.
 */
-void delete_client(Server *server, Clients *client) {
-    Clients *temp = server->clients, *prev;
-    if (temp != NULL && temp->id == client->id) {
-        server->clients = temp->prev;
-        free(temp);
-        server->clientCount--;
-        return;
-    }
-    while (temp != NULL && temp->id != client->id) {
-        prev = temp;
-        temp = temp->prev;
+bool send_all(int socket, const char *data, size_t length) {
+    while (length > 0) {
+        ssize_t count = write(socket, data, length);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += count;
+        length -= count;
     }
-    if (temp == NULL) {
-        return;
+    return true;
+}
+
+/*
+ * Function to store every complete message in the bytes written to a
+ * client into its backlog, numbering them with framesSent. Must be called
+ * with the sessionLock held.
+ *
+ * @param client: The client whose session is written to.
+ *
+ * @param data: The bytes written.
+ *
+ * @param size: The number of bytes.
+ *
+ * return's nothing.
+*/
+void record_session_frames(Clients *client, const char *data, size_t size) {
+    const char *end;
+    while ((end = memchr(data, '\n', size)) != NULL) {
+        size_t length = end - data + 1;
+        byte_buffer_append(&client->partial, data, length);
+        size_t pending = byte_buffer_pending(&client->partial);
+        char **slot = &client->backlog[client->framesSent % RESUME_BACKLOG];
+        *slot = realloc(*slot, pending + 1);
+        memcpy(*slot, client->partial.data + client->partial.start, pending);
+        (*slot)[pending] = '\0';
+        client->partial.start = client->partial.length = 0;
+        client->framesSent++;
+        data += length;
+        size -= length;
+    }
+    byte_buffer_append(&client->partial, data, size);
+}
+
+/*
+ * Function used as the write function of a client's toClient stream when
+ * sessions can be resumed. Messages are kept in the backlog and written to
+ * the socket unless the connection has dropped.
+ *
+ * @param cookie: The client.
+ *
+ * @param data: The bytes written to the stream.
+ *
+ * @param size: The number of bytes.
+ *
+ * return's size, a dropped connection isn't an error for the writer.
+*/
+ssize_t write_to_session(void *cookie, const char *data, size_t size) {
+    Clients *client = (Clients *) cookie;
+    MUTEX_LOCK(&client->sessionLock);
+    if (client->token != NULL) {
+        record_session_frames(client, data, size);
+    }
+    if (!client->detached) {
+        send_all(client->socket, data, size);
+    }
+    MUTEX_UNLOCK(&client->sessionLock);
+    return size;
+}
+
+/*
+ * Function to make a random resumption token.
+ *
+ * return's the token as a string of hex digits.
+*/
+char *generate_session_token(void) {
+    unsigned char bytes[TOKEN_BYTES];
+    FILE *random = fopen("/dev/urandom", "r");
+    if (random == NULL || fread(bytes, 1, TOKEN_BYTES, random) !=
+            TOKEN_BYTES) {
+        for (int i = 0; i < TOKEN_BYTES; ++i) {
+            bytes[i] = (unsigned char) (get_time_ns() >> (i % 8 * 8)) ^
+                    (unsigned char) rand();
+        }
+    }
+    if (random != NULL) {
+        fclose(random);
+    }
+    char *token = (char *) malloc(sizeof(char) * (TOKEN_BYTES * 2 + 1));
+    for (int i = 0; i < TOKEN_BYTES; ++i) {
+        sprintf(token + i * 2, "%02x", bytes[i]);
+    }
+    return token;
+}
+
+/*
+ * Function to send a client its resumption token. Every message sent to
+ * the client after the token is kept in its backlog.
+ *
+ * @param client: The client which finished its handshake.
+ *
+ * return's nothing.
+*/
+void issue_session_token(Clients *client) {
+    char *token = generate_session_token();
+    send_token_message(client->toClient, token);
+    MUTEX_LOCK(&client->sessionLock);
+    client->backlog = (char **) calloc(RESUME_BACKLOG, sizeof(char *));
+    client->framesSent = 0;
+    client->token = token;
+    MUTEX_UNLOCK(&client->sessionLock);
+}
+
+/*
+ * Function to free the session state of a client.
+ *
+ * @param client: The client.
+ *
+ * return's nothing.
+*/
+void free_session(Clients *client) {
+    if (client->backlog != NULL) {
+        for (int i = 0; i < RESUME_BACKLOG; ++i) {
+            free(client->backlog[i]);
+        }
+        free(client->backlog);
+    }
+    free(client->token);
+    free(client->partial.data);
+}
+
+/*
+ * Function to make a client stream use a buffer inside the Clients node.
+ *
+ * @param stream: The newly opened stream, may be NULL.
+ *
+ * @param buffer: The node's CLIENT_STREAM_BUFFSIZE byte buffer.
+ *
+ * @param mode: _IOFBF, or READ_BUFFERING for fromClient.
+ *
+ * return's the stream.
+*/
+FILE *compact_stream(FILE *stream, char *buffer, int mode) {
+    if (stream != NULL) {
+        setvbuf(stream, buffer, mode, CLIENT_STREAM_BUFFSIZE);
+    }
+    return stream;
+}
+
+/*
+ * Function to open the toClient and fromClient streams on a client's
+ * socket. The socket is closed along with the streams: with toClient, and
+ * fromClient reads from a duplicate of it, or with fromClient when
+ * toClient writes to the session.
+ *
+ * @param server: The server struct.
+ *
+ * @param client: The client.
+ *
+ * return's nothing.
+*/
+void open_client_streams(Server *server, Clients *client) {
+    if (server->resumeGrace) {
+        cookie_io_functions_t functions = {NULL, write_to_session, NULL,
+                NULL};
+        client->toClient = compact_stream(fopencookie(client, "w",
+                functions), client->toBuffer, _IOFBF);
+        client->fromClient = compact_stream(fdopen(client->socket, "r"),
+                client->fromBuffer, READ_BUFFERING);
+    } else {
+        client->toClient = compact_stream(fdopen(client->socket, "w"),
+                client->toBuffer, _IOFBF);
+        client->fromClient = compact_stream(fdopen(dup(client->socket),
+                "r"), client->fromBuffer, READ_BUFFERING);
+    }
+}
+
+/*
+ * Function to close a client's streams, and with them its socket. The
+ * streams of a shared-memory channel leave the socket open, so it is
+ * closed here.
+ *
+ * @param client: The client.
+ *
+ * return's nothing.
+*/
+void close_client_streams(Clients *client) {
+    if (client->toClient != NULL) {
+        fclose(client->toClient);
+        client->toClient = NULL;
+    }
+    if (client->fromClient != NULL) {
+        fclose(client->fromClient);
+        client->fromClient = NULL;
+    }
+    if (client->channel != NULL) {
+        close(client->socket);
+    }
+}
+
+/*
+ * Function to add a slab of free Clients nodes, giving them the slots
+ * after the last slab's. Must be called with the slabLock held.
+ *
+ * @param server: The server struct.
+ *
+ * return's nothing.
+*/
+void add_client_slab(Server *server) {
+    if (server->slabCount == server->slabCapacity) {
+        server->slabCapacity = server->slabCapacity ?
+                server->slabCapacity * 2 : CLIENT_INITIAL_SLABS;
+        server->slabs = (ClientSlab **) realloc(server->slabs,
+                sizeof(ClientSlab *) * server->slabCapacity);
+    }
+    ClientSlab *slab = (ClientSlab *) malloc(sizeof(ClientSlab));
+    uint32_t first = (uint32_t) server->slabCount * CLIENT_SLAB_SLOTS;
+    server->slabs[server->slabCount++] = slab;
+    for (int i = 0; i < CLIENT_SLAB_SLOTS; ++i) {
+        slab->slots[i].id = CLIENT_HANDLE(first + i, 0);
+        // Kept across reuse, a writer may still be leaving a deleted node.
+        pthread_mutex_init(&slab->slots[i].outbound.lock, NULL);
+        pthread_cond_init(&slab->slots[i].outbound.open, NULL);
+        slab->slots[i].outbound.writing = false;
+        memset(slab->slots[i].outbound.lanes, 0,
+                sizeof(slab->slots[i].outbound.lanes));
+        slab->slots[i].next = i + 1 < CLIENT_SLAB_SLOTS ?
+                &slab->slots[i + 1] : NULL;
+    }
+    if (server->lastFreeClient != NULL) {
+        server->lastFreeClient->next = &slab->slots[0];
+    } else {
+        server->freeClients = &slab->slots[0];
+    }
+    server->lastFreeClient = &slab->slots[CLIENT_SLAB_SLOTS - 1];
+}
+
+/*
+ * Function to take a Clients node for a new connection. Deleted nodes are
+ * reused oldest first, and a new slab is allocated once there are none.
+ * The node keeps the id of its slot's current generation.
+ *
+ * @param server: The server struct.
+ *
+ * return's the node, its other contents are left to new_client().
+*/
+Clients *take_client_node(Server *server) {
+    MUTEX_LOCK(&server->slabLock);
+    if (server->freeClients == NULL) {
+        add_client_slab(server);
+    }
+    Clients *client = server->freeClients;
+    server->freeClients = client->next;
+    if (server->freeClients == NULL) {
+        server->lastFreeClient = NULL;
+    }
+    MUTEX_UNLOCK(&server->slabLock);
+    return client;
+}
+
+/*
+ * Function to give back the node of a deleted client along with its name.
+ * The slot moves to its next generation so the old id stops matching.
+ *
+ * @param server: The server struct.
+ *
+ * @param client: The deleted client.
+ *
+ * return's nothing.
+*/
+void free_client_node(Server *server, Clients *client) {
+    name_release(server->names, client->name);
+    client->name = NULL;
+    MUTEX_LOCK(&server->slabLock);
+    __atomic_store_n(&client->id, CLIENT_HANDLE(HANDLE_SLOT(client->id),
+            HANDLE_GENERATION(client->id) + 1), __ATOMIC_RELEASE);
+    client->next = NULL;
+    if (server->lastFreeClient != NULL) {
+        server->lastFreeClient->next = client;
+    } else {
+        server->freeClients = client;
+    }
+    server->lastFreeClient = client;
+    MUTEX_UNLOCK(&server->slabLock);
+}
+
+/*
+ * Function to find a client by id in constant time.
+ *
+ * @param server: The server struct.
+ *
+ * @param id: The id, as the client's node had it.
+ *
+ * return's the client, NULL if it has since been deleted.
+*/
+Clients *find_client(Server *server, ClientHandle id) {
+    uint32_t slot = HANDLE_SLOT(id);
+    Clients *client = NULL;
+    MUTEX_LOCK(&server->slabLock);
+    if (slot / CLIENT_SLAB_SLOTS < (uint32_t) server->slabCount) {
+        client = &server->slabs[slot / CLIENT_SLAB_SLOTS]->slots[slot %
+                CLIENT_SLAB_SLOTS];
+        if (client->id != id) {
+            client = NULL;
+        }
+    }
+    MUTEX_UNLOCK(&server->slabLock);
+    return client;
+}
+
+/*
+ * Function to add a detached session to the server's table of them by
+ * token. Must be called with the serverLock held.
+ *
+ * @param server: The server struct.
+ *
+ * @param client: The detached client, which has a token.
+ *
+ * return's nothing.
+*/
+void add_detached_session(Server *server, Clients *client) {
+    Clients **bucket = &server->sessions[SESSION_OF(name_hash(
+            client->token))];
+    client->nextSession = *bucket;
+    *bucket = client;
+}
+
+/*
+ * Function to take a session out of the server's table of detached ones.
+ * Must be called with the serverLock held.
+ *
+ * @param server: The server struct.
+ *
+ * @param client: The client, which still has its token.
+ *
+ * return's nothing.
+*/
+void remove_detached_session(Server *server, Clients *client) {
+    Clients **link = &server->sessions[SESSION_OF(name_hash(
+            client->token))];
+    while (*link != NULL && *link != client) {
+        link = &(*link)->nextSession;
+    }
+    if (*link != NULL) {
+        *link = client->nextSession;
+    }
+}
+
+/*
+ * Function to break a client thread's wait for its next message. Does
+ * nothing if the thread isn't waiting for one.
+ *
+ * @param client: The client.
+ *
+ * return's nothing.
+*/
+void wake_client(Clients *client) {
+    MUTEX_LOCK(&client->readLock);
+    if (client->awaitingMessage) {
+        pthread_kill(client->thread, WAKE_SIGNAL);
+    }
+    MUTEX_UNLOCK(&client->readLock);
+}
+
+/*
+ * Function called by the timer wheel when a connection's handshake
+ * deadline passes. The socket is shut down, which ends the read its thread
+ * is blocked in.
+ *
+ * @param context: The client.
+ *
+ * return's 0, the timer is not armed again.
+*/
+uint64_t handshake_expired(void *context) {
+    Clients *client = (Clients *) context;
+    __atomic_fetch_add(&client->server->timerCount.handshakesExpired, 1,
+            __ATOMIC_RELAXED);
+    shutdown(client->socket, SHUT_RDWR);
+    return 0;
+}
+
+/*
+ * Function called by the timer wheel for a chatter's keepalive. A chatter
+ * silent for the keepalive period has its thread send PING:, and one still
+ * silent a period after the PING: went out has its socket shut down, which
+ * its thread sees as the connection dropping.
+ *
+ * @param context: The client.
+ *
+ * return's the milliseconds until the timer fires again, 0 if it doesn't.
+*/
+uint64_t keepalive_expired(void *context) {
+    Clients *client = (Clients *) context;
+    Server *server = client->server;
+    uint64_t period = server->keepalive * 1000ULL;
+    uint64_t idle = (get_time_ns() - __atomic_load_n(&client->lastActivity,
+            __ATOMIC_ACQUIRE)) / 1000000;
+    if (idle < period) {
+        return period - idle;
+    }
+    int state = __atomic_load_n(&client->keepaliveState, __ATOMIC_ACQUIRE);
+    if (state == KEEPALIVE_IDLE) {
+        __atomic_store_n(&client->keepaliveState, KEEPALIVE_PING_DUE,
+                __ATOMIC_RELEASE);
+        wake_client(client);
+        return period;
+    } else if (state == KEEPALIVE_PING_DUE) {
+        // The thread was busy or the wake was missed, try again shortly.
+        wake_client(client);
+        return WHEEL_TICK_MS;
+    }
+    __atomic_fetch_add(&server->timerCount.idleDropped, 1, __ATOMIC_RELAXED);
+    shutdown(client->socket, SHUT_RDWR);
+    return 0;
+}
+
+/*
+ * Function to start a chatter's keepalive, if the server has one.
+ *
+ * @param server: The server struct.
+ *
+ * @param client: The chatter, whose handshake timer is no longer armed.
+ *
+ * return's nothing.
+*/
+void start_keepalive(Server *server, Clients *client) {
+    __atomic_store_n(&client->lastActivity, get_time_ns(), __ATOMIC_RELEASE);
+    __atomic_store_n(&client->keepaliveState, KEEPALIVE_IDLE,
+            __ATOMIC_RELEASE);
+    if (server->keepalive) {
+        timer_init(&client->timer, keepalive_expired, client);
+        timer_arm(server->timers, &client->timer, server->keepalive * 1000ULL);
+    }
+}
+
+/*
+ * Function called by a chatter's thread before waiting for its next
+ * message, to send the PING: its keepalive asked for.
+ *
+ * @param server: The server struct.
+ *
+ * @param client: The chatter.
+ *
+ * return's nothing.
+*/
+void send_due_ping(Server *server, Clients *client) {
+    if (__atomic_load_n(&client->keepaliveState, __ATOMIC_ACQUIRE) !=
+            KEEPALIVE_PING_DUE) {
+        return;
+    }
+    lane_enter(client, LANE_CONTROL);
+    send_ping_message(client->toClient, "PING:");
+    lane_leave(client, LANE_CONTROL);
+    int due = KEEPALIVE_PING_DUE;
+    __atomic_compare_exchange_n(&client->keepaliveState, &due,
+            KEEPALIVE_PINGED, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&server->timerCount.pingsSent, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * Function called when a client's connection drops. The session is kept
+ * for the server's resumeGrace seconds without telling the other clients,
+ * and a connection presenting the token may take it over in that time.
+ *
+ * @param server: The server struct.
+ *
+ * @param client: The client whose connection dropped.
+ *
+ * return's a bool indicating if the session was resumed.
+*/
+bool wait_for_resume(Server *server, Clients *client) {
+    if (server->resumeGrace == 0 || client->token == NULL) {
+        return false;
+    }
+    timer_cancel(server->timers, &client->timer);
+    MUTEX_LOCK(&server->serverLock);
+    MUTEX_LOCK(&client->sessionLock);
+    client->detached = true;
+    fclose(client->fromClient);
+    client->fromClient = NULL;
+    client->socket = -1;
+    MUTEX_UNLOCK(&client->sessionLock);
+    add_detached_session(server, client);
+    MUTEX_UNLOCK(&server->serverLock);
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += server->resumeGrace;
+    while (sem_timedwait(&client->resumed, &deadline) != 0) {
+        if (errno == EINTR) {
+            continue;
+        }
+        MUTEX_LOCK(&server->serverLock);
+        MUTEX_LOCK(&client->sessionLock);
+        bool expired = client->detached;
+        if (expired) {
+            remove_detached_session(server, client);
+            free(client->token);
+            client->token = NULL;
+        }
+        MUTEX_UNLOCK(&client->sessionLock);
+        MUTEX_UNLOCK(&server->serverLock);
+        if (expired) {
+            return false;
+        }
+        // Resumed just as the grace period ran out, take the post.
+        sem_wait(&client->resumed);
+        break;
+    }
+    client->fromClient = compact_stream(fdopen(client->socket, "r"),
+            client->fromBuffer, READ_BUFFERING);
+    start_keepalive(server, client);
+    return true;
+}
+
+/*
+ * Function to hand a session a new connection. The client is sent OK:
+ * followed by every message after the first frames it already has that is
+ * still in the backlog. Must be called with the sessionLock held.
+ *
+ * @param session: The detached session.
+ *
+ * @param socket: The socket of the resuming connection.
+ *
+ * @param frames: The number of messages the client received.
+ *
+ * return's nothing.
+*/
+void replay_session(Clients *session, int socket, uint64_t frames) {
+    uint64_t first = frames;
+    if (session->framesSent > RESUME_BACKLOG &&
+            first < session->framesSent - RESUME_BACKLOG) {
+        first = session->framesSent - RESUME_BACKLOG;
+    }
+    send_all(socket, "OK:\n", strlen("OK:\n"));
+    for (uint64_t sequence = first; sequence < session->framesSent;
+            ++sequence) {
+        char *frame = session->backlog[sequence % RESUME_BACKLOG];
+        if (frame != NULL) { // sent before a hot upgrade
+            send_all(socket, frame, strlen(frame));
+        }
+    }
+    send_all(socket, session->partial.data + session->partial.start,
+            byte_buffer_pending(&session->partial));
+    session->socket = socket;
+    session->detached = false;
+}
+
+/*
+ * Function to resume a session for a connection which sent RESUME: in
+ * place of AUTH:.
+ *
+ * @param server: The server struct.
+ *
+ * @param current: The resuming connection.
+ *
+ * @param request: The "token:frames" sent by the client.
+ *
+ * return's a bool indicating if a session was resumed. The connection's
+ * socket has then been handed to the session.
+*/
+bool resume_session(Server *server, Clients *current, char *request) {
+    char *separator = strrchr(request, ':');
+    char *end;
+    if (separator == NULL) {
+        return false;
+    }
+    *separator = '\0';
+    unsigned long long frames = strtoull(separator + 1, &end, 10);
+    if (separator[1] == '\0' || *end != '\0') {
+        return false;
+    }
+    bool resumed = false;
+    MUTEX_LOCK(&server->serverLock);
+    Clients **link = &server->sessions[SESSION_OF(name_hash(request))];
+    for (; *link != NULL; link = &(*link)->nextSession) {
+        Clients *session = *link;
+        // Tokens in the table are only freed under the serverLock.
+        if (session->isDeleted || strcmp(session->token, request) != 0) {
+            continue;
+        }
+        MUTEX_LOCK(&session->sessionLock);
+        if (frames <= session->framesSent) {
+            *link = session->nextSession;
+            replay_session(session, dup(current->socket), frames);
+            resumed = true;
+        }
+        MUTEX_UNLOCK(&session->sessionLock);
+        if (resumed) {
+            sem_post(&session->resumed);
+        }
+        break;
+    }
+    MUTEX_UNLOCK(&server->serverLock);
+    return resumed;
+}
+
+/*
+ * Function to add a client to the newest end of a list of clients. Must be
+ * called with the serverLock held.
+ *
+ * @param list: The newest client of the list, the server's clients or
+ *              handshakes.
+ *
+ * @param client: The client.
+ *
+ * return's nothing.
+*/
+void link_client(Clients **list, Clients *client) {
+    client->prev = *list;
+    client->next = NULL;
+    if (*list != NULL) {
+        (*list)->next = client;
+    }
+    *list = client;
+}
+
+/*
+ * Function to take a client out of a list of clients. Must be called with
+ * the serverLock held.
+ *
+ * @param list: The newest client of the list the client is in.
+ *
+ * @param client: The client.
+ *
+ * return's nothing.
+*/
+void unlink_client(Clients **list, Clients *client) {
+    if (client->next != NULL) {
+        client->next->prev = client->prev;
+    } else {
+        *list = client->prev;
+    }
+    if (client->prev != NULL) {
+        client->prev->next = client->next;
+    }
+}
+
+/*
+ * Function to move a connection which has authenticated and claimed a name
+ * out of the handshake stage and into the server's clients. It isn't
+ * listed yet, so no kick can have deleted it.
+ *
+ * @param server: The server struct.
+ *
+ * @param client: The client.
+ *
+ * return's nothing.
+*/
+void register_client(Server *server, Clients *client) {
+    MUTEX_LOCK(&server->serverLock);
+    unlink_client(&server->handshakes, client);
+    server->handshaking--;
+    link_client(&server->clients, client);
+    server->clientCount++;
+    client->registered = true;
+    server->handshakeCount.registered++;
+    MUTEX_UNLOCK(&server->serverLock);
+}
+
+/*
+ * Function to delete a client from the server, once it is out of the
+ * roster and its streams are closed. Only the client's own thread calls
+ * this. Must be called with the serverLock held.
+ *
+ * @param server: The server struct which holds all the clients
+ *
+ * @param client: The client struct who is to be deleted.
+ *
+ * return's nothing.
+*/
+void delete_client(Server *server, Clients *client) {
+    if (client->registered) {
+        unlink_client(&server->clients, client);
+        server->clientCount--;
+    } else {
+        unlink_client(&server->handshakes, client);
+        server->handshaking--;
+    }
+    timer_cancel(server->timers, &client->timer);
+    free_session(client);
+    free_client_node(server, client);
+}
+
+/*
+ * Function to read a SAY: after its first character, keeping to the
+ * server's maxSay. A longer one is cut short, dropped or, if it is to be
+ * streamed, returned with more set and the rest of its text unread.
+ *
+ * @param server: The server struct.
+ *
+ * @param input: The FILE * of the client socket to read from.
+ *
+ * return's the message.
+*/
+ClientMessage read_say_frame(Server *server, FILE *input) {
+    ClientMessage msg = parse_say_message_bounded(input, server->maxSay);
+    FrameCount *count = &server->frameCount;
+    if (!msg.more) {
+        return msg;
+    }
+    if (server->oversize == OVERSIZE_STREAM) {
+        __atomic_fetch_add(&count->streamed, 1, __ATOMIC_RELAXED);
+        return msg;
+    }
+    __atomic_fetch_add(&count->discardedBytes, skip_line(input),
+            __ATOMIC_RELAXED);
+    msg.more = false;
+    if (server->oversize == OVERSIZE_REJECT) {
+        free(msg.message);
+        msg.message = NULL;
+        msg.messID = C_INVALID;
+        __atomic_fetch_add(&count->rejected, 1, __ATOMIC_RELAXED);
+    } else {
+        __atomic_fetch_add(&count->truncated, 1, __ATOMIC_RELAXED);
+    }
+    return msg;
+}
+
+/*
+ * Function to parse a message from the client on a first character basis.
+ *
+ * @param server: The server struct.
+ *
+ * @param input: The FILE * of the client socket to read from.
+ *
+ * @param readTime: If not NULL, set to the time the first byte was read.
+*/
+ClientMessage parse_message_from_client(Server *server, FILE *input,
+        uint64_t *readTime) {
+    ClientMessage msg;
+    msg.message = NULL;
+    msg.messID = C_INVALID;
+    char first = fgetc(input);
+    if (readTime != NULL) {
+        *readTime = get_time_ns();
+    }
+    switch (first) {
+        case 'A':
+            msg = parse_auth_message(input, server->authString);
+            break;
+        case 'N':
+            msg = parse_name_message(input);
+            break;
+        case 'S':
+            first = fgetc(input);
+            ungetc(first, input);
+            if (first == 'E') {
+                msg = parse_search_message(input);
+            } else {
+                msg = read_say_frame(server, input);
+            }
+            break;
+        case 'L':
+            first = fgetc(input);
+            if (first == 'E') {
+                msg = parse_leave_message(input);
+            }
+            if (first == 'I') {
+                msg = parse_list_message(input);
+            }
+            break;
+        case 'K':
+            msg = parse_kick_message(input);
+            break;
+        case 'R':
+            msg = parse_resume_message(input);
+            break;
+        case 'P':
+            msg = parse_pong_message(input);
+            break;
+        default:
+            break;
+    }
+    return msg;
+}
+
+/*
+ * Function used as the handler of WAKE_SIGNAL. It does nothing, the
+ * signal is only sent to break a blocking read.
+ *
+ * @param signal: The signal.
+ *
+ * return's nothing.
+*/
+void wake_client_thread(const int signal) {
+}
+
+/*
+ * Function to check if a stream has read ahead bytes not yet consumed.
+ * Looks into the glibc FILE, as gnulib's freadahead() does. Elsewhere
+ * fromClient is unbuffered (see READ_BUFFERING), so nothing is read ahead.
+ *
+ * @param input: The stream.
+ *
+ * return's true if the next read is served from the stream's buffer.
+*/
+bool input_buffered(FILE *input) {
+#ifdef __GLIBC__
+    return input->_IO_read_ptr < input->_IO_read_end;
+#else
+    return false;
+#endif
+}
+
+/*
+ * Function to stop a client thread at the start of a message while the
+ * server hands its connections over in a hot upgrade. Returns only if the
+ * upgrade is called off; otherwise the process exits with it stopped.
+ *
+ * @param server: The server struct.
+ *
+ * @param client: The client whose thread stops.
+ *
+ * return's nothing.
+*/
+void park_for_upgrade(Server *server, Clients *client) {
+    MUTEX_LOCK(&server->upgradeLock);
+    client->parked = true;
+    pthread_cond_broadcast(&server->upgradeCond);
+    while (server->upgrading) {
+        COND_WAIT(&server->upgradeCond, &server->upgradeLock);
+    }
+    client->parked = false;
+    MUTEX_UNLOCK(&server->upgradeLock);
+}
+
+/*
+ * Function to block until a client's next message starts arriving. The
+ * wait can be broken with WAKE_SIGNAL without losing anything, as
+ * nothing of the message has been read yet.
+ *
+ * @param client: The client.
+ *
+ * return's false if the wait was broken by the signal.
+*/
+bool wait_for_message(Clients *client) {
+    if (input_buffered(client->fromClient)) {
+        return true;
+    }
+    MUTEX_LOCK(&client->readLock);
+    client->awaitingMessage = true;
+    MUTEX_UNLOCK(&client->readLock);
+    int next = fgetc(client->fromClient);
+    int error = errno;
+    MUTEX_LOCK(&client->readLock);
+    client->awaitingMessage = false;
+    MUTEX_UNLOCK(&client->readLock);
+    if (next != EOF) {
+        ungetc(next, client->fromClient);
+        return true;
+    }
+    if (ferror(client->fromClient) && error == EINTR) {
+        clearerr(client->fromClient);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Function to pass on the rest of a SAY: being streamed. Each maxSay
+ * characters are sent on as a message of their own once they are read.
+ *
+ * @param server: The server struct.
+ *
+ * @param client: The client the SAY: is from.
+ *
+ * @param more: true if the SAY: was cut short and streamed.
+ *
+ * return's nothing.
+*/
+void stream_rest_of_say(Server *server, Clients *client, bool more) {
+    while (more) {
+        char *chunk = read_line_bounded(client->fromClient, server->maxSay,
+                &more);
+        if (chunk == NULL) {
+            return;
+        }
+        print_chat_message(server->logger, client->name, chunk);
+        broadcast_chat_message(server, chunk, client->name);
+        peer_publish(server->peers, PEER_SAY, client->name, chunk);
+        free(chunk);
+    }
+}
+
+/*
+ * Function to take a chatter whose connection is ending out of the roster
+ * and tell the chat it left. Nothing is announced if a kick took it out
+ * first, the kick announces it.
+ *
+ * @param server: The server struct.
+ *
+ * @param client: The chatter.
+ *
+ * return's nothing.
+*/
+void announce_leave(Server *server, Clients *client) {
+    if (!leave_roster(server, client)) {
+        return;
+    }
+    send_left_message_to_clients(server, client);
+    print_left_client_info(server->logger, client->name);
+}
+
+/*
+ * Function which adds a client to the chat lobby and starts chatting.
+ *
+ * @param server: the server struct which has all the clients stored.
+ *
+ * @param verifiedClient: The client which has been verified.
+ *
+ * @param id: The client's id when its thread started.
+ *
+ * return's a bool indicating wether to close the connection or not.
+*/
+bool add_client_to_chat_lobby(Server *server, Clients *verifiedClient,
+        ClientHandle id) {
+    ClientMessage msg;
+    memset(&msg, 0, sizeof(ClientMessage));
+    char *list = NULL;
+    uint64_t readTime, parseTime, dispatchTime, doneTime;
+    verifiedClient->inLobby = true;
+    start_keepalive(server, verifiedClient);
+    while (1) {
+        if (is_client_gone(verifiedClient, id)) {
+            break;
+        }
+        if (server->upgrading &&
+                !input_buffered(verifiedClient->fromClient)) {
+            park_for_upgrade(server, verifiedClient);
+        }
+        send_due_ping(server, verifiedClient);
+        if (!wait_for_message(verifiedClient)) {
+            continue;
+        }
+        msg = parse_message_from_client(server, verifiedClient->fromClient,
+                &readTime);
+        if (is_client_gone(verifiedClient, id)) {
+            // Kicked while it was read, the frame is not acted on.
+            free(msg.message);
+            return false;
+        }
+        parseTime = get_time_ns();
+        __atomic_store_n(&verifiedClient->lastActivity, parseTime,
+                __ATOMIC_RELEASE);
+        __atomic_store_n(&verifiedClient->keepaliveState, KEEPALIVE_IDLE,
+                __ATOMIC_RELEASE);
+        switch (msg.messID) {
+            case C_SAY:
+                update_message_count(verifiedClient, server, C_SAY);
+                print_chat_message(server->logger, verifiedClient->name, 
+                        msg.message);
+                if (server->search != NULL) {
+                    search_index_add(server->search, verifiedClient->name,
+                            msg.message);
+                }
+                dispatchTime = get_time_ns();
+                doneTime = broadcast_chat_message(server, msg.message, 
+                        verifiedClient->name);
+                peer_publish(server->peers, PEER_SAY, verifiedClient->name,
+                        msg.message);
+                record_message_latency(server, readTime, parseTime,
+                        dispatchTime, doneTime);
+                free(msg.message);
+                stream_rest_of_say(server, verifiedClient, msg.more);
+                break;
+            case C_LIST:
+                update_message_count(verifiedClient, server, C_LIST);
+                list = get_client_list(server);
+                dispatchTime = get_time_ns();
+                lane_enter(verifiedClient, LANE_CONTROL);
+                send_list_to_client(verifiedClient->toClient, list);
+                lane_leave(verifiedClient, LANE_CONTROL);
+                doneTime = get_time_ns();
+                histogram_record(&server->latency[STAGE_WRITE],
+                        doneTime - dispatchTime);
+                record_message_latency(server, readTime, parseTime,
+                        dispatchTime, doneTime);
+                free(list);
+                break;
+            case C_SEARCH:
+                dispatchTime = get_time_ns();
+                answer_search(server, verifiedClient, msg.message);
+                doneTime = get_time_ns();
+                record_message_latency(server, readTime, parseTime,
+                        dispatchTime, doneTime);
+                free(msg.message);
+                break;
+            case C_KICK:
+                update_message_count(verifiedClient, server, C_KICK);
+                dispatchTime = get_time_ns();
+                send_kick_message_to_client(server, msg.message);
+                doneTime = get_time_ns();
+                record_message_latency(server, readTime, parseTime,
+                        dispatchTime, doneTime);
+                break;
+            case C_PONG:
+                continue;
+            case C_LEAVE:
+                update_message_count(0, server, C_LEAVE);
+                announce_leave(server, verifiedClient);
+                return false;
+            default: 
+                if (!feof(verifiedClient->fromClient) &&
+                        !ferror(verifiedClient->fromClient)) {
+                    msg.messID = C_INVALID;
+                    break;
+                }
+                if (is_client_gone(verifiedClient, id)) {
+                    return false;
+                }
+                if (wait_for_resume(server, verifiedClient)) {
+                    break;
+                }
+                announce_leave(server, verifiedClient);
+                return false;
+        }
+        usleep(100000);
+    }
+    return false;
+}
+
+/*
+ * Ask name from the client by sending a WHO: message.
+ *
+ * @param client: The client whose name is to be asked.
+ *
+ * return's a ClientMessage struct indicating the message type recieved from
+ * the client.
+*/
+ClientMessage ask_name_from_client(Clients *client) {
+    send_who_message(client->toClient, "WHO:");
+    ClientMessage msg = parse_name_message(client->fromClient);
+    if (msg.messID == C_NAME_TAKEN) {
+        return msg;
+    } else if (msg.messID == C_LEAVE) {
+        return msg;
+    }
+    return msg;
+}
+
+/*
+ * Function to send AUTH: to a client on the Unix socket and take up a
+ * shared-memory channel if it answers with an offer of one. On taking it
+ * the client is sent OK: on the socket and its streams are opened on the
+ * channel, where AUTH: is sent again. An offer is turned down by sending
+ * AUTH: on the socket, as it is when sessions can be resumed since those
+ * replay over a socket. Without a channel the streams are opened on the
+ * socket.
+ *
+ * @param client: The client struct of the connection.
+ *
+ * return's nothing.
+*/
+void accept_channel_offer(Clients *client) {
+    ShmEndpoint *channel = NULL;
+    int fd = -2;
+    if (send_all(client->socket, "AUTH:\n", strlen("AUTH:\n"))) {
+        fd = shm_receive_offer(client->socket);
+    }
+    if (fd >= 0 && !client->server->resumeGrace) {
+        channel = shm_endpoint_attach(client->socket, fd);
+    } else if (fd >= 0) {
+        close(fd);
+    }
+    const char *reply = channel != NULL ? SHM_ACCEPT : "AUTH:\n";
+    if (fd != -2 && !send_all(client->socket, reply, strlen(reply))) {
+        shm_endpoint_free(channel);
+        channel = NULL;
+    }
+    if (channel == NULL) {
+        open_client_streams(client->server, client);
+        return;
+    }
+    client->channel = channel;
+    client->toClient = compact_stream(shm_endpoint_stream(channel, "w"),
+            client->toBuffer, _IOFBF);
+    client->fromClient = compact_stream(shm_endpoint_stream(channel, "r"),
+            client->fromBuffer, READ_BUFFERING);
+    send_auth_message_to_client(client->toClient, "AUTH:");
+}
+
+/*
+ * Function to list a client as its history replay is picked, with the
+ * history locked. A message recorded before this is replayed to the
+ * client and skipped by its broadcast, one recorded after finds the
+ * client listed.
+ *
+ * @param context: The client.
+ *
+ * @param end: The number of the first record not replayed.
+ *
+ * return's nothing.
+*/
+void list_replayed_client(void *context, uint64_t end) {
+    Clients *client = (Clients *) context;
+    client->historyCutoff = end;
+    list_client(client->server, client);
+}
+
+/*
+ * Function to replay the last chat messages kept in the history to a
+ * client which has just been sent its OK:, listing it once they are
+ * picked. They are sent from the segment files straight to the socket,
+ * unless the client talks over a shared-memory channel. Must be called
+ * with the client's control lane held, so the broadcasts that find it
+ * listed are written after the replay.
+ *
+ * @param server: The server struct.
+ *
+ * @param client: The client.
+ *
+ * return's nothing.
+*/
+void replay_history(Server *server, Clients *client) {
+    if (client->channel != NULL) {
+        history_replay(server->history, -1, client->toClient,
+                list_replayed_client, client);
+    } else {
+        fflush(client->toClient);
+        history_replay(server->history, client->socket, NULL,
+                list_replayed_client, client);
+    }
+}
+
+/*
+ * Function to check the auth status after sending an AUTH: message to client.
+ *
+ * @param client: The client struct to whom the message is to be sent.
+ *
+ * @param authString: The authString to get accepted.
+ *
+ * @param resumeRequest: Set to the "token:frames" of a RESUME: reply.
+ *
+ * return's an int indicating successfull auth or not.
+ * 0 is success, 1 is failure and 2 is a request to resume a session.
+*/
+int get_auth_status(Clients *client, char *authString, char **resumeRequest) {
+    if (client->isUnix) {
+        accept_channel_offer(client);
+    } else {
+        send_auth_message_to_client(client->toClient, "AUTH:");
+    }
+    ClientMessage auth = parse_message_from_client(client->server,
+            client->fromClient, NULL);
+    if (auth.messID == C_RESUME) {
+        *resumeRequest = auth.message;
+        return 2;
+    }
+    if (auth.messID == C_AUTH) {
+        if (strlen(authString) == 0 && auth.message == 0) {
+            return 0;
+        } else if (strcmp(auth.message, authString) == 0) {
+            return 0;
+        } else {
+            return 1;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Function to clean up after a client thread is done with its connection.
+ *
+ * @param server: The server struct.
+ *
+ * @param current: The client.
+ *
+ * @param holdConnect: false if the connection is to be closed.
+ *
+ * @param channel: The client's shared-memory channel, NULL if none.
+ *
+ * return's nothing.
+*/
+void finish_client(Server *server, Clients *current, bool holdConnect,
+        ShmEndpoint *channel) {
+    if (!holdConnect) {
+        leave_roster(server, current);
+        MUTEX_LOCK(&server->serverLock);
+        while (current->kicking) {
+            COND_WAIT(&server->kickDone, &server->serverLock);
+        }
+        MUTEX_UNLOCK(&server->serverLock);
+        timer_cancel(server->timers, &current->timer);
+        // Writers that found the client before it was marked deleted are
+        // let through first, any after see it gone.
+        lane_enter(current, LANE_CONTROL);
+        lane_leave(current, LANE_CONTROL);
+        close_client_streams(current);
+        MUTEX_LOCK(&server->serverLock);
+        delete_client(server, current);
+        MUTEX_UNLOCK(&server->serverLock);
+    }
+    shm_endpoint_free(channel);
+}
+
+/*
+ * Function which handles a client connection after a client connects
+ *
+ * @param clientInfo: The client struct of the connection passed on by the
+ *                    thread.
+ *
+ * return's NULL.
+*/
+void *handle_client(void *clientInfo) {
+    Clients *current = (Clients *) clientInfo;
+    Server *server = current->server;
+    ClientHandle id = current->id;
+    char *resumeRequest = NULL;
+    int authStatus = get_auth_status(current, server->authString,
+            &resumeRequest);
+    // Unmapped by this thread once it is done reading from the channel.
+    ShmEndpoint *channel = current->channel;
+    bool holdConnect = true;
+    switch (authStatus) { 
+        case 0:
+            update_auth_message_count(server);
+            send_ok_message(current->toClient, "OK:");
+            ClientMessage msg = ask_name_from_client(current);
+            if (msg.messID == C_LEAVE) {
+                holdConnect = false;
+                break;
+            }
+            while (!claim_client_name(server, current, msg.message)) {
+                if (feof(current->fromClient) || 
+                        ferror(current->fromClient)) {
+                    break;
+                }
+                send_name_taken_message(current->toClient, "NAME_TAKEN:");
+                msg = ask_name_from_client(current);
+            }
+            if (current->name == NULL) { // closed, or its deadline passed
+                holdConnect = false;
+                break;
+            }
+            register_client(server, current);
+            lane_enter(current, LANE_CONTROL);
+            send_ok_message(current->toClient, "OK:");
+            if (server->history != NULL) {
+                replay_history(server, current);
+            }
+            lane_leave(current, LANE_CONTROL);
+            if (server->resumeGrace) {
+                issue_session_token(current);
+            }
+            timer_cancel(server->timers, &current->timer);
+            update_name_message_count(server);
+            list_client(server, current);
+            send_enter_message_to_clients(server, current->name);
+            peer_publish(server->peers, PEER_ENTER, current->name, NULL);
+            print_client_name(server->logger, current->name);
+            holdConnect = add_client_to_chat_lobby(server, current, id);
+            break;
+        case 1:
+            update_auth_message_count(server);
+            holdConnect = false;
+            break;
+        case 2:
+            // Resumed or not, this connection's own thread is done.
+            if (server->resumeGrace) {
+                resume_session(server, current, resumeRequest);
+            }
+            free(resumeRequest);
+            holdConnect = false;
+            break;
+    }
+    finish_client(server, current, holdConnect, channel);
+    return NULL;
+}
+
+/*
+ * Function to create a new Client struct. Must be called with the
+ * serverLock held.
+ *
+ * @param server: Takes in the server struct.
+ *
+ * @param registered: true to add it to the server's clients, false to add
+ *                    it to the handshakes.
+ *
+ * return's a new Client struct.
+*/
+Clients *new_client(Server *server, bool registered) {
+    Clients *client = take_client_node(server);
+    link_client(registered ? &server->clients : &server->handshakes, client);
+    client->registered = registered;
+    client->server = server;
+    client->name = NULL;
+    client->rosterIndex = -1;
+    client->listed = false;
+    client->historyCutoff = 0;
+    client->isDeleted = false;
+    client->kicking = false;
+    client->isUnix = false;
+    client->channel = NULL;
+    client->inLobby = false;
+    client->awaitingMessage = false;
+    client->parked = false;
+    pthread_mutex_init(&client->readLock, NULL);
+    timer_init(&client->timer, handshake_expired, client);
+    client->lastActivity = 0;
+    client->keepaliveState = KEEPALIVE_IDLE;
+    memset(&client->messageCount, 0, sizeof(ClientMessageCount));
+    MUTEX_LOCK(&client->outbound.lock);
+    for (int lane = 0; lane < LANE_COUNT; ++lane) {
+        // The tickets carry on, a writer may still hold one from before.
+        client->outbound.lanes[lane].frames = 0;
+        client->outbound.lanes[lane].deepest = 0;
+        client->outbound.lanes[lane].maxWait = 0;
+    }
+    MUTEX_UNLOCK(&client->outbound.lock);
+    client->token = NULL;
+    client->detached = false;
+    client->nextSession = NULL;
+    client->framesSent = 0;
+    client->backlog = NULL;
+    memset(&client->partial, 0, sizeof(ByteBuffer));
+    pthread_mutex_init(&client->sessionLock, NULL);
+    sem_init(&client->resumed, 0, 0);
+    return client;
+}
+
+/*
+ * Function to add an accepted connection to the handshake stage and start
+ * the thread which handles it. If the stage already holds handshakeLimit
+ * connections the connection is closed instead.
+ *
+ * @param server: The server struct containign the server info.
+ *
+ * @param socket: The accepted socket.
+ *
+ * @param portNumber: The client's port, 0 for a Unix socket.
+ *
+ * @param isUnix: true if the connection came in on the Unix socket.
+ *
+ * return's nothing.
+*/
+void add_client_connection(Server *server, int socket, int portNumber,
+        bool isUnix) {
+    MUTEX_LOCK(&server->serverLock);
+    if (server->handshakeLimit &&
+            server->handshaking >= server->handshakeLimit) {
+        server->handshakeCount.refused++;
+        MUTEX_UNLOCK(&server->serverLock);
+        close(socket);
+        return;
+    }
+    Clients *newClient = new_client(server, false);
+    newClient->socket = socket;
+    newClient->portNumber = portNumber;
+    newClient->isUnix = isUnix;
+    newClient->toClient = newClient->fromClient = NULL;
+    if (!isUnix) { // a Unix one may yet move to a channel
+        open_client_streams(server, newClient);
+    }
+    if (++server->handshaking > server->handshakeCount.deepest) {
+        server->handshakeCount.deepest = server->handshaking;
+    }
+    if (server->handshakeTimeout) {
+        timer_arm(server->timers, &newClient->timer,
+                server->handshakeTimeout * 1000ULL);
+    }
+    pthread_create(&newClient->thread, &server->clientThreads, handle_client,
+            (void *) newClient);
+    pthread_detach(newClient->thread);
+    MUTEX_UNLOCK(&server->serverLock);
+}
+
+/*
+ * Function which accept's the client connection.
+ *
+ * @param server: The server struct containign the server info.
+ *
+ * return's nothing.
+*/
+void accept_client_connections(Server *server) {
+    struct sockaddr_in client;
+    socklen_t socklen = sizeof(client);
+    int socket = accept(server->socket, (struct sockaddr *) &client, &socklen);
+    if (socket == -1) {
+        fprintf(stderr, "Communications error\n");
+        exit(COMMS_ERROR);
+    }
+    add_client_connection(server, socket, ntohs(client.sin_port), false);
+}
+
+/*
+ * Function run by the thread accepting connections on the Unix socket.
+ *
+ * @param serverInfo: The server struct.
+ *
+ * return's NULL.
+*/
+void *accept_unix_connections(void *serverInfo) {
+    Server *server = (Server *) serverInfo;
+    while (1) {
+        int socket = accept(server->unixSocket, NULL, NULL);
+        if (socket == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            fprintf(stderr, "Communications error\n");
+            exit(COMMS_ERROR);
+        }
+        add_client_connection(server, socket, 0, true);
+    }
+    return NULL;
+}
+
+/*
+ * Function to listen on the server's Unix socket path, if it has one, and
+ * start the thread accepting connections on it. A file left at the path
+ * by an earlier run is removed first.
+ *
+ * @param server: The server struct.
+ *
+ * return's a bool indicating if the socket is listening.
+*/
+bool start_unix_listener(Server *server) {
+    if (server->unixPath == NULL) {
+        return true;
+    }
+    if (server->unixSocket != -1) { // inherited in a hot upgrade
+        pthread_t unixThread;
+        pthread_create(&unixThread, NULL, accept_unix_connections,
+                (void *) server);
+        pthread_detach(unixThread);
+        return true;
+    }
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(struct sockaddr_un));
+    address.sun_family = AF_UNIX;
+    if (strlen(server->unixPath) >= sizeof(address.sun_path)) {
+        return false;
+    }
+    strcpy(address.sun_path, server->unixPath);
+    server->unixSocket = socket(AF_UNIX, SOCK_STREAM, DEFAULT_PROTOCOL);
+    if (server->unixSocket == -1) {
+        return false;
+    }
+    unlink(server->unixPath);
+    if (bind(server->unixSocket, (struct sockaddr *) &address,
+            sizeof(struct sockaddr_un)) != 0 ||
+            listen(server->unixSocket, SOMAXCONN) != 0) {
+        close(server->unixSocket);
+        return false;
+    }
+    pthread_t unixThread;
+    pthread_create(&unixThread, NULL, accept_unix_connections,
+            (void *) server);
+    pthread_detach(unixThread);
+    return true;
+}
+
+/*
+ * Function to start the server. Print's the port number to stderr.
+ *
+ * @param server: Takes in the server struct.
+ *
+ * return's a bool indicating if the server could be started or not.
+*/
+bool start_server(Server *server) {
+    struct sockaddr_in socket;
+    socklen_t socklen = sizeof(socket);
+    if (getsockname(server->socket, (struct sockaddr *) &socket,
+            &socklen) == -1) {
+        return false;
+    }
+    server->actualPort = ntohs(socket.sin_port);
+    server->port = int_to_string(server->actualPort);
+    
+    MUTEX_LOCK(&server->serverLock);
+    fprintf(stderr, "%s\n", server->port);
+    if (server->peers != NULL && server->peers->listenPort) {
+        fprintf(stderr, "%d\n", server->peers->listenPort);
+    }
+    fflush(stderr);
+    MUTEX_UNLOCK(&server->serverLock);
+    return true;
+}
+
+/*
+ * Function to see if the server is listening or not.
+ *
+ * @param server: Takes in the Server struct.
+ *
+ * return's a bool indicating if the server ha sstarted listening for
+ * connections or not.
+*/
+bool is_server_listening(Server *server) {
+    struct addrinfo hints, *result;
+    memset(&hints, 0, sizeof(struct addrinfo));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = DEFAULT_PROTOCOL;
+    hints.ai_flags = AI_PASSIVE;
+    if (getaddrinfo(server->host, server->port, &hints,
+            &result) != 0) {
+        return false;
+    }
+    for (struct addrinfo *attempt = result; attempt != NULL; 
+            attempt = attempt->ai_next) {
+        server->socket = socket(attempt->ai_family, attempt->ai_socktype,
+                attempt->ai_protocol);
+        if (server->socket == -1) {
+            continue;
+        }
+        int v = 1;
+        setsockopt(server->socket, SOL_SOCKET, SO_REUSEADDR, &v, sizeof(v));
+        if (bind(server->socket, attempt->ai_addr, 
+                attempt->ai_addrlen) != 0) {
+            close(server->socket);
+            continue;    
+        }
+    }
+    if (listen(server->socket, SOMAXCONN)) {
+        perror("Listen");
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Function which run's a server and performs various steps into making
+ * a server struct perform like a server.
+ *
+ * @param server: The server struct.
+ *
+ * return's nothing.
+*/
+void run_server(Server *server) {
+    if (server->socket == -1 && !is_server_listening(server)) {
+        fprintf(stderr, "Communications error\n");
+        exit(COMMS_ERROR);
+    }
+    if (!start_server(server) || !start_unix_listener(server)) {
+        fprintf(stderr, "Communications error\n");
+        exit(COMMS_ERROR);
+    }
+    while (1) {
+        accept_client_connections(server);
+    }
+}
+
+/*
+ * Function to start off a server thread.
+ *
+ * @param serverInfo: The server struct passed on to the thread.
+ *
+ * return's nothing.
+*/
+void *make_server(void *serverInfo) {
+    Server *server = (Server *) serverInfo;
+    run_server(server);
+    return NULL;
+}
+
+/*
+ * The function which print's the stats of the currently connected clients.
+ * The clients are shown in a lexicographical order.
+ *
+ * @param server: The main server struct.
+ *
+ * return's nothing.
+*/
+void print_client_stats(Server *server) {
+    lock_roster(server);
+    int members = 0;
+    for (int i = 0; i < CLIENT_SHARDS; ++i) {
+        members += server->shards[i].count;
+    }
+    int pos = 0;
+    Clients *clients[members];
+    for (int i = 0; i < CLIENT_SHARDS; ++i) {
+        for (int j = 0; j < server->shards[i].count; ++j) {
+            Clients *client = server->shards[i].members[j];
+            if (client->listed && !client->isDeleted) {
+                clients[pos++] = client;
+            }
+        }
     }
-    prev->prev = temp->prev;
+    qsort(clients, pos, sizeof(Clients *), compare_client_names);
+    
+    for (int i = 0; i < pos; ++i) {
+        ClientMessageCount count = clients[i]->messageCount;
+        fprintf(stderr, "%s:SAY:%d:KICK:%d:LIST:%d\n", clients[i]->name,
+                count.msgCount, count.kickCount, count.listCount);
+        fflush(stderr);
+    }
+    unlock_roster(server);
+}
 
-    free(temp);
-    server->clientCount--;
-    return;
+/*
+ * The function which prints the total server stats.
+ *
+ * @param server: The server struct.
+ *
+ * return's nothing.
+*/
+void print_server_stats(Server *server) {
+    MUTEX_LOCK(&server->serverLock);
+    ServerMessageCount count = server->messageCount;
+    fprintf(stderr, "%s:AUTH:%d:NAME:%d:SAY:%d:KICK:%d:LIST:%d:LEAVE:%d\n", 
+            server->name, count.authCount, count.nameCount, count.msgCount,
+            count.kickCount, count.listCount, count.leaveCount);
+    fflush(stderr);
+    MUTEX_UNLOCK(&server->serverLock);
 }
 
 /*
- * Function to parse a message from the client on a first character basis.
+ * Function which prints the latency histograms of every message stage in
+ * microseconds.
  *
- * @param input: The FILE * of the client socket to read from.
+ * @param server: The server struct.
  *
- * @param authString: The authString of the server.
+ * return's nothing.
 */
-ClientMessage parse_message_from_client(FILE *input, char *authSting) {
-    ClientMessage msg;
-    msg.message = NULL;
-    msg.messID = C_INVALID;
-    char first = fgetc(input);
-    switch (first) {
-        case 'A':
-            msg = parse_auth_message(input, authSting);
-            break;
-        case 'N':
-            msg = parse_name_message(input);
-            break;
-        case 'S':
-            msg = parse_say_message(input);
-            break;
-        case 'L':
-            first = fgetc(input);
-            if (first == 'E') {
-                msg = parse_leave_message(input);
-            }
-            if (first == 'I') {
-                msg = parse_list_message(input);
-            }
-            break;
-        case 'K':
-            msg = parse_kick_message(input);
-            break;
-        default:
-            break;
+void print_latency_stats(Server *server) {
+    const char *stages[STAGE_COUNT] = {"PARSE", "DISPATCH", "WRITE",
+            "DELIVERED"};
+    for (int i = 0; i < STAGE_COUNT; ++i) {
+        Histogram *hist = &server->latency[i];
+        fprintf(stderr, "%s:COUNT:%llu:P50:%llu:P99:%llu:P999:%llu:MAX:%llu\n",
+                stages[i], (unsigned long long) histogram_count(hist),
+                (unsigned long long) histogram_percentile(hist, 50) / 1000,
+                (unsigned long long) histogram_percentile(hist, 99) / 1000,
+                (unsigned long long) histogram_percentile(hist, 99.9) / 1000,
+                (unsigned long long) histogram_max(hist) / 1000);
     }
-    return msg;
+    fflush(stderr);
 }
 
 /*
- * Function which adds a client to the chat lobby and starts chatting.
+ * Function which prints how many chat log records were written and how many
+ * were dropped because the logger thread fell behind.
  *
- * @param server: the server struct which has all the clients stored.
+ * @param server: The server struct.
  *
- * @param verifiedClient: The client which has been verified.
+ * return's nothing.
+*/
+void print_logger_stats(Server *server) {
+    fprintf(stderr, "WRITTEN:%llu:DROPPED:%llu\n",
+            (unsigned long long) logger_written(server->logger),
+            (unsigned long long) logger_dropped(server->logger));
+    fflush(stderr);
+}
+
+/*
+ * Function to get the resident memory of the server process.
  *
- * return's a bool indicating wether to close the connection or not.
+ * return's the resident bytes, 0 if they can't be read.
 */
-bool add_client_to_chat_lobby(Server *server, Clients *verifiedClient) {
-    ClientMessage msg;
-    memset(&msg, 0, sizeof(ClientMessage));
-    char *list = NULL;
-    while (1) {
-        if (verifiedClient->isDeleted) {
-            break;
-        }
-        msg = parse_message_from_client(verifiedClient->fromClient,
-                server->authString);
-        switch (msg.messID) {
-            case C_SAY:
-                update_message_count(verifiedClient, server, C_SAY);
-                print_chat_message(server->serverOut, verifiedClient->name, 
-                        msg.message);
-                broadcast_chat_message(server, msg.message, 
-                        verifiedClient->name);
-                break;
-            case C_LIST:
-                update_message_count(verifiedClient, server, C_LIST);
-                list = get_client_list(server);
-                send_list_to_client(verifiedClient->toClient, list);
-                break;
-            case C_KICK:
-                update_message_count(verifiedClient, server, C_KICK);
-                pthread_mutex_lock(&server->serverLock);
-                send_kick_message_to_client(server, msg.message);
-                pthread_mutex_unlock(&server->serverLock);
-                break;
-            case C_LEAVE:
-                update_message_count(0, server, C_LEAVE);
-                send_left_message_to_clients(server, verifiedClient);
-                print_left_client_info(server->serverOut, 
-                        verifiedClient->name);
-                return false;
-            default: 
-                msg.messID = C_INVALID;
-                break;
+long resident_bytes(void) {
+    long pages = 0, resident = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (statm == NULL) {
+        return 0;
+    }
+    if (fscanf(statm, "%ld %ld", &pages, &resident) != 2) {
+        resident = 0;
+    }
+    fclose(statm);
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+/*
+ * Function which prints the memory used by connections. NODE is the fixed
+ * size of a Clients node with its stream buffers and NAMES is the interned
+ * names table. PER_CONNECTION is the growth in resident memory since the
+ * server started divided by the open connections, so with every client
+ * idle it is the whole cost of an idle connection: node, stdio streams,
+ * thread stack and whatever else the connection made the server allocate.
+ *
+ * @param server: The server struct.
+ *
+ * return's nothing.
+*/
+void print_memory_stats(Server *server) {
+    MUTEX_LOCK(&server->serverLock);
+    long connections = server->handshaking;
+    for (Clients *client = server->clients; client != NULL;
+            client = client->prev) {
+        if (!client->isDeleted) {
+            connections++;
         }
-        usleep(100000);
     }
-    return false;
+    MUTEX_UNLOCK(&server->serverLock);
+    long growth = resident_bytes() - server->baseResident;
+    fprintf(stderr, "CONNECTIONS:%ld:SLABS:%d:NODE:%zu:NAMES:%zu:"
+            "PER_CONNECTION:%ld\n", connections, server->slabCount,
+            sizeof(Clients), name_table_bytes(server->names),
+            connections > 0 && growth > 0 ? growth / connections : 0);
+    fflush(stderr);
+}
+
+/*
+ * Function which prints the connections in the handshake stage and what
+ * has gone through it: the most there at once, the connections closed as
+ * the stage was full and those that went on to chat.
+ *
+ * @param server: The server struct.
+ *
+ * return's nothing.
+*/
+void print_handshake_stats(Server *server) {
+    MUTEX_LOCK(&server->serverLock);
+    HandshakeCount count = server->handshakeCount;
+    int handshaking = server->handshaking;
+    MUTEX_UNLOCK(&server->serverLock);
+    fprintf(stderr, "ACTIVE:%d:LIMIT:%d:DEEPEST:%d:REFUSED:%llu:"
+            "REGISTERED:%llu\n", handshaking, server->handshakeLimit,
+            count.deepest, (unsigned long long) count.refused,
+            (unsigned long long) count.registered);
+    fflush(stderr);
 }
 
 /*
- * Function which stores a client name into the client struct.
+ * Function which prints the number of armed timers and what the handshake
+ * deadlines and keepalives have done.
+ *
+ * @param server: The server struct.
  *
- * @param client: a client struct.
+ * return's nothing.
+*/
+void print_timer_stats(Server *server) {
+    TimerCount *count = &server->timerCount;
+    fprintf(stderr, "ARMED:%llu:FIRED:%llu:HANDSHAKE_EXPIRED:%llu:"
+            "PINGS:%llu:IDLE_DROPPED:%llu\n",
+            (unsigned long long) timer_wheel_armed(server->timers),
+            (unsigned long long) timer_wheel_fired(server->timers),
+            (unsigned long long) __atomic_load_n(&count->handshakesExpired,
+            __ATOMIC_RELAXED),
+            (unsigned long long) __atomic_load_n(&count->pingsSent,
+            __ATOMIC_RELAXED),
+            (unsigned long long) __atomic_load_n(&count->idleDropped,
+            __ATOMIC_RELAXED));
+    fflush(stderr);
+}
+
+/*
+ * Function which prints what has been done with SAY: messages longer than
+ * the server's maxSay.
  *
- * @param name: the name which is to be stored into the client.
+ * @param server: The server struct.
  *
- * return's nothing
+ * return's nothing.
 */
-void store_client_name(Clients *client, char *name) {
-    client->name = malloc(sizeof(char) * strlen(name));
-    strcpy(client->name, name);
+void print_frame_stats(Server *server) {
+    FrameCount *count = &server->frameCount;
+    fprintf(stderr, "MAX_SAY:%zu:TRUNCATED:%llu:REJECTED:%llu:STREAMED:%llu:"
+            "DISCARDED_BYTES:%llu\n", server->maxSay,
+            (unsigned long long) __atomic_load_n(&count->truncated,
+            __ATOMIC_RELAXED),
+            (unsigned long long) __atomic_load_n(&count->rejected,
+            __ATOMIC_RELAXED),
+            (unsigned long long) __atomic_load_n(&count->streamed,
+            __ATOMIC_RELAXED),
+            (unsigned long long) __atomic_load_n(&count->discardedBytes,
+            __ATOMIC_RELAXED));
+    fflush(stderr);
 }
 
 /*
- * Function to check if the name given by a client name is unique or not.
+ * Function which prints, for each chatter, the frames written on its
+ * control and chat lanes, the writers waiting on each now and at most, and
+ * the longest wait in microseconds.
+ *
+ * @param server: The server struct.
  *
- * @param server: The server struct
+ * return's nothing.
+*/
+void print_queue_stats(Server *server) {
+    lock_roster(server);
+    for (int i = 0; i < CLIENT_SHARDS; ++i) {
+        for (int j = 0; j < server->shards[i].count; ++j) {
+            Clients *client = server->shards[i].members[j];
+            if (!client->listed || client->isDeleted) {
+                continue;
+            }
+            MUTEX_LOCK(&client->outbound.lock);
+            LaneCount control = client->outbound.lanes[LANE_CONTROL];
+            LaneCount chat = client->outbound.lanes[LANE_CHAT];
+            MUTEX_UNLOCK(&client->outbound.lock);
+            fprintf(stderr, "%s:CONTROL:%llu:QUEUED:%llu:DEEPEST:%llu:"
+                    "MAX_WAIT:%llu:CHAT:%llu:QUEUED:%llu:DEEPEST:%llu:"
+                    "MAX_WAIT:%llu\n", client->name,
+                    (unsigned long long) control.frames,
+                    (unsigned long long) (control.tickets - control.serving),
+                    (unsigned long long) control.deepest,
+                    (unsigned long long) control.maxWait / 1000,
+                    (unsigned long long) chat.frames,
+                    (unsigned long long) (chat.tickets - chat.serving),
+                    (unsigned long long) chat.deepest,
+                    (unsigned long long) chat.maxWait / 1000);
+        }
+    }
+    fflush(stderr);
+    unlock_roster(server);
+}
+
+/*
+ * Function which prints the number of fan-out threads and how many
+ * broadcasts were spread over them or written by the sender.
  *
- * @param name: The name given by a connecting client.
+ * @param server: The server struct.
  *
- * return's a bool indicating if the name is unique or not.
+ * return's nothing.
 */
-bool is_name_unique(Server *server, char *name) {
-    int count = 0;
-    if (name == NULL) {
-        return false;
+void print_fanout_stats(Server *server) {
+    FanoutCount *count = &server->fanoutCount;
+    fprintf(stderr, "THREADS:%d:PARALLEL:%llu:SEQUENTIAL:%llu\n",
+            server->fanout ? server->fanout->threads : 0,
+            (unsigned long long) __atomic_load_n(&count->parallel,
+            __ATOMIC_RELAXED),
+            (unsigned long long) __atomic_load_n(&count->sequential,
+            __ATOMIC_RELAXED));
+    fflush(stderr);
+}
+
+/*
+ * Function which shows the clients of this server an event from a linked
+ * server.
+ *
+ * @param context: The server struct.
+ *
+ * @param event: The event.
+ *
+ * return's nothing.
+*/
+void deliver_peer_event(void *context, PeerEvent *event) {
+    Server *server = (Server *) context;
+    switch (event->kind) {
+        case PEER_ENTER:
+        case PEER_FOUND:
+            send_enter_message_to_clients(server, event->name);
+            print_client_name(server->logger, event->name);
+            break;
+        case PEER_LEAVE:
+            send_leave_to_local_clients(server, event->name);
+            print_left_client_info(server->logger, event->name);
+            break;
+        case PEER_SAY:
+            print_chat_message(server->logger, event->name, event->text);
+            if (server->search != NULL) {
+                search_index_add(server->search, event->name, event->text);
+            }
+            broadcast_chat_message(server, event->text, event->name);
+            break;
+        case PEER_KICK:
+            kick_local_client(server, event->name);
+            break;
+        default:
+            break;
     }
-    Clients *temp = server->clients;
-    for (; temp != NULL; temp = temp->prev) {
-        if (temp->name == NULL || temp->isDeleted) {
-            continue;
-        }
-        if (strcmp(temp->name, name) == 0) {
-            count++;
-        }
+}
+
+/*
+ * Function which links the server with other servers if any of the peer
+ * options were given.
+ *
+ * @param server: The server struct.
+ *
+ * return's a bool indicating if the peer port could be opened.
+*/
+bool start_peers(Server *server) {
+    if (server->peerPort == NULL && server->peerAddressCount == 0) {
+        return true;
     }
-    if (count > 0) {
+    server->peers = peers_create(server->authString, deliver_peer_event,
+            server);
+    if (server->peerListenSocket != -1) { // inherited in a hot upgrade
+        if (!peers_listen_on(server->peers, server->peerListenSocket)) {
+            return false;
+        }
+    } else if (server->peerPort != NULL &&
+            !peers_listen(server->peers, server->peerPort)) {
         return false;
     }
+    for (int i = 0; i < server->peerAddressCount; ++i) {
+        peers_connect(server->peers, server->peerAddresses[i]);
+    }
     return true;
 }
 
 /*
- * Ask name from the client by sending a WHO: message.
+ * Function to tell the linked servers about the chatters inherited in a
+ * hot upgrade. The new server is a new node to them, and the links of the
+ * old one going down took its chatters off their rosters. Each chatter is
+ * published with its shard locked, so an ENTER: always goes out before the
+ * LEAVE: of a chatter leaving meanwhile.
  *
- * @param client: The client whose name is to be asked.
+ * @param server: The server struct, with its peers started.
  *
- * return's a ClientMessage struct indicating the message type recieved from
- * the client.
+ * return's nothing.
 */
-ClientMessage ask_name_from_client(Clients *client) {
-    send_who_message(client->toClient, "WHO:");
-    ClientMessage msg = parse_name_message(client->fromClient);
-    if (msg.messID == C_NAME_TAKEN) {
-        return msg;
-    } else if (msg.messID == C_LEAVE) {
-        return msg;
+void publish_inherited_chatters(Server *server) {
+    for (int i = 0; i < CLIENT_SHARDS; ++i) {
+        ClientShard *shard = &server->shards[i];
+        MUTEX_LOCK(&shard->lock);
+        for (int j = 0; j < shard->count; ++j) {
+            if (shard->members[j]->listed) {
+                peer_publish(server->peers, PEER_ENTER,
+                        shard->members[j]->name, NULL);
+            }
+        }
+        MUTEX_UNLOCK(&shard->lock);
     }
-    return msg;
 }
 
 /*
- * Function to check the auth status after sending an AUTH: message to client.
+ * Function to send a record of the state handed over in a hot upgrade,
+ * with descriptors attached.
  *
- * @param client: The client struct to whom the message is to be sent.
+ * @param fd: The socket to the new server.
  *
- * @param authString: The authString to get accepted.
+ * @param fds: The descriptors to pass along, NULL if none.
  *
- * return's an int indicating successfull auth or not.
- * 0 is success and 1 is failure.
+ * @param count: The number of descriptors, at most UPGRADE_MAX_FDS.
+ *
+ * @param format: printf style format of the record.
+ *
+ * return's a bool indicating if the record was sent.
 */
-int get_auth_status(Clients *client, char *authString) {
-    send_auth_message_to_client(client->toClient, "AUTH:");
-    ClientMessage auth = parse_message_from_client(client->fromClient, 
-            authString);
-    if (auth.messID == C_AUTH) {
-        if (strlen(authString) == 0 && auth.message == 0) {
-            return 0;
-        } else if (strcmp(auth.message, authString) == 0) {
-            return 0;
-        } else {
-            return 1;
-        }
+bool send_upgrade_record(int fd, int *fds, int count, const char *format,
+        ...) {
+    char record[UPGRADE_RECORD_SIZE];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(record, UPGRADE_RECORD_SIZE, format, args);
+    va_end(args);
+    if (length < 0 || length >= UPGRADE_RECORD_SIZE) {
+        return false;
     }
-    return 1;
+    char control[CMSG_SPACE(sizeof(int) * UPGRADE_MAX_FDS)];
+    memset(control, 0, sizeof(control));
+    struct iovec data = {record, length};
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &data;
+    message.msg_iovlen = 1;
+    if (count > 0) {
+        message.msg_control = control;
+        message.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+        struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+        header->cmsg_level = SOL_SOCKET;
+        header->cmsg_type = SCM_RIGHTS;
+        header->cmsg_len = CMSG_LEN(sizeof(int) * count);
+        memcpy(CMSG_DATA(header), fds, sizeof(int) * count);
+    }
+    return sendmsg(fd, &message, MSG_NOSIGNAL) == length;
 }
 
 /*
- * Function which handles a client connection after a client connects
+ * Function to receive a record of the state handed over in a hot upgrade.
  *
- * @param serverInfo: The info of the sever passed on by the thread.
+ * @param fd: The socket to the old server.
  *
- * return's NULL.
+ * @param record: Buffer of UPGRADE_RECORD_SIZE bytes, set to the record.
+ *
+ * @param fds: Set to the descriptors which came with the record.
+ *
+ * @param count: Set to the number of descriptors.
+ *
+ * return's the length of the record, 0 once the old server has gone and
+ * -1 on an error.
 */
-void *handle_client(void *serverInfo) {
-    Server *server = (Server *) serverInfo;
-    Clients *current = server->clients;
-    int authStatus = get_auth_status(current, server->authString);
-    bool holdConnect = true;
-    switch (authStatus) { 
-        case 0:
-            update_auth_message_count(server);
-            send_ok_message(current->toClient, "OK:");
-            ClientMessage msg = ask_name_from_client(current);
-            if (msg.messID == C_LEAVE) {
-                holdConnect = false;
-                break;
-            }
-            while (!is_name_unique(server, msg.message) || 
-                msg.message == NULL) {
-                send_name_taken_message(current->toClient, "NAME_TAKEN:");
-                msg = ask_name_from_client(current);
-            }
-            send_ok_message(current->toClient, "OK:");
-            update_name_message_count(server);
-            store_client_name(current, msg.message);
-            send_enter_message_to_clients(server->clients, current->name);
-            print_client_name(server->serverOut, current->name);
-            holdConnect = add_client_to_chat_lobby(server, current);
-            break;
-        case 1:
-            update_auth_message_count(server);
-            holdConnect = false;
-            break;
+ssize_t receive_upgrade_record(int fd, char *record, int *fds, int *count) {
+    char control[CMSG_SPACE(sizeof(int) * UPGRADE_MAX_FDS)];
+    struct iovec data = {record, UPGRADE_RECORD_SIZE - 1};
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &data;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    ssize_t length = recvmsg(fd, &message, MSG_CMSG_CLOEXEC);
+    *count = 0;
+    if (length <= 0) {
+        return length;
     }
-    if (!holdConnect) {
-        close(current->socket);
-        delete_client(server, current);
+    record[length] = '\0';
+    struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+    if (header != NULL && header->cmsg_level == SOL_SOCKET &&
+            header->cmsg_type == SCM_RIGHTS) {
+        *count = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        memcpy(fds, CMSG_DATA(header), sizeof(int) * *count);
+    }
+    return length;
+}
+
+/*
+ * Function to make the command line of the new server in a hot upgrade:
+ * the server's own, with the descriptor to inherit from added.
+ *
+ * @param server: The server struct.
+ *
+ * return's the NULL terminated arguments.
+*/
+char **successor_arguments(Server *server) {
+    char **arguments = (char **) calloc(server->argc + 3, sizeof(char *));
+    int count = 0;
+    for (int i = 0; i < server->argc; ++i) {
+        if (strcmp(server->argv[i], UPGRADE_OPTION) == 0) {
+            i++; // inherited by this server from an earlier upgrade
+            continue;
+        }
+        arguments[count++] = server->argv[i];
     }
-    return NULL;
+    arguments[count++] = UPGRADE_OPTION;
+    arguments[count++] = int_to_string(UPGRADE_FD);
+    return arguments;
 }
 
 /*
- * Function to create a new Client struct.
+ * Function run in the child of a hot upgrade to start the new server. Only
+ * the standard streams and the socket to the old server are left open.
  *
- * @param server: Takes in the server struct.
+ * @param arguments: The command line of the new server.
  *
- * return's a new Client struct.
+ * @param fd: The child's end of the socket to the old server.
+ *
+ * return's nothing, it never returns.
 */
-Clients *new_client(Server *server) {
-    Clients *client = (Clients *) malloc(sizeof(Clients));
-    client->prev = server->clients; // store the last client's info.
-    client->next = NULL;
-    client->server = server;
-    client->name = NULL;
-    client->isDeleted = false;
-    memset(&client->messageCount, 0, sizeof(ClientMessageCount));
-    if (server->clients != NULL) {
-        server->clients->next = client;
+void exec_successor(char **arguments, int fd) {
+    if (fd != UPGRADE_FD) {
+        dup2(fd, UPGRADE_FD);
     }
-    return client;
+    close_range(UPGRADE_FD + 1, ~0U, 0);
+    execvp(arguments[0], arguments);
+    _exit(COMMS_ERROR);
 }
 
 /*
- * Function which accept's the client connection.
+ * Function to wait for the new server of a hot upgrade to say it is ready
+ * for the state.
  *
- * @param server: The server struct containign the server info.
+ * @param fd: The socket to the new server.
  *
- * return's nothing.
+ * return's a bool indicating if it became ready in UPGRADE_TIMEOUT.
 */
-void accept_client_connections(Server *server) {
-    struct sockaddr_in client;
-    socklen_t socklen = sizeof(client);
-    int socket = accept(server->socket, (struct sockaddr *) &client, &socklen);
-    if (socket == -1) {
-        fprintf(stderr, "Communications error\n");
-        exit(COMMS_ERROR);
-    }
-    pthread_mutex_lock(&server->serverLock);
-    Clients *newClient = new_client(server);
-    newClient->socket = socket;
-    newClient->portNumber = ntohs(client.sin_port);
-    newClient->toClient = fdopen(newClient->socket, "w");
-    newClient->fromClient = fdopen(newClient->socket, "r");
-    newClient->id = server->clientCount;
-    server->clientCount++;
-    server->clients = newClient;
-    pthread_mutex_unlock(&server->serverLock);
-    pthread_t clientThread;
-    pthread_create(&clientThread, NULL, handle_client, (void *) server);
-    pthread_detach(clientThread);
+bool wait_for_successor(int fd) {
+    struct pollfd ready = {fd, POLLIN, 0};
+    char record[UPGRADE_RECORD_SIZE];
+    int fds[UPGRADE_MAX_FDS], count;
+    return poll(&ready, 1, UPGRADE_TIMEOUT * 1000) == 1 &&
+            receive_upgrade_record(fd, record, fds, &count) > 0 &&
+            strcmp(record, "READY:\n") == 0;
 }
 
 /*
- * Function to start the server. Print's the port number to stderr.
+ * Function to stop every chatter's thread before its next message. Those
+ * blocked waiting for one are woken with WAKE_SIGNAL, the others
+ * stop once they have handled the message they are on.
  *
- * @param server: Takes in the server struct.
+ * @param server: The server struct.
  *
- * return's a bool indicating if the server could be started or not.
+ * return's a bool indicating if they all stopped in UPGRADE_TIMEOUT.
 */
-bool start_server(Server *server) {
-    struct sockaddr_in socket;
-    socklen_t socklen = sizeof(socket);
-    if (getsockname(server->socket, (struct sockaddr *) &socket,
-            &socklen) == -1) {
-        return false;
+bool park_clients(Server *server) {
+    MUTEX_LOCK(&server->upgradeLock);
+    server->upgrading = true;
+    MUTEX_UNLOCK(&server->upgradeLock);
+    uint64_t deadline = get_time_ns() + UPGRADE_TIMEOUT * 1000000000ULL;
+    while (get_time_ns() < deadline) {
+        bool moving = false;
+        MUTEX_LOCK(&server->serverLock);
+        for (Clients *client = server->clients; client != NULL;
+                client = client->prev) {
+            if (!client->inLobby || client->isDeleted || client->detached ||
+                    client->parked) {
+                continue;
+            }
+            moving = true;
+            wake_client(client);
+        }
+        MUTEX_UNLOCK(&server->serverLock);
+        if (!moving) {
+            return true;
+        }
+        usleep(UPGRADE_POLL_DELAY);
     }
-    server->actualPort = ntohs(socket.sin_port);
-    server->port = int_to_string(server->actualPort);
-    
-    pthread_mutex_lock(&server->serverLock);
-    fprintf(stderr, "%s\n", server->port);
-    fflush(stderr);
-    pthread_mutex_unlock(&server->serverLock);
-    return true;
+    return false;
 }
 
 /*
- * Function to see if the server is listening or not.
+ * Function to send the new server of a hot upgrade the listening sockets,
+ * including the one for links from other servers, the message counts and
+ * every stopped chatter, oldest first. Must be called with the serverLock
+ * held.
  *
- * @param server: Takes in the Server struct.
+ * @param server: The server struct.
  *
- * return's a bool indicating if the server ha sstarted listening for
- * connections or not.
+ * @param fd: The socket to the new server.
+ *
+ * return's a bool indicating if everything was sent.
 */
-bool is_server_listening(Server *server) {
-    struct addrinfo hints, *result;
-    hints.ai_family = AF_INET;
-    hints.ai_socktype = SOCK_STREAM;
-    hints.ai_protocol = DEFAULT_PROTOCOL;
-    hints.ai_flags = AI_PASSIVE;
-    if (getaddrinfo(server->host, server->port, &hints,
-            &result) != 0) {
+bool hand_over_state(Server *server, int fd) {
+    int listening[2] = {server->socket, server->unixSocket};
+    int peerListening = server->peers ? server->peers->listenSocket : -1;
+    ServerMessageCount counts = server->messageCount;
+    if (!send_upgrade_record(fd, listening, server->unixSocket == -1 ? 1 : 2,
+            "LISTEN:\n") || (peerListening != -1 && !send_upgrade_record(fd,
+            &peerListening, 1, "PEERS:\n")) || !send_upgrade_record(fd,
+            NULL, 0,
+            "COUNTS:%d:%d:%d:%d:%d:%d\n", counts.authCount, counts.nameCount,
+            counts.msgCount, counts.kickCount, counts.listCount,
+            counts.leaveCount)) {
         return false;
     }
-    for (struct addrinfo *attempt = result; attempt != NULL; 
-            attempt = attempt->ai_next) {
-        server->socket = socket(attempt->ai_family, attempt->ai_socktype,
-                attempt->ai_protocol);
-        if (server->socket == -1) {
+    int total = 0;
+    for (Clients *client = server->clients; client != NULL;
+            client = client->prev) {
+        total++;
+    }
+    Clients *clients[total];
+    int i = total;
+    for (Clients *client = server->clients; client != NULL;
+            client = client->prev) {
+        clients[--i] = client;
+    }
+    for (i = 0; i < total; ++i) {
+        Clients *client = clients[i];
+        if (!client->parked || client->isDeleted) {
             continue;
         }
-        int v = 1;
-        setsockopt(server->socket, SOL_SOCKET, SO_REUSEADDR, &v, sizeof(v));
-        if (bind(server->socket, attempt->ai_addr, 
-                attempt->ai_addrlen) != 0) {
-            close(server->socket);
-            continue;    
+        fflush(client->toClient);
+        int fds[2] = {client->socket, client->channel ? client->channel->fd :
+                -1};
+        ClientMessageCount count = client->messageCount;
+        if (!send_upgrade_record(fd, fds, client->channel ? 2 : 1,
+                "CLIENT:%d:%d:%d:%d:%llu:%s:%s\n", client->isUnix,
+                count.msgCount, count.kickCount, count.listCount,
+                (unsigned long long) client->framesSent,
+                client->token ? client->token : "-", client->name)) {
+            return false;
         }
     }
-    if (listen(server->socket, SOMAXCONN)) {
-        perror("Listen");
-        return false;
-    }
-    return true;
+    return send_upgrade_record(fd, NULL, 0, "END:\n");
 }
 
 /*
- * Function which run's a server and performs various steps into making
- * a server struct perform like a server.
+ * Function to hand the server over to a new process started with the same
+ * command line, so a new binary can be put in place without dropping the
+ * chatters. The new server inherits the listening sockets, the counts and
+ * every chatter's connection, and carries on without a new handshake.
+ * Connections still in their handshake and sessions waiting to be resumed
+ * are dropped, and links to other servers are made again by the new one.
  *
  * @param server: The server struct.
  *
- * return's nothing.
+ * return's false if the upgrade failed, otherwise this process exits.
 */
-void run_server(Server *server) {
-    if (!is_server_listening(server)) {
-        fprintf(stderr, "Communications error\n");
-        exit(COMMS_ERROR);
+bool upgrade_server(Server *server) {
+    int pair[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, DEFAULT_PROTOCOL, pair) == -1) {
+        return false;
     }
-    if (!start_server(server)) {
-        fprintf(stderr, "Communications error\n");
-        exit(COMMS_ERROR);
+    char **arguments = successor_arguments(server);
+    pid_t child = fork();
+    if (child == 0) {
+        close(pair[0]);
+        exec_successor(arguments, pair[1]);
     }
-    while (1) {
-        accept_client_connections(server);
+    close(pair[1]);
+    int last = 0;
+    while (arguments[last + 1] != NULL) {
+        last++;
+    }
+    free(arguments[last]); // the descriptor number
+    free(arguments);
+    if (child != -1 && wait_for_successor(pair[0]) && park_clients(server)) {
+        MUTEX_LOCK(&server->serverLock);
+        if (hand_over_state(server, pair[0])) {
+            logger_flush(server->logger);
+            _exit(NORMAL_EXIT);
+        }
+        MUTEX_UNLOCK(&server->serverLock);
+    }
+    // The new server gives up when the socket closes before END:.
+    close(pair[0]);
+    if (child != -1) {
+        waitpid(child, NULL, 0);
     }
+    MUTEX_LOCK(&server->upgradeLock);
+    server->upgrading = false;
+    pthread_cond_broadcast(&server->upgradeCond);
+    MUTEX_UNLOCK(&server->upgradeLock);
+    fprintf(stderr, "Upgrade failed\n");
+    fflush(stderr);
+    return false;
 }
 
 /*
- * Function to start off a server thread.
+ * Function run by the thread of a chatter inherited in a hot upgrade.
  *
- * @param serverInfo: The server struct passed on to the thread.
+ * @param clientInfo: The client struct.
  *
- * return's nothing.
+ * return's NULL.
 */
-void *make_server(void *serverInfo) {
-    Server *server = (Server *) serverInfo;
-    run_server(server);
+void *handle_inherited_client(void *clientInfo) {
+    Clients *current = (Clients *) clientInfo;
+    Server *server = current->server;
+    ClientHandle id = current->id;
+    ShmEndpoint *channel = current->channel;
+    bool holdConnect = add_client_to_chat_lobby(server, current, id);
+    finish_client(server, current, holdConnect, channel);
     return NULL;
 }
 
 /*
- * The function which print's the stats of the currently connected clients.
- * The clients are shown in a lexicographical order.
+ * Function to add a chatter from a CLIENT: record of a hot upgrade. Its
+ * thread is started once the whole state has been received.
  *
- * @param server: The main server struct.
+ * @param server: The server struct.
  *
- * return's nothing.
+ * @param fields: The record after "CLIENT:".
+ *
+ * @param fds: The chatter's socket, and its channel's memfd if it has one.
+ *
+ * @param count: The number of descriptors.
+ *
+ * return's a bool indicating if the record was valid.
 */
-void print_client_stats(Server *server) {
-    pthread_mutex_lock(&server->serverLock);
-    int names = 0;
-    Clients *client = server->clients;
-    for (; client != NULL; client = client->prev) {
-        if (!client->isDeleted && client->name != NULL) {
-            names++;   
-        }
+bool inherit_client(Server *server, char *fields, int *fds, int count) {
+    int isUnix, offset;
+    unsigned long long frames;
+    ClientMessageCount messages;
+    if (count < 1 || sscanf(fields, "%d:%d:%d:%d:%llu:%n", &isUnix,
+            &messages.msgCount, &messages.kickCount, &messages.listCount,
+            &frames, &offset) != 5) {
+        return false;
     }
-    int pos = 0;
-    char *clientNames[names];
-    client = server->clients;
-    for (; client != NULL; client = client->prev) {
-        if (!client->isDeleted && client->name != NULL) {
-            clientNames[pos++] = client->name;   
-        }
+    char *token = fields + offset;
+    char *name = strchr(token, ':');
+    if (name == NULL) {
+        return false;
     }
-    size_t size = sizeof(clientNames) / sizeof(char *);
-    qsort(clientNames, size, sizeof(char *), compare_names);
-    
-    int i = 0;
-    while (i < pos) {
-        client = server->clients;
-        for (; client != NULL; client = client->prev) {
-            if (strcmp(client->name, clientNames[i]) == 0) {
-                ClientMessageCount count = client->messageCount;
-                fprintf(stderr, "%s:SAY:%d:KICK:%d:LIST:%d\n", clientNames[i],
-                        count.msgCount, count.kickCount, count.listCount);
-                fflush(stderr);
-                i++;
+    *name++ = '\0';
+    name[strcspn(name, "\n")] = '\0';
+    Clients *client = new_client(server, true);
+    client->socket = fds[0];
+    client->isUnix = isUnix;
+    client->messageCount = messages;
+    client->inLobby = true;
+    if (claim_client_name(server, client, name)) {
+        client->listed = true;
+    }
+    if (strcmp(token, "-") != 0) {
+        client->token = strdup(token);
+        client->backlog = (char **) calloc(RESUME_BACKLOG, sizeof(char *));
+        client->framesSent = frames;
+    }
+    if (count > 1 && (client->channel = shm_endpoint_attach(client->socket,
+            fds[1])) != NULL) {
+        client->toClient = compact_stream(shm_endpoint_stream(
+                client->channel, "w"), client->toBuffer, _IOFBF);
+        client->fromClient = compact_stream(shm_endpoint_stream(
+                client->channel, "r"), client->fromBuffer, READ_BUFFERING);
+    } else {
+        open_client_streams(server, client);
+    }
+    struct sockaddr_in address;
+    socklen_t length = sizeof(address);
+    if (!isUnix && getpeername(client->socket, (struct sockaddr *) &address,
+            &length) == 0) {
+        client->portNumber = ntohs(address.sin_port);
+    }
+    server->clientCount++;
+    return true;
+}
+
+/*
+ * Function for the new server of a hot upgrade to take over the state of
+ * the old one. Once everything is received it waits for the old server to
+ * exit, so the two never serve the same connections or write the same
+ * history segment. The inherited chatters are started by
+ * start_inherited_clients().
+ *
+ * @param server: The server struct.
+ *
+ * @param fd: The socket to the old server.
+ *
+ * return's a bool indicating if the whole state was received.
+*/
+bool inherit_server(Server *server, int fd) {
+    char record[UPGRADE_RECORD_SIZE];
+    int fds[UPGRADE_MAX_FDS], count;
+    ServerMessageCount *counts = &server->messageCount;
+    if (!send_upgrade_record(fd, NULL, 0, "READY:\n")) {
+        return false;
+    }
+    while (1) {
+        if (receive_upgrade_record(fd, record, fds, &count) <= 0) {
+            return false;
+        }
+        if (strcmp(record, "LISTEN:\n") == 0 && count >= 1) {
+            server->socket = fds[0];
+            server->unixSocket = count > 1 ? fds[1] : -1;
+        } else if (strcmp(record, "PEERS:\n") == 0 && count == 1) {
+            server->peerListenSocket = fds[0];
+        } else if (sscanf(record, "COUNTS:%d:%d:%d:%d:%d:%d",
+                &counts->authCount, &counts->nameCount, &counts->msgCount,
+                &counts->kickCount, &counts->listCount,
+                &counts->leaveCount) == 6) {
+            continue;
+        } else if (strncmp(record, "CLIENT:", strlen("CLIENT:")) == 0) {
+            if (!inherit_client(server, record + strlen("CLIENT:"), fds,
+                    count)) {
+                return false;
             }
+        } else if (strcmp(record, "END:\n") == 0) {
+            break;
+        } else {
+            return false;
         }
     }
-    pthread_mutex_unlock(&server->serverLock);
+    while (receive_upgrade_record(fd, record, fds, &count) > 0) {
+        continue;
+    }
+    close(fd);
+    return true;
 }
 
 /*
- * The function which prints the total server stats.
+ * Function to start a thread for each chatter inherited from the old
+ * server of a hot upgrade.
  *
  * @param server: The server struct.
  *
  * return's nothing.
 */
-void print_server_stats(Server *server) {
-    pthread_mutex_lock(&server->serverLock);
-    ServerMessageCount count = server->messageCount;
-    fprintf(stderr, "%s:AUTH:%d:NAME:%d:SAY:%d:KICK:%d:LIST:%d:LEAVE:%d\n", 
-            server->name, count.authCount, count.nameCount, count.msgCount,
-            count.kickCount, count.listCount, count.leaveCount);
-    fflush(stderr);
-    pthread_mutex_unlock(&server->serverLock);
+void start_inherited_clients(Server *server) {
+    for (Clients *client = server->clients; client != NULL;
+            client = client->prev) {
+        pthread_create(&client->thread, &server->clientThreads,
+                handle_inherited_client, (void *) client);
+        pthread_detach(client->thread);
+    }
+}
+
+/*
+ * Function which clears the latency histograms of every message stage.
+ *
+ * @param server: The server struct.
+ *
+ * return's nothing.
+*/
+void reset_latency_stats(Server *server) {
+    for (int i = 0; i < STAGE_COUNT; ++i) {
+        histogram_reset(&server->latency[i]);
+    }
 }
 
 /*
@@ -755,7 +3198,7 @@ void print_server_stats(Server *server) {
 char *get_authrization_string(char *fileName) {
     FILE *authFile = fopen(fileName, "r");
     if (!authFile) {
-        fprintf(stderr, "%s\n", "Usage: server authfile [port]");
+        fprintf(stderr, "%s\n", SERVER_USAGE);
         fflush(stderr);
         exit(BAD_AUTH_FILE);
     }
@@ -775,6 +3218,12 @@ void handle_sighup(const int signal) {
     if (signal == SIGHUP) {
         sigHup = true;
     }
+    if (signal == SIGUSR1) {
+        sigUsr1 = true;
+    }
+    if (signal == SIGUSR2) {
+        sigUsr2 = true;
+    }
 }
 
 /*
@@ -817,39 +3266,262 @@ Server *create_new_server(char *serverName) {
     server->host = LOCALHOST;
     server->port = DEFAULT_PORT;
     server->clientCount = 0;
+    server->resumeGrace = 0;
+    server->handshakeTimeout = HANDSHAKE_TIMEOUT;
+    server->handshakeLimit = HANDSHAKE_LIMIT;
+    server->keepalive = 0;
+    server->maxSay = MAX_SAY_LENGTH;
+    server->oversize = OVERSIZE_TRUNCATE;
+    memset(&server->frameCount, 0, sizeof(FrameCount));
+    server->timers = timer_wheel_start();
+    memset(&server->timerCount, 0, sizeof(TimerCount));
+    server->peers = NULL;
+    server->peerPort = NULL;
+    server->peerAddressCount = 0;
+    server->unixPath = NULL;
+    server->unixSocket = -1;
+    server->socket = -1;
+    server->argc = 0;
+    server->argv = NULL;
+    server->upgradeFd = -1;
+    server->peerListenSocket = -1;
+    server->upgrading = false;
+    pthread_mutex_init(&server->upgradeLock, NULL);
+    pthread_cond_init(&server->upgradeCond, NULL);
     server->status = true;
     server->serverOut = stdout;
+    server->logger = logger_start(server->serverOut, LOG_RING_SIZE);
     server->clients = NULL;
+    memset(server->sessions, 0, sizeof(server->sessions));
+    server->handshakes = NULL;
+    server->handshaking = 0;
+    memset(&server->handshakeCount, 0, sizeof(HandshakeCount));
+    server->rosterCount = 0;
+    server->fanoutThreads = -1;
+    server->fanout = NULL;
+    memset(&server->fanoutCount, 0, sizeof(FanoutCount));
+    server->searchRetain = SEARCH_RETAIN_DEFAULT;
+    server->searchAge = 0;
+    server->search = NULL;
+    server->historyDirectory = NULL;
+    server->historyReplay = HISTORY_REPLAY_DEFAULT;
+    server->history = NULL;
+    for (int i = 0; i < CLIENT_SHARDS; ++i) {
+        pthread_mutex_init(&server->shards[i].lock, NULL);
+        server->shards[i].members = NULL;
+        server->shards[i].count = 0;
+        server->shards[i].capacity = 0;
+    }
+    server->slabs = NULL;
+    server->freeClients = NULL;
+    server->lastFreeClient = NULL;
+    server->slabCount = 0;
+    server->slabCapacity = 0;
+    pthread_mutex_init(&server->slabLock, NULL);
+    for (int i = 0; i < CLIENT_INITIAL_SLABS; ++i) {
+        add_client_slab(server);
+    }
+    server->names = name_table_new();
+    pthread_attr_init(&server->clientThreads);
+    pthread_attr_setstacksize(&server->clientThreads, CLIENT_STACK_SIZE);
+    server->baseResident = 0;
     memset(&server->messageCount, 0, sizeof(ServerMessageCount));
+    memset(server->latency, 0, sizeof(server->latency));
     pthread_mutex_init(&server->serverLock, NULL);
+    pthread_cond_init(&server->kickDone, NULL);
     return server;
 }
 
+/*
+ * Function to parse an option's number, such as a number of seconds.
+ *
+ * @param text: The option's argument.
+ *
+ * @param number: Set to the number.
+ *
+ * return's a bool indicating if it was a whole number >= 0.
+*/
+bool parse_number(char *text, int *number) {
+    char *end;
+    long value = strtol(text, &end, 10);
+    if (*text == '\0' || *end != '\0' || value < 0 || value > INT_MAX) {
+        return false;
+    }
+    *number = (int) value;
+    return true;
+}
+
+/*
+ * Function to start the threads broadcasts are written from. With one
+ * thread or fewer every broadcast is written by its sender.
+ *
+ * @param server: The server struct.
+ *
+ * return's nothing.
+*/
+void start_fanout(Server *server) {
+    int threads = server->fanoutThreads;
+    if (threads < 0) {
+        threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (threads > CLIENT_SHARDS) {
+        threads = CLIENT_SHARDS;
+    }
+    if (threads > 1) {
+        server->fanout = fanout_start(threads, CLIENT_SHARDS);
+    }
+}
+
+/*
+ * Function to parse the port and the options after the authfile.
+ *
+ * @param server: The server struct to set them on.
+ *
+ * @param argc: The argument count.
+ *
+ * @param argv: The arguments.
+ *
+ * return's a bool indicating if every argument was valid.
+*/
+bool parse_server_options(Server *server, int argc, char **argv) {
+    int i = 2;
+    if (argc > 2 && strncmp(argv[2], "--", 2) != 0) {
+        server->port = argv[2];
+        i++;
+    }
+    for (; i < argc; ++i) {
+        if (strcmp(argv[i], RESUME_OPTION) == 0 && i + 1 < argc) {
+            if (!parse_number(argv[++i], &server->resumeGrace) ||
+                    server->resumeGrace == 0) {
+                return false;
+            }
+        } else if (strcmp(argv[i], HANDSHAKE_OPTION) == 0 && i + 1 < argc) {
+            if (!parse_number(argv[++i], &server->handshakeTimeout)) {
+                return false;
+            }
+        } else if (strcmp(argv[i], HANDSHAKE_LIMIT_OPTION) == 0 &&
+                i + 1 < argc) {
+            if (!parse_number(argv[++i], &server->handshakeLimit)) {
+                return false;
+            }
+        } else if (strcmp(argv[i], MAX_SAY_OPTION) == 0 && i + 1 < argc) {
+            int length;
+            if (!parse_number(argv[++i], &length) || length == 0) {
+                return false;
+            }
+            server->maxSay = length;
+        } else if (strcmp(argv[i], OVERSIZE_OPTION) == 0 && i + 1 < argc) {
+            const char *policies[OVERSIZE_COUNT] = OVERSIZE_NAMES;
+            for (server->oversize = 0; server->oversize < OVERSIZE_COUNT &&
+                    strcmp(argv[i + 1], policies[server->oversize]) != 0;
+                    server->oversize++) {
+            }
+            if (server->oversize == OVERSIZE_COUNT) {
+                return false;
+            }
+            i++;
+        } else if (strcmp(argv[i], FANOUT_OPTION) == 0 && i + 1 < argc) {
+            if (!parse_number(argv[++i], &server->fanoutThreads)) {
+                return false;
+            }
+        } else if (strcmp(argv[i], SEARCH_RETAIN_OPTION) == 0 &&
+                i + 1 < argc) {
+            if (!parse_number(argv[++i], &server->searchRetain)) {
+                return false;
+            }
+        } else if (strcmp(argv[i], SEARCH_AGE_OPTION) == 0 && i + 1 < argc) {
+            if (!parse_number(argv[++i], &server->searchAge) ||
+                    server->searchAge == 0) {
+                return false;
+            }
+        } else if (strcmp(argv[i], HISTORY_OPTION) == 0 && i + 1 < argc) {
+            server->historyDirectory = argv[++i];
+        } else if (strcmp(argv[i], HISTORY_REPLAY_OPTION) == 0 &&
+                i + 1 < argc) {
+            if (!parse_number(argv[++i], &server->historyReplay)) {
+                return false;
+            }
+        } else if (strcmp(argv[i], KEEPALIVE_OPTION) == 0 && i + 1 < argc) {
+            if (!parse_number(argv[++i], &server->keepalive) ||
+                    server->keepalive == 0) {
+                return false;
+            }
+        } else if (strcmp(argv[i], PEER_LISTEN_OPTION) == 0 &&
+                i + 1 < argc) {
+            server->peerPort = argv[++i];
+        } else if (strcmp(argv[i], UNIX_OPTION) == 0 && i + 1 < argc) {
+            server->unixPath = argv[++i];
+        } else if (strcmp(argv[i], UPGRADE_OPTION) == 0 && i + 1 < argc) {
+            server->upgradeFd = atoi(argv[++i]);
+        } else if (strcmp(argv[i], PEER_OPTION) == 0 && i + 1 < argc &&
+                server->peerAddressCount < MAX_PEER_LINKS) {
+            server->peerAddresses[server->peerAddressCount++] = argv[++i];
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
 /*
  * main function. Handles sighup, creates a thread to start server.
 */
 int main(int argc, char *argv[]) {
-    bool isPortPresent = false;
-    if (argc < 2 || argc > 3) {
-        fprintf(stderr, "%s\n", "Usage: server authfile [port]");
+    if (argc < 2) {
+        fprintf(stderr, "%s\n", SERVER_USAGE);
         fflush(stderr);
         exit(BAD_AGS_NUMBER);
     }
-    if (argc == 3) {
-        isPortPresent = true;
-    }
     Server *server = create_new_server(argv[0]);
+    if (!parse_server_options(server, argc, argv)) {
+        fprintf(stderr, "%s\n", SERVER_USAGE);
+        fflush(stderr);
+        exit(BAD_AGS_NUMBER);
+    }
     struct sigaction sa;
     sa.sa_handler = handle_sighup;
     sa.sa_flags = SA_RESTART;
     sigaction(SIGHUP, &sa, 0);
+    sigaction(SIGUSR1, &sa, 0);
+    sigaction(SIGUSR2, &sa, 0);
+    struct sigaction wake;
+    memset(&wake, 0, sizeof(struct sigaction));
+    wake.sa_handler = wake_client_thread; // no SA_RESTART, reads must break
+    sigaction(WAKE_SIGNAL, &wake, 0);
     signal(SIGPIPE, SIG_IGN);
-    if (isPortPresent == true) {
-        server->port = argv[2];
-    } else {
-        server->port = DEFAULT_PORT;
-    }
+    server->argc = argc;
+    server->argv = argv;
     server->authString = get_authrization_string(argv[1]);
+    start_fanout(server);
+    if (server->searchRetain > 0) {
+        server->search = search_index_new(server->searchRetain,
+                (uint64_t) server->searchAge * 1000000000);
+    }
+    server->baseResident = resident_bytes();
+    if (server->upgradeFd != -1 && !inherit_server(server,
+            server->upgradeFd)) {
+        fprintf(stderr, "Communications error\n");
+        exit(COMMS_ERROR);
+    }
+    if (server->historyDirectory != NULL) {
+        server->history = history_open(server->historyDirectory,
+                server->historyReplay);
+        if (server->history == NULL) {
+            fprintf(stderr, "%s\n", SERVER_USAGE);
+            fflush(stderr);
+            exit(BAD_AGS_NUMBER);
+        }
+    }
+    if (server->upgradeFd != -1) {
+        start_inherited_clients(server);
+    }
+    if (!start_peers(server)) {
+        fprintf(stderr, "Communications error\n");
+        exit(COMMS_ERROR);
+    }
+    if (server->upgradeFd != -1) {
+        publish_inherited_chatters(server);
+    }
     pthread_t serverThread;
     pthread_create(&serverThread, NULL, make_server, (void *) server);
     
@@ -862,6 +3534,53 @@ int main(int argc, char *argv[]) {
             fprintf(stderr, "%s", SERVER_HEAD);
             fflush(stderr);
             print_server_stats(server);
+            fprintf(stderr, "%s", LATENCY_HEAD);
+            fflush(stderr);
+            print_latency_stats(server);
+            fprintf(stderr, "%s", LOGGER_HEAD);
+            fflush(stderr);
+            print_logger_stats(server);
+            fprintf(stderr, "%s", MEMORY_HEAD);
+            fflush(stderr);
+            print_memory_stats(server);
+            fprintf(stderr, "%s", TIMERS_HEAD);
+            fflush(stderr);
+            print_timer_stats(server);
+            fprintf(stderr, "%s", FRAMES_HEAD);
+            fflush(stderr);
+            print_frame_stats(server);
+            fprintf(stderr, "%s", QUEUES_HEAD);
+            fflush(stderr);
+            print_queue_stats(server);
+            fprintf(stderr, "%s", FANOUT_HEAD);
+            fflush(stderr);
+            print_fanout_stats(server);
+            if (server->search != NULL) {
+                fprintf(stderr, "%s", SEARCH_HEAD);
+                search_index_print_stats(server->search, stderr);
+            }
+            if (server->history != NULL) {
+                fprintf(stderr, "%s", HISTORY_HEAD);
+                history_print_stats(server->history, stderr);
+            }
+#ifdef LOCK_STATS
+            fprintf(stderr, "%s", LOCKS_HEAD);
+            lock_stats_print(stderr);
+#endif
+            if (server->peers != NULL) {
+                fprintf(stderr, "%s", PEERS_HEAD);
+                peer_print_stats(server->peers, stderr);
+            }
+            fprintf(stderr, "%s", HANDSHAKES_HEAD);
+            print_handshake_stats(server);
+        }
+        if (sigUsr1) {
+            sigUsr1 = false;
+            reset_latency_stats(server);
+        }
+        if (sigUsr2) {
+            sigUsr2 = false;
+            upgrade_server(server);
         }
     }
 }
@@ -1,6 +1,10 @@
 #ifndef SERVER_H
 #define SERVER_H
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // for fopencookie()
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <pthread.h>
@@ -12,18 +16,184 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <stdarg.h>
 #include <semaphore.h>
 #include "shared.h"
 #include "client.h"
 #include "comms.h"
+#include "histogram.h"
+#include "logger.h"
+#include "peer.h"
+#include "shmring.h"
+#include "names.h"
+#include "timerwheel.h"
+#include "lockstat.h"
+#include "fanout.h"
+#include "search.h"
+#include "history.h"
 
 #define CLIENT_HEAD "@CLIENTS@\n"
 #define SERVER_HEAD "@SERVER@\n"
+#define LATENCY_HEAD "@LATENCY@\n"
+#define LOGGER_HEAD "@LOGGER@\n"
+#define PEERS_HEAD "@PEERS@\n"
+#define MEMORY_HEAD "@MEMORY@\n"
+#define TIMERS_HEAD "@TIMERS@\n"
+#define FRAMES_HEAD "@FRAMES@\n"
+#define QUEUES_HEAD "@QUEUES@\n"
+#define LOCKS_HEAD "@LOCKS@\n"
+#define FANOUT_HEAD "@FANOUT@\n"
+#define SEARCH_HEAD "@SEARCH@\n"
+#define HISTORY_HEAD "@HISTORY@\n"
+#define HANDSHAKES_HEAD "@HANDSHAKES@\n"
+#define SERVER_USAGE "Usage: server authfile [port]"
+// Option taking the seconds a dropped session is kept for resumption.
+#define RESUME_OPTION "--resume"
+// Number of the most recent messages kept to replay to a resuming client.
+#define RESUME_BACKLOG 256
+// Random bytes in a resumption token, sent as twice as many hex digits.
+#define TOKEN_BYTES 16
+// Buckets of the table of detached sessions by token hash, must be a power
+// of two.
+#define SESSION_BUCKETS 64
+#define SESSION_OF(hash) ((hash) & (SESSION_BUCKETS - 1))
+// Options to accept links from other servers and to link to one.
+#define PEER_LISTEN_OPTION "--peer-listen"
+#define PEER_OPTION "--peer"
+#define MAX_PEER_LINKS 16
+// Option taking the path of a Unix domain socket to listen on as well.
+#define UNIX_OPTION "--unix"
+// Option a hot upgrade starts the new server with, taking the descriptor
+// the old server hands its state over on.
+#define UPGRADE_OPTION "--upgrade-fd"
+// Descriptor number the state is handed over on in the new server.
+#define UPGRADE_FD 3
+// Seconds the old server waits for the new one to start and for every
+// chatter to reach a point where its connection can be handed over.
+#define UPGRADE_TIMEOUT 5
+// Microseconds between checks that every chatter has stopped.
+#define UPGRADE_POLL_DELAY 10000
+// Largest record of the state handed over, and the most descriptors
+// passed with one.
+#define UPGRADE_RECORD_SIZE 4096
+#define UPGRADE_MAX_FDS 2
+// Signal sent to a client thread to break its blocking read, to stop it
+// for a hot upgrade or to have it send a PING:.
+#define WAKE_SIGNAL SIGRTMIN
+// Option taking the seconds a connection has to get through AUTH: and
+// NAME: before it is closed, 0 to wait forever.
+#define HANDSHAKE_OPTION "--handshake-timeout"
+#define HANDSHAKE_TIMEOUT 10
+// Option taking the most connections that may be in the handshake at
+// once, 0 for no limit. Connections accepted past it are closed at once.
+#define HANDSHAKE_LIMIT_OPTION "--handshake-limit"
+#define HANDSHAKE_LIMIT 256
+// Option taking the seconds a chatter may be silent before it is sent a
+// PING:, and then has to answer it in. Off unless given.
+#define KEEPALIVE_OPTION "--keepalive"
+// Option taking the most characters of text a SAY: may carry. The limit
+// is kept while reading, every other line is cut at MAX_SAY_LENGTH +
+// BUFFSIZE characters.
+#define MAX_SAY_OPTION "--max-say"
+#define MAX_SAY_LENGTH 65536
+// Option picking what happens to a longer SAY:, one of the names below.
+#define OVERSIZE_OPTION "--oversize"
+#define OVERSIZE_NAMES {"truncate", "reject", "stream"}
+// Option taking the number of threads broadcasts are written from, 0 to
+// write them from the sender's thread. One per core, up to CLIENT_SHARDS,
+// if not given.
+#define FANOUT_OPTION "--fanout"
+// Fewest chatters a broadcast is spread over the fan-out threads for,
+// smaller rosters are written quicker by the sender than handed over.
+#define FANOUT_MIN_RECIPIENTS 64
+// Option taking the number of recent messages kept for SEARCH:, 0 to keep
+// none and answer every search with nothing.
+#define SEARCH_RETAIN_OPTION "--search-retain"
+#define SEARCH_RETAIN_DEFAULT 100000
+// Option taking the seconds a message is kept for SEARCH:, however few
+// messages have come after it. No limit if not given.
+#define SEARCH_AGE_OPTION "--search-age"
+// Most messages one SEARCH: is answered with, the newest that match.
+#define SEARCH_MAX_RESULTS 20
+// Option taking the directory chat messages are kept in, as the MSG:
+// lines clients are sent, so the last ones can be replayed to a client
+// which joins. Off unless given.
+#define HISTORY_OPTION "--history"
+// Option taking the most messages replayed to a client which joins.
+#define HISTORY_REPLAY_OPTION "--history-replay"
+#define HISTORY_REPLAY_DEFAULT 50
+// Stack of each client thread. The threads only parse and forward lines so
+// they need a small part of the default 8 MiB.
+#define CLIENT_STACK_SIZE (64 * 1024)
+// Bytes of the stdio buffer each client stream is given inside its Clients
+// node, in place of a separately allocated 4-8 KiB one. Longer lines are
+// put together by read_line() and longer writes skip the buffer.
+#define CLIENT_STREAM_BUFFSIZE 256
+// Buffering of fromClient. Only glibc lets input_buffered() see bytes
+// read ahead, elsewhere fromClient is unbuffered so none ever are.
+#ifdef __GLIBC__
+#define READ_BUFFERING _IOFBF
+#else
+#define READ_BUFFERING _IONBF
+#endif
+// Clients nodes allocated together, freed nodes are reused for new
+// connections.
+#define CLIENT_SLAB_SLOTS 64
+// Slabs allocated at start up, so the first connections allocate no nodes.
+#define CLIENT_INITIAL_SLABS 4
+// Shards the roster of named chatters is split into by name hash, must be
+// a power of two. Joins, leaves and kicks lock only the name's shard.
+#define CLIENT_SHARDS 16
+#define SHARD_OF(hash) ((hash) & (CLIENT_SHARDS - 1))
 
 typedef struct Server Server;
 
 typedef struct Clients Clients;
 
+typedef struct ClientSlab ClientSlab;
+
+// A client's id: the slot of its node in the low 32 bits and the slot's
+// generation, bumped every time the node is deleted, in the high 32 bits.
+// An id held after the client is deleted no longer matches its node.
+typedef uint64_t ClientHandle;
+#define CLIENT_HANDLE(slot, generation) \
+        (((ClientHandle) (generation) << 32) | (uint32_t) (slot))
+#define HANDLE_SLOT(id) ((uint32_t) (id))
+#define HANDLE_GENERATION(id) ((uint32_t) ((id) >> 32))
+
+// One shard of the roster: the chatters whose names hash to it.
+typedef struct {
+    pthread_mutex_t lock;
+    Clients **members; // in no particular order.
+    int count;
+    int capacity;
+} ClientShard;
+
+// A chatter as it was when the roster was read, see snapshot_roster().
+typedef struct {
+    Clients *client;
+    ClientHandle id;
+} RosterEntry;
+
+// A chat message being written to every chatter, split by shard over the
+// fan-out threads.
+typedef struct {
+    Server *server;
+    char *name;
+    char *chat;
+    uint64_t start; // when the fan out started.
+    uint64_t done; // when the last recipient so far was flushed.
+    uint64_t record; // its number in the history.
+} Broadcast;
+
+// struct to store how broadcasts have been written.
+typedef struct {
+    uint64_t parallel; // spread over the fan-out threads.
+    uint64_t sequential; // written by the sender's thread.
+} FanoutCount;
+
 // struct to store the client message count
 typedef struct {
     int msgCount;
@@ -41,6 +211,81 @@ typedef struct {
     int leaveCount;
 } ServerMessageCount;
 
+// Enum of the stages a client message is timed through. Each stage is
+// measured from the end of the previous one, STAGE_DELIVERED is the whole
+// time from reading the first byte to flushing the last recipient.
+typedef enum {
+    STAGE_PARSE,     // first byte read -> message parsed
+    STAGE_DISPATCH,  // message parsed -> fan out started
+    STAGE_WRITE,     // fan out started -> one recipient flushed
+    STAGE_DELIVERED, // first byte read -> last recipient flushed
+    STAGE_COUNT
+} LatencyStage;
+
+// struct to store what has gone through the handshake stage.
+typedef struct {
+    uint64_t refused; // closed when accepted, the stage was full.
+    uint64_t registered; // authenticated and named.
+    int deepest; // most connections in the stage at once.
+} HandshakeCount;
+
+// Enum of where a chatter is in a keepalive exchange.
+typedef enum {
+    KEEPALIVE_IDLE, // heard from within the keepalive period.
+    KEEPALIVE_PING_DUE, // silent for a period, its thread is to send PING:.
+    KEEPALIVE_PINGED // sent PING:, closed unless heard from in a period.
+} KeepaliveState;
+
+// Enum of what is done with a SAY: longer than the server's maxSay.
+typedef enum {
+    OVERSIZE_TRUNCATE, // the first maxSay characters are sent.
+    OVERSIZE_REJECT, // nothing is sent.
+    OVERSIZE_STREAM, // sent on as it is read, as messages of maxSay each.
+    OVERSIZE_COUNT
+} OversizePolicy;
+
+// struct to store what has been done with oversized lines.
+typedef struct {
+    uint64_t truncated;
+    uint64_t rejected;
+    uint64_t streamed;
+    uint64_t discardedBytes; // text dropped from truncated or rejected SAY:
+} FrameCount;
+
+// Enum of the lanes a frame to a chatter is written on. Writers of a
+// control frame (OK:, LIST:, KICK:, PING:) waiting for a chatter's stream
+// are always let in before writers of a chat frame (MSG:, ENTER:, LEAVE:).
+typedef enum {
+    LANE_CONTROL,
+    LANE_CHAT,
+    LANE_COUNT
+} Lane;
+
+// struct to store what has gone through one of a chatter's lanes.
+typedef struct {
+    uint64_t frames; // frames written.
+    uint64_t tickets; // handed out in turn to the lane's writers.
+    uint64_t serving; // ticket of the lane's next writer.
+    uint64_t deepest; // most writers ever waiting at once.
+    uint64_t maxWait; // longest a writer waited, in nanoseconds.
+} LaneCount;
+
+// Gate every writer to a chatter's toClient passes through, one frame at
+// a time, control lane first and in turn within a lane.
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t open; // signalled when the stream is given up.
+    bool writing; // a writer holds the stream.
+    LaneCount lanes[LANE_COUNT];
+} Outbound;
+
+// struct to store what the server's timers have done.
+typedef struct {
+    uint64_t handshakesExpired;
+    uint64_t pingsSent;
+    uint64_t idleDropped;
+} TimerCount;
+
 // The server struct
 struct Server {
     char *authString;
@@ -53,39 +298,128 @@ struct Server {
     int socket;
     int actualPort;
     int clientCount;
+    int resumeGrace; // seconds a dropped session waits, 0 if disabled.
+    int handshakeTimeout; // seconds to authenticate and pick a name.
+    int keepalive; // seconds of silence before a PING:, 0 if disabled.
+    size_t maxSay; // most characters of text in a SAY:.
+    int oversize; // an OversizePolicy.
     
-    Clients *clients;
+    Clients *clients; // connections past the handshake, newest first.
+    Clients *handshakes; // connections still in it, newest first.
+    int handshaking; // connections in handshakes.
+    int handshakeLimit; // most in handshakes at once, 0 for no limit.
+    HandshakeCount handshakeCount;
+    ClientShard shards[CLIENT_SHARDS]; // the chatters by name.
+    int rosterCount; // chatters in all the shards.
+    ClientSlab **slabs; // slot s is in slabs[s / CLIENT_SLAB_SLOTS].
+    Clients *sessions[SESSION_BUCKETS]; // detached sessions by token.
+    Clients *freeClients; // deleted nodes, oldest first, linked by next.
+    Clients *lastFreeClient;
+    int slabCount;
+    int slabCapacity;
+    pthread_mutex_t slabLock;
+    NameTable *names; // the clients' names.
+    pthread_attr_t clientThreads; // attributes client threads start with.
+    long baseResident; // resident bytes before any client connected.
     ServerMessageCount messageCount;
+    int fanoutThreads; // -1 for one per core.
+    FanoutPool *fanout; // NULL if broadcasts are written by the sender.
+    FanoutCount fanoutCount;
+    int searchRetain;
+    int searchAge; // seconds, 0 for no limit.
+    SearchIndex *search; // NULL if no messages are kept.
+    char *historyDirectory; // NULL unless messages are kept on disk.
+    int historyReplay;
+    HistoryLog *history;
+    TimerWheel *timers; // handshake deadlines and keepalives.
+    TimerCount timerCount;
+    FrameCount frameCount;
+    Histogram latency[STAGE_COUNT];
     
     FILE *serverOut;
+    ChatLogger *logger;
+
+    Peers *peers; // NULL unless linked with other servers.
+    char *peerPort;
+    char *peerAddresses[MAX_PEER_LINKS];
+    int peerAddressCount;
+    int peerListenSocket; // inherited in a hot upgrade, -1 if not.
+
+    char *unixPath; // NULL unless also listening on a Unix socket.
+    int unixSocket;
+
+    // Hot upgrade. The arguments are kept to start the new server with.
+    int argc;
+    char **argv;
+    int upgradeFd; // state is inherited from this descriptor if not -1.
+    bool upgrading; // client threads stop before their next message.
+    pthread_mutex_t upgradeLock;
+    pthread_cond_t upgradeCond;
     
     pthread_t threadId;
 
+    // guards clients, clientCount, handshakes and handshaking.
     pthread_mutex_t serverLock;
+    pthread_cond_t kickDone; // broadcast when a kick is done with a client.
 };
 
 // The client struct
 struct Clients {
-    char *name;
+    char *name; // interned in the server's names table.
+    int rosterIndex; // in its shard's members, -1 if not in the roster.
+    bool listed; // shown to other chatters, set once OK: is sent.
+    uint64_t historyCutoff; // history records before it were replayed.
     
     bool isDeleted;
+    bool kicking; // a kick still uses the node, its thread waits for it.
+    bool registered; // in the server's clients, else in its handshakes.
     
     int socket;
     int portNumber;
-    int id;
+    ClientHandle id; // stays with the slot, see find_client().
     
     FILE *toClient;
     FILE *fromClient;
+    char toBuffer[CLIENT_STREAM_BUFFSIZE]; // stdio buffer of toClient.
+    char fromBuffer[CLIENT_STREAM_BUFFSIZE]; // stdio buffer of fromClient.
+    Outbound outbound; // orders the frames written to toClient.
+
+    bool isUnix; // connected through the Unix socket.
+    ShmEndpoint *channel; // set if the streams use a shared-memory channel.
+
+    pthread_t thread;
+    bool inLobby; // past the handshake.
+    bool awaitingMessage; // blocked reading the start of a message.
+    bool parked; // stopped for a hot upgrade.
+    pthread_mutex_t readLock; // held to change or act on awaitingMessage.
+
+    Timer timer; // the handshake deadline, then the keepalive.
+    uint64_t lastActivity; // time the last message was read.
+    int keepaliveState; // a KeepaliveState.
     
     ClientMessageCount messageCount;
 
+    // Session resumption, only used when the server has a resumeGrace.
+    char *token; // NULL until a token has been issued.
+    bool detached; // the connection dropped and the session waits.
+    Clients *nextSession; // next detached session in the same bucket.
+    uint64_t framesSent; // sequence number of the next message sent.
+    char **backlog; // the last RESUME_BACKLOG messages by sequence.
+    ByteBuffer partial; // a message not yet ended by a newline.
+    pthread_mutex_t sessionLock;
+    sem_t resumed; // posted when a resuming connection takes over.
     
-    Clients *next;
-    Clients *prev;
+    Clients *next; // newer client in its list, or next free node.
+    Clients *prev; // older client in its list.
     
     Server *server;
 };
 
+// A block of Clients nodes.
+struct ClientSlab {
+    Clients slots[CLIENT_SLAB_SLOTS];
+};
+
 // Enum to store different errors encoutered by the server.
 typedef enum {
     NORMAL_EXIT = 0,
@@ -94,4 +428,6 @@ typedef enum {
     COMMS_ERROR = 2
 } ExitCodes;
 
+void delete_client(Server *server, Clients *client);
+
 #endif //ass4_server_h
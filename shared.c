@@ -1,5 +1,9 @@
 #include "shared.h"
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
 
 /*
  * Functions which read's line character by character.
@@ -9,33 +13,77 @@
  * return's a null terminated string (char *).
 */
 char *read_line(FILE *file) {
-    int buffSize = BUFFSIZE;
+    bool more;
+    return read_line_bounded(file, 0, &more);
+}
+
+/*
+ * Function which read's a line character by character, stopping after
+ * limit characters. The buffer only grows as far as the line needs.
+ *
+ * @param file: The FILE * of the file whose line is to be read.
+ *
+ * @param limit: The most characters to read, 0 for no limit.
+ *
+ * @param more: Set to true if the limit was reached before the end of the
+ *              line, the rest of which is left unread.
+ *
+ * return's a null terminated string, NULL at end of file.
+*/
+char *read_line_bounded(FILE *file, size_t limit, bool *more) {
+    size_t buffSize = BUFFSIZE;
+    if (limit != 0 && limit + 1 < buffSize) {
+        buffSize = limit + 1;
+    }
     char *buffer = (char *) malloc(sizeof(char) * buffSize);
-    int numOfReads = 0;
+    size_t numOfReads = 0;
     int next;
+    *more = false;
     while (1) {
         next = fgetc(file);
+        if (limit != 0 && numOfReads == limit && next != '\n' &&
+                next != EOF) {
+            ungetc(next, file);
+            *more = true;
+            buffer[numOfReads] = '\0';
+            break;
+        }
         if (next == EOF && numOfReads == 0) {
             free(buffer);
             return NULL;
         }
         if (numOfReads == buffSize - 1) {
             buffSize *= 2;
+            if (limit != 0 && buffSize > limit + 1) {
+                buffSize = limit + 1;
+            }
             buffer = (char *) realloc(buffer, sizeof(char) * buffSize);
         }
-        if (next < 32) {
-            buffer[numOfReads] = '?';
-        }
         if (next == '\n' || next == EOF) {
             buffer[numOfReads] = '\0';
             break;
         }
         buffer[numOfReads++] = next;
     }
-    //fflush(file);
     return buffer;
 }
 
+/*
+ * Function which read's and throws away the rest of a line.
+ *
+ * @param file: The FILE * of the file.
+ *
+ * return's the number of characters thrown away, not counting the newline.
+*/
+size_t skip_line(FILE *file) {
+    size_t skipped = 0;
+    int next;
+    while ((next = fgetc(file)) != EOF && next != '\n') {
+        skipped++;
+    }
+    return skipped;
+}
+
 /*
  * Function which convert's an integer to a string.
  *
@@ -44,7 +92,7 @@ char *read_line(FILE *file) {
  * return's a number in the string format.
 */
 char *int_to_string(int number) {
-    int length = 1;
+    int length = number < 0 ? 3 : 2; // room for the sign and terminator
     int duplicate = number;
     while (duplicate /= 10) {
         length++;
@@ -70,3 +118,272 @@ int get_slash_count(char *string) {
     }
     return count;
 }
+
+/*
+ * Function to read the monotonic clock.
+ *
+ * return's the current monotonic time in nanoseconds.
+*/
+uint64_t get_time_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/*
+ * Function to create a LineReader for a file descriptor.
+ *
+ * @param fd: The file descriptor to read from.
+ *
+ * return's the new LineReader.
+*/
+LineReader *new_line_reader(int fd) {
+    return new_line_reader_sized(fd, IO_BUFFSIZE);
+}
+
+/*
+ * Function to create a LineReader whose buffer starts at a given size, so
+ * each fill_line_reader() can read that much at once.
+ *
+ * @param fd: The file descriptor to read from.
+ *
+ * @param size: The initial size of the buffer.
+ *
+ * return's the new LineReader.
+*/
+LineReader *new_line_reader_sized(int fd, size_t size) {
+    LineReader *reader = (LineReader *) calloc(1, sizeof(LineReader));
+    reader->fd = fd;
+    reader->size = size < 2 ? 2 : size;
+    reader->buffer = (char *) malloc(sizeof(char) * reader->size);
+    return reader;
+}
+
+/*
+ * Function to create a LineReader which gets its bytes from a read function
+ * instead of a file descriptor. The fd of the reader is -1.
+ *
+ * @param readFunction: The function to read with.
+ *
+ * @param source: Passed to the read function.
+ *
+ * return's the new LineReader.
+*/
+LineReader *new_line_reader_from(ReadFunction readFunction, void *source) {
+    LineReader *reader = new_line_reader_sized(-1, IO_BUFFSIZE);
+    reader->readFunction = readFunction;
+    reader->source = source;
+    return reader;
+}
+
+/*
+ * Function to free a LineReader. The file descriptor is left open.
+ *
+ * @param reader: The LineReader to free.
+ *
+ * return's nothing.
+*/
+void free_line_reader(LineReader *reader) {
+    if (reader != NULL) {
+        free(reader->buffer);
+        free(reader);
+    }
+}
+
+/*
+ * Function which performs a single read() into the reader's buffer, moving
+ * or growing the buffer first if it is full. Lines returned by next_line()
+ * before this call are no longer valid afterwards.
+ *
+ * @param reader: The LineReader to fill.
+ *
+ * return's the number of bytes read, 0 at end of file or -1 on error with
+ * errno set (EAGAIN if the descriptor is non-blocking and empty).
+*/
+ssize_t fill_line_reader(LineReader *reader) {
+    if (reader->start == reader->end) {
+        reader->start = reader->end = reader->scanned = 0;
+    }
+    if (reader->end + 1 >= reader->size) {
+        if (reader->start > 0) {
+            memmove(reader->buffer, reader->buffer + reader->start,
+                    reader->end - reader->start);
+            reader->end -= reader->start;
+            reader->start = 0;
+        } else {
+            reader->size *= 2;
+            reader->buffer = (char *) realloc(reader->buffer,
+                    sizeof(char) * reader->size);
+        }
+    }
+    // One byte is kept spare so a last line without a newline can still be
+    // terminated in place.
+    size_t space = reader->size - reader->end - 1;
+    ssize_t count = reader->readFunction ?
+            reader->readFunction(reader->source,
+            reader->buffer + reader->end, space) :
+            read(reader->fd, reader->buffer + reader->end, space);
+    if (count == 0) {
+        reader->eof = true;
+    }
+    if (count > 0) {
+        reader->end += count;
+    }
+    return count;
+}
+
+/*
+ * Function to get the next complete line already in the reader's buffer.
+ * At end of file the remaining bytes are returned as a last line.
+ *
+ * @param reader: The LineReader.
+ *
+ * return's the line, null terminated and without its newline, or NULL if
+ * no complete line is buffered. The line is valid until the next
+ * fill_line_reader().
+*/
+char *next_line(LineReader *reader) {
+    char *from = reader->buffer + reader->start + reader->scanned;
+    char *newline = memchr(from, '\n', reader->end - reader->start -
+            reader->scanned);
+    char *line = reader->buffer + reader->start;
+    if (newline != NULL) {
+        *newline = '\0';
+        reader->start = newline - reader->buffer + 1;
+        reader->scanned = 0;
+        return line;
+    }
+    reader->scanned = reader->end - reader->start;
+    if (reader->eof && reader->end > reader->start) {
+        reader->buffer[reader->end] = '\0';
+        reader->start = reader->end;
+        reader->scanned = 0;
+        return line;
+    }
+    return NULL;
+}
+
+/*
+ * Function to check if next_line() would return a line without another
+ * fill of the reader.
+ *
+ * @param reader: The LineReader.
+ *
+ * return's a bool indicating if a line is ready.
+*/
+bool line_reader_has_line(LineReader *reader) {
+    if (reader->eof && reader->end > reader->start) {
+        return true;
+    }
+    return memchr(reader->buffer + reader->start + reader->scanned, '\n',
+            reader->end - reader->start - reader->scanned) != NULL;
+}
+
+/*
+ * Function which reads a line, blocking until one is available. This is
+ * the LineReader version of read_line().
+ *
+ * @param reader: The LineReader of a blocking file descriptor.
+ *
+ * return's the line or NULL at end of file or on error. The line is valid
+ * until the next call.
+*/
+char *read_line_blocking(LineReader *reader) {
+    char *line;
+    while ((line = next_line(reader)) == NULL) {
+        if (reader->eof) {
+            return NULL;
+        }
+        ssize_t count = fill_line_reader(reader);
+        if (count < 0 && errno != EINTR) {
+            return NULL;
+        }
+    }
+    return line;
+}
+
+/*
+ * Function to append bytes to a ByteBuffer.
+ *
+ * @param buffer: The ByteBuffer.
+ *
+ * @param data: The bytes to append.
+ *
+ * @param length: The number of bytes.
+ *
+ * return's nothing.
+*/
+void byte_buffer_append(ByteBuffer *buffer, const char *data, size_t length) {
+    if (buffer->start == buffer->length) {
+        buffer->start = buffer->length = 0;
+    }
+    if (buffer->length + length > buffer->capacity && buffer->start > 0) {
+        memmove(buffer->data, buffer->data + buffer->start,
+                buffer->length - buffer->start);
+        buffer->length -= buffer->start;
+        buffer->start = 0;
+    }
+    if (buffer->length + length > buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity : IO_BUFFSIZE;
+        while (capacity < buffer->length + length) {
+            capacity *= 2;
+        }
+        buffer->data = (char *) realloc(buffer->data, capacity);
+        buffer->capacity = capacity;
+    }
+    memcpy(buffer->data + buffer->length, data, length);
+    buffer->length += length;
+}
+
+/*
+ * Function to get the number of bytes waiting in a ByteBuffer.
+ *
+ * @param buffer: The ByteBuffer.
+ *
+ * return's the number of bytes not yet written.
+*/
+size_t byte_buffer_pending(ByteBuffer *buffer) {
+    return buffer->length - buffer->start;
+}
+
+/*
+ * Function to write as much of a ByteBuffer as the descriptor takes.
+ *
+ * @param buffer: The ByteBuffer.
+ *
+ * @param fd: The file descriptor to write to.
+ *
+ * return's the number of bytes written, or -1 on an error other than the
+ * descriptor being full.
+*/
+ssize_t byte_buffer_write(ByteBuffer *buffer, int fd) {
+    ssize_t total = 0;
+    while (byte_buffer_pending(buffer) > 0) {
+        ssize_t count = write(fd, buffer->data + buffer->start,
+                byte_buffer_pending(buffer));
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            return -1;
+        }
+        buffer->start += count;
+        total += count;
+    }
+    return total;
+}
+
+/*
+ * Function to put a file descriptor into non-blocking mode.
+ *
+ * @param fd: The file descriptor.
+ *
+ * return's a bool indicating success.
+*/
+bool set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL);
+    return flags != -1 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) != -1;
+}
@@ -5,12 +5,61 @@
 #define LOCALHOST "127.0.0.1"
 #define DEFAULT_PORT "0"
 #define DEFAULT_PROTOCOL 0
+// Initial size of the buffers used by LineReader and ByteBuffer.
+#define IO_BUFFSIZE 4096
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+// Reads up to length bytes from source into buffer, with the same return
+// value as read(). Lets a LineReader read from something other than a file
+// descriptor.
+typedef ssize_t (*ReadFunction)(void *source, char *buffer, size_t length);
+
+// Reader which splits what is read from a file descriptor into lines
+// without going through stdio, so the descriptor can be used with poll().
+typedef struct {
+    int fd;
+    ReadFunction readFunction; // used in place of read() on fd if set.
+    void *source;
+    char *buffer;
+    size_t size;
+    size_t start; // first byte not yet returned as part of a line.
+    size_t end; // one past the last byte read.
+    size_t scanned; // bytes after start known not to hold a newline.
+    bool eof;
+} LineReader;
+
+// Growable buffer of bytes waiting to be written to a file descriptor.
+typedef struct {
+    char *data;
+    size_t start; // first byte not yet written.
+    size_t length; // one past the last byte appended.
+    size_t capacity;
+} ByteBuffer;
 
 char *read_line(FILE *file);
+char *read_line_bounded(FILE *file, size_t limit, bool *more);
+size_t skip_line(FILE *file);
 char *int_to_string(int number);
 int get_slash_count(char *string);
+uint64_t get_time_ns(void);
+
+LineReader *new_line_reader(int fd);
+LineReader *new_line_reader_sized(int fd, size_t size);
+LineReader *new_line_reader_from(ReadFunction readFunction, void *source);
+void free_line_reader(LineReader *reader);
+ssize_t fill_line_reader(LineReader *reader);
+char *next_line(LineReader *reader);
+bool line_reader_has_line(LineReader *reader);
+char *read_line_blocking(LineReader *reader);
+
+void byte_buffer_append(ByteBuffer *buffer, const char *data, size_t length);
+size_t byte_buffer_pending(ByteBuffer *buffer);
+ssize_t byte_buffer_write(ByteBuffer *buffer, int fd);
+bool set_nonblocking(int fd);
 
 #endif //ass4_shared_h
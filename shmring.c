@@ -0,0 +1,431 @@
+#define _GNU_SOURCE
+#include "shmring.h"
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+/*
+ * Function to check if a ring has what a side is waiting for.
+ *
+ * @param ring: The ring.
+ *
+ * @param forData: true for a reader waiting for data, false for a writer
+ *                 waiting for space.
+ *
+ * return's true if the side can go on, which it also can once the ring is
+ * broken so it finds that out.
+*/
+static bool ring_ready(ShmRing *ring, bool forData) {
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    if (head - tail > SHM_RING_SIZE) {
+        return true;
+    }
+    if (forData) {
+        return head != tail ||
+                __atomic_load_n(&ring->closed, __ATOMIC_ACQUIRE);
+    }
+    return head - tail < SHM_RING_SIZE;
+}
+
+/*
+ * Function to check if the process at the other end of the channel is
+ * still there, by looking at the Unix socket neither side writes to once
+ * the channel is up.
+ *
+ * @param endpoint: This side of the channel.
+ *
+ * return's true if the socket is still open at both ends.
+*/
+static bool peer_alive(ShmEndpoint *endpoint) {
+    struct pollfd watch = {endpoint->socket, POLLIN, 0};
+    if (poll(&watch, 1, 0) == -1) {
+        return errno == EINTR;
+    }
+    return watch.revents == 0;
+}
+
+/*
+ * Function to wake the other side of a ring if it said it was waiting.
+ *
+ * @param signal: The futex word the other side sleeps on.
+ *
+ * @param waiting: The other side's waiting flag.
+ *
+ * return's nothing.
+*/
+static void wake_side(uint32_t *signal, uint32_t *waiting) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(waiting, __ATOMIC_SEQ_CST)) {
+        __atomic_fetch_add(signal, 1, __ATOMIC_SEQ_CST);
+        syscall(SYS_futex, signal, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    }
+}
+
+/*
+ * Function to wait until a ring has data for the reader or space for the
+ * writer. Spins for a while first, then sleeps on the ring's futex word,
+ * waking up now and then to check the other side has not gone. A signal
+ * handled without SA_RESTART ends the wait like it would a read().
+ *
+ * @param endpoint: This side of the channel.
+ *
+ * @param ring: The ring being waited on.
+ *
+ * @param forData: true to wait for data, false to wait for space.
+ *
+ * return's 1 once ready, 0 if the other side went away first and -1 with
+ * errno set to EINTR if a signal ended the wait.
+*/
+static int wait_on_ring(ShmEndpoint *endpoint, ShmRing *ring,
+        bool forData) {
+    uint32_t *signal = forData ? &ring->dataSignal : &ring->spaceSignal;
+    uint32_t *waiting = forData ? &ring->readerWaiting : &ring->writerWaiting;
+    for (int spin = 0; spin < SHM_SPIN; ++spin) {
+        if (ring_ready(ring, forData)) {
+            return 1;
+        }
+        __asm__ __volatile__("" ::: "memory");
+    }
+    while (1) {
+        uint32_t seen = __atomic_load_n(signal, __ATOMIC_SEQ_CST);
+        __atomic_store_n(waiting, 1, __ATOMIC_SEQ_CST);
+        if (ring_ready(ring, forData)) {
+            break;
+        }
+        struct timespec timeout = {0, SHM_IDLE_CHECK_NS};
+        if (syscall(SYS_futex, signal, FUTEX_WAIT, seen, &timeout, NULL,
+                0) == -1) {
+            if (errno == EINTR) {
+                __atomic_store_n(waiting, 0, __ATOMIC_SEQ_CST);
+                errno = EINTR;
+                return -1;
+            }
+            if (errno == ETIMEDOUT && !peer_alive(endpoint)) {
+                __atomic_store_n(waiting, 0, __ATOMIC_SEQ_CST);
+                return ring_ready(ring, forData);
+            }
+        }
+        if (ring_ready(ring, forData)) {
+            break;
+        }
+    }
+    __atomic_store_n(waiting, 0, __ATOMIC_SEQ_CST);
+    return 1;
+}
+
+/*
+ * Function to map a channel from its memfd.
+ *
+ * @param socket: The Unix socket the channel was set up on.
+ *
+ * @param fd: The memfd holding the channel.
+ *
+ * @param isClient: true for the client's side of the channel.
+ *
+ * return's the endpoint or NULL if the memfd could not be mapped.
+*/
+static ShmEndpoint *map_channel(int socket, int fd, bool isClient) {
+    ShmChannel *channel = mmap(NULL, sizeof(ShmChannel),
+            PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (channel == MAP_FAILED) {
+        return NULL;
+    }
+    ShmEndpoint *endpoint = calloc(1, sizeof(ShmEndpoint));
+    endpoint->channel = channel;
+    endpoint->in = isClient ? &channel->toClient : &channel->toServer;
+    endpoint->out = isClient ? &channel->toServer : &channel->toClient;
+    endpoint->socket = socket;
+    endpoint->fd = fd;
+    return endpoint;
+}
+
+/*
+ * Function for a client to create a channel. The rings live in a memfd
+ * which is handed to the server with shm_send_offer(), sealed at its size.
+ *
+ * @param socket: The Unix socket connected to the server.
+ *
+ * @param fd: Set to the memfd, which stays owned by the endpoint.
+ *
+ * return's the endpoint or NULL if the memory could not be set up.
+*/
+ShmEndpoint *shm_endpoint_create(int socket, int *fd) {
+    *fd = memfd_create("chat-channel", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (*fd == -1) {
+        return NULL;
+    }
+    if (ftruncate(*fd, sizeof(ShmChannel)) == -1 ||
+            fcntl(*fd, F_ADD_SEALS, SHM_SEALS) == -1) {
+        close(*fd);
+        return NULL;
+    }
+    ShmEndpoint *endpoint = map_channel(socket, *fd, true);
+    if (endpoint == NULL) {
+        close(*fd);
+    }
+    return endpoint;
+}
+
+/*
+ * Function for the server to map a channel offered by a client. A memfd
+ * without SHM_SEALS is refused, the client could otherwise shrink it and
+ * have the server fault on its mapping.
+ *
+ * @param socket: The Unix socket of the client.
+ *
+ * @param fd: The memfd received from the client. Owned by the endpoint,
+ *            or closed if the memfd could not be mapped.
+ *
+ * return's the endpoint or NULL if the memfd could not be mapped.
+*/
+ShmEndpoint *shm_endpoint_attach(int socket, int fd) {
+    ShmEndpoint *endpoint = NULL;
+    int seals = fcntl(fd, F_GET_SEALS);
+    off_t size = lseek(fd, 0, SEEK_END);
+    if (seals != -1 && (seals & SHM_SEALS) == SHM_SEALS &&
+            size >= (off_t) sizeof(ShmChannel)) {
+        endpoint = map_channel(socket, fd, false);
+    }
+    if (endpoint == NULL) {
+        close(fd);
+    }
+    return endpoint;
+}
+
+/*
+ * Function to read from a channel. Blocks until there is at least a byte.
+ * Has the signature of a ReadFunction so a LineReader can use it.
+ *
+ * @param endpoint: This side of the channel.
+ *
+ * @param buffer: Where to put the bytes.
+ *
+ * @param length: The most bytes to read.
+ *
+ * return's the number of bytes read, 0 once the other side has closed,
+ * gone away or broken the ring and -1 if a signal ended the wait.
+*/
+ssize_t shm_endpoint_read(void *endpoint, char *buffer, size_t length) {
+    ShmEndpoint *self = (ShmEndpoint *) endpoint;
+    ShmRing *ring = self->in;
+    int ready = wait_on_ring(self, ring, true);
+    if (ready <= 0) {
+        return ready;
+    }
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint64_t tail = ring->tail;
+    uint64_t count = head - tail;
+    if (count == 0 || count > SHM_RING_SIZE) {
+        return 0; // closed, or broken
+    }
+    if (count > length) {
+        count = length;
+    }
+    size_t offset = tail & (SHM_RING_SIZE - 1);
+    size_t first = SHM_RING_SIZE - offset;
+    if (first > count) {
+        first = count;
+    }
+    memcpy(buffer, ring->data + offset, first);
+    memcpy(buffer + first, ring->data, count - first);
+    __atomic_store_n(&ring->tail, tail + count, __ATOMIC_RELEASE);
+    wake_side(&ring->spaceSignal, &ring->writerWaiting);
+    return count;
+}
+
+/*
+ * Function to write to a channel. Blocks until every byte is in the ring.
+ *
+ * @param endpoint: This side of the channel.
+ *
+ * @param data: The bytes to write.
+ *
+ * @param length: The number of bytes.
+ *
+ * return's length, or -1 if the other side went away or broke the ring
+ * first.
+*/
+ssize_t shm_endpoint_write(ShmEndpoint *endpoint, const char *data,
+        size_t length) {
+    ShmRing *ring = endpoint->out;
+    size_t written = 0;
+    while (written < length) {
+        int ready = wait_on_ring(endpoint, ring, false);
+        if (ready < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ready == 0) {
+            errno = EPIPE;
+            return -1;
+        }
+        uint64_t head = ring->head;
+        uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        if (head - tail > SHM_RING_SIZE) {
+            errno = EPIPE;
+            return -1;
+        }
+        size_t count = SHM_RING_SIZE - (head - tail);
+        if (count > length - written) {
+            count = length - written;
+        }
+        size_t offset = head & (SHM_RING_SIZE - 1);
+        size_t first = SHM_RING_SIZE - offset;
+        if (first > count) {
+            first = count;
+        }
+        memcpy(ring->data + offset, data + written, first);
+        memcpy(ring->data, data + written + first, count - first);
+        __atomic_store_n(&ring->head, head + count, __ATOMIC_RELEASE);
+        wake_side(&ring->dataSignal, &ring->readerWaiting);
+        written += count;
+    }
+    return length;
+}
+
+/*
+ * Function to shut a channel down from this side. The other side's reads
+ * return 0 once it has drained what was written, and so do this side's,
+ * which wakes a thread of this side blocked reading from the channel.
+ *
+ * @param endpoint: This side of the channel.
+ *
+ * return's nothing.
+*/
+void shm_endpoint_close(ShmEndpoint *endpoint) {
+    __atomic_store_n(&endpoint->out->closed, 1, __ATOMIC_RELEASE);
+    wake_side(&endpoint->out->dataSignal, &endpoint->out->readerWaiting);
+    __atomic_store_n(&endpoint->in->closed, 1, __ATOMIC_RELEASE);
+    wake_side(&endpoint->in->dataSignal, &endpoint->in->readerWaiting);
+}
+
+/*
+ * Function to unmap a channel and free this side of it. Streams opened on
+ * the endpoint must not be used after this.
+ *
+ * @param endpoint: This side of the channel.
+ *
+ * return's nothing.
+*/
+void shm_endpoint_free(ShmEndpoint *endpoint) {
+    if (endpoint != NULL) {
+        shm_endpoint_close(endpoint);
+        munmap(endpoint->channel, sizeof(ShmChannel));
+        close(endpoint->fd);
+        free(endpoint);
+    }
+}
+
+/*
+ * Function used as the read function of a channel stream.
+*/
+static ssize_t read_stream(void *cookie, char *buffer, size_t length) {
+    return shm_endpoint_read(cookie, buffer, length);
+}
+
+/*
+ * Function used as the write function of a channel stream. stdio wants 0
+ * rather than -1 on error.
+*/
+static ssize_t write_stream(void *cookie, const char *data, size_t length) {
+    ssize_t count = shm_endpoint_write((ShmEndpoint *) cookie, data, length);
+    return count < 0 ? 0 : count;
+}
+
+/*
+ * Function to open a stdio stream on one direction of a channel, so code
+ * written against FILE * can use it in place of the socket. Closing the
+ * stream leaves the channel open; the other side notices this one going
+ * away through the socket, as it would on a plain socket.
+ *
+ * @param endpoint: This side of the channel.
+ *
+ * @param mode: "r" for the incoming ring or "w" for the outgoing one.
+ *
+ * return's the stream.
+*/
+FILE *shm_endpoint_stream(ShmEndpoint *endpoint, const char *mode) {
+    cookie_io_functions_t functions = {NULL, NULL, NULL, NULL};
+    if (mode[0] == 'r') {
+        functions.read = read_stream;
+    } else {
+        functions.write = write_stream;
+    }
+    return fopencookie(endpoint, mode, functions);
+}
+
+/*
+ * Function for a client to offer a channel to the server, sending the
+ * offer line with the memfd attached.
+ *
+ * @param socket: The Unix socket connected to the server.
+ *
+ * @param fd: The memfd of the channel.
+ *
+ * return's true if the offer was sent.
+*/
+bool shm_send_offer(int socket, int fd) {
+    char control[CMSG_SPACE(sizeof(int))];
+    memset(control, 0, sizeof(control));
+    struct iovec data = {SHM_OFFER, strlen(SHM_OFFER)};
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &data;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(header), &fd, sizeof(int));
+    return sendmsg(socket, &message, MSG_NOSIGNAL) ==
+            (ssize_t) strlen(SHM_OFFER);
+}
+
+/*
+ * Function for the server to look for a channel offer as the first thing
+ * a client on the Unix socket sends. Only peeks unless the offer is there,
+ * so a client answering AUTH: as usual is left to be read as normal.
+ *
+ * @param socket: The Unix socket of the client.
+ *
+ * return's the offered memfd, -2 if the client sent something else and -1
+ * if the offer came without a usable memfd.
+*/
+int shm_receive_offer(int socket) {
+    size_t length = strlen(SHM_OFFER);
+    char peek[sizeof(SHM_OFFER)];
+    if (recv(socket, peek, length, MSG_PEEK | MSG_WAITALL) !=
+            (ssize_t) length || memcmp(peek, SHM_OFFER, length) != 0) {
+        return -2;
+    }
+    char control[CMSG_SPACE(sizeof(int))];
+    struct iovec data = {peek, length};
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &data;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    if (recvmsg(socket, &message, MSG_WAITALL | MSG_CMSG_CLOEXEC) !=
+            (ssize_t) length) {
+        return -1;
+    }
+    struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+    if (header == NULL || header->cmsg_level != SOL_SOCKET ||
+            header->cmsg_type != SCM_RIGHTS) {
+        return -1;
+    }
+    int fd;
+    memcpy(&fd, CMSG_DATA(header), sizeof(int));
+    return fd;
+}
@@ -0,0 +1,73 @@
+#ifndef SHMRING_H
+#define SHMRING_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+// Bytes each direction of a channel holds, must be a power of two.
+#define SHM_RING_SIZE (256 * 1024)
+// Times a side checks the ring before sleeping on it.
+#define SHM_SPIN 2000
+// Longest a side sleeps on a ring before checking the other side is still
+// there, in nanoseconds.
+#define SHM_IDLE_CHECK_NS 100000000
+// Seals a channel's memfd must carry before the server maps it, so the
+// client can't shrink it under the server's mapping.
+#define SHM_SEALS (F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL)
+// Line a client sends, with the memfd attached, to offer a channel.
+#define SHM_OFFER "SHM:\n"
+// Reply from a server which has switched to the channel.
+#define SHM_ACCEPT "OK:\n"
+
+// A single-producer single-consumer ring of bytes. The counters only grow;
+// the writer owns head and the reader owns tail, and each sleeps on a futex
+// word bumped by the other side only when it said it was waiting. The
+// other process can write anything here, so counters more than
+// SHM_RING_SIZE apart are taken as the channel being broken.
+typedef struct {
+    uint64_t head; // bytes written.
+    char headPad[56];
+    uint64_t tail; // bytes read.
+    char tailPad[56];
+
+    uint32_t dataSignal; // bumped when data is added for a waiting reader.
+    uint32_t readerWaiting;
+    uint32_t spaceSignal; // bumped when space is freed for a waiting writer.
+    uint32_t writerWaiting;
+    uint32_t closed; // set by the writer once it will write no more.
+
+    char data[SHM_RING_SIZE];
+} ShmRing;
+
+// The shared mapping: one ring for each direction.
+typedef struct {
+    ShmRing toServer;
+    ShmRing toClient;
+} ShmChannel;
+
+// One side's view of a channel. The Unix socket the channel was set up on
+// stays open and is only looked at while idle, to notice the other process
+// going away.
+typedef struct {
+    ShmChannel *channel;
+    ShmRing *in;
+    ShmRing *out;
+    int socket;
+    int fd; // the memfd, kept so the channel can be handed on.
+} ShmEndpoint;
+
+ShmEndpoint *shm_endpoint_create(int socket, int *fd);
+ShmEndpoint *shm_endpoint_attach(int socket, int fd);
+ssize_t shm_endpoint_read(void *endpoint, char *buffer, size_t length);
+ssize_t shm_endpoint_write(ShmEndpoint *endpoint, const char *data,
+        size_t length);
+void shm_endpoint_close(ShmEndpoint *endpoint);
+void shm_endpoint_free(ShmEndpoint *endpoint);
+FILE *shm_endpoint_stream(ShmEndpoint *endpoint, const char *mode);
+bool shm_send_offer(int socket, int fd);
+int shm_receive_offer(int socket);
+
+#endif //ass4_shmring_h
@@ -0,0 +1,250 @@
+#include "timerwheel.h"
+
+/*
+ * Function to put an armed timer into the slot it expires in. Timers
+ * already due go into the slot handled next. Must be called with the
+ * wheel's lock held.
+ *
+ * @param wheel: The timer wheel.
+ *
+ * @param timer: The timer, not in any slot.
+ *
+ * return's nothing.
+*/
+static void place_timer(TimerWheel *wheel, Timer *timer) {
+    uint64_t delta = timer->expires > wheel->now ?
+            timer->expires - wheel->now : 0;
+    int level = 0;
+    uint64_t span = WHEEL_SLOTS;
+    while (delta >= span && level < WHEEL_LEVELS - 1) {
+        span <<= WHEEL_BITS;
+        level++;
+    }
+    if (delta >= span) {
+        timer->expires = wheel->now + span - 1;
+    } else if (delta == 0) {
+        timer->expires = wheel->now;
+    }
+    Timer *head = &wheel->slots[level][(timer->expires >>
+            (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1)];
+    timer->next = head->next;
+    timer->prev = head;
+    head->next->prev = timer;
+    head->next = timer;
+}
+
+/*
+ * Function to take a timer out of its slot. Must be called with the
+ * wheel's lock held.
+ *
+ * @param timer: The armed timer.
+ *
+ * return's nothing.
+*/
+static void unlink_timer(Timer *timer) {
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->next = timer->prev = NULL;
+}
+
+/*
+ * Function to move every timer of a slot of a coarser level down to the
+ * level its expiry now falls in. Must be called with the wheel's lock held.
+ *
+ * @param wheel: The timer wheel.
+ *
+ * @param level: The level, above 0.
+ *
+ * @param index: The slot of that level.
+ *
+ * return's nothing.
+*/
+static void cascade_slot(TimerWheel *wheel, int level, int index) {
+    Timer *head = &wheel->slots[level][index];
+    while (head->next != head) {
+        Timer *timer = head->next;
+        unlink_timer(timer);
+        place_timer(wheel, timer);
+    }
+}
+
+/*
+ * Function to advance the wheel by one tick, firing every timer due on it.
+ * Timers whose callback asks for it are armed again.
+ *
+ * @param wheel: The timer wheel.
+ *
+ * return's nothing.
+*/
+static void run_tick(TimerWheel *wheel) {
+    pthread_mutex_lock(&wheel->lock);
+    uint64_t tick = wheel->now;
+    int index = tick & (WHEEL_SLOTS - 1);
+    for (int level = 1; index == 0 && level < WHEEL_LEVELS; ++level) {
+        int upper = (tick >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1);
+        cascade_slot(wheel, level, upper);
+        if (upper != 0) {
+            break;
+        }
+    }
+    // Take the slot's list first, a timer armed again may land back in it.
+    Timer due;
+    Timer *head = &wheel->slots[0][index];
+    due.next = due.prev = &due;
+    if (head->next != head) {
+        due.next = head->next;
+        due.prev = head->prev;
+        due.next->prev = due.prev->next = &due;
+        head->next = head->prev = head;
+    }
+    wheel->now = tick + 1;
+    while (due.next != &due) {
+        Timer *timer = due.next;
+        unlink_timer(timer);
+        wheel->fired++;
+        uint64_t again = timer->fire(timer->context);
+        if (again > 0) {
+            timer->expires = tick + (again + WHEEL_TICK_MS - 1) /
+                    WHEEL_TICK_MS;
+            place_timer(wheel, timer);
+        } else {
+            wheel->armed--;
+        }
+    }
+    pthread_mutex_unlock(&wheel->lock);
+}
+
+/*
+ * Function run by the wheel's thread. It turns the wheel once every
+ * WHEEL_TICK_MS, catching up on any ticks it was late for.
+ *
+ * @param wheelInfo: The timer wheel.
+ *
+ * return's NULL.
+*/
+static void *turn_wheel(void *wheelInfo) {
+    TimerWheel *wheel = (TimerWheel *) wheelInfo;
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    while (1) {
+        next.tv_nsec += WHEEL_TICK_MS * 1000000L;
+        if (next.tv_nsec >= 1000000000L) {
+            next.tv_nsec -= 1000000000L;
+            next.tv_sec++;
+        }
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next,
+                NULL) != 0) {
+            continue;
+        }
+        run_tick(wheel);
+    }
+    return NULL;
+}
+
+/*
+ * Function to create a timer wheel and start the thread which turns it.
+ *
+ * return's the timer wheel.
+*/
+TimerWheel *timer_wheel_start(void) {
+    TimerWheel *wheel = (TimerWheel *) calloc(1, sizeof(TimerWheel));
+    for (int level = 0; level < WHEEL_LEVELS; ++level) {
+        for (int i = 0; i < WHEEL_SLOTS; ++i) {
+            wheel->slots[level][i].next = &wheel->slots[level][i];
+            wheel->slots[level][i].prev = &wheel->slots[level][i];
+        }
+    }
+    pthread_mutex_init(&wheel->lock, NULL);
+    pthread_create(&wheel->thread, NULL, turn_wheel, (void *) wheel);
+    pthread_detach(wheel->thread);
+    return wheel;
+}
+
+/*
+ * Function to set up a timer before it is first armed.
+ *
+ * @param timer: The timer.
+ *
+ * @param fire: Called when the timer expires.
+ *
+ * @param context: Passed to fire.
+ *
+ * return's nothing.
+*/
+void timer_init(Timer *timer, TimerFire fire, void *context) {
+    timer->next = timer->prev = NULL;
+    timer->expires = 0;
+    timer->fire = fire;
+    timer->context = context;
+}
+
+/*
+ * Function to arm a timer, or move it if it is already armed.
+ *
+ * @param wheel: The timer wheel.
+ *
+ * @param timer: The timer.
+ *
+ * @param delay: Milliseconds until it fires, rounded up to whole ticks.
+ *
+ * return's nothing.
+*/
+void timer_arm(TimerWheel *wheel, Timer *timer, uint64_t delay) {
+    pthread_mutex_lock(&wheel->lock);
+    if (timer->prev != NULL) {
+        unlink_timer(timer);
+    } else {
+        wheel->armed++;
+    }
+    timer->expires = wheel->now + (delay + WHEEL_TICK_MS - 1) /
+            WHEEL_TICK_MS;
+    place_timer(wheel, timer);
+    pthread_mutex_unlock(&wheel->lock);
+}
+
+/*
+ * Function to disarm a timer. Once it returns the timer's callback is not
+ * running and will not run.
+ *
+ * @param wheel: The timer wheel.
+ *
+ * @param timer: The timer, armed or not.
+ *
+ * return's nothing.
+*/
+void timer_cancel(TimerWheel *wheel, Timer *timer) {
+    pthread_mutex_lock(&wheel->lock);
+    if (timer->prev != NULL) {
+        unlink_timer(timer);
+        wheel->armed--;
+    }
+    pthread_mutex_unlock(&wheel->lock);
+}
+
+/*
+ * Function to get the number of armed timers.
+ *
+ * @param wheel: The timer wheel.
+ *
+ * return's the number of timers.
+*/
+uint64_t timer_wheel_armed(TimerWheel *wheel) {
+    pthread_mutex_lock(&wheel->lock);
+    uint64_t armed = wheel->armed;
+    pthread_mutex_unlock(&wheel->lock);
+    return armed;
+}
+
+/*
+ * Function to get the number of timers fired since the wheel started.
+ *
+ * @param wheel: The timer wheel.
+ *
+ * return's the number of timers.
+*/
+uint64_t timer_wheel_fired(TimerWheel *wheel) {
+    pthread_mutex_lock(&wheel->lock);
+    uint64_t fired = wheel->fired;
+    pthread_mutex_unlock(&wheel->lock);
+    return fired;
+}
@@ -0,0 +1,54 @@
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+// Slots on each level of the wheel as a power of two.
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+// Levels of the wheel. Each level's slot spans a whole turn of the level
+// below, so 4 levels of 64 slots reach 64^4 ticks ahead.
+#define WHEEL_LEVELS 4
+// Length of a tick in milliseconds, the resolution of every timer.
+#define WHEEL_TICK_MS 100
+
+// Called from the wheel's thread, with the wheel locked, when a timer
+// expires. Returns the milliseconds until the timer should fire again, or
+// 0 to leave it disarmed. It must not call any of the timer_ functions.
+typedef uint64_t (*TimerFire)(void *context);
+
+// A timer, embedded in whatever it times so arming one never allocates.
+typedef struct Timer {
+    struct Timer *next;
+    struct Timer *prev; // NULL while the timer is not armed.
+    uint64_t expires; // tick the timer fires on.
+    TimerFire fire;
+    void *context;
+} Timer;
+
+// A hierarchical timing wheel. Timers due within WHEEL_SLOTS ticks are in
+// level 0, one per tick; later ones sit in a coarser level and move down
+// as the wheel turns. Arming, cancelling and firing a timer are O(1).
+typedef struct {
+    Timer slots[WHEEL_LEVELS][WHEEL_SLOTS]; // list heads.
+    uint64_t now; // ticks since the wheel started.
+    uint64_t armed; // timers currently armed.
+    uint64_t fired; // timers fired since the wheel started.
+    pthread_mutex_t lock;
+    pthread_t thread;
+} TimerWheel;
+
+TimerWheel *timer_wheel_start(void);
+void timer_init(Timer *timer, TimerFire fire, void *context);
+void timer_arm(TimerWheel *wheel, Timer *timer, uint64_t delay);
+void timer_cancel(TimerWheel *wheel, Timer *timer);
+uint64_t timer_wheel_armed(TimerWheel *wheel);
+uint64_t timer_wheel_fired(TimerWheel *wheel);
+
+#endif //ass4_timerwheel_h